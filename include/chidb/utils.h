@@ -40,6 +40,14 @@
 #ifndef UTILS_H_
 #define UTILS_H_
 
+#include <stdint.h>
+#include <chidb/chidb.h>
+
 int chidb_tokenize(char *str, char ***tokens);
 
+/* Prints statistics (depth, page counts, fill factors, etc.) of the B-Tree
+ * whose root is in page nroot, or of every B-Tree in the database if
+ * nroot is 0 */
+int chidb_analyze(chidb *db, uint32_t nroot);
+
 #endif /*CHIDB_H_*/
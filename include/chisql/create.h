@@ -4,9 +4,18 @@
 #include "common.h"
 #include "column.h"
 
+/* Storage options of a table or index: CREATE ... WITH (name = value, ...).
+ * They are handed to the B-Tree layer (see chidb_Btree_setSplitPolicy). */
+typedef struct StorageOptions_s {
+   int fill_factor;      /* Percentage of a page kept full when splitting on
+                          * appends (0 for the default) */
+   int split_by_bytes;   /* Split leaves at the middle byte, not cell */
+} StorageOptions_t;
+
 typedef struct Table_s {
    char *name;
    Column_t *columns;
+   StorageOptions_t options;
 } Table_t;
 
 enum key_dec_type {KEY_DEC_PRIMARY, KEY_DEC_FOREIGN};
@@ -24,9 +33,17 @@ typedef struct TableReference_s {
    char *table_name, *alias;
 } TableReference_t;
 
+/* Access method of an index: CREATE INDEX ... USING method */
+enum IndexMethod { INDEX_BTREE, INDEX_HASH };
+
 typedef struct Index_s {
-   char *name, *table_name, *column_name;
+   char *name, *table_name;
+   char *column_name;    /* First column of the key */
+   StrList_t *columns;   /* Columns of the key, in order */
+   StrList_t *include;   /* Columns stored in the index leaves (INCLUDE) */
    int unique;
+   enum IndexMethod method;
+   StorageOptions_t options;
 } Index_t;
 
 enum CreateType { CREATE_TABLE, CREATE_INDEX };
@@ -43,6 +60,10 @@ Table_t *   Table_make(char *name, Column_t *columns, KeyDec_t *decs);
 void        Table_print(Table_t *table);
 void        Table_free(void *table); /* void for generic */
 Table_t *   Table_addKeyDecs(Table_t *table, KeyDec_t *decs);
+Table_t *   Table_setOptions(Table_t *table, StorageOptions_t options);
+
+StorageOptions_t StorageOptions_set(StorageOptions_t options, char *name, int value);
+void        StorageOptions_print(StorageOptions_t options);
 
 KeyDec_t *  KeyDec_append(KeyDec_t *decs, KeyDec_t *dec);
 KeyDec_t *  ForeignKeyDec(ForeignKeyRef_t fkr);
@@ -51,8 +72,10 @@ KeyDec_t *  PrimaryKeyDec(StrList_t *col_names);
 TableReference_t *TableReference_make(char *table_name, char *alias);
 void        TableReference_free(TableReference_t *tref);
 
-Index_t *   Index_make(char *name, char *table_name, char *column_name);
+Index_t *   Index_make(char *name, char *table_name, StrList_t *columns, StrList_t *include);
 Index_t *   Index_makeUnique(Index_t *idx);
+Index_t *   Index_setOptions(Index_t *idx, StorageOptions_t options);
+Index_t *   Index_setMethod(Index_t *idx, char *method);
 void        Index_print(Index_t *idx);
 void        Index_free(Index_t *idx);
 
@@ -194,7 +194,7 @@ int chidb_column_type(chidb_stmt *stmt, int col)
 				return SQL_INTEGER_4BYTE;
 				break;
 			case REG_STRING:
-				return 2 * strlen(r->value.s) + SQL_TEXT;
+				return 2 * reg_strlen(r) + SQL_TEXT;
 				break;
 			default:
 				return SQL_NOTVALID;
@@ -324,6 +324,9 @@ const char *chidb_column_text(chidb_stmt *stmt, int col)
 			}
 			else
 			{
+				/* The caller keeps the string after the DBM moves on */
+				if(chidb_stmt_reg_materialize(r) != CHIDB_OK)
+					return NULL;
 				return r->value.s;
 			}
 		}
@@ -0,0 +1,257 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Blocked Bloom filters
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "bloom.h"
+
+/* Forward declaration of auxiliary functions. */
+uint64_t bloom_hash(chidb_key_t key);
+uint8_t *bloom_block(BloomFilter *bf, uint64_t h);
+
+
+/* Choose the number of bits per key for a false-positive rate
+ *
+ * With the optimal number of hash functions, the false-positive rate of a
+ * Bloom filter with b bits per key is about 0.6185^b, so we use the
+ * smallest b that gets below fp_rate.
+ *
+ * Parameters
+ * - fp_rate: Desired false-positive rate (0 < fp_rate < 1)
+ *
+ * Return
+ * - Number of bits per key (between 1 and BLOOM_MAX_BITS_PER_KEY)
+ */
+uint8_t chidb_Bloom_bitsPerKey(double fp_rate)
+{
+    if (fp_rate <= 0 || fp_rate >= 1) {
+        fp_rate = BLOOM_DEFAULT_FP_RATE;
+    }
+    uint8_t bits_per_key = 1;
+    double rate = 0.6185;
+    while (rate > fp_rate && bits_per_key < BLOOM_MAX_BITS_PER_KEY) {
+        rate *= 0.6185;
+        bits_per_key++;
+    }
+
+    return bits_per_key;
+}
+
+
+/* Compute how many pages a filter needs
+ *
+ * Parameters
+ * - nkeys: Number of keys the filter must hold (at least BLOOM_MIN_KEYS
+ *          are assumed)
+ * - bits_per_key: See chidb_Bloom_bitsPerKey
+ * - page_size: Page size of the database file
+ *
+ * Return
+ * - Number of pages
+ */
+npage_t chidb_Bloom_pagesFor(uint32_t nkeys, uint8_t bits_per_key, uint16_t page_size)
+{
+    uint64_t nbits = (uint64_t) (nkeys < BLOOM_MIN_KEYS ? BLOOM_MIN_KEYS : nkeys) * bits_per_key;
+    uint64_t page_bits = (uint64_t) page_size * 8;
+
+    return (npage_t) ((nbits + page_bits - 1) / page_bits);
+}
+
+
+/* Create an empty Bloom filter in memory
+ *
+ * Parameters
+ * - bf: Out parameter. Used to return the new filter.
+ * - first_page: First page where the filter is stored
+ * - npages: Number of pages of the filter
+ * - page_size: Page size of the database file (a multiple of
+ *              BLOOM_BLOCK_SIZE)
+ * - bits_per_key: See chidb_Bloom_bitsPerKey
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Bloom_create(BloomFilter **bf, npage_t first_page, npage_t npages, uint16_t page_size, uint8_t bits_per_key)
+{
+    if ((*bf = malloc(sizeof(BloomFilter))) == NULL) {
+        return CHIDB_ENOMEM;
+    }
+    if (((*bf)->bits = calloc(npages, page_size)) == NULL) {
+        free(*bf);
+        return CHIDB_ENOMEM;
+    }
+    (*bf)->first_page = first_page;
+    (*bf)->npages = npages;
+    (*bf)->page_size = page_size;
+    (*bf)->nblocks = (uint32_t) npages * (page_size / BLOOM_BLOCK_SIZE);
+    (*bf)->bits_per_key = bits_per_key;
+    // k = bits_per_key * ln(2) is optimal
+    (*bf)->k = (bits_per_key * 693 + 500) / 1000;
+    if ((*bf)->k < 1) {
+        (*bf)->k = 1;
+    } else if ((*bf)->k > BLOOM_MAX_K) {
+        (*bf)->k = BLOOM_MAX_K;
+    }
+    (*bf)->n_keys = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Free a Bloom filter
+ *
+ * Parameters
+ * - bf: Filter to free
+ */
+void chidb_Bloom_free(BloomFilter *bf)
+{
+    free(bf->bits);
+    free(bf);
+}
+
+
+/* Number of keys a filter can hold at its intended false-positive rate
+ *
+ * Parameters
+ * - bf: A Bloom filter
+ *
+ * Return
+ * - Number of keys
+ */
+uint32_t chidb_Bloom_capacity(BloomFilter *bf)
+{
+    return (uint32_t) ((uint64_t) bf->nblocks * BLOOM_BLOCK_BITS / bf->bits_per_key);
+}
+
+
+/* Add a key to a Bloom filter
+ *
+ * The bits are set atomically, so keys can be added while other threads
+ * are checking the filter. Only the in-memory copy is modified; the
+ * caller must write the page that contains the key's block.
+ *
+ * Parameters
+ * - bf: A Bloom filter
+ * - key: Key to add
+ *
+ * Return
+ * - Page number of the page that was modified
+ */
+npage_t chidb_Bloom_add(BloomFilter *bf, chidb_key_t key)
+{
+    uint64_t h = bloom_hash(key);
+    uint8_t *block = bloom_block(bf, h);
+    uint32_t h1 = (uint32_t) h;
+    uint32_t h2 = (uint32_t) ((h * 0x9e3779b97f4a7c15ULL) >> 32) | 1;
+    for (uint8_t i = 0; i < bf->k; i++) {
+        uint32_t bit = (h1 + i * h2) % BLOOM_BLOCK_BITS;
+        __atomic_fetch_or(&block[bit / 8], (uint8_t) (1 << (bit % 8)), __ATOMIC_RELAXED);
+    }
+
+    return bf->first_page + (npage_t) ((block - bf->bits) / bf->page_size);
+}
+
+
+/* Find the page where the bits of a key are
+ *
+ * Parameters
+ * - bf: A Bloom filter
+ * - key: A key
+ *
+ * Return
+ * - Page number of the page that chidb_Bloom_add would modify
+ */
+npage_t chidb_Bloom_page(BloomFilter *bf, chidb_key_t key)
+{
+    uint8_t *block = bloom_block(bf, bloom_hash(key));
+
+    return bf->first_page + (npage_t) ((block - bf->bits) / bf->page_size);
+}
+
+
+/* Check whether a key may be in a Bloom filter
+ *
+ * Parameters
+ * - bf: A Bloom filter
+ * - key: Key to check
+ *
+ * Return
+ * - false: The key was never added to the filter
+ * - true: The key may have been added to the filter
+ */
+bool chidb_Bloom_mayContain(BloomFilter *bf, chidb_key_t key)
+{
+    uint64_t h = bloom_hash(key);
+    uint8_t *block = bloom_block(bf, h);
+    uint32_t h1 = (uint32_t) h;
+    uint32_t h2 = (uint32_t) ((h * 0x9e3779b97f4a7c15ULL) >> 32) | 1;
+    for (uint8_t i = 0; i < bf->k; i++) {
+        uint32_t bit = (h1 + i * h2) % BLOOM_BLOCK_BITS;
+        if (!(__atomic_load_n(&block[bit / 8], __ATOMIC_RELAXED) & (1 << (bit % 8)))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/* Mixes the bits of a key (the 64-bit finalizer of MurmurHash3) */
+uint64_t bloom_hash(chidb_key_t key)
+{
+    uint64_t h = key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+/* Returns the block for a hash. The block is chosen with the bits that
+ * are not used to choose the bits within the block. */
+uint8_t *bloom_block(BloomFilter *bf, uint64_t h)
+{
+    uint64_t nblock = ((h >> 40) * bf->nblocks) >> 24;
+
+    return bf->bits + nblock * BLOOM_BLOCK_SIZE;
+}
@@ -0,0 +1,81 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Blocked Bloom filters
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef BLOOM_H_
+#define BLOOM_H_
+
+#include "chidbInt.h"
+
+/* A blocked Bloom filter is split into blocks of BLOOM_BLOCK_SIZE bytes
+ * (one cache line). A key is hashed to one block, and all the bits for
+ * that key are set (and checked) in that block, so a lookup touches a
+ * single cache line and an insertion dirties a single page. */
+#define BLOOM_BLOCK_SIZE (64)
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_SIZE * 8)
+
+#define BLOOM_DEFAULT_FP_RATE (0.01)
+#define BLOOM_MIN_KEYS (1024)     /* Smallest number of keys a filter is sized for */
+#define BLOOM_MAX_BITS_PER_KEY (32)
+#define BLOOM_MAX_K (16)
+
+/* The BloomFilter struct is the in-memory copy of a filter stored in
+ * npages consecutive pages of the database file, starting at first_page.
+ * The bits are laid out in the pages in order, with no page header. */
+typedef struct BloomFilter
+{
+    npage_t first_page;       /* First page of the filter */
+    npage_t npages;           /* Number of pages */
+    uint16_t page_size;
+    uint32_t nblocks;         /* Number of blocks (npages * page_size / BLOOM_BLOCK_SIZE) */
+    uint8_t k;                /* Number of bits set for every key */
+    uint8_t bits_per_key;     /* Bits per key the filter was sized for */
+    uint32_t n_keys;          /* Number of keys added in bulk (see chidb_Bloom_capacity) */
+    uint8_t *bits;            /* npages * page_size bytes */
+} BloomFilter;
+
+uint8_t chidb_Bloom_bitsPerKey(double fp_rate);
+npage_t chidb_Bloom_pagesFor(uint32_t nkeys, uint8_t bits_per_key, uint16_t page_size);
+int chidb_Bloom_create(BloomFilter **bf, npage_t first_page, npage_t npages, uint16_t page_size, uint8_t bits_per_key);
+void chidb_Bloom_free(BloomFilter *bf);
+uint32_t chidb_Bloom_capacity(BloomFilter *bf);
+npage_t chidb_Bloom_page(BloomFilter *bf, chidb_key_t key);
+npage_t chidb_Bloom_add(BloomFilter *bf, chidb_key_t key);
+bool chidb_Bloom_mayContain(BloomFilter *bf, chidb_key_t key);
+
+#endif /*BLOOM_H_*/
@@ -54,6 +54,87 @@
 #include "pager.h"
 #include "util.h"
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/* Forward declaration of auxiliary functions. */
+void node_read_header(BTree *bt, BTreeNode *btn);
+int node_alloc(BTree *bt, npage_t *npage);
+void node_init(BTree *bt, MemPage *mem_page, uint8_t type);
+bool append_cache_get(BTree *bt, npage_t nroot, BTreeAppendCache *ac);
+void append_cache_extend(BTree *bt, npage_t nroot, npage_t nleaf, chidb_key_t key);
+void append_cache_set(BTree *bt, const BTreeAppendCache *leaf);
+void append_cache_invalidate(BTree *bt, npage_t npage);
+bool append_leaf_fits(BTreeNode *btn, BTreeCell *btc);
+int split_root(BTree *bt, npage_t nroot, BTreeNode *btn, BTreeCell *btc, const BTreeSplitPolicy *policy);
+ncell_t split_left_cells(BTreeNode *btn, ncell_t mid_cell, npage_t *right_page);
+int insert_cell(BTree *bt, npage_t nroot, BTreeCell *btc);
+int insert_non_full(BTree *bt, npage_t npage, BTreeCell *btc, const BTreeSplitPolicy *policy, BTreeAppendCache *ac);
+int insert_step(BTree *bt, npage_t npage, BTreeCell *btc, const BTreeSplitPolicy *policy, bool *rightmost, npage_t *child_page, BTreeAppendCache *ac);
+int split_child(BTree *bt, npage_t npage, ncell_t parent_cell, BTreeNode *child_btn, BTreeCell *btc, const BTreeSplitPolicy *policy, bool *rightmost, npage_t *npage_child, bool *bounded, chidb_key_t *bound);
+uint16_t cell_size(uint8_t type, BTreeCell *btc);
+int insert_batch_cmp(const void *a, const void *b);
+int batch_descend(BTree *bt, npage_t nroot, BTreeCell *btc, const BTreeSplitPolicy *policy, BTreeBatchLeaf *bl);
+uint32_t batch_merge(uint8_t type, BTreeCell *old, ncell_t n_old, BTreeCell **cells, uint32_t n, BTreeCell *merged);
+uint32_t batch_split_appends(uint8_t type, BTreeCell *cells, uint32_t n, uint32_t min_cells, uint16_t capacity, const BTreeSplitPolicy *policy, uint32_t max_leaves, uint32_t *ends);
+uint32_t batch_split_even(uint8_t type, BTreeCell *cells, uint32_t n, uint32_t bytes, uint16_t capacity, uint32_t min_leaves, uint32_t *ends);
+int batch_fill(BTree *bt, npage_t nroot, BTreeBatchLeaf *bl, BTreeCell **cells, uint32_t n, const BTreeSplitPolicy *policy, uint32_t *n_done, BTreeAppendCache *ac);
+ncell_t search_keys(const chidb_key_t *keys, ncell_t n, chidb_key_t key);
+int meta_load(BTree *bt);
+int meta_write(BTree *bt);
+BloomFilter *meta_bloom(BTree *bt, npage_t nroot);
+int meta_entry(BTree *bt, npage_t nroot, BTreeMeta **meta);
+BTreeSplitPolicy meta_split_policy(BTree *bt, npage_t nroot);
+int bloom_install(BTree *bt, npage_t nroot, uint8_t bits_per_key);
+BTreePinnedTree *pin_find(BTree *bt, npage_t nroot);
+void pin_free(BTreePinnedNode *pn);
+int pin_page_cmp(const void *a, const void *b);
+void pin_unmark(BTree *bt, npage_t *pages, npage_t n, npage_t *keep, npage_t n_keep);
+int pin_build(BTree *bt, BTreePinnedTree *pt);
+int pin_descend(BTree *bt, npage_t nroot, chidb_key_t key, npage_t *npage, npage_t *parent, bool *bounded, chidb_key_t *bound);
+void pin_invalidate(BTree *bt, npage_t npage);
+int freelist_push(BTree *bt, npage_t npage);
+int freelist_pop(BTree *bt, npage_t *npage);
+int freelist_save(BTree *bt);
+int delete_height(BTree *bt, BTreeNode *root_btn, uint32_t *height);
+int delete_trim(BTree *bt, BTreeNode *btn, uint32_t height, chidb_key_t lo, chidb_key_t hi, chidb_key_t min, chidb_key_t max, npage_t *prev_leaf, npage_t *next_leaf, bool *empty);
+int delete_subtree(BTree *bt, npage_t npage, uint32_t height);
+int delete_edge_leaf(BTree *bt, npage_t npage, uint32_t height, bool rightmost, npage_t *nleaf);
+int delete_rebuild(BTree *bt, npage_t npage, npage_t *children, chidb_key_t *keys, ncell_t n);
+int delete_link(BTree *bt, npage_t prev_leaf, npage_t next_leaf);
+int delete_rebalance(BTree *bt, npage_t nroot, chidb_key_t lo);
+int delete_merge(BTree *bt, BTreeNode *parent_btn, ncell_t ncell, bool *merged);
+int delete_collapse(BTree *bt, npage_t nroot);
+void changes_bump(BTree *bt, npage_t nroot);
+uint16_t delete_node_bytes(BTree *bt, BTreeNode *btn);
+int bloom_collect_keys(BTree *bt, npage_t npage, chidb_key_t **keys, uint32_t *n, uint32_t *size);
+int bloom_write_page(BTree *bt, BloomFilter *bf, npage_t npage);
+int bloom_add_key(BTree *bt, BloomFilter *bf, chidb_key_t key);
+int bloom_add_batch(BTree *bt, BloomFilter *bf, BTreeCell **cells, uint32_t n);
+int analyze_node(BTree *bt, npage_t npage, uint32_t level, BTreeStats *stats);
+void analyze_page(BTree *bt, BTreeNode *btn, BTreeStats *stats);
+double analyze_percentile(BTreeStats *stats, double p);
+int estimate_read(BTree *bt, npage_t npage, BTreeLevelSizes *lvl, BTreeRangeEstimate *est, BTreeNode **btn);
+void estimate_cover(BTreeNode *btn, ncell_t from, ncell_t to, BTreeLevelSizes *lvl, npage_t *samples, uint32_t *sample_levels, uint32_t n_samples, uint32_t level, uint64_t *n_seen, uint64_t *rnd);
+uint64_t estimate_random(uint64_t *state);
+int partition_key_cmp(const void *a, const void *b);
+BTreeInsertBuffer *ibuf_find(BTree *bt, npage_t nroot);
+uint32_t ibuf_search(BTreeInsertBuffer *ibuf, chidb_key_t key);
+int ibuf_insert(BTree *bt, BTreeInsertBuffer *ibuf, chidb_key_t keyIdx, chidb_key_t keyPk);
+int ibuf_merge(BTree *bt, BTreeInsertBuffer *ibuf);
+int index_find(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t *keyPk);
+chidb_key_t varindex_prefix(const uint8_t *key, uint16_t size);
+uint16_t varindex_cell_size(BTreeCell *btc);
+int varindex_search(BTreeNode *btn, const uint8_t *key, uint16_t size, ncell_t *ncell, bool *equal);
+int varindex_child(BTreeNode *btn, const uint8_t *key, uint16_t size, ncell_t *ncell, npage_t *child_page);
+bool varindex_has_room(BTree *bt, BTreeNode *btn, BTreeCell *btc);
+uint16_t varindex_separator_size(BTreeNode *btn, ncell_t ncell);
+int varindex_split(BTree *bt, BTreeNode *parent_btn, ncell_t parent_ncell, BTreeNode *child_btn);
+int varindex_split_root(BTree *bt, BTreeNode *root_btn);
+int varindex_find_leaf(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, BTreeNode **leaf, uint8_t *bound, uint16_t *bound_size);
+int varindex_seek(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, bool inclusive, BTreeNode **leaf, ncell_t *ncell);
+
 
 /* Open a B-Tree file
  *
@@ -85,6 +166,9 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
     //uint32_t file_change_counter = 0;
     //uint32_t schema_version = 0;
     uint32_t page_cache_size = DEFAULT_PAGE_CACHE_SIZE;
+    npage_t meta_page = 0;
+    npage_t free_head = 0;
+    npage_t n_free = 0;
     //uint32_t user_cookie = 0;
     //npage_t n_pages = 1;
 
@@ -231,11 +315,15 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
         if (magic_num_8 != DEFAULT_MAGIC_NUM_8) {
             return CHIDB_ECORRUPTHEADER;
         }
+        meta_page = get4byte(&buf[META_PAGE_OFFSET]);
+        free_head = get4byte(&buf[FREELIST_PAGE_OFFSET]);
+        n_free = get4byte(&buf[FREELIST_COUNT_OFFSET]);
         pager->page_size = page_size;
         if ((ret = chidb_Pager_getRealDBSize(pager, &pager->n_pages)) != CHIDB_OK) {
             return ret;
         }
     }
+    chidb_Pager_setCacheSize(pager, page_cache_size);
 
     *bt = malloc(sizeof(Btree));
     if (*bt == NULL) {
@@ -243,9 +331,26 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
     }
     (*bt)->db = db;
     (*bt)->pager = pager;
+    pthread_mutex_init(&(*bt)->lock, NULL);
+    memset((*bt)->append_cache, 0, sizeof((*bt)->append_cache));
+    (*bt)->append_next = 0;
+    pthread_rwlock_init(&(*bt)->meta_latch, NULL);
+    (*bt)->meta_page = meta_page;
+    (*bt)->meta = NULL;
+    (*bt)->n_meta = 0;
+    (*bt)->ibufs = NULL;
+    pthread_rwlock_init(&(*bt)->pin_latch, NULL);
+    (*bt)->pinned = NULL;
+    (*bt)->pin_epoch = 0;
+    pthread_mutex_init(&(*bt)->free_lock, NULL);
+    (*bt)->free_head = free_head;
+    (*bt)->n_free = n_free;
+    (*bt)->free_dirty = false;
+    (*bt)->free_epoch = 0;
+    memset((*bt)->changes, 0, sizeof((*bt)->changes));
     db->bt = *bt;
 
-    return CHIDB_OK;
+    return meta_load(*bt);
 }
 
 
@@ -265,9 +370,41 @@ int chidb_Btree_close(BTree *bt)
 {
     /* Your code goes here */
     int ret;
+    for (BTreeInsertBuffer *ibuf = bt->ibufs; ibuf != NULL; ibuf = ibuf->next) {
+        if ((ret = ibuf_merge(bt, ibuf)) != CHIDB_OK) {
+            return ret;
+        }
+    }
+    if ((ret = freelist_save(bt)) != CHIDB_OK) {
+        return ret;
+    }
     if ((ret = chidb_Pager_close(bt->pager)) != CHIDB_OK) {
         return ret;
     }
+    while (bt->ibufs != NULL) {
+        BTreeInsertBuffer *next = bt->ibufs->next;
+        pthread_mutex_destroy(&bt->ibufs->lock);
+        free(bt->ibufs->cells);
+        free(bt->ibufs);
+        bt->ibufs = next;
+    }
+    for (uint16_t i = 0; i < bt->n_meta; i++) {
+        if (bt->meta[i].bloom != NULL) {
+            chidb_Bloom_free(bt->meta[i].bloom);
+        }
+    }
+    free(bt->meta);
+    while (bt->pinned != NULL) {
+        BTreePinnedTree *next = bt->pinned->next;
+        pin_free(bt->pinned->root);
+        free(bt->pinned->pages);
+        free(bt->pinned);
+        bt->pinned = next;
+    }
+    pthread_rwlock_destroy(&bt->pin_latch);
+    pthread_mutex_destroy(&bt->free_lock);
+    pthread_rwlock_destroy(&bt->meta_latch);
+    pthread_mutex_destroy(&bt->lock);
     free(bt);
 
     return CHIDB_OK;
@@ -298,7 +435,7 @@ int chidb_Btree_close(BTree *bt)
 int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **btn)
 {
     /* Your code goes here */
-    if (npage > bt->pager->n_pages || npage < 1) {
+    if (npage > __atomic_load_n(&bt->pager->n_pages, __ATOMIC_SEQ_CST) || npage < 1) {
         return CHIDB_EPAGENO;
     }
     int ret;
@@ -306,32 +443,49 @@ int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **btn)
     if ((ret = chidb_Pager_readPage(bt->pager, npage, &mem_page)) != CHIDB_OK) {
         return ret;
     }
-    int off = 0;
-    if (npage == 1) {
-        off += HEADER_BUF_SIZE;
-    }
     *btn = malloc(sizeof(BTreeNode));
     if (*btn == NULL) {
         return CHIDB_ENOMEM;
     }
     (*btn)->page = mem_page;
-    (*btn)->type = mem_page->data[off + 0];
-    (*btn)->free_offset = (mem_page->data[off + 1] << 8) |
-                            mem_page->data[off + 2];
-    (*btn)->n_cells = (mem_page->data[off + 3] << 8) |
-                            mem_page->data[off + 4];
-    (*btn)->cells_offset = (mem_page->data[off + 5] << 8) |
-                            mem_page->data[off + 6];
-    if ((*btn)->type == PGTYPE_TABLE_INTERNAL || (*btn)->type == PGTYPE_INDEX_INTERNAL) {
-        (*btn)->right_page = (mem_page->data[off + 8] << 24) |
-                            (mem_page->data[off + 9] << 16) |
-                            (mem_page->data[off + 10] << 8) |
-                            mem_page->data[off + 11];
-        (*btn)->celloffset_array = mem_page->data + off + INTPG_CELLSOFFSET_OFFSET;
-    } else {
-        (*btn)->right_page = 0;
-        (*btn)->celloffset_array = mem_page->data + off + LEAFPG_CELLSOFFSET_OFFSET;
+    (*btn)->keys = NULL;
+    (*btn)->children = NULL;
+    (*btn)->pager = bt->pager;
+    node_read_header(bt, *btn);
+
+    return CHIDB_OK;
+}
+
+
+/* Reloads an in-memory B-Tree node from disk
+ *
+ * Reads a B-Tree node from a page in the disk into a BTreeNode previously
+ * returned by chidb_Btree_getNodeByPage, reusing its memory (including
+ * the in-memory page) instead of allocating a new one. The node's
+ * decoded sidecar is discarded. This allows moving from node to node
+ * (as cursors do) without allocating memory.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Page of node to load
+ * - btn: BTreeNode to load the node into. Its contents are overwritten.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_reloadNode(BTree *bt, npage_t npage, BTreeNode *btn)
+{
+    int ret;
+    if ((ret = chidb_Pager_readPageInto(bt->pager, npage, btn->page)) != CHIDB_OK) {
+        return ret;
     }
+    free(btn->keys);
+    btn->keys = NULL;
+    btn->children = NULL;
+    node_read_header(bt, btn);
 
     return CHIDB_OK;
 }
@@ -354,6 +508,7 @@ int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn)
 {
     /* Your code goes here */
     int ret = chidb_Pager_releaseMemPage(bt->pager, btn->page);
+    free(btn->keys);
     free(btn);
     if (ret != CHIDB_OK) {
         return ret;
@@ -365,6 +520,7 @@ int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn)
 /* Create a new B-Tree node
  *
  * Allocates a new page in the file and initializes it as a B-Tree node.
+ * Pages in the freelist (see chidb_Btree_deleteRange) are used first.
  *
  * Parameters
  * - bt: B-Tree file
@@ -382,18 +538,36 @@ int chidb_Btree_newNode(BTree *bt, npage_t *npage, uint8_t type)
 {
     /* Your code goes here */
     int ret;
-    if ((ret = chidb_Pager_allocatePage(bt->pager, npage)) != CHIDB_OK) {
+    if ((ret = node_alloc(bt, npage)) != CHIDB_OK) {
         return ret;
     }
     return chidb_Btree_initEmptyNode(bt, *npage, type);
 }
 
+/* Takes a page for a new node from the freelist or, if it is empty, from
+ * the end of the file, without writing anything to it */
+int node_alloc(BTree *bt, npage_t *npage)
+{
+    int ret;
+    if ((ret = freelist_pop(bt, npage)) != CHIDB_OK) {
+        return ret;
+    }
+    if (*npage == 0) {
+        return chidb_Pager_allocatePage(bt->pager, npage);
+    }
+
+    return CHIDB_OK;
+}
+
 
 /* Initialize a B-Tree node
  *
  * Initializes a database page to contain an empty B-Tree node. The
  * database page is assumed to exist and to have been already allocated
- * by the pager.
+ * by the pager. Everything after the file header is zeroed, since the
+ * page may come from the freelist with a previous node (or a freelist
+ * trunk) still on it, and a split does not set the right page of the
+ * node on its left.
  *
  * Parameters
  * - bt: B-Tree file
@@ -415,16 +589,30 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
         return ret;
     }
     mem_page->npage = npage;
+    node_init(bt, mem_page, type);
+
+    if ((ret = chidb_Pager_writePage(bt->pager, mem_page)) != CHIDB_OK) {
+        return ret;
+    }
+    pin_invalidate(bt, npage);
+
+    return CHIDB_OK;
+}
 
+/* Lays out an empty node of the given type on an in-memory page (see
+ * chidb_Btree_initEmptyNode), without writing it */
+void node_init(BTree *bt, MemPage *mem_page, uint8_t type)
+{
     int page_off = 0;
-    if (npage == 1) {
+    if (mem_page->npage == 1) {
         page_off = HEADER_OFFSET;
     }
+    memset(&mem_page->data[page_off], 0, bt->pager->page_size - page_off);
     uint16_t free_offset;
     ncell_t n_cells = 0;
     uint16_t cells_offset = bt->pager->page_size;
     //npage_t right_page;
-    if (type == PGTYPE_TABLE_INTERNAL || type == PGTYPE_INDEX_INTERNAL) {
+    if (PGTYPE_IS_INTERNAL(type)) {
         free_offset = page_off + INTPG_CELLSOFFSET_OFFSET;
     } else {
         free_offset = page_off + LEAFPG_CELLSOFFSET_OFFSET;
@@ -432,6 +620,7 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
 
     uint8_t arr2[2];
     memcpy(&mem_page->data[page_off + PGHEADER_PGTYPE_OFFSET], &type, sizeof(uint8_t));
+    mem_page->data[page_off + PGHEADER_ZERO_OFFSET] = 0;
 
     arr2[0] = (free_offset >> 8) & 0xff;
     arr2[1] = free_offset & 0xff;
@@ -442,12 +631,6 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
     arr2[0] = (cells_offset >> 8) & 0xff;
     arr2[1] = cells_offset & 0xff;
     memcpy(&mem_page->data[page_off + PGHEADER_CELL_OFFSET], &arr2, sizeof(uint16_t));
-
-    if ((ret = chidb_Pager_writePage(bt->pager, mem_page)) != CHIDB_OK) {
-        return ret;
-    }
-
-    return CHIDB_OK;
 }
 
 
@@ -488,17 +671,54 @@ int chidb_Btree_writeNode(BTree *bt, BTreeNode *btn)
     arr2[0] = (btn->cells_offset >> 8) & 0xff;
     arr2[1] = btn->cells_offset & 0xff;
     memcpy(&btn->page->data[page_off + 5], &arr2, sizeof(uint16_t));
-    if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL) {
+    if (PGTYPE_IS_INTERNAL(btn->type)) {
         arr4[0] = (btn->right_page >> 24) & 0xff;
         arr4[1] = (btn->right_page >> 16) & 0xff;
         arr4[2] = (btn->right_page >> 8) & 0xff;
         arr4[3] = btn->right_page & 0xff;
         memcpy(&btn->page->data[page_off + 8], &arr4, sizeof(uint32_t));
     }
+    btn->page->data[page_off + PGHEADER_ZERO_OFFSET] = btn->linked ? PGFLAG_LINKED : 0;
+    if (btn->linked) {
+        uint8_t *end = btn->page->data + bt->pager->page_size;
+        put4byte(end - LEAFPG_NEXT_OFFSET, btn->next_leaf);
+        put4byte(end - LEAFPG_PREV_OFFSET, btn->prev_leaf);
+    }
     int ret;
     if ((ret = chidb_Pager_writePage(bt->pager, btn->page)) != CHIDB_OK) {
         return ret;
     }
+    pin_invalidate(bt, btn->page->npage);
+
+    return CHIDB_OK;
+}
+
+
+/* Turn an empty table leaf into a linked leaf
+ *
+ * Reserves space at the end of the page for the sibling links (see
+ * PGFLAG_LINKED) and sets them. Like any other change to a BTreeNode,
+ * this is not effective until chidb_Btree_writeNode is called.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - btn: Empty table leaf node
+ * - prev_leaf: Page of the previous leaf (0 if none)
+ * - next_leaf: Page of the next leaf (0 if none)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECELLNO: The node is not an empty table leaf
+ */
+int chidb_Btree_linkLeaf(BTree *bt, BTreeNode *btn, npage_t prev_leaf, npage_t next_leaf)
+{
+    if (btn->type != PGTYPE_TABLE_LEAF || btn->n_cells != 0) {
+        return CHIDB_ECELLNO;
+    }
+    btn->linked = true;
+    btn->cells_offset = bt->pager->page_size - LEAFPG_LINKS_SIZE;
+    btn->prev_leaf = prev_leaf;
+    btn->next_leaf = next_leaf;
 
     return CHIDB_OK;
 }
@@ -600,6 +820,37 @@ int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
                 btn->page->data[cell_off + 11];
 
         break;
+    case PGTYPE_VARINDEX_INTERNAL:
+    case PGTYPE_VARINDEX_LEAF: {
+        uint32_t key_size;
+        uint8_t *cell_data;
+        if (cell->type == PGTYPE_VARINDEX_INTERNAL) {
+            idx_off = off + INTPG_CELLSOFFSET_OFFSET + ncell * 2;
+            cell_data = btn->page->data + get2byte(&btn->page->data[idx_off]);
+            cell->fields.varIndex.child_page = get4byte(cell_data + VARINDEXINTCELL_CHILD_OFFSET);
+            cell->fields.varIndex.keyPk = 0;
+            getVarint32(cell_data + VARINDEXINTCELL_KEYSIZE_OFFSET, &key_size);
+            cell->fields.varIndex.data_size = 0;
+            cell->fields.varIndex.data = NULL;
+        } else {
+            uint32_t data_size;
+            idx_off = off + LEAFPG_CELLSOFFSET_OFFSET + ncell * 2;
+            cell_data = btn->page->data + get2byte(&btn->page->data[idx_off]);
+            cell->fields.varIndex.child_page = 0;
+            cell->fields.varIndex.keyPk = get4byte(cell_data + VARINDEXLEAFCELL_KEYPK_OFFSET);
+            getVarint32(cell_data + VARINDEXLEAFCELL_KEYSIZE_OFFSET, &key_size);
+            getVarint32(cell_data + VARINDEXLEAFCELL_KEY_OFFSET + key_size, &data_size);
+            cell->fields.varIndex.data_size = data_size;
+            cell->fields.varIndex.data = cell_data + VARINDEXLEAFCELL_KEY_OFFSET + key_size +
+                    VARINDEXLEAFCELL_DATASIZE_SIZE;
+        }
+        // both kinds of cells have the key size and key at the same offsets
+        cell->fields.varIndex.key_size = key_size;
+        cell->fields.varIndex.key_data = cell_data + VARINDEXINTCELL_KEY_OFFSET;
+        cell->key = varindex_prefix(cell->fields.varIndex.key_data, key_size);
+
+        break;
+    }
     }
 
     return CHIDB_OK;
@@ -725,6 +976,30 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
         memcpy(&btn->page->data[cell_off + INDEXLEAFCELL_KEYPK_OFFSET], &arr4, 4);
 
         break;
+    case PGTYPE_VARINDEX_INTERNAL:
+        cell_off -= varindex_cell_size(cell);
+
+        put4byte(&btn->page->data[cell_off + VARINDEXINTCELL_CHILD_OFFSET], cell->fields.varIndex.child_page);
+        putVarint32(&btn->page->data[cell_off + VARINDEXINTCELL_KEYSIZE_OFFSET], cell->fields.varIndex.key_size);
+        memcpy(&btn->page->data[cell_off + VARINDEXINTCELL_KEY_OFFSET], cell->fields.varIndex.key_data, cell->fields.varIndex.key_size);
+
+        break;
+    case PGTYPE_VARINDEX_LEAF: {
+        uint16_t data_off;
+        cell_off -= varindex_cell_size(cell);
+        data_off = cell_off + VARINDEXLEAFCELL_KEY_OFFSET + cell->fields.varIndex.key_size;
+
+        put4byte(&btn->page->data[cell_off + VARINDEXLEAFCELL_KEYPK_OFFSET], cell->fields.varIndex.keyPk);
+        putVarint32(&btn->page->data[cell_off + VARINDEXLEAFCELL_KEYSIZE_OFFSET], cell->fields.varIndex.key_size);
+        memcpy(&btn->page->data[cell_off + VARINDEXLEAFCELL_KEY_OFFSET], cell->fields.varIndex.key_data, cell->fields.varIndex.key_size);
+        putVarint32(&btn->page->data[data_off], cell->fields.varIndex.data_size);
+        if (cell->fields.varIndex.data_size > 0) {
+            memcpy(&btn->page->data[data_off + VARINDEXLEAFCELL_DATASIZE_SIZE], cell->fields.varIndex.data,
+                    cell->fields.varIndex.data_size);
+        }
+
+        break;
+    }
     }
 
     btn->cells_offset = cell_off;
@@ -741,6 +1016,132 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
     btn->n_cells++;
     btn->free_offset += 2;
 
+    // the decoded sidecar is stale now, and so is the one in the cache
+    free(btn->keys);
+    btn->keys = NULL;
+    btn->children = NULL;
+    btn->page->version = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Decode the keys of a B-Tree node
+ *
+ * Builds the node's decoded sidecar: a contiguous array with the key of
+ * every cell as a native-endian integer (the first four bytes of the key,
+ * in variable-length key indexes), and (in internal nodes) a
+ * parallel array with the child page of every cell. The keys array is
+ * 32-byte aligned and padded with UINT32_MAX up to a multiple of eight
+ * entries, so it can be scanned with full SIMD vectors (see
+ * chidb_Btree_searchNode).
+ *
+ * The sidecar is discarded by chidb_Btree_insertCell, so this function
+ * does nothing if the node has already been decoded since it was
+ * last modified.
+ *
+ * The sidecar of a node that has not been modified since it was read is
+ * also kept in the pager's cache, along with the page (see
+ * chidb_Pager_setDecoded), until the page is written or evicted. Nodes
+ * read from the same version of the page copy that sidecar instead of
+ * decoding their cells again, so a node on the path of every lookup (such
+ * as the root) is only decoded once per change.
+ *
+ * Parameters
+ * - btn: BTreeNode to decode
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Btree_decodeNode(BTreeNode *btn)
+{
+    if (btn->keys != NULL) {
+        return CHIDB_OK;
+    }
+
+    // at least one vector of padding after the last key
+    size_t cap = (btn->n_cells + 8) & ~(size_t) 7;
+    size_t size = cap * (sizeof(chidb_key_t) + sizeof(npage_t));
+    void *mem;
+    if (posix_memalign(&mem, 32, size) != 0) {
+        return CHIDB_ENOMEM;
+    }
+    btn->keys = mem;
+    btn->children = (npage_t *) (btn->keys + cap);
+    if (btn->pager != NULL && chidb_Pager_getDecoded(btn->pager, btn->page, mem, size)) {
+        return CHIDB_OK;
+    }
+
+    uint8_t *data = btn->page->data;
+    for (ncell_t i = 0; i < btn->n_cells; i++) {
+        uint8_t *cell = data + get2byte(btn->celloffset_array + i * 2);
+        switch (btn->type) {
+        case PGTYPE_TABLE_INTERNAL:
+            btn->children[i] = get4byte(cell + TABLEINTCELL_CHILD_OFFSET);
+            getVarint32(cell + TABLEINTCELL_KEY_OFFSET, &btn->keys[i]);
+            break;
+        case PGTYPE_TABLE_LEAF:
+            btn->children[i] = 0;
+            getVarint32(cell + TABLELEAFCELL_KEY_OFFSET, &btn->keys[i]);
+            break;
+        case PGTYPE_INDEX_INTERNAL:
+            btn->children[i] = get4byte(cell + INDEXINTCELL_CHILD_OFFSET);
+            btn->keys[i] = get4byte(cell + INDEXINTCELL_KEYIDX_OFFSET);
+            break;
+        case PGTYPE_INDEX_LEAF:
+            btn->children[i] = 0;
+            btn->keys[i] = get4byte(cell + INDEXLEAFCELL_KEYIDX_OFFSET);
+            break;
+        case PGTYPE_VARINDEX_INTERNAL:
+        case PGTYPE_VARINDEX_LEAF: {
+            uint32_t key_size;
+            getVarint32(cell + VARINDEXINTCELL_KEYSIZE_OFFSET, &key_size);
+            btn->children[i] = btn->type == PGTYPE_VARINDEX_INTERNAL ?
+                    get4byte(cell + VARINDEXINTCELL_CHILD_OFFSET) : 0;
+            btn->keys[i] = varindex_prefix(cell + VARINDEXINTCELL_KEY_OFFSET, key_size);
+            break;
+        }
+        }
+    }
+    for (size_t i = btn->n_cells; i < cap; i++) {
+        btn->keys[i] = UINT32_MAX;
+        btn->children[i] = 0;
+    }
+    if (btn->pager != NULL) {
+        return chidb_Pager_setDecoded(btn->pager, btn->page, mem, size);
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Search for a key in a B-Tree node
+ *
+ * Finds the first cell in the node whose key is greater than or equal
+ * to the given key, using the decoded sidecar (which is built if
+ * necessary). In an internal node, that is the cell whose child page
+ * contains the key (or the right page, if there is no such cell); in a
+ * leaf node, that is the position where the key is or should be.
+ *
+ * Parameters
+ * - btn: BTreeNode to search
+ * - key: Key to search for
+ * - ncell: Out parameter. Number of the first cell with a key >= key,
+ *          or n_cells if all the keys in the node are smaller.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Btree_searchNode(BTreeNode *btn, chidb_key_t key, ncell_t *ncell)
+{
+    int ret;
+    if ((ret = chidb_Btree_decodeNode(btn)) != CHIDB_OK) {
+        return ret;
+    }
+    *ncell = search_keys(btn->keys, btn->n_cells, key);
+
     return CHIDB_OK;
 }
 
@@ -748,6 +1149,9 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
  *
  * Finds the data associated for a given key in a table B-Tree
  *
+ * If the tree has a Bloom filter (see chidb_Btree_bloomCreate), it is
+ * checked first, and keys that it rules out are not looked up in the tree.
+ *
  * Parameters
  * - bt: B-Tree file
  * - nroot: Page number of the root node of the B-Tree we want search in
@@ -766,48 +1170,175 @@ int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data,
     /* Your code goes here */
     int ret;
     BTreeNode *btn;
-    if ((ret = chidb_Btree_getNodeByPage(bt, nroot, &btn)) != CHIDB_OK) {
+    if (!chidb_Btree_bloomMayContain(bt, nroot, key)) {
+        return CHIDB_ENOTFOUND;
+    }
+    if ((ret = chidb_Btree_findLeaf(bt, nroot, key, false, &btn, NULL, NULL)) != CHIDB_OK) {
+        return ret == CHIDB_EDUPLICATE ? CHIDB_ENOTFOUND : ret;
+    }
+    ncell_t ncell;
+    if ((ret = chidb_Btree_searchNode(btn, key, &ncell)) != CHIDB_OK) {
+        chidb_Btree_releaseNode(bt, btn);
         return ret;
     }
+
     BTreeCell cell;
-    for (ncell_t i = 0; i < btn->n_cells; i++) {
-        if ((ret = chidb_Btree_getCell(btn, i, &cell)) != CHIDB_OK) {
-            return ret;
+    ret = CHIDB_ENOTFOUND;
+    if (btn->type == PGTYPE_TABLE_LEAF && ncell < btn->n_cells && btn->keys[ncell] == key) {
+        chidb_Btree_getCell(btn, ncell, &cell);
+        *size = cell.fields.tableLeaf.data_size;
+        *data = malloc(cell.fields.tableLeaf.data_size);
+        if (*data == NULL) {
+            ret = CHIDB_ENOMEM;
+        } else {
+            memcpy(*data, &cell.fields.tableLeaf.data[0], cell.fields.tableLeaf.data_size);
+            ret = CHIDB_OK;
         }
-        switch (cell.type) {
-        case PGTYPE_TABLE_INTERNAL:
-            if (key <= cell.key) {
-                return chidb_Btree_find(bt, cell.fields.tableInternal.child_page, key, data, size);
-            }
+    }
+    chidb_Btree_releaseNode(bt, btn);
+
+    return ret;
+}
+
+
+/* Find the leaf where a key belongs
+ *
+ * Descends from the root to the leaf that contains (or would contain) the
+ * given key, crabbing down the tree: the child is latched before the latch
+ * of its parent is released, so no writer can split the child in between.
+ * Internal nodes are only latched in shared mode. If exclusive is true, the
+ * leaf is latched in exclusive mode instead, so that the caller can insert
+ * into it; this is only possible while its parent is still latched, because
+ * the shared latch has to be released first.
+ *
+ * The leaf is returned latched. Release it with chidb_Btree_releaseNode.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - key: Key to look for
+ * - exclusive: Latch the leaf in exclusive mode
+ * - leaf: Out parameter. Used to return the (latched) leaf.
+ * - bounded: Out parameter (may be NULL). Set to true if the keys in the
+ *            leaf have an upper bound, i.e., the leaf was reached through
+ *            a cell (and not a right_page pointer) at some level.
+ * - bound: Out parameter (may be NULL). Upper bound of the keys in the
+ *          leaf: they are <= bound in a table B-Tree and < bound in an
+ *          index B-Tree.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: An internal node has no child for the key yet
+ * - CHIDB_EDUPLICATE: The key is in an internal node of an index B-Tree
+ * - CHIDB_EPAGENO: The tree contains an invalid page number
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_findLeaf(BTree *bt, npage_t nroot, chidb_key_t key, bool exclusive, BTreeNode **leaf, bool *bounded, chidb_key_t *bound)
+{
+    int ret;
+    BTreeNode *btn;
+    npage_t npage = nroot;
+    npage_t parent = 0;
+    bool latched_x = false;
+    if (bounded != NULL) {
+        *bounded = false;
+    }
+
+    // start below the pinned top levels of the tree, if it has any
+    if ((ret = pin_descend(bt, nroot, key, &npage, &parent, bounded, bound)) != CHIDB_OK) {
+        return ret;
+    }
+    while ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) == CHIDB_OK) {
+        bool is_leaf = btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF;
+        if (is_leaf && exclusive && !latched_x) {
+            // trade the shared latch for an exclusive one, and read it again
+            chidb_Btree_freeMemNode(bt, btn);
+            chidb_Pager_unlatch(bt->pager, npage);
+            chidb_Pager_latch(bt->pager, npage, true);
+            latched_x = true;
+            continue;
+        }
+        if (!is_leaf && latched_x) {
+            // only the root can stop being a leaf (when it is split), which
+            // may have happened while it was unlatched: start over
+            chidb_Btree_freeMemNode(bt, btn);
+            chidb_Pager_unlatch(bt->pager, npage);
+            chidb_Pager_latch(bt->pager, npage, false);
+            latched_x = false;
+            continue;
+        }
+        if (parent != 0) {
+            chidb_Pager_unlatch(bt->pager, parent);
+            parent = 0;
+        }
+        if (is_leaf) {
+            *leaf = btn;
+            return CHIDB_OK;
+        }
+
+        ncell_t ncell;
+        if ((ret = chidb_Btree_searchNode(btn, key, &ncell)) != CHIDB_OK) {
+            chidb_Btree_freeMemNode(bt, btn);
             break;
-        case PGTYPE_TABLE_LEAF:
-            if (key == cell.key) {
-                *size = cell.fields.tableLeaf.data_size;
-                *data = malloc(cell.fields.tableLeaf.data_size);
-                if (*data == NULL) {
-                    return CHIDB_ENOMEM;
-                }
-                memcpy(*data, &cell.fields.tableLeaf.data[0], cell.fields.tableLeaf.data_size);
-                return CHIDB_OK;
-            } else if (key < cell.key) {
-                return CHIDB_ENOTFOUND;
+        }
+        npage_t child_page = btn->right_page;
+        if (ncell < btn->n_cells) {
+            if (btn->type == PGTYPE_INDEX_INTERNAL && btn->keys[ncell] == key) {
+                ret = CHIDB_EDUPLICATE;
             }
+            child_page = btn->children[ncell];
+            if (bounded != NULL) {
+                *bounded = true;
+            }
+            if (bound != NULL) {
+                *bound = btn->keys[ncell];
+            }
+        }
+        chidb_Btree_freeMemNode(bt, btn);
+        if (ret == CHIDB_OK && child_page == 0) {
+            ret = CHIDB_ENOTFOUND;
+        }
+        if (ret != CHIDB_OK) {
             break;
-        case PGTYPE_INDEX_INTERNAL:
-
-            break;
-        case PGTYPE_INDEX_LEAF:
+        }
 
+        if ((ret = chidb_Pager_latch(bt->pager, child_page, false)) != CHIDB_OK) {
             break;
         }
+        parent = npage;
+        npage = child_page;
     }
-    if (btn->type == PGTYPE_TABLE_INTERNAL) {
-        if (btn->right_page > 1) {
-            return chidb_Btree_find(bt, btn->right_page, key, data, size);
-        }
+
+    // something went wrong: release whatever we are holding
+    if (parent != 0) {
+        chidb_Pager_unlatch(bt->pager, parent);
     }
+    chidb_Pager_unlatch(bt->pager, npage);
+
+    return ret;
+}
+
+
+/* Release a latched B-Tree node
+ *
+ * Releases the latch on the node's page (see chidb_Btree_findLeaf) and
+ * frees the node.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - btn: BTreeNode to release
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The node has an invalid page number
+ */
+int chidb_Btree_releaseNode(BTree *bt, BTreeNode *btn)
+{
+    npage_t npage = btn->page->npage;
+    chidb_Btree_freeMemNode(bt, btn);
 
-    return CHIDB_ENOTFOUND;
+    return chidb_Pager_unlatch(bt->pager, npage);
 }
 
 
@@ -849,7 +1380,8 @@ int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t
  *
  * This is a convenience function that wraps around chidb_Btree_insert.
  * It takes a KeyIdx and a KeyPk, and creates a BTreeCell that can be passed
- * along to chidb_Btree_insert.
+ * along to chidb_Btree_insert. If the index has an insert buffer (see
+ * chidb_Btree_bufferIndex), the entry is added to the buffer instead.
  *
  * Parameters
  * - bt: B-Tree file
@@ -867,6 +1399,11 @@ int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t
 int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk)
 {
     /* Your code goes here */
+    BTreeInsertBuffer *ibuf = ibuf_find(bt, nroot);
+    if (ibuf != NULL) {
+        return ibuf_insert(bt, ibuf, keyIdx, keyPk);
+    }
+
     BTreeCell btc;
     btc.type = PGTYPE_INDEX_LEAF;
     btc.key = keyIdx;
@@ -886,6 +1423,23 @@ int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chid
  * splitting any other node). If so, chidb_Btree_split is called
  * before calling chidb_Btree_insertNonFull.
  *
+ * Most insertions happen in increasing key order (e.g., rowids), so if
+ * the key is larger than every key in the tree and we know which leaf
+ * is the rightmost one (see the append cache in btree.h), the cell is
+ * appended to that leaf directly, without descending from the root.
+ * When the rightmost leaf is full, the regular path is taken, which will
+ * split it unevenly, according to the tree's fill factor (see
+ * chidb_Btree_setSplitPolicy and chidb_Btree_splitCell).
+ *
+ * Otherwise, the insertion is first attempted optimistically: the tree
+ * is descended with shared latches and only the leaf is latched
+ * exclusively (see chidb_Btree_findLeaf). Most of the time the leaf has
+ * room for the cell, and other threads can keep using the rest of the
+ * tree. If it does not, the insertion starts over from the root, this
+ * time latching every node exclusively so that it can be split.
+ *
+ * If the tree has a Bloom filter, the key is added to it.
+ *
  * Parameters
  * - bt: B-Tree file
  * - nroot: Page number of the root node of the B-Tree we want to insert
@@ -901,125 +1455,119 @@ int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chid
 int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
 {
     /* Your code goes here */
+    int ret = CHIDB_OK;
+    pthread_rwlock_rdlock(&bt->meta_latch);
+    // the key is added to the filter first, so that a lookup that finds it
+    // in the tree would also find it in the filter
+    BloomFilter *bf = meta_bloom(bt, nroot);
+    if (bf != NULL) {
+        ret = bloom_add_key(bt, bf, btc->key);
+    }
+    if (ret == CHIDB_OK) {
+        ret = insert_cell(bt, nroot, btc);
+    }
+    pthread_rwlock_unlock(&bt->meta_latch);
+    changes_bump(bt, nroot);
+
+    return ret;
+}
+
+/* Does the actual work of chidb_Btree_insert. The caller must hold the
+ * meta latch in shared mode, and have added the key to the tree's Bloom
+ * filter (if it has one). */
+int insert_cell(BTree *bt, npage_t nroot, BTreeCell *btc)
+{
     int ret;
     BTreeNode *btn;
-    if ((ret = chidb_Btree_getNodeByPage(bt, nroot, &btn)) != CHIDB_OK) {
-        return ret;
-    }
+    ncell_t ncell;
 
-    uint8_t is_root_full = 0;
-    uint16_t free_space = btn->cells_offset - btn->free_offset;
-    switch (btn->type) {
-    case PGTYPE_TABLE_INTERNAL:
-        if (free_space < TABLEINTCELL_SIZE + 2) {
-            is_root_full = 1;
-        }
-        break;
-    case PGTYPE_TABLE_LEAF:
-        if (free_space < TABLELEAFCELL_SIZE_WITHOUTDATA + btc->fields.tableLeaf.data_size + 2) {
-            is_root_full = 1;
-        }
-        break;
-    case PGTYPE_INDEX_INTERNAL:
-        if (free_space < INDEXINTCELL_SIZE + 2) {
-            is_root_full = 1;
-        }
-        break;
-    case PGTYPE_INDEX_LEAF:
-        if (free_space < INDEXLEAFCELL_SIZE + 2) {
-            is_root_full = 1;
-        }
-        break;
-    }
-    if (is_root_full == 1) {
-        BTreeCell root_btc;
-        ncell_t mid_cell = (btn->n_cells - 1) / 2;
-        // write left child node
-        npage_t left_page;
-        BTreeNode *left_btn;
-        if ((ret = chidb_Btree_newNode(bt, &left_page, btn->type)) != CHIDB_OK) {
+    // the leaf the insertion reaches replaces the cache entry if it is the
+    // rightmost one, unless pages are freed in the meantime
+    BTreeAppendCache leaf_ac = {nroot, 0, 0, __atomic_load_n(&bt->free_epoch, __ATOMIC_SEQ_CST)};
+
+    // another thread may have split or appended to the cached leaf since
+    // it was cached, so make sure the key still goes at its end
+    BTreeAppendCache ac;
+    bool cached = append_cache_get(bt, nroot, &ac);
+    if (cached && btc->key > ac.max_key) {
+        if ((ret = chidb_Pager_latch(bt->pager, ac.nleaf, true)) != CHIDB_OK) {
             return ret;
         }
-        if ((ret = chidb_Btree_getNodeByPage(bt, left_page, &left_btn)) != CHIDB_OK) {
+        if ((ret = chidb_Btree_getNodeByPage(bt, ac.nleaf, &btn)) != CHIDB_OK) {
+            chidb_Pager_unlatch(bt->pager, ac.nleaf);
             return ret;
         }
-        // insert left cell
-        ncell_t left_mid_cell = mid_cell;
-        if (btn->type == PGTYPE_INDEX_INTERNAL || btn->type == PGTYPE_INDEX_LEAF) {
-            left_mid_cell--;
-        }
-        for (ncell_t i = 0; i <= left_mid_cell; i++) {
-            if ((ret = chidb_Btree_getCell(btn, i, &root_btc)) != CHIDB_OK) {
-                return ret;
+        // the leaf may have been freed by a range delete since it was cached
+        if (ac.epoch == __atomic_load_n(&bt->free_epoch, __ATOMIC_SEQ_CST) && append_leaf_fits(btn, btc)) {
+            if ((ret = chidb_Btree_insertCell(btn, btn->n_cells, btc)) == CHIDB_OK) {
+                ret = chidb_Btree_writeNode(bt, btn);
             }
-            if ((ret = chidb_Btree_insertCell(left_btn, i, &root_btc)) != CHIDB_OK) {
-                return ret;
+            chidb_Btree_releaseNode(bt, btn);
+            if (ret == CHIDB_OK) {
+                append_cache_extend(bt, nroot, ac.nleaf, btc->key);
             }
-        }
-        if ((ret = chidb_Btree_writeNode(bt, left_btn)) != CHIDB_OK) {
             return ret;
         }
+        chidb_Btree_releaseNode(bt, btn);
+    }
 
-        // write right child node
-        npage_t right_page;
-        BTreeNode *right_btn;
-        if ((ret = chidb_Btree_newNode(bt, &right_page, btn->type)) != CHIDB_OK) {
-           return ret;
-        }
-        if ((ret = chidb_Btree_getNodeByPage(bt, right_page, &right_btn)) != CHIDB_OK) {
-            return ret;
-        }
-        int j = 0;
-        for (ncell_t i = mid_cell + 1; i < btn->n_cells; i++) {
-            if ((ret = chidb_Btree_getCell(btn, i, &root_btc)) != CHIDB_OK) {
-                return ret;
+    // optimistic insertion: only the leaf is latched exclusively, which is
+    // enough as long as it does not have to be split
+    bool bounded;
+    ret = chidb_Btree_findLeaf(bt, nroot, btc->key, true, &btn, &bounded, NULL);
+    if (ret == CHIDB_OK) {
+        if (!chidb_Btree_isFull(btn, btc)) {
+            if ((ret = chidb_Btree_searchNode(btn, btc->key, &ncell)) == CHIDB_OK) {
+                if (ncell < btn->n_cells && btn->keys[ncell] == btc->key) {
+                    ret = CHIDB_EDUPLICATE;
+                } else if ((ret = chidb_Btree_insertCell(btn, ncell, btc)) == CHIDB_OK) {
+                    ret = chidb_Btree_writeNode(bt, btn);
+                }
             }
-            if ((ret = chidb_Btree_insertCell(right_btn, j, &root_btc)) != CHIDB_OK) {
-                return ret;
+            // an unbounded leaf was reached through right pages alone
+            BTreeCell last_btc;
+            if (ret == CHIDB_OK && !bounded
+                    && chidb_Btree_getCell(btn, btn->n_cells - 1, &last_btc) == CHIDB_OK) {
+                leaf_ac.nleaf = btn->page->npage;
+                leaf_ac.max_key = last_btc.key;
+            }
+            chidb_Btree_releaseNode(bt, btn);
+            if (leaf_ac.nleaf != 0 && (!cached || ac.nleaf != leaf_ac.nleaf)) {
+                append_cache_set(bt, &leaf_ac);
+            } else if (leaf_ac.nleaf != 0) {
+                append_cache_extend(bt, nroot, leaf_ac.nleaf, leaf_ac.max_key);
             }
-            j++;
-        }
-        right_btn->right_page = btn->right_page;
-        if ((ret = chidb_Btree_writeNode(bt, right_btn)) != CHIDB_OK) {
             return ret;
         }
+        chidb_Btree_releaseNode(bt, btn);
+    } else if (ret != CHIDB_ENOTFOUND) {
+        return ret;
+    }
 
-        // write root node
-        if ((ret = chidb_Btree_getCell(btn, mid_cell, &root_btc)) != CHIDB_OK) {
-            return ret;
-        }
+    // pessimistic insertion: latch the root exclusively and split on the
+    // way down
+    BTreeSplitPolicy policy = meta_split_policy(bt, nroot);
+    if ((ret = chidb_Pager_latch(bt->pager, nroot, true)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, nroot, &btn)) != CHIDB_OK) {
+        chidb_Pager_unlatch(bt->pager, nroot);
+        return ret;
+    }
+    if (chidb_Btree_isFull(btn, btc)) {
+        ret = split_root(bt, nroot, btn, btc, &policy);
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+    if (ret != CHIDB_OK) {
+        chidb_Pager_unlatch(bt->pager, nroot);
+        return ret;
+    }
 
-        uint8_t new_type = 0;
-        if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_TABLE_LEAF) {
-            new_type = PGTYPE_TABLE_INTERNAL;
-        } else if (btn->type == PGTYPE_INDEX_INTERNAL || btn->type == PGTYPE_INDEX_LEAF) {
-            new_type = PGTYPE_INDEX_INTERNAL;
-        }
-        if ((ret = chidb_Btree_initEmptyNode(bt, nroot, new_type)) != CHIDB_OK) {
-            return ret;
-        }
-        if ((ret = chidb_Btree_getNodeByPage(bt, nroot, &btn)) != CHIDB_OK) {
-            return ret;
-        }
-        root_btc.type = new_type;
-        switch (new_type) {
-        case PGTYPE_TABLE_INTERNAL:
-            root_btc.fields.tableInternal.child_page = left_page;
-            break;
-        case PGTYPE_INDEX_INTERNAL:
-            root_btc.fields.indexInternal.child_page = left_page;
-            break;
-        }
-        if ((ret = chidb_Btree_insertCell(btn, 0, &root_btc)) != CHIDB_OK) {
-            return ret;
-        }
-        btn->right_page = right_page;
-        if ((ret = chidb_Btree_writeNode(bt, btn)) != CHIDB_OK) {
-            return ret;
-        }
+    if ((ret = insert_non_full(bt, nroot, btc, &policy, &leaf_ac)) == CHIDB_OK && leaf_ac.nleaf != 0) {
+        append_cache_set(bt, &leaf_ac);
     }
 
-    return chidb_Btree_insertNonFull(bt, nroot, btc);
+    return ret;
 }
 
 /* Insert a BTreeCell into a non-full B-Tree node
@@ -1029,15 +1577,25 @@ int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
  * node is a leaf node, the cell is directly added in the appropriate
  * position according to its key. If the node is an internal node, the
  * function will determine what child node it must insert it in, and
- * calls itself recursively on that child node. However, before doing so
- * it will check if the child node is full or not. If it is, then it will
+ * continues with that child node. However, before doing so it will
+ * check if the child node is full or not. If it is, then it will
  * have to be split first.
  *
+ * The caller must hold an exclusive latch on npage, which is released
+ * before returning. The child is latched before its parent is released,
+ * and once it has been split (if necessary) it cannot be split again by
+ * this insertion, so at most two nodes are latched at any time.
+ *
+ * npage is taken to be on the right edge of the tree, as the root is: a
+ * child is on it only if it is reached from npage through right pages
+ * alone (see chidb_Btree_splitCell).
+ *
  * Parameters
  * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this cell in.
+ * - npage: Page number of the node we want to insert this cell in
  * - btc: BTreeCell to insert into B-Tree
+ * - policy: How to split full nodes (NULL for the default policy; see
+ *           chidb_Btree_splitCell)
  *
  * Return
  * - CHIDB_OK: Operation successful
@@ -1045,161 +1603,160 @@ int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc)
+int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc, const BTreeSplitPolicy *policy)
 {
     /* Your code goes here */
-    int ret;
-    BTreeNode *btn;
-    if ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
-        return ret;
-    }
-    // if cell in leaf node, insert directly
-    if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF) {
-        ncell_t insert_cell = btn->n_cells;
-        BTreeCell orig_btc;
-        for (ncell_t i = 0; i < btn->n_cells; i++) {
-            if ((ret = chidb_Btree_getCell(btn, i, &orig_btc)) != CHIDB_OK) {
-                return ret;
-            }
-            if (btc->key == orig_btc.key) {
-                return CHIDB_EDUPLICATE;
-            } else if (btc->key < orig_btc.key) {
-                insert_cell = i;
-                break;
-            }
-        }
+    return insert_non_full(bt, npage, btc, policy, NULL);
+}
 
-        if ((ret = chidb_Btree_insertCell(btn, insert_cell, btc)) != CHIDB_OK) {
-            return ret;
-        }
-        if ((ret = chidb_Btree_writeNode(bt, btn)) != CHIDB_OK) {
+/* Does the actual work of chidb_Btree_insertNonFull. If ac is not NULL and
+ * the cell is inserted into a leaf on the right edge of the tree, ac->nleaf
+ * and ac->max_key are set to that leaf and its largest key (see
+ * insert_step); otherwise, ac is left as it is. */
+int insert_non_full(BTree *bt, npage_t npage, BTreeCell *btc, const BTreeSplitPolicy *policy, BTreeAppendCache *ac)
+{
+    int ret;
+    npage_t child_page;
+    bool rightmost = true;
+    while (1) {
+        ret = insert_step(bt, npage, btc, policy, &rightmost, &child_page, ac);
+        chidb_Pager_unlatch(bt->pager, npage);
+        if (ret != CHIDB_OK || child_page == 0) {
             return ret;
         }
+        npage = child_page;
+    }
+}
+
 
+
+/* Insert a batch of BTreeCells into a B-Tree
+ *
+ * Inserts n cells into the B-Tree rooted at nroot. The cells are sorted
+ * by key (the cells array itself is not modified), and then inserted
+ * bottom-up, one leaf at a time. The tree is descended once for the first
+ * cell of a run, splitting full internal nodes on the way down like
+ * chidb_Btree_insert does, and keeping track of the range of keys that
+ * belong to the leaf we reach. Every following cell in that range joins
+ * the run, which is merged with the leaf's cells while the leaf and its
+ * parent are latched:
+ *
+ * - If the run fits in the leaf, it is inserted there, and the leaf is
+ *   written once.
+ * - Otherwise, the merged cells are cut into leaves, and each leaf is laid
+ *   out in memory and written once: the first one to the leaf's page and
+ *   the rest to new pages, if the run is an append (keys larger than any
+ *   in the leaf, on the right edge of the tree), or the last one to the
+ *   leaf's page and the rest to new pages before it otherwise. Appends
+ *   fill each leaf to the tree's fill factor, the way inserting them one
+ *   by one would (see chidb_Btree_splitCell); any other run is spread
+ *   evenly over as few leaves as it fits in. Then the separators of the new
+ *   pages are added to the parent, which is written once. A root leaf
+ *   moves all its cells to new pages and becomes their parent.
+ *
+ * A run only takes as many cells as the parent has room for separators;
+ * the next run descends from the root again, splitting the parent if it
+ * is full. So the only leaves written more than once by a batch are the
+ * last leaf filled by a run cut short that way, which the next run fills
+ * further, and, in linked table leaves, the leaf before a run that is not
+ * an append, whose link to the next leaf changes.
+ *
+ * If the tree has a Bloom filter, all the keys are added to it first. A
+ * bulk load that takes the filter past its capacity (see
+ * chidb_Bloom_capacity) rebuilds it for the new size of the tree.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          the cells in.
+ * - cells: Array of BTreeCells to insert. All of them must have the same
+ *          type (table leaf or index leaf).
+ * - n: Number of cells in the array
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: The tree (or the batch itself) contains a cell with
+ *                     the same key as one of the cells. The cells with
+ *                     smaller keys have been inserted; the rest have not.
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertBatch(BTree *bt, npage_t nroot, BTreeCell *cells, uint32_t n)
+{
+    int ret = CHIDB_OK;
+    BTreeCell **sorted;
+    if (n == 0) {
         return CHIDB_OK;
     }
+    if ((sorted = malloc(n * sizeof(BTreeCell *))) == NULL) {
+        return CHIDB_ENOMEM;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        sorted[i] = &cells[i];
+    }
+    qsort(sorted, n, sizeof(BTreeCell *), insert_batch_cmp);
 
-    // if cell in internal node
-    // 1. find child node, if no exist, create one
-    // 2. check child node is full, if so split it
-    // 3. insert cell to child node
-    ncell_t parent_cell = btn->n_cells;
-    npage_t child_page = btn->right_page;
-    BTreeCell search_btc;
-    uint8_t find_child = 0;
-    for (ncell_t i = 0; i < btn->n_cells; i++) {
-        if ((ret = chidb_Btree_getCell(btn, i, &search_btc)) != CHIDB_OK) {
-            return ret;
-        }
-        switch (btn->type) {
-        case PGTYPE_TABLE_INTERNAL:
-            if (btc->key <= search_btc.key) {
-                parent_cell = i;
-                child_page = search_btc.fields.tableInternal.child_page;
-                find_child = 1;
-            }
-            break;
-        case PGTYPE_INDEX_INTERNAL:
-            if (btc->key == search_btc.key) {
-                return CHIDB_EDUPLICATE;
-            } else if (btc->key < search_btc.key) {
-                parent_cell = i;
-                child_page = search_btc.fields.indexInternal.child_page;
-                find_child = 1;
-            }
-            break;
-        }
-        if (find_child == 1) {
-            break;
-        }
+    pthread_rwlock_rdlock(&bt->meta_latch);
+    BloomFilter *bf = meta_bloom(bt, nroot);
+    if (bf != NULL) {
+        ret = bloom_add_batch(bt, bf, sorted, n);
     }
 
-    BTreeNode *child_btn;
-    if (child_page > 0) {
-        // check child is full
-        uint8_t is_full = 0;
-        uint16_t free_space = 0;
-        if ((ret = chidb_Btree_getNodeByPage(bt, child_page, &child_btn)) != CHIDB_OK) {
-            return ret;
-        }
-        free_space = child_btn->cells_offset - child_btn->free_offset;
-        switch (child_btn->type) {
-        case PGTYPE_TABLE_INTERNAL:
-            if (free_space < TABLEINTCELL_SIZE + 2) {
-                is_full = 1;
-            }
-            break;
-        case PGTYPE_TABLE_LEAF:
-            if (free_space < TABLELEAFCELL_SIZE_WITHOUTDATA + btc->fields.tableLeaf.data_size + 2) {
-                is_full = 1;
-            }
-            break;
-        case PGTYPE_INDEX_INTERNAL:
-            if (free_space < INDEXINTCELL_SIZE + 2) {
-                is_full = 1;
-            }
-            break;
-        case PGTYPE_INDEX_LEAF:
-            if (free_space < INDEXLEAFCELL_SIZE + 2) {
-                is_full = 1;
-            }
+    BTreeSplitPolicy policy = meta_split_policy(bt, nroot);
+    uint32_t i = 0;
+    while (i < n && ret == CHIDB_OK) {
+        BTreeBatchLeaf bl;
+        uint32_t end, n_done;
+        // the last leaf of the run replaces the cache entry if it is the
+        // rightmost one, unless pages are freed in the meantime
+        BTreeAppendCache leaf_ac = {nroot, 0, 0, __atomic_load_n(&bt->free_epoch, __ATOMIC_SEQ_CST)};
+
+        ret = batch_descend(bt, nroot, sorted[i], &policy, &bl);
+        if (ret == CHIDB_ENOTFOUND) {
+            // the node has no child for this key yet; let the regular
+            // insertion create it
+            ret = insert_cell(bt, nroot, sorted[i]);
+            i++;
+            continue;
+        } else if (ret != CHIDB_OK) {
             break;
         }
-        // split page
-        if (is_full == 1) {
-            npage_t child_page2 = 0;
-            if ((ret = chidb_Btree_split(bt, npage, child_page, parent_cell, &child_page2)) != CHIDB_OK) {
-                return ret;
-            }
-            if ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
-                return ret;
-            }
-            if ((ret = chidb_Btree_getCell(btn, parent_cell, &search_btc)) != CHIDB_OK) {
-                return ret;
-            }
-            if (btc->key <= search_btc.key) {
-                child_page = child_page2;
-            }
+
+        // the run is every cell in the leaf's range
+        end = bl.bounded ? i + 1 : n;
+        while (end < n && (sorted[end]->key < bl.bound
+                || (sorted[end]->key == bl.bound && bl.leaf->type == PGTYPE_TABLE_LEAF))) {
+            end++;
         }
-    } else {
-        // create a child page
-        uint8_t child_type = 0;
-        if (btn->type == PGTYPE_TABLE_INTERNAL) {
-            child_type = PGTYPE_TABLE_LEAF;
-        } else if (btn->type == PGTYPE_INDEX_INTERNAL) {
-            child_type = PGTYPE_INDEX_LEAF;
+        ret = batch_fill(bt, nroot, &bl, &sorted[i], end - i, &policy, &n_done, &leaf_ac);
+        chidb_Btree_releaseNode(bt, bl.leaf);
+        if (bl.parent != NULL) {
+            chidb_Btree_releaseNode(bt, bl.parent);
         }
-        if ((ret = chidb_Btree_newNode(bt, &child_page, child_type)) != CHIDB_OK) {
-            return ret;
+        i += n_done;
+        if (ret == CHIDB_OK && leaf_ac.nleaf != 0) {
+            append_cache_set(bt, &leaf_ac);
         }
-        if (btn->n_cells != 0) {
-            btn->right_page = child_page;
-        } else {
-            BTreeCell parent_btc;
-            parent_btc.type = btn->type;
-            parent_btc.key = btc->key;
+    }
 
-            switch (btn->type) {
-            case PGTYPE_TABLE_INTERNAL:
-                parent_btc.fields.tableInternal.child_page = child_page;
-                break;
-            case PGTYPE_INDEX_INTERNAL:
-                parent_btc.fields.indexInternal.child_page = child_page;
-                break;
-            }
-            if ((ret = chidb_Btree_insertCell(btn, 0, &parent_btc)) != CHIDB_OK) {
-                return ret;
-            }
-        }
-        if ((ret = chidb_Btree_writeNode(bt, btn)) != CHIDB_OK) {
-            return ret;
-        }
-        if (btn->type == PGTYPE_INDEX_INTERNAL) {
-            return CHIDB_OK;
+    bool rebuild = false;
+    if (bf != NULL && i > 0) {
+        uint32_t n_keys = __atomic_add_fetch(&bf->n_keys, i, __ATOMIC_RELAXED);
+        rebuild = n_keys > chidb_Bloom_capacity(bf);
+        int wret;
+        if ((wret = meta_write(bt)) != CHIDB_OK && ret == CHIDB_OK) {
+            ret = wret;
         }
     }
+    pthread_rwlock_unlock(&bt->meta_latch);
+    free(sorted);
+    changes_bump(bt, nroot);
+
+    if (ret == CHIDB_OK && rebuild) {
+        ret = chidb_Btree_bloomRebuild(bt, nroot);
+    }
 
-    return chidb_Btree_insertNonFull(bt, child_page, btc);
+    return ret;
 }
 
 
@@ -1229,6 +1786,46 @@ int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc)
 int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_ncell, npage_t *npage_child2)
 {
     /* Your code goes here */
+    int ret;
+    BTreeNode *btn;
+    if ((ret = chidb_Btree_getNodeByPage(bt, npage_child, &btn)) != CHIDB_OK) {
+        return ret;
+    }
+    ncell_t mid_cell = (btn->n_cells - 1) / 2;
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return chidb_Btree_splitAt(bt, npage_parent, npage_child, parent_ncell, mid_cell, npage_child2);
+}
+
+
+/* Split a B-Tree node at a given cell
+ *
+ * Same as chidb_Btree_split, but the cell that is moved (or, from a table
+ * leaf, copied) to the parent is mid_cell instead of the median cell.
+ * The cells before mid_cell (and mid_cell itself, if it is copied) go to
+ * the new node M, and the rest stay in N. If N is internal, M's right
+ * page is the child of mid_cell.
+ * If N is a linked leaf (see PGFLAG_LINKED), M is linked in right
+ * before N, so the leaf that preceded N is updated to point to M.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage_parent: Page number of the parent node
+ * - npage_child: Page number of the node to split
+ * - parent_ncell: Position in the parent where the new cell will
+ *                 be inserted.
+ * - mid_cell: Cell of the child where the node is split. Both halves must
+ *             be left with at least one cell, so 0 < mid_cell < n_cells - 1
+ *             (or mid_cell = 0 in a table B-Tree).
+ * - npage_child2: Out parameter. Used to return the page of the new child node.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_splitAt(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_ncell, ncell_t mid_cell, npage_t *npage_child2)
+{
     int ret;
     BTreeNode *parent_btn;
     if ((ret = chidb_Btree_getNodeByPage(bt, npage_parent, &parent_btn)) != CHIDB_OK) {
@@ -1256,15 +1853,35 @@ int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncel
     if ((ret = chidb_Btree_getNodeByPage(bt, npage_child, &right_btn)) != CHIDB_OK) {
         return ret;
     }
+    // linked leaves: M goes between the previous leaf and N
+    if (orig_btn->linked) {
+        chidb_Btree_linkLeaf(bt, left_btn, orig_btn->prev_leaf, npage_child);
+        chidb_Btree_linkLeaf(bt, right_btn, left_page, orig_btn->next_leaf);
+        if (orig_btn->prev_leaf != 0) {
+            // siblings are only ever latched right to left
+            BTreeNode *prev_btn;
+            if ((ret = chidb_Pager_latch(bt->pager, orig_btn->prev_leaf, true)) != CHIDB_OK) {
+                return ret;
+            }
+            if ((ret = chidb_Btree_getNodeByPage(bt, orig_btn->prev_leaf, &prev_btn)) != CHIDB_OK) {
+                chidb_Pager_unlatch(bt->pager, orig_btn->prev_leaf);
+                return ret;
+            }
+            prev_btn->next_leaf = left_page;
+            ret = chidb_Btree_writeNode(bt, prev_btn);
+            chidb_Btree_releaseNode(bt, prev_btn);
+            if (ret != CHIDB_OK) {
+                return ret;
+            }
+        }
+    }
+
+    append_cache_invalidate(bt, npage_child);
 
     BTreeCell orig_btc;
-    ncell_t mid_cell = (orig_btn->n_cells - 1) / 2;
     // insert left cell
-    ncell_t left_mid_cell = mid_cell;
-    if (parent_btn->type == PGTYPE_INDEX_INTERNAL || parent_btn->type == PGTYPE_INDEX_LEAF) {
-        left_mid_cell--;
-    }
-    for (ncell_t i = 0; i <= left_mid_cell; i++) {
+    ncell_t left_cells = split_left_cells(orig_btn, mid_cell, &left_btn->right_page);
+    for (ncell_t i = 0; i < left_cells; i++) {
         if ((ret = chidb_Btree_getCell(orig_btn, i, &orig_btc)) != CHIDB_OK) {
             return ret;
         }
@@ -1319,3 +1936,4376 @@ int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncel
     return CHIDB_OK;
 }
 
+
+/* Check whether a cell fits in a B-Tree node
+ *
+ * Parameters
+ * - btn: BTreeNode where the cell would be inserted
+ * - btc: BTreeCell to insert. Only used to determine the size of the
+ *        cell in table leaf nodes.
+ *
+ * Return
+ * - true: The node does not have enough free space for the cell and
+ *         its entry in the cell offset array (it has to be split).
+ * - false: The cell can be inserted in the node.
+ */
+bool chidb_Btree_isFull(BTreeNode *btn, BTreeCell *btc)
+{
+    uint16_t free_space = btn->cells_offset - btn->free_offset;
+    switch (btn->type) {
+    case PGTYPE_TABLE_INTERNAL:
+    case PGTYPE_TABLE_LEAF:
+    case PGTYPE_INDEX_INTERNAL:
+    case PGTYPE_INDEX_LEAF:
+    case PGTYPE_VARINDEX_INTERNAL:
+    case PGTYPE_VARINDEX_LEAF:
+        return free_space < cell_size(btn->type, btc) + 2;
+    }
+
+    return false;
+}
+
+
+/* Choose the cell at which a full B-Tree node will be split
+ *
+ * Normally, a node is split at its median cell, leaving both halves
+ * half empty. However, if the node is on the right edge of the tree and
+ * the cell being inserted has a larger key than any cell in the node,
+ * we are most likely appending keys in increasing order: the left half
+ * would never be filled again. In that case, the left node keeps the
+ * fill factor's share of the cells, and the right node (where the
+ * following keys will go) gets the rest. With the default fill factor,
+ * the node is split just before its last cell, so the left node stays
+ * almost full and the right node starts out nearly empty; a lower fill
+ * factor leaves room in the left node for later insertions, so they do
+ * not have to split it right away.
+ *
+ * If the policy splits by bytes, the shares are measured in bytes (of
+ * the cells, including the new one, and their offsets) rather than in
+ * cells. Splitting by cells can leave most of the bytes of a table leaf
+ * with records of very different sizes on one side, with no room there
+ * for a large record.
+ *
+ * Parameters
+ * - btn: BTreeNode that will be split
+ * - btc: BTreeCell whose insertion requires the split
+ * - rightmost: true if btn is on the right edge of the tree (i.e., it is
+ *              the root, or it was reached through right_page pointers)
+ * - policy: Split policy of the tree (NULL for the default policy)
+ *
+ * Return
+ * - Cell at which the node must be split (see chidb_Btree_splitAt)
+ */
+ncell_t chidb_Btree_splitCell(BTreeNode *btn, BTreeCell *btc, bool rightmost, const BTreeSplitPolicy *policy)
+{
+    ncell_t n = btn->n_cells;
+    BTreeSplitPolicy defaults = { DEFAULT_FILL_FACTOR, false };
+    if (policy == NULL) {
+        policy = &defaults;
+    }
+    if (n < 3) {
+        return (n - 1) / 2;
+    }
+
+    // percentage of the node that stays in the left node
+    uint32_t fill = 50;
+    if (rightmost && n >= 4) {
+        BTreeCell last_btc;
+        if (chidb_Btree_getCell(btn, n - 1, &last_btc) == CHIDB_OK
+                && btc->key > last_btc.key) {
+            fill = policy->fill_factor;
+        }
+    }
+
+    ncell_t mid_cell;
+    if (policy->by_bytes) {
+        // the new cell is counted where it will go, so that the half it
+        // ends up in has room for it
+        BTreeCell cell;
+        uint32_t new_size = cell_size(btn->type, btc) + 2;
+        uint32_t total = new_size, acc = 0;
+        bool counted = false;
+        for (ncell_t i = 0; i < n; i++) {
+            chidb_Btree_getCell(btn, i, &cell);
+            total += cell_size(btn->type, &cell) + 2;
+        }
+        // split where the left node's share is closest to fill
+        int64_t target = (int64_t) total * fill, best = INT64_MAX;
+        mid_cell = 0;
+        for (ncell_t i = 0; i < n - 1; i++) {
+            chidb_Btree_getCell(btn, i, &cell);
+            if (!counted && btc->key <= cell.key) {
+                acc += new_size;
+                counted = true;
+            }
+            acc += cell_size(btn->type, &cell) + 2;
+            int64_t dist = llabs((int64_t) acc * 100 - target);
+            if (dist < best) {
+                best = dist;
+                mid_cell = i;
+            }
+            if ((int64_t) acc * 100 >= target) {
+                break;
+            }
+        }
+    } else {
+        mid_cell = (n * fill + 99) / 100 - 1;
+    }
+
+    // both halves must be left with at least one cell
+    if (mid_cell < 1) {
+        mid_cell = 1;
+    } else if (mid_cell > n - 2) {
+        mid_cell = n - 2;
+    }
+
+    return mid_cell;
+}
+
+
+/* Find the rightmost leaf of a B-Tree
+ *
+ * Follows the right_page pointers from the root down to a leaf.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - nleaf: Out parameter. Page number of the rightmost leaf.
+ * - max_key: Out parameter. Largest key in the leaf (and in the tree).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EEMPTY: The rightmost leaf has no cells
+ * - CHIDB_EPAGENO: The tree contains an invalid page number
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_findRightmostLeaf(BTree *bt, npage_t nroot, npage_t *nleaf, chidb_key_t *max_key)
+{
+    int ret;
+    BTreeNode *btn;
+    BTreeCell btc;
+    npage_t npage = nroot;
+    npage_t child_page;
+    if ((ret = chidb_Pager_latch(bt->pager, npage, false)) != CHIDB_OK) {
+        return ret;
+    }
+    while (1) {
+        if ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+            chidb_Pager_unlatch(bt->pager, npage);
+            return ret;
+        }
+        if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF) {
+            break;
+        }
+        if (btn->right_page != 0) {
+            child_page = btn->right_page;
+        } else if (btn->n_cells > 0) {
+            chidb_Btree_getCell(btn, btn->n_cells - 1, &btc);
+            child_page = btc.type == PGTYPE_TABLE_INTERNAL ?
+                    btc.fields.tableInternal.child_page : btc.fields.indexInternal.child_page;
+        } else {
+            chidb_Btree_releaseNode(bt, btn);
+            return CHIDB_EEMPTY;
+        }
+        if ((ret = chidb_Pager_latch(bt->pager, child_page, false)) != CHIDB_OK) {
+            chidb_Btree_releaseNode(bt, btn);
+            return ret;
+        }
+        chidb_Btree_releaseNode(bt, btn);
+        npage = child_page;
+    }
+
+    ret = CHIDB_EEMPTY;
+    if (btn->n_cells > 0) {
+        chidb_Btree_getCell(btn, btn->n_cells - 1, &btc);
+        *nleaf = npage;
+        *max_key = btc.key;
+        ret = CHIDB_OK;
+    }
+    chidb_Btree_releaseNode(bt, btn);
+
+    return ret;
+}
+
+
+/* Delete a range of keys from a table B-Tree
+ *
+ * Deletes every entry with lo <= key <= hi. Only the nodes on the paths
+ * to lo and hi are read and trimmed: a subtree whose keys all lie within
+ * the range is dropped from its parent as a whole, and its pages go
+ * straight to the freelist. Its internal nodes have to be read to find
+ * its pages, but its leaves are only latched (to wait for any thread that
+ * is still using them), never read. Nodes left empty by the trimming are
+ * freed too, and the leaves on either side of the range are linked to
+ * each other (if the tree's leaves are linked).
+ *
+ * The tree is then rebalanced once, along the path to lo: at every level,
+ * the nodes on either side of the hole left by the range are merged if
+ * they fit in a single page, and a root left with a single child takes
+ * over its contents. Nodes that do not fit together are left as they are,
+ * so nodes may be left less than half full. All in all, the cost of the
+ * delete depends on the height of the tree rather than on the number of
+ * entries deleted.
+ *
+ * The root is latched in exclusive mode until the delete is done. The
+ * freelist is written to the file header at the end.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - lo: Smallest key to delete
+ * - hi: Largest key to delete (nothing is deleted if hi < lo)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The B-Tree is not a table B-Tree
+ * - CHIDB_EPAGENO: The tree contains an invalid page number
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_deleteRange(BTree *bt, npage_t nroot, chidb_key_t lo, chidb_key_t hi)
+{
+    int ret;
+    BTreeNode *btn;
+    uint32_t height;
+    npage_t prev_leaf = 0, next_leaf = 0;
+    bool empty = false;
+
+    if ((ret = chidb_Pager_latch(bt->pager, nroot, true)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, nroot, &btn)) != CHIDB_OK) {
+        chidb_Pager_unlatch(bt->pager, nroot);
+        return ret;
+    }
+    if (btn->type != PGTYPE_TABLE_INTERNAL && btn->type != PGTYPE_TABLE_LEAF) {
+        chidb_Btree_releaseNode(bt, btn);
+        return CHIDB_EMISMATCH;
+    }
+    if (hi < lo) {
+        chidb_Btree_releaseNode(bt, btn);
+        return CHIDB_OK;
+    }
+
+    // the leaf in the append cache may be freed from now on
+    __atomic_add_fetch(&bt->free_epoch, 1, __ATOMIC_SEQ_CST);
+
+    if ((ret = delete_height(bt, btn, &height)) == CHIDB_OK) {
+        ret = delete_trim(bt, btn, height, lo, hi, 0, UINT32_MAX, &prev_leaf, &next_leaf, &empty);
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+    if (ret == CHIDB_OK && empty) {
+        ret = chidb_Btree_initEmptyNode(bt, nroot, PGTYPE_TABLE_LEAF);
+    }
+    if (ret == CHIDB_OK && !empty) {
+        ret = delete_link(bt, prev_leaf, next_leaf);
+    }
+    if (ret == CHIDB_OK && !empty) {
+        ret = delete_rebalance(bt, nroot, lo);
+    }
+    chidb_Pager_unlatch(bt->pager, nroot);
+    changes_bump(bt, nroot);
+    if (ret != CHIDB_OK) {
+        return ret;
+    }
+
+    return freelist_save(bt);
+}
+
+
+/* Number of free pages
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - Number of pages in the freelist (see chidb_Btree_deleteRange),
+ *   which chidb_Btree_newNode will use before growing the file
+ */
+npage_t chidb_Btree_freePages(BTree *bt)
+{
+    pthread_mutex_lock(&bt->free_lock);
+    npage_t n_free = bt->n_free;
+    pthread_mutex_unlock(&bt->free_lock);
+
+    return n_free;
+}
+
+
+/* Change counter of a B-Tree
+ *
+ * The counter is bumped after every insertion into the B-Tree (including
+ * the merges of its insert buffer) and every range delete, once the
+ * change is complete. Whoever keeps copies of the B-Tree's nodes from
+ * one call to the next, like a cursor, can read the counter before
+ * reading the nodes, and know that the copies may be stale if it has
+ * changed since then. The counter may also change when another B-Tree
+ * does (see CHANGE_SLOTS), but never stays the same when this one does.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ *
+ * Return
+ * - Current value of the counter
+ */
+uint64_t chidb_Btree_changes(BTree *bt, npage_t nroot)
+{
+    return __atomic_load_n(&bt->changes[nroot % CHANGE_SLOTS], __ATOMIC_SEQ_CST);
+}
+
+
+/* Set the split policy of a B-Tree
+ *
+ * Sets the fill factor of a B-Tree, and whether its full nodes are split
+ * by size or by number of cells (see chidb_Btree_splitCell), and records
+ * them in the metadata directory (which is created if the file does not
+ * have one yet). A fill factor of 100 packs the nodes filled by
+ * increasing insertions and bulk loads, which suits read-mostly tables;
+ * a lower one leaves room in them for later insertions, so they do not
+ * cause a cascade of splits. The policy only affects future splits.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - fill_factor: Percentage of a node kept when splitting on appends,
+ *                from MIN_FILL_FACTOR to 100
+ * - by_bytes: true to split nodes by size instead of number of cells
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The fill factor is out of range
+ * - CHIDB_EFULLDB: The metadata directory has no room for another B-Tree
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_setSplitPolicy(BTree *bt, npage_t nroot, uint8_t fill_factor, bool by_bytes)
+{
+    int ret;
+    BTreeMeta *meta;
+    if (fill_factor < MIN_FILL_FACTOR || fill_factor > 100) {
+        return CHIDB_EMISUSE;
+    }
+    pthread_rwlock_wrlock(&bt->meta_latch);
+    if ((ret = meta_entry(bt, nroot, &meta)) == CHIDB_OK) {
+        meta->split.fill_factor = fill_factor;
+        meta->split.by_bytes = by_bytes;
+        ret = meta_write(bt);
+    }
+    pthread_rwlock_unlock(&bt->meta_latch);
+
+    return ret;
+}
+
+
+/* Get the split policy of a B-Tree
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - policy: Out parameter. Split policy of the B-Tree (the default one if
+ *           it was never set).
+ */
+void chidb_Btree_getSplitPolicy(BTree *bt, npage_t nroot, BTreeSplitPolicy *policy)
+{
+    pthread_rwlock_rdlock(&bt->meta_latch);
+    *policy = meta_split_policy(bt, nroot);
+    pthread_rwlock_unlock(&bt->meta_latch);
+}
+
+
+/* Pin the top levels of a B-Tree in memory
+ *
+ * The root and the first internal levels of a B-Tree are read on every
+ * descent. Pinning them keeps a decoded copy of those nodes in memory,
+ * linked to each other through pointers, so chidb_Btree_findLeaf (and so
+ * lookups and insertions) can search them and go down to their children
+ * without reading and decoding their pages. Their pages are also made
+ * resident in the pager's cache (see chidb_Pager_setResident), so leaves
+ * cannot push them out of it.
+ *
+ * Nodes are pinned level by level, starting at the root, until levels
+ * levels have been pinned or max_pages nodes have been pinned, whichever
+ * comes first (so a budget may leave a level only partly pinned). Leaves
+ * are never pinned. The pinned nodes follow the tree as it grows: when a
+ * split writes a pinned page, they are read again by the next descent.
+ * Pinning only lasts until the B-Tree file is closed.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - levels: Number of levels to pin (0 unpins the tree)
+ * - max_pages: Most nodes to pin (0 for no limit)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_pinLevels(BTree *bt, npage_t nroot, uint8_t levels, npage_t max_pages)
+{
+    int ret = CHIDB_OK;
+    BTreePinnedTree **prev, *pt;
+
+    pthread_rwlock_wrlock(&bt->pin_latch);
+    for (prev = &bt->pinned; *prev != NULL && (*prev)->nroot != nroot; prev = &(*prev)->next)
+        ;
+    pt = *prev;
+    if (levels == 0) {
+        if (pt != NULL) {
+            *prev = pt->next;
+            pin_unmark(bt, pt->pages, pt->n_pages, NULL, 0);
+            pin_free(pt->root);
+            free(pt->pages);
+            free(pt);
+        }
+        pthread_rwlock_unlock(&bt->pin_latch);
+        return CHIDB_OK;
+    }
+
+    if (pt == NULL) {
+        if ((pt = calloc(1, sizeof(BTreePinnedTree))) == NULL) {
+            pthread_rwlock_unlock(&bt->pin_latch);
+            return CHIDB_ENOMEM;
+        }
+        pt->nroot = nroot;
+        pt->next = bt->pinned;
+        __atomic_store_n(&bt->pinned, pt, __ATOMIC_RELEASE);
+    }
+    pt->levels = levels;
+    pt->max_pages = max_pages;
+    ret = pin_build(bt, pt);
+    pthread_rwlock_unlock(&bt->pin_latch);
+
+    return ret;
+}
+
+
+/* Get the number of pinned nodes of a B-Tree
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ *
+ * Return
+ * - Number of nodes pinned by chidb_Btree_pinLevels (0 if the tree is
+ *   not pinned). If a pinned page has been written since they were
+ *   pinned, they are pinned again first.
+ */
+npage_t chidb_Btree_pinnedPages(BTree *bt, npage_t nroot)
+{
+    npage_t n = 0;
+    BTreePinnedTree *pt;
+
+    pthread_rwlock_wrlock(&bt->pin_latch);
+    if ((pt = pin_find(bt, nroot)) != NULL) {
+        if (pt->epoch != __atomic_load_n(&bt->pin_epoch, __ATOMIC_SEQ_CST)) {
+            pin_build(bt, pt);
+        }
+        n = pt->n_nodes;
+    }
+    pthread_rwlock_unlock(&bt->pin_latch);
+
+    return n;
+}
+
+
+/* Create a Bloom filter for a B-Tree
+ *
+ * Creates a Bloom filter with the keys currently in the B-Tree, and
+ * registers it in the metadata directory (which is created if the file
+ * does not have one yet), replacing any filter the tree already had (whose
+ * pages are reused or go to the freelist, see chidb_Btree_bloomRebuild). From
+ * then on, every key inserted into the tree is added to the filter, and
+ * chidb_Btree_find (and chidb_cursor_seek) use it to reject keys that are
+ * not in the tree without descending it. In an index B-Tree, the filter
+ * holds the index keys.
+ *
+ * The filter is sized for twice the number of keys in the tree (and at
+ * least BLOOM_MIN_KEYS), to leave room for the keys inserted afterwards.
+ * When it fills up, it can be resized with chidb_Btree_bloomRebuild.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - fp_rate: Desired false-positive rate (between 0 and 1, exclusive; any
+ *            other value selects BLOOM_DEFAULT_FP_RATE)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EFULLDB: The metadata directory has no room for another B-Tree
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_bloomCreate(BTree *bt, npage_t nroot, double fp_rate)
+{
+    int ret;
+    pthread_rwlock_wrlock(&bt->meta_latch);
+    ret = bloom_install(bt, nroot, chidb_Bloom_bitsPerKey(fp_rate));
+    pthread_rwlock_unlock(&bt->meta_latch);
+
+    return ret;
+}
+
+
+/* Rebuild the Bloom filter of a B-Tree
+ *
+ * Builds a new filter, with the same false-positive rate, from the keys
+ * currently in the B-Tree. This is done automatically after a bulk load
+ * (see chidb_Btree_insertBatch) but should also be done after large
+ * numbers of single insertions, since the false-positive rate grows as
+ * the filter fills up. The new filter is written over the old one if it
+ * fits in its pages; otherwise, it is written to new pages, and the old
+ * filter's pages go to the freelist (as they do in chidb_Btree_bloomCreate
+ * with a different false-positive rate).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The B-Tree does not have a Bloom filter
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_bloomRebuild(BTree *bt, npage_t nroot)
+{
+    int ret = CHIDB_ENOTFOUND;
+    pthread_rwlock_wrlock(&bt->meta_latch);
+    BloomFilter *bf = meta_bloom(bt, nroot);
+    if (bf != NULL) {
+        ret = bloom_install(bt, nroot, bf->bits_per_key);
+    }
+    pthread_rwlock_unlock(&bt->meta_latch);
+
+    return ret;
+}
+
+
+/* Check whether a key may be in a B-Tree
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - key: Key to check
+ *
+ * Return
+ * - false: The B-Tree's Bloom filter rules out the key
+ * - true: The key may be in the B-Tree (or the tree has no filter)
+ */
+bool chidb_Btree_bloomMayContain(BTree *bt, npage_t nroot, chidb_key_t key)
+{
+    // most files have no filters at all
+    if (__atomic_load_n(&bt->n_meta, __ATOMIC_ACQUIRE) == 0) {
+        return true;
+    }
+    pthread_rwlock_rdlock(&bt->meta_latch);
+    BloomFilter *bf = meta_bloom(bt, nroot);
+    bool may_contain = bf == NULL || chidb_Bloom_mayContain(bf, key);
+    pthread_rwlock_unlock(&bt->meta_latch);
+
+    return may_contain;
+}
+
+
+/* Analyze a B-Tree
+ *
+ * Walks the whole B-Tree and collects statistics on its shape and on how
+ * well its pages are used (see BTreeStats). The walk is depth-first, and
+ * only one page is loaded (and latched, in shared mode) at any time: the
+ * child pages of an internal node are copied before the node is released.
+ * So the walk needs memory proportional to the depth and fanout of the
+ * tree, not to its size, and every page is read exactly once.
+ *
+ * The latches make every page consistent, but the tree may change while
+ * it is being walked (pages split by a concurrent insertion may be
+ * counted twice or missed), so the statistics are only exact if nothing
+ * is inserted into the tree during the walk.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - stats: Out parameter. Statistics of the B-Tree.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The tree contains an invalid page number
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_analyze(BTree *bt, npage_t nroot, BTreeStats *stats)
+{
+    int ret;
+    memset(stats, 0, sizeof(BTreeStats));
+    stats->min_key = UINT32_MAX;
+    if ((ret = analyze_node(bt, nroot, 1, stats)) != CHIDB_OK) {
+        return ret;
+    }
+
+    if (stats->usable_bytes > 0) {
+        stats->fill_avg = (double) stats->used_bytes / stats->usable_bytes;
+    }
+    stats->fill_p10 = analyze_percentile(stats, 0.10);
+    stats->fill_p50 = analyze_percentile(stats, 0.50);
+    stats->fill_p90 = analyze_percentile(stats, 0.90);
+    if (stats->n_entries > 0 && stats->min_key <= stats->max_key) {
+        stats->key_density = (double) stats->n_entries /
+                ((double) stats->max_key - stats->min_key + 1);
+    } else {
+        stats->min_key = 0;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Estimate the number of entries in a range of keys
+ *
+ * Estimates how many entries of a B-Tree have keys between lo and hi
+ * (inclusive) without reading them. The tree is descended towards lo and
+ * towards hi; the entries in the pages on those two paths are counted
+ * exactly, and every subtree that hangs between the two paths lies entirely
+ * within the range. The size of a subtree is extrapolated from the average
+ * fanout and cell count of the nodes read at each level below it, so only
+ * 2 * depth pages are read.
+ *
+ * If n_samples > 0, that many of the subtrees within the range are picked
+ * at random, and a random path is followed from each one down to a leaf.
+ * This reads up to n_samples * depth more pages, and makes the averages
+ * (and the bounds) depend less on the nodes at the edges of the range.
+ *
+ * low and high are the estimates with the smallest and with the largest
+ * node seen at each level. They bound the true count as long as the nodes
+ * that were read are representative of the whole tree.
+ *
+ * Pages are latched one at a time, so the estimate is only approximate
+ * if the tree is modified at the same time.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree (a table or an
+ *          index B-Tree with integer keys)
+ * - lo: Smallest key of the range
+ * - hi: Largest key of the range
+ * - n_samples: Number of random paths to sample (0 for none)
+ * - est: Out parameter. The estimate (see BTreeRangeEstimate).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The B-Tree does not have integer keys
+ * - CHIDB_ECORRUPT: The B-Tree is deeper than BTREE_MAX_DEPTH
+ * - CHIDB_EPAGENO: The tree contains an invalid page number
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_estimateRange(BTree *bt, npage_t nroot, chidb_key_t lo, chidb_key_t hi, uint32_t n_samples, BTreeRangeEstimate *est)
+{
+    int ret = CHIDB_OK;
+    BTreeLevelSizes levels[BTREE_MAX_DEPTH];
+    npage_t path[2] = {nroot, nroot};  // nodes on the paths to lo and to hi
+    npage_t *samples = NULL;           // roots of the subtrees to sample
+    uint32_t *sample_levels = NULL;
+    uint64_t n_seen = 0;
+    uint64_t rnd = ((uint64_t) lo << 32 | hi) + 1;
+    uint32_t depth = 0;
+
+    memset(est, 0, sizeof(BTreeRangeEstimate));
+    memset(levels, 0, sizeof(levels));
+    if (lo > hi) {
+        return CHIDB_OK;
+    }
+    if (n_samples > 0) {
+        samples = malloc(n_samples * sizeof(npage_t));
+        sample_levels = malloc(n_samples * sizeof(uint32_t));
+        if (samples == NULL || sample_levels == NULL) {
+            free(samples);
+            free(sample_levels);
+            return CHIDB_ENOMEM;
+        }
+    }
+
+    while (ret == CHIDB_OK && (path[0] != 0 || path[1] != 0)) {
+        npage_t next[2] = {0, 0};
+        bool shared = path[0] == path[1];
+        if (depth == BTREE_MAX_DEPTH) {
+            ret = CHIDB_ECORRUPT;
+            break;
+        }
+        for (int side = 0; side < (shared ? 1 : 2) && ret == CHIDB_OK; side++) {
+            BTreeNode *btn;
+            if (path[side] == 0) {
+                continue;
+            }
+            if ((ret = estimate_read(bt, path[side], &levels[depth], est, &btn)) != CHIDB_OK) {
+                break;
+            }
+            if (depth == 0) {
+                est->type = btn->type;
+                if (btn->type == PGTYPE_VARINDEX_INTERNAL || btn->type == PGTYPE_VARINDEX_LEAF) {
+                    chidb_Btree_releaseNode(bt, btn);
+                    ret = CHIDB_EMISMATCH;
+                    break;
+                }
+            }
+
+            // the cells of internal table nodes are not entries
+            if (btn->type != PGTYPE_TABLE_INTERNAL) {
+                ncell_t first = search_keys(btn->keys, btn->n_cells, lo);
+                ncell_t last = hi == UINT32_MAX ? btn->n_cells : search_keys(btn->keys, btn->n_cells, hi + 1);
+                est->exact += last - first;
+            }
+
+            if (PGTYPE_IS_INTERNAL(btn->type)) {
+                ncell_t lo_idx = search_keys(btn->keys, btn->n_cells, lo);
+                ncell_t hi_idx = search_keys(btn->keys, btn->n_cells, hi);
+                // the children between the two paths are entirely in range
+                ncell_t from = side == 0 ? lo_idx + 1 : 0;
+                ncell_t to = side == 1 || shared ? hi_idx : btn->n_cells + 1;
+                estimate_cover(btn, from, to, &levels[depth + 1], samples, sample_levels,
+                               n_samples, depth + 1, &n_seen, &rnd);
+                if (side == 0) {
+                    next[0] = lo_idx < btn->n_cells ? btn->children[lo_idx] : btn->right_page;
+                }
+                if (side == 1 || shared) {
+                    next[1] = hi_idx < btn->n_cells ? btn->children[hi_idx] : btn->right_page;
+                }
+            }
+            chidb_Btree_releaseNode(bt, btn);
+        }
+        path[0] = next[0];
+        path[1] = next[1];
+        depth++;
+    }
+    est->depth = depth;
+
+    // follow a random path from each sampled subtree
+    for (uint64_t s = 0; s < n_seen && s < n_samples && ret == CHIDB_OK; s++) {
+        npage_t npage = samples[s];
+        for (uint32_t level = sample_levels[s]; npage != 0 && level < depth; level++) {
+            BTreeNode *btn;
+            if ((ret = estimate_read(bt, npage, &levels[level], est, &btn)) != CHIDB_OK) {
+                break;
+            }
+            npage = 0;
+            if (PGTYPE_IS_INTERNAL(btn->type)) {
+                ncell_t i = estimate_random(&rnd) % (btn->n_cells + 1);
+                npage = i < btn->n_cells ? btn->children[i] : btn->right_page;
+            }
+            chidb_Btree_releaseNode(bt, btn);
+        }
+    }
+    free(samples);
+    free(sample_levels);
+    if (ret != CHIDB_OK) {
+        return ret;
+    }
+
+    // size of a subtree rooted at each level, from the bottom up
+    bool is_index = est->type == PGTYPE_INDEX_INTERNAL || est->type == PGTYPE_INDEX_LEAF;
+    double size_avg = 0, size_min = 0, size_max = 0;
+    est->estimate = est->low = est->high = est->exact;
+    for (uint32_t level = depth; level-- > 1;) {
+        BTreeLevelSizes *lvl = &levels[level];
+        if (lvl->n_nodes == 0) {
+            continue;
+        }
+        if (level == depth - 1) {
+            size_avg = lvl->sum_cells / lvl->n_nodes;
+            size_min = lvl->min_cells;
+            size_max = lvl->max_cells;
+        } else {
+            size_avg = lvl->sum_children / lvl->n_nodes * size_avg + (is_index ? lvl->sum_cells / lvl->n_nodes : 0);
+            size_min = lvl->min_children * size_min + (is_index ? lvl->min_cells : 0);
+            size_max = lvl->max_children * size_max + (is_index ? lvl->max_cells : 0);
+        }
+        est->estimate += lvl->n_covered * size_avg;
+        est->low += lvl->n_covered * size_min;
+        est->high += lvl->n_covered * size_max;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Split a table B-Tree into ranges of keys
+ *
+ * Picks up to n - 1 keys that split the keys of the tree into up to n
+ * ranges of about the same size: range i holds the keys in
+ * (bounds[i - 1], bounds[i]], the first one starts at 0, and the last one
+ * ends at UINT32_MAX. The bounds are separator keys of the internal nodes,
+ * so every range is a set of whole subtrees. The tree is read one level
+ * at a time, starting at the root, until the levels read so far have at
+ * least 4 (n - 1) separator keys (or the next level is the leaves, which
+ * are never read), and the bounds are then spread evenly among those keys;
+ * having several keys to choose from for each bound keeps the ranges
+ * balanced even if the subtrees of the upper levels are not.
+ *
+ * Pages are latched one at a time, so the ranges are only balanced as of
+ * when they were read; they are still disjoint and cover every key if the
+ * tree is modified at the same time.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the table B-Tree
+ * - n: Number of ranges wanted (at least 1)
+ * - bounds: Out parameter. Room for n - 1 keys, which are returned in
+ *           increasing order.
+ * - n_bounds: Out parameter. Number of keys returned in bounds (so there
+ *             are n_bounds + 1 ranges). Fewer than n - 1 if the internal
+ *             nodes do not have that many keys.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The B-Tree is not a table B-Tree
+ * - CHIDB_EPAGENO: The tree contains an invalid page number
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_partition(BTree *bt, npage_t nroot, uint32_t n, chidb_key_t *bounds, uint32_t *n_bounds)
+{
+    int ret = CHIDB_OK;
+    npage_t *level = malloc(sizeof(npage_t));
+    uint32_t n_level = 1;
+    chidb_key_t *keys = NULL;
+    uint32_t n_keys = 0;
+
+    *n_bounds = 0;
+    if (level == NULL) {
+        return CHIDB_ENOMEM;
+    }
+    level[0] = nroot;
+    while (n_level > 0 && n_keys < 4 * (uint64_t) (n - 1) && ret == CHIDB_OK) {
+        npage_t *next = NULL;
+        uint32_t n_next = 0;
+        for (uint32_t i = 0; i < n_level; i++) {
+            BTreeNode *btn;
+            if ((ret = chidb_Pager_latch(bt->pager, level[i], false)) != CHIDB_OK) {
+                break;
+            }
+            if ((ret = chidb_Btree_getNodeByPage(bt, level[i], &btn)) != CHIDB_OK) {
+                chidb_Pager_unlatch(bt->pager, level[i]);
+                break;
+            }
+            // all the nodes of a level have the same type: if the first one
+            // is a leaf, so are the rest
+            if (btn->type == PGTYPE_TABLE_LEAF) {
+                chidb_Btree_releaseNode(bt, btn);
+                break;
+            }
+            if (btn->type != PGTYPE_TABLE_INTERNAL) {
+                chidb_Btree_releaseNode(bt, btn);
+                ret = CHIDB_EMISMATCH;
+                break;
+            }
+            if ((ret = chidb_Btree_decodeNode(btn)) != CHIDB_OK) {
+                chidb_Btree_releaseNode(bt, btn);
+                break;
+            }
+            chidb_key_t *more_keys = realloc(keys, (n_keys + btn->n_cells + 1) * sizeof(chidb_key_t));
+            npage_t *more_next = realloc(next, (n_next + btn->n_cells + 1) * sizeof(npage_t));
+            if (more_keys != NULL) {
+                keys = more_keys;
+            }
+            if (more_next != NULL) {
+                next = more_next;
+            }
+            if (more_keys == NULL || more_next == NULL) {
+                chidb_Btree_releaseNode(bt, btn);
+                ret = CHIDB_ENOMEM;
+                break;
+            }
+            memcpy(keys + n_keys, btn->keys, btn->n_cells * sizeof(chidb_key_t));
+            memcpy(next + n_next, btn->children, btn->n_cells * sizeof(npage_t));
+            n_keys += btn->n_cells;
+            n_next += btn->n_cells;
+            if (btn->right_page != 0) {
+                next[n_next++] = btn->right_page;
+            }
+            chidb_Btree_releaseNode(bt, btn);
+        }
+        free(level);
+        level = next;
+        n_level = ret == CHIDB_OK && n_next > 0 && n_keys > 0 ? n_next : 0;
+    }
+    free(level);
+
+    if (ret == CHIDB_OK && n_keys > 0) {
+        // the keys of lower levels fall between those of upper levels
+        qsort(keys, n_keys, sizeof(chidb_key_t), partition_key_cmp);
+        if (n_keys + 1 <= n) {
+            memcpy(bounds, keys, n_keys * sizeof(chidb_key_t));
+            *n_bounds = n_keys;
+        } else {
+            // the keys split the tree into n_keys + 1 subtrees, and bound i
+            // is the one closest to the first i / n of them
+            for (uint32_t i = 1; i < n; i++) {
+                bounds[i - 1] = keys[((uint64_t) i * (n_keys + 1) + n / 2) / n - 1];
+            }
+            *n_bounds = n - 1;
+        }
+    }
+    free(keys);
+
+    return ret;
+}
+
+
+/* Buffer the insertions into an index B-Tree
+ *
+ * Gives the index an insert buffer (see BTreeInsertBuffer) with room for
+ * capacity entries. From then on, chidb_Btree_insertInIndex adds entries
+ * to the buffer, and they are merged into the tree in key order when the
+ * buffer is full, when a cursor is positioned on the index, or when the
+ * file is closed. If the index already has a buffer, it is merged and
+ * resized.
+ *
+ * Duplicates are still reported by chidb_Btree_insertInIndex: a new key is
+ * looked up in the buffer and then in the tree, which only takes a read-only
+ * descent if the index's Bloom filter does not rule the key out.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the index B-Tree
+ * - capacity: Number of entries in the buffer (0 selects
+ *             DEFAULT_INSERT_BUFFER_SIZE)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The B-Tree is not an index B-Tree
+ * - CHIDB_EPAGENO: nroot is not a valid page number
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_bufferIndex(BTree *bt, npage_t nroot, uint32_t capacity)
+{
+    int ret;
+    BTreeNode *btn;
+    if (capacity == 0) {
+        capacity = DEFAULT_INSERT_BUFFER_SIZE;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, nroot, &btn)) != CHIDB_OK) {
+        return ret;
+    }
+    bool is_index = btn->type == PGTYPE_INDEX_INTERNAL || btn->type == PGTYPE_INDEX_LEAF;
+    chidb_Btree_freeMemNode(bt, btn);
+    if (!is_index) {
+        return CHIDB_EMISMATCH;
+    }
+
+    BTreeInsertBuffer *ibuf = ibuf_find(bt, nroot);
+    if (ibuf != NULL) {
+        pthread_mutex_lock(&ibuf->lock);
+        ret = ibuf_merge(bt, ibuf);
+        BTreeCell *cells = realloc(ibuf->cells, capacity * sizeof(BTreeCell));
+        if (cells == NULL) {
+            ret = CHIDB_ENOMEM;
+        } else {
+            ibuf->cells = cells;
+            ibuf->capacity = capacity;
+        }
+        pthread_mutex_unlock(&ibuf->lock);
+        return ret;
+    }
+
+    if ((ibuf = malloc(sizeof(BTreeInsertBuffer))) == NULL) {
+        return CHIDB_ENOMEM;
+    }
+    if ((ibuf->cells = malloc(capacity * sizeof(BTreeCell))) == NULL) {
+        free(ibuf);
+        return CHIDB_ENOMEM;
+    }
+    ibuf->nroot = nroot;
+    pthread_mutex_init(&ibuf->lock, NULL);
+    ibuf->n = 0;
+    ibuf->capacity = capacity;
+
+    pthread_rwlock_wrlock(&bt->meta_latch);
+    ibuf->next = bt->ibufs;
+    __atomic_store_n(&bt->ibufs, ibuf, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&bt->meta_latch);
+
+    return CHIDB_OK;
+}
+
+
+/* Merge the insert buffer of an index B-Tree into the tree
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the index B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (or the index has no insert buffer)
+ * - CHIDB_EDUPLICATE: The tree already had one of the buffered keys (it
+ *                     was inserted into without the buffer). The buffer
+ *                     is emptied anyway; see chidb_Btree_insertBatch for
+ *                     which entries made it into the tree.
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_flushIndexBuffer(BTree *bt, npage_t nroot)
+{
+    int ret = CHIDB_OK;
+    BTreeInsertBuffer *ibuf = ibuf_find(bt, nroot);
+    if (ibuf != NULL) {
+        pthread_mutex_lock(&ibuf->lock);
+        ret = ibuf_merge(bt, ibuf);
+        pthread_mutex_unlock(&ibuf->lock);
+    }
+
+    return ret;
+}
+
+
+/* Find an entry of an index B-Tree
+ *
+ * Looks the key up in the index's insert buffer (if it has one), and then
+ * in the tree itself, unless its Bloom filter rules the key out.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the index B-Tree
+ * - keyIdx: Key to look for
+ * - keyPk: Out parameter. Used to return the primary key of the entry.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The index has no entry with that key
+ * - CHIDB_EPAGENO: The tree contains an invalid page number
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_findIndexEntry(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t *keyPk)
+{
+    BTreeInsertBuffer *ibuf = ibuf_find(bt, nroot);
+    if (ibuf != NULL) {
+        bool found = false;
+        pthread_mutex_lock(&ibuf->lock);
+        uint32_t i = ibuf_search(ibuf, keyIdx);
+        if (i < ibuf->n && ibuf->cells[i].key == keyIdx) {
+            *keyPk = ibuf->cells[i].fields.indexLeaf.keyPk;
+            found = true;
+        }
+        pthread_mutex_unlock(&ibuf->lock);
+        if (found) {
+            return CHIDB_OK;
+        }
+    }
+    if (!chidb_Btree_bloomMayContain(bt, nroot, keyIdx)) {
+        return CHIDB_ENOTFOUND;
+    }
+
+    return index_find(bt, nroot, keyIdx, keyPk);
+}
+
+
+/* Compare two variable-length keys
+ *
+ * Keys are compared as strings of unsigned bytes; if one key is a prefix
+ * of the other one, the shorter key goes first. This is the order of the
+ * entries of variable-length key indexes, so keys must be encoded in a way
+ * that makes it the order they should be sorted in (see
+ * chidb_Btree_encodeTextKey).
+ *
+ * Parameters
+ * - key1, size1: First key and its size in bytes
+ * - key2, size2: Second key and its size in bytes
+ *
+ * Return
+ * - A negative number, zero or a positive number if key1 is, respectively,
+ *   smaller than, equal to or larger than key2.
+ */
+int chidb_Btree_varKeyCompare(const uint8_t *key1, uint16_t size1, const uint8_t *key2, uint16_t size2)
+{
+    int cmp = memcmp(key1, key2, size1 < size2 ? size1 : size2);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (int) size1 - (int) size2;
+}
+
+
+/* Largest key that can be inserted in a variable-length key index
+ *
+ * Cells are limited to a quarter of a page, so that every node can hold at
+ * least four cells, and both halves of a split node have room for one
+ * more cell (see chidb_Btree_insertInVarIndex). In covering indexes, the
+ * limit is on the size of the key and the data together.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - Maximum size of a key, in bytes
+ */
+uint16_t chidb_Btree_varKeyMaxSize(BTree *bt)
+{
+    return (bt->pager->page_size - HEADER_OFFSET - INTPG_CELLSOFFSET_OFFSET) / 4
+            - VARINDEXLEAFCELL_SIZE_WITHOUTKEY - 2;
+}
+
+
+/* Encode a TEXT value as a variable-length key
+ *
+ * The key is the text, a zero byte, and the primary key of the row in
+ * big-endian order. So keys sort like the texts (by bytes, with shorter
+ * texts first), rows with the same text sort by primary key, and keys are
+ * unique even if the texts are not. The first strlen(text) + 1 bytes of the
+ * key are a prefix shared by the keys of all the rows with that text, so
+ * they can be used to seek to the first one.
+ *
+ * Parameters
+ * - text: NUL-terminated text
+ * - keyPk: Primary key of the row
+ * - key: Out parameter. Buffer for the key, which must have room for at
+ *        least strlen(text) + 5 bytes.
+ *
+ * Return
+ * - Size of the key, in bytes
+ */
+uint16_t chidb_Btree_encodeTextKey(const char *text, chidb_key_t keyPk, uint8_t *key)
+{
+    size_t len = strlen(text);
+    memcpy(key, text, len);
+    key[len] = 0;
+    put4byte(key + len + 1, keyPk);
+
+    return len + 5;
+}
+
+
+/* Insert an entry into a variable-length key index
+ *
+ * Variable-length key indexes are B+-Trees: every entry is in a leaf, and
+ * the cells of internal nodes only guide the search. The child pointed to
+ * by an internal cell has the keys smaller than the cell's separator, and
+ * the right page has the rest. When a leaf is split, the separator that
+ * goes up is not the first key of the right half, but its shortest prefix
+ * that is still larger than the last key of the left half, so internal
+ * nodes hold as many children as possible even if keys are long.
+ *
+ * Nodes are split on the way down (like chidb_Btree_insert does), near
+ * the middle of their bytes rather than of their cells, and pages are
+ * latched in exclusive mode from the root down, releasing every parent
+ * once its child is known to have room for a new cell. Keys are limited
+ * to chidb_Btree_varKeyMaxSize bytes.
+ *
+ * This is a convenience function that wraps around
+ * chidb_Btree_insertInCoveringIndex, for entries with no data.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the index. It must have been
+ *          created with type PGTYPE_VARINDEX_LEAF.
+ * - key, size: Key and its size in bytes
+ * - keyPk: Primary key of the row
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ETOOBIG: The key is larger than chidb_Btree_varKeyMaxSize
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertInVarIndex(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, chidb_key_t keyPk)
+{
+    return chidb_Btree_insertInCoveringIndex(bt, nroot, key, size, keyPk, NULL, 0);
+}
+
+
+/* Insert an entry into a covering index
+ *
+ * A covering index is a variable-length key index whose leaf cells also
+ * hold some data: usually, a record with the columns of the row that are
+ * not part of the key (the INCLUDE columns of the index). A query that
+ * only needs the columns in the key and in the data can then be answered
+ * from the index alone, without looking up each entry in the table. The
+ * data is not used to order or find entries, and is not copied into
+ * internal nodes.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the index. It must have been
+ *          created with type PGTYPE_VARINDEX_LEAF.
+ * - key, size: Key and its size in bytes
+ * - keyPk: Primary key of the row
+ * - data, data_size: Data and its size in bytes (data may be NULL if
+ *                    data_size is zero)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ETOOBIG: The key and data are larger than chidb_Btree_varKeyMaxSize
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertInCoveringIndex(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, chidb_key_t keyPk, const uint8_t *data, uint16_t data_size)
+{
+    int ret;
+    BTreeNode *btn, *child_btn;
+    BTreeCell btc;
+    ncell_t ncell;
+    npage_t child_page;
+    bool equal;
+
+    if (size + data_size > chidb_Btree_varKeyMaxSize(bt)) {
+        return CHIDB_ETOOBIG;
+    }
+    btc.type = PGTYPE_VARINDEX_LEAF;
+    btc.key = varindex_prefix(key, size);
+    btc.fields.varIndex.child_page = 0;
+    btc.fields.varIndex.keyPk = keyPk;
+    btc.fields.varIndex.key_size = size;
+    btc.fields.varIndex.key_data = (uint8_t *) key;
+    btc.fields.varIndex.data_size = data_size;
+    btc.fields.varIndex.data = (uint8_t *) data;
+
+    if ((ret = chidb_Pager_latch(bt->pager, nroot, true)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, nroot, &btn)) != CHIDB_OK) {
+        chidb_Pager_unlatch(bt->pager, nroot);
+        return ret;
+    }
+    if (!varindex_has_room(bt, btn, &btc)) {
+        ret = varindex_split_root(bt, btn);
+        chidb_Btree_freeMemNode(bt, btn);
+        if (ret == CHIDB_OK) {
+            ret = chidb_Btree_getNodeByPage(bt, nroot, &btn);
+        }
+        if (ret != CHIDB_OK) {
+            chidb_Pager_unlatch(bt->pager, nroot);
+            return ret;
+        }
+    }
+
+    while (btn->type == PGTYPE_VARINDEX_INTERNAL) {
+        if ((ret = varindex_child(btn, key, size, &ncell, &child_page)) != CHIDB_OK) {
+            break;
+        }
+        if ((ret = chidb_Pager_latch(bt->pager, child_page, true)) != CHIDB_OK) {
+            break;
+        }
+        if ((ret = chidb_Btree_getNodeByPage(bt, child_page, &child_btn)) != CHIDB_OK) {
+            chidb_Pager_unlatch(bt->pager, child_page);
+            break;
+        }
+        if (!varindex_has_room(bt, child_btn, &btc)) {
+            // the parent has room for the separator, and both halves of
+            // the child have room for the new cell, so search the parent
+            // again and go down into the right half
+            ret = varindex_split(bt, btn, ncell, child_btn);
+            chidb_Btree_releaseNode(bt, child_btn);
+            if (ret != CHIDB_OK) {
+                break;
+            }
+            continue;
+        }
+        chidb_Btree_releaseNode(bt, btn);
+        btn = child_btn;
+    }
+
+    if (ret == CHIDB_OK) {
+        ret = varindex_search(btn, key, size, &ncell, &equal);
+    }
+    if (ret == CHIDB_OK && equal) {
+        ret = CHIDB_EDUPLICATE;
+    }
+    if (ret == CHIDB_OK) {
+        chidb_Btree_insertCell(btn, ncell, &btc);
+        ret = chidb_Btree_writeNode(bt, btn);
+    }
+    chidb_Btree_releaseNode(bt, btn);
+
+    return ret;
+}
+
+
+/* Find an entry in a variable-length key index
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the index
+ * - key, size: Key and its size in bytes
+ * - keyPk: Out parameter. Primary key of the entry with that key.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No entry with the given key
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_findInVarIndex(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, chidb_key_t *keyPk)
+{
+    int ret;
+    BTreeNode *leaf;
+    BTreeCell btc;
+    ncell_t ncell;
+
+    if ((ret = varindex_seek(bt, nroot, key, size, true, &leaf, &ncell)) != CHIDB_OK) {
+        return ret;
+    }
+    chidb_Btree_getCell(leaf, ncell, &btc);
+    if (chidb_Btree_varKeyCompare(btc.fields.varIndex.key_data, btc.fields.varIndex.key_size,
+            key, size) == 0) {
+        *keyPk = btc.fields.varIndex.keyPk;
+    } else {
+        ret = CHIDB_ENOTFOUND;
+    }
+    chidb_Btree_freeMemNode(bt, leaf);
+
+    return ret;
+}
+
+
+/* Position a cursor on a variable-length key index
+ *
+ * Positions the cursor on the first entry with a key larger than or equal
+ * to the given one. To visit all the entries whose keys start with some
+ * prefix, seek to the prefix and call chidb_Btree_nextVarIndex until a key
+ * does not start with it. The cursor holds a copy of its leaf and no
+ * latches, so it must be closed with chidb_Btree_closeVarIndex, but it does
+ * not block writers.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the index
+ * - key, size: Key to seek to and its size in bytes
+ * - cursor: Out parameter. The cursor.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: All the keys are smaller than the given one
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_seekVarIndex(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, BTreeVarIndexCursor *cursor)
+{
+    int ret;
+    cursor->nroot = nroot;
+    cursor->leaf = NULL;
+    cursor->ncell = 0;
+    if ((ret = varindex_seek(bt, nroot, key, size, true, &cursor->leaf, &cursor->ncell)) != CHIDB_OK) {
+        cursor->leaf = NULL;
+    }
+
+    return ret;
+}
+
+
+/* Move a cursor on a variable-length key index to the next entry
+ *
+ * Leaves are not linked to each other, so moving past the end of a leaf
+ * seeks again, from the root, to the first key larger than the last one
+ * in the leaf. Entries inserted by other threads may or may not be
+ * visited, but every entry that was in the index when the cursor was
+ * positioned and is still there is visited once, in order.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - cursor: Cursor positioned with chidb_Btree_seekVarIndex
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The cursor was on the last entry (or not positioned)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_nextVarIndex(BTree *bt, BTreeVarIndexCursor *cursor)
+{
+    int ret;
+    BTreeNode *leaf;
+    BTreeCell btc;
+    ncell_t ncell;
+
+    if (cursor->leaf == NULL) {
+        return CHIDB_ENOTFOUND;
+    }
+    if (cursor->ncell + 1 < cursor->leaf->n_cells) {
+        cursor->ncell++;
+        return CHIDB_OK;
+    }
+
+    chidb_Btree_getCell(cursor->leaf, cursor->leaf->n_cells - 1, &btc);
+    ret = varindex_seek(bt, cursor->nroot, btc.fields.varIndex.key_data,
+            btc.fields.varIndex.key_size, false, &leaf, &ncell);
+    chidb_Btree_freeMemNode(bt, cursor->leaf);
+    if (ret != CHIDB_OK) {
+        cursor->leaf = NULL;
+        return ret;
+    }
+    cursor->leaf = leaf;
+    cursor->ncell = ncell;
+
+    return CHIDB_OK;
+}
+
+
+/* Close a cursor on a variable-length key index
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - cursor: Cursor to close
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Btree_closeVarIndex(BTree *bt, BTreeVarIndexCursor *cursor)
+{
+    if (cursor->leaf != NULL) {
+        chidb_Btree_freeMemNode(bt, cursor->leaf);
+        cursor->leaf = NULL;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Returns a copy of the append cache entry for a B-Tree in ac. Returns
+ * false if there is no entry for the tree, or if it is stale. */
+bool append_cache_get(BTree *bt, npage_t nroot, BTreeAppendCache *ac)
+{
+    bool found = false;
+    pthread_mutex_lock(&bt->lock);
+    for (int i = 0; i < APPEND_CACHE_SIZE; i++) {
+        if (bt->append_cache[i].nroot == nroot) {
+            *ac = bt->append_cache[i];
+            found = ac->nleaf != 0 && ac->epoch == __atomic_load_n(&bt->free_epoch, __ATOMIC_SEQ_CST);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&bt->lock);
+
+    return found;
+}
+
+/* Records that key was appended to nleaf, if nleaf is still the cached
+ * rightmost leaf of the B-Tree */
+void append_cache_extend(BTree *bt, npage_t nroot, npage_t nleaf, chidb_key_t key)
+{
+    pthread_mutex_lock(&bt->lock);
+    for (int i = 0; i < APPEND_CACHE_SIZE; i++) {
+        BTreeAppendCache *ac = &bt->append_cache[i];
+        if (ac->nroot == nroot && ac->nleaf == nleaf && key > ac->max_key) {
+            ac->max_key = key;
+        }
+    }
+    pthread_mutex_unlock(&bt->lock);
+}
+
+/* Stores the rightmost leaf that an insertion has just reached in the
+ * append cache, replacing the oldest entry if the tree is not in the cache
+ * yet. leaf->epoch must have been read before the descent to the leaf. */
+void append_cache_set(BTree *bt, const BTreeAppendCache *leaf)
+{
+    pthread_mutex_lock(&bt->lock);
+    BTreeAppendCache *ac = NULL;
+    for (int i = 0; i < APPEND_CACHE_SIZE && ac == NULL; i++) {
+        if (bt->append_cache[i].nroot == leaf->nroot) {
+            ac = &bt->append_cache[i];
+        }
+    }
+    if (ac == NULL) {
+        ac = &bt->append_cache[bt->append_next];
+        bt->append_next = (bt->append_next + 1) % APPEND_CACHE_SIZE;
+    }
+    *ac = *leaf;
+    pthread_mutex_unlock(&bt->lock);
+}
+
+/* Marks as stale any append cache entry whose rightmost leaf is npage */
+void append_cache_invalidate(BTree *bt, npage_t npage)
+{
+    pthread_mutex_lock(&bt->lock);
+    for (int i = 0; i < APPEND_CACHE_SIZE; i++) {
+        if (bt->append_cache[i].nleaf == npage) {
+            bt->append_cache[i].nleaf = 0;
+        }
+    }
+    pthread_mutex_unlock(&bt->lock);
+}
+
+/* Checks that a cell can be appended to a (latched) leaf taken from the
+ * append cache: the leaf must still be a leaf of the right type, still be
+ * the rightmost one (if it is linked), have room for the cell, and every
+ * key in it must be smaller than the cell's key */
+bool append_leaf_fits(BTreeNode *btn, BTreeCell *btc)
+{
+    if (btn->type != btc->type || (btn->linked && btn->next_leaf != 0)) {
+        return false;
+    }
+    if (chidb_Btree_isFull(btn, btc)) {
+        return false;
+    }
+    if (btn->n_cells > 0) {
+        BTreeCell last_btc;
+        if (chidb_Btree_getCell(btn, btn->n_cells - 1, &last_btc) != CHIDB_OK
+                || last_btc.key >= btc->key) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Splits a full root node (see chidb_Btree_insert). Its cells are moved to
+ * two new nodes, and the root becomes an internal node pointing to them,
+ * so the page number of the root does not change. The caller must hold an
+ * exclusive latch on the root. */
+int split_root(BTree *bt, npage_t nroot, BTreeNode *btn, BTreeCell *btc, const BTreeSplitPolicy *policy)
+{
+    int ret;
+    BTreeCell root_btc;
+    ncell_t mid_cell = chidb_Btree_splitCell(btn, btc, true, policy);
+    // the root's cells are about to move to other pages
+    append_cache_invalidate(bt, nroot);
+    // write left child node
+    npage_t left_page;
+    BTreeNode *left_btn;
+    if ((ret = chidb_Btree_newNode(bt, &left_page, btn->type)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, left_page, &left_btn)) != CHIDB_OK) {
+        return ret;
+    }
+    npage_t right_page;
+    BTreeNode *right_btn;
+    if ((ret = chidb_Btree_newNode(bt, &right_page, btn->type)) != CHIDB_OK) {
+        chidb_Btree_freeMemNode(bt, left_btn);
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, right_page, &right_btn)) != CHIDB_OK) {
+        chidb_Btree_freeMemNode(bt, left_btn);
+        return ret;
+    }
+    // the first split of a table creates its first two linked leaves
+    if (btn->type == PGTYPE_TABLE_LEAF) {
+        chidb_Btree_linkLeaf(bt, left_btn, 0, right_page);
+        chidb_Btree_linkLeaf(bt, right_btn, left_page, 0);
+    }
+    // insert left cell
+    ncell_t left_cells = split_left_cells(btn, mid_cell, &left_btn->right_page);
+    for (ncell_t i = 0; i < left_cells && ret == CHIDB_OK; i++) {
+        if ((ret = chidb_Btree_getCell(btn, i, &root_btc)) == CHIDB_OK) {
+            ret = chidb_Btree_insertCell(left_btn, i, &root_btc);
+        }
+    }
+    if (ret == CHIDB_OK) {
+        ret = chidb_Btree_writeNode(bt, left_btn);
+    }
+    chidb_Btree_freeMemNode(bt, left_btn);
+
+    // write right child node
+    int j = 0;
+    for (ncell_t i = mid_cell + 1; i < btn->n_cells && ret == CHIDB_OK; i++) {
+        if ((ret = chidb_Btree_getCell(btn, i, &root_btc)) == CHIDB_OK) {
+            ret = chidb_Btree_insertCell(right_btn, j, &root_btc);
+        }
+        j++;
+    }
+    right_btn->right_page = btn->right_page;
+    if (ret == CHIDB_OK) {
+        ret = chidb_Btree_writeNode(bt, right_btn);
+    }
+    chidb_Btree_freeMemNode(bt, right_btn);
+    if (ret != CHIDB_OK) {
+        return ret;
+    }
+
+    // write root node
+    if ((ret = chidb_Btree_getCell(btn, mid_cell, &root_btc)) != CHIDB_OK) {
+        return ret;
+    }
+
+    uint8_t new_type = 0;
+    if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_TABLE_LEAF) {
+        new_type = PGTYPE_TABLE_INTERNAL;
+    } else if (btn->type == PGTYPE_INDEX_INTERNAL || btn->type == PGTYPE_INDEX_LEAF) {
+        new_type = PGTYPE_INDEX_INTERNAL;
+    }
+    if ((ret = chidb_Btree_initEmptyNode(bt, nroot, new_type)) != CHIDB_OK) {
+        return ret;
+    }
+    BTreeNode *root_btn;
+    if ((ret = chidb_Btree_getNodeByPage(bt, nroot, &root_btn)) != CHIDB_OK) {
+        return ret;
+    }
+    root_btc.type = new_type;
+    switch (new_type) {
+    case PGTYPE_TABLE_INTERNAL:
+        root_btc.fields.tableInternal.child_page = left_page;
+        break;
+    case PGTYPE_INDEX_INTERNAL:
+        root_btc.fields.indexInternal.child_page = left_page;
+        break;
+    }
+    if ((ret = chidb_Btree_insertCell(root_btn, 0, &root_btc)) == CHIDB_OK) {
+        root_btn->right_page = right_page;
+        ret = chidb_Btree_writeNode(bt, root_btn);
+    }
+    chidb_Btree_freeMemNode(bt, root_btn);
+
+    return ret;
+}
+
+/* Returns how many of the first cells of a node split at mid_cell go to
+ * the node on its left, and the right page of that node. In a table leaf,
+ * the middle cell is copied to the parent and also stays on the left. In
+ * any other node, it only goes up to the parent, and if the node is
+ * internal, the left node points to the middle cell's child on its right
+ * (otherwise, the keys under that child would not be reachable). */
+ncell_t split_left_cells(BTreeNode *btn, ncell_t mid_cell, npage_t *right_page)
+{
+    BTreeCell btc;
+
+    *right_page = 0;
+    switch (btn->type) {
+    case PGTYPE_TABLE_LEAF:
+        return mid_cell + 1;
+    case PGTYPE_TABLE_INTERNAL:
+        chidb_Btree_getCell(btn, mid_cell, &btc);
+        *right_page = btc.fields.tableInternal.child_page;
+        break;
+    case PGTYPE_INDEX_INTERNAL:
+        chidb_Btree_getCell(btn, mid_cell, &btc);
+        *right_page = btc.fields.indexInternal.child_page;
+        break;
+    }
+
+    return mid_cell;
+}
+
+/* Does one step of chidb_Btree_insertNonFull on node npage, which the
+ * caller has latched exclusively. If the node is a leaf, the cell is
+ * inserted into it and child_page is set to 0. Otherwise, the child where
+ * the cell belongs is latched exclusively (and split, if it is full) and
+ * returned in child_page; the caller must continue with it. rightmost
+ * says whether npage is on the right edge of the tree, and is updated to
+ * say whether the returned child is. If the cell is inserted into a leaf
+ * on the right edge, and ac is not NULL, the leaf and its largest key are
+ * stored in ac->nleaf and ac->max_key. On error, no child is left latched. */
+int insert_step(BTree *bt, npage_t npage, BTreeCell *btc, const BTreeSplitPolicy *policy, bool *rightmost, npage_t *child_page, BTreeAppendCache *ac)
+{
+    int ret;
+    BTreeNode *btn;
+    *child_page = 0;
+    if ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+        return ret;
+    }
+    ncell_t search_cell;
+    if ((ret = chidb_Btree_searchNode(btn, btc->key, &search_cell)) != CHIDB_OK) {
+        chidb_Btree_freeMemNode(bt, btn);
+        return ret;
+    }
+    // if cell in leaf node, insert directly
+    if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF) {
+        if (search_cell < btn->n_cells && btn->keys[search_cell] == btc->key) {
+            ret = CHIDB_EDUPLICATE;
+        } else if ((ret = chidb_Btree_insertCell(btn, search_cell, btc)) == CHIDB_OK) {
+            ret = chidb_Btree_writeNode(bt, btn);
+        }
+        BTreeCell last_btc;
+        if (ret == CHIDB_OK && *rightmost && ac != NULL
+                && chidb_Btree_getCell(btn, btn->n_cells - 1, &last_btc) == CHIDB_OK) {
+            ac->nleaf = npage;
+            ac->max_key = last_btc.key;
+        }
+        chidb_Btree_freeMemNode(bt, btn);
+        return ret;
+    }
+
+    // if cell in internal node
+    // 1. find child node, if no exist, create one
+    // 2. check child node is full, if so split it
+    // 3. insert cell to child node
+    ncell_t parent_cell = search_cell;
+    npage_t npage_child = btn->right_page;
+    if (parent_cell < btn->n_cells) {
+        if (btn->type == PGTYPE_INDEX_INTERNAL && btn->keys[parent_cell] == btc->key) {
+            chidb_Btree_freeMemNode(bt, btn);
+            return CHIDB_EDUPLICATE;
+        }
+        npage_child = btn->children[parent_cell];
+    }
+    *rightmost = *rightmost && parent_cell == btn->n_cells;
+
+    if (npage_child == 0) {
+        // create a child page; nobody can reach it before the parent is
+        // written, and the parent is latched
+        uint8_t child_type = 0;
+        if (btn->type == PGTYPE_TABLE_INTERNAL) {
+            child_type = PGTYPE_TABLE_LEAF;
+        } else if (btn->type == PGTYPE_INDEX_INTERNAL) {
+            child_type = PGTYPE_INDEX_LEAF;
+        }
+        if ((ret = chidb_Btree_newNode(bt, &npage_child, child_type)) != CHIDB_OK) {
+            chidb_Btree_freeMemNode(bt, btn);
+            return ret;
+        }
+        if (btn->n_cells != 0) {
+            btn->right_page = npage_child;
+        } else {
+            BTreeCell parent_btc;
+            parent_btc.type = btn->type;
+            parent_btc.key = btc->key;
+
+            switch (btn->type) {
+            case PGTYPE_TABLE_INTERNAL:
+                parent_btc.fields.tableInternal.child_page = npage_child;
+                break;
+            case PGTYPE_INDEX_INTERNAL:
+                parent_btc.fields.indexInternal.child_page = npage_child;
+                break;
+            }
+            ret = chidb_Btree_insertCell(btn, 0, &parent_btc);
+        }
+        if (ret == CHIDB_OK) {
+            ret = chidb_Btree_writeNode(bt, btn);
+        }
+        bool index = btn->type == PGTYPE_INDEX_INTERNAL;
+        chidb_Btree_freeMemNode(bt, btn);
+        if (ret != CHIDB_OK || index) {
+            return ret;
+        }
+        if ((ret = chidb_Pager_latch(bt->pager, npage_child, true)) == CHIDB_OK) {
+            *child_page = npage_child;
+        }
+        return ret;
+    }
+
+    chidb_Btree_freeMemNode(bt, btn);
+
+    BTreeNode *child_btn;
+    if ((ret = chidb_Pager_latch(bt->pager, npage_child, true)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, npage_child, &child_btn)) != CHIDB_OK) {
+        chidb_Pager_unlatch(bt->pager, npage_child);
+        return ret;
+    }
+    // split page
+    if (chidb_Btree_isFull(child_btn, btc)) {
+        if ((ret = split_child(bt, npage, parent_cell, child_btn, btc, policy, rightmost, &npage_child, NULL, NULL)) != CHIDB_OK) {
+            return ret;
+        }
+    } else {
+        chidb_Btree_freeMemNode(bt, child_btn);
+    }
+    *child_page = npage_child;
+
+    return CHIDB_OK;
+}
+
+/* Splits child_btn, the child of node npage at position parent_cell, which
+ * has no room for btc (see insert_step). Both nodes must be latched
+ * exclusively, and child_btn is freed. npage_child is set to the half
+ * where btc belongs, which is left latched (the other one is not), and
+ * rightmost is updated. If btc goes to the new node on the left and
+ * bounded is not NULL, bounded and bound are set to the bound that the
+ * cell moved up to the parent puts on the keys of that node (see
+ * chidb_Btree_findLeaf). On error, no child is left latched. */
+int split_child(BTree *bt, npage_t npage, ncell_t parent_cell, BTreeNode *child_btn, BTreeCell *btc, const BTreeSplitPolicy *policy, bool *rightmost, npage_t *npage_child, bool *bounded, chidb_key_t *bound)
+{
+    int ret;
+    npage_t npage_child2 = 0;
+    BTreeCell mid_btc;
+    ncell_t mid_cell = chidb_Btree_splitCell(child_btn, btc, *rightmost, policy);
+    ret = chidb_Btree_getCell(child_btn, mid_cell, &mid_btc);
+    chidb_Btree_freeMemNode(bt, child_btn);
+    if (ret == CHIDB_OK) {
+        ret = chidb_Btree_splitAt(bt, npage, *npage_child, parent_cell, mid_cell, &npage_child2);
+    }
+    if (ret != CHIDB_OK) {
+        chidb_Pager_unlatch(bt->pager, *npage_child);
+        return ret;
+    }
+    if ((mid_btc.type == PGTYPE_INDEX_INTERNAL || mid_btc.type == PGTYPE_INDEX_LEAF) && btc->key == mid_btc.key) {
+        // the cell that just moved up to the parent has this key
+        chidb_Pager_unlatch(bt->pager, *npage_child);
+        return CHIDB_EDUPLICATE;
+    }
+    if (btc->key <= mid_btc.key) {
+        // the new node (to the left) is latched before the old one is
+        // released, so crabbing order is preserved
+        chidb_Pager_latch(bt->pager, npage_child2, true);
+        chidb_Pager_unlatch(bt->pager, *npage_child);
+        *npage_child = npage_child2;
+        *rightmost = false;
+        if (bounded != NULL) {
+            *bounded = true;
+            *bound = mid_btc.key;
+        }
+    }
+
+    return CHIDB_OK;
+}
+
+/* Returns the number of bytes a cell takes in a node of the given type,
+ * not counting its entry in the cell offset array */
+uint16_t cell_size(uint8_t type, BTreeCell *btc)
+{
+    switch (type) {
+    case PGTYPE_TABLE_INTERNAL:
+        return TABLEINTCELL_SIZE;
+    case PGTYPE_TABLE_LEAF:
+        return TABLELEAFCELL_SIZE_WITHOUTDATA + btc->fields.tableLeaf.data_size;
+    case PGTYPE_INDEX_INTERNAL:
+        return INDEXINTCELL_SIZE;
+    case PGTYPE_INDEX_LEAF:
+        return INDEXLEAFCELL_SIZE;
+    case PGTYPE_VARINDEX_INTERNAL:
+    case PGTYPE_VARINDEX_LEAF:
+        return varindex_cell_size(btc);
+    }
+
+    return 0;
+}
+
+/* Orders pointers to BTreeCells by key (used by chidb_Btree_insertBatch) */
+int insert_batch_cmp(const void *a, const void *b)
+{
+    const BTreeCell *btc_a = *(const BTreeCell **) a;
+    const BTreeCell *btc_b = *(const BTreeCell **) b;
+    if (btc_a->key < btc_b->key) {
+        return -1;
+    } else if (btc_a->key > btc_b->key) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Descends from the root of a B-Tree to the leaf where btc belongs (see
+ * chidb_Btree_insertBatch). Nodes are latched exclusively, and full
+ * internal nodes are split on the way down, as in
+ * chidb_Btree_insertNonFull, so the leaf's parent is left with room for at
+ * least one more cell. The leaf and its parent are returned in bl, still
+ * latched. Returns CHIDB_ENOTFOUND, with nothing latched, if a node has no
+ * child for the key, and CHIDB_EDUPLICATE if the key is in an internal
+ * node of an index. */
+int batch_descend(BTree *bt, npage_t nroot, BTreeCell *btc, const BTreeSplitPolicy *policy, BTreeBatchLeaf *bl)
+{
+    int ret;
+    BTreeNode *btn, *child_btn;
+
+    bl->parent = NULL;
+    bl->parent_cell = 0;
+    bl->rightmost = true;
+    bl->bounded = false;
+    bl->bound = 0;
+    if ((ret = chidb_Pager_latch(bt->pager, nroot, true)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, nroot, &btn)) != CHIDB_OK) {
+        chidb_Pager_unlatch(bt->pager, nroot);
+        return ret;
+    }
+    // a root leaf is split by batch_fill
+    if (PGTYPE_IS_INTERNAL(btn->type) && chidb_Btree_isFull(btn, btc)) {
+        ret = split_root(bt, nroot, btn, btc, policy);
+        chidb_Btree_freeMemNode(bt, btn);
+        if (ret == CHIDB_OK) {
+            ret = chidb_Btree_getNodeByPage(bt, nroot, &btn);
+        }
+        if (ret != CHIDB_OK) {
+            chidb_Pager_unlatch(bt->pager, nroot);
+            return ret;
+        }
+    }
+
+    while (PGTYPE_IS_INTERNAL(btn->type)) {
+        npage_t npage = btn->page->npage;
+        ncell_t parent_cell;
+        if ((ret = chidb_Btree_searchNode(btn, btc->key, &parent_cell)) != CHIDB_OK) {
+            break;
+        }
+        npage_t npage_child = btn->right_page;
+        if (parent_cell < btn->n_cells) {
+            if (btn->type == PGTYPE_INDEX_INTERNAL && btn->keys[parent_cell] == btc->key) {
+                ret = CHIDB_EDUPLICATE;
+                break;
+            }
+            npage_child = btn->children[parent_cell];
+            bl->bounded = true;
+            bl->bound = btn->keys[parent_cell];
+        }
+        if (npage_child == 0) {
+            ret = CHIDB_ENOTFOUND;
+            break;
+        }
+        bl->rightmost = bl->rightmost && parent_cell == btn->n_cells;
+
+        if ((ret = chidb_Pager_latch(bt->pager, npage_child, true)) != CHIDB_OK) {
+            break;
+        }
+        if ((ret = chidb_Btree_getNodeByPage(bt, npage_child, &child_btn)) != CHIDB_OK) {
+            chidb_Pager_unlatch(bt->pager, npage_child);
+            break;
+        }
+        if (!PGTYPE_IS_INTERNAL(child_btn->type)) {
+            bl->leaf = child_btn;
+            bl->parent = btn;
+            bl->parent_cell = parent_cell;
+            return CHIDB_OK;
+        }
+        if (chidb_Btree_isFull(child_btn, btc)) {
+            ret = split_child(bt, npage, parent_cell, child_btn, btc, policy, &bl->rightmost, &npage_child, &bl->bounded, &bl->bound);
+            if (ret == CHIDB_OK && (ret = chidb_Btree_getNodeByPage(bt, npage_child, &child_btn)) != CHIDB_OK) {
+                chidb_Pager_unlatch(bt->pager, npage_child);
+            }
+            if (ret != CHIDB_OK) {
+                break;
+            }
+        }
+        chidb_Btree_releaseNode(bt, btn);
+        btn = child_btn;
+    }
+    if (ret == CHIDB_OK) {
+        // the root is a leaf
+        bl->leaf = btn;
+        return CHIDB_OK;
+    }
+    chidb_Btree_releaseNode(bt, btn);
+
+    return ret;
+}
+
+/* Merges the cells of a leaf (old, sorted by key) with a run of a batch
+ * into merged, for a leaf of the given type. Returns the number of bytes
+ * the merged cells take, including their offsets. */
+uint32_t batch_merge(uint8_t type, BTreeCell *old, ncell_t n_old, BTreeCell **cells, uint32_t n, BTreeCell *merged)
+{
+    uint32_t i = 0, j = 0, bytes = 0;
+    while (i < n_old || j < n) {
+        BTreeCell *btc;
+        if (j == n || (i < n_old && old[i].key < cells[j]->key)) {
+            btc = &old[i++];
+        } else {
+            btc = cells[j++];
+        }
+        merged[i + j - 1] = *btc;
+        bytes += cell_size(type, btc) + 2;
+    }
+
+    return bytes;
+}
+
+/* Cuts the merged cells of an append into leaves the way inserting them
+ * one by one would: a leaf is filled until the next cell does not fit in
+ * it, and is then split where chidb_Btree_splitCell would split it for
+ * that cell, so it keeps the fill factor's share of its cells. The last
+ * leaf takes whatever is left. At most max_leaves leaves are filled, and
+ * the last of them takes at least the first min_cells cells (those of the
+ * leaf being filled), so the cells after it may be left over. In an index,
+ * the cell that follows each leaf but the last goes up to the parent.
+ * Returns the number of leaves, and the end of each one (one past its last
+ * cell) in ends; the end of the last one is the number of cells taken. */
+uint32_t batch_split_appends(uint8_t type, BTreeCell *cells, uint32_t n, uint32_t min_cells, uint16_t capacity, const BTreeSplitPolicy *policy, uint32_t max_leaves, uint32_t *ends)
+{
+    bool index = type == PGTYPE_INDEX_LEAF;
+    uint32_t i = 0, k = 0;
+    while (i < n && k < max_leaves) {
+        uint32_t start = i, full = 0, bytes = 0;
+        while (start + full < n && (full == 0 || bytes + cell_size(type, &cells[start + full]) + 2 <= capacity)) {
+            bytes += cell_size(type, &cells[start + full]) + 2;
+            full++;
+        }
+        if (start + full == n) {
+            ends[k++] = n;
+            break;
+        }
+
+        uint32_t mid;
+        if (full < 3) {
+            mid = (full - 1) / 2;
+        } else {
+            uint32_t fill = full >= 4 ? policy->fill_factor : 50;
+            if (policy->by_bytes) {
+                uint32_t acc = 0;
+                int64_t target = (int64_t) (bytes + cell_size(type, &cells[start + full]) + 2) * fill, best = INT64_MAX;
+                mid = 0;
+                for (uint32_t c = 0; c < full - 1; c++) {
+                    acc += cell_size(type, &cells[start + c]) + 2;
+                    int64_t dist = llabs((int64_t) acc * 100 - target);
+                    if (dist < best) {
+                        best = dist;
+                        mid = c;
+                    }
+                    if ((int64_t) acc * 100 >= target) {
+                        break;
+                    }
+                }
+            } else {
+                mid = (full * fill + 99) / 100 - 1;
+            }
+            if (mid < 1) {
+                mid = 1;
+            } else if (mid > full - 2) {
+                mid = full - 2;
+            }
+        }
+        // a table leaf keeps the middle cell, an index leaf moves it up
+        uint32_t end = start + (index ? mid : mid + 1);
+        if (end == start) {
+            end++;
+        }
+        if (k + 1 == max_leaves && end < min_cells) {
+            end = min_cells;
+        }
+        ends[k++] = end;
+        i = index ? end + 1 : end;
+    }
+
+    return k;
+}
+
+/* Cuts merged cells into as few leaves as they fit in (but at least
+ * min_leaves), with about the same number of bytes in each one. Returns
+ * the number of leaves, and their ends as in batch_split_appends. */
+uint32_t batch_split_even(uint8_t type, BTreeCell *cells, uint32_t n, uint32_t bytes, uint16_t capacity, uint32_t min_leaves, uint32_t *ends)
+{
+    bool index = type == PGTYPE_INDEX_LEAF;
+    uint32_t leaves = (bytes + capacity - 1) / capacity;
+    if (leaves < min_leaves) {
+        leaves = min_leaves;
+    }
+    while (1) {
+        uint32_t target = (bytes + leaves - 1) / leaves, i = 0, k = 0;
+        while (i < n) {
+            uint32_t start = i, acc = 0;
+            while (i < n) {
+                uint32_t size = cell_size(type, &cells[i]) + 2;
+                if (i > start && (acc + size > capacity || acc + size > target)) {
+                    break;
+                }
+                acc += size;
+                i++;
+            }
+            // in an index, the last cell cannot be left alone after a
+            // separator: it joins this leaf, or takes the leaf's last cell
+            // as its separator
+            if (index && i == n - 1) {
+                if (acc + cell_size(type, &cells[i]) + 2 <= capacity) {
+                    i++;
+                } else if (i - start > 1) {
+                    i--;
+                }
+            }
+            ends[k++] = i;
+            if (index && i < n) {
+                i++;
+            }
+        }
+        if (k <= leaves) {
+            return k;
+        }
+        leaves++;
+    }
+}
+
+/* Inserts a run of sorted cells into the leaf in bl (see
+ * chidb_Btree_insertBatch). If the run does not fit in the leaf, the
+ * leaf's cells and the run are cut into leaves (filled to the fill factor
+ * if the run is an append, or evenly otherwise), which are written to the
+ * leaf's page and to new pages, and then a separator for each new page is
+ * added to the parent. If the leaf is the root, every leaf goes to a new
+ * page and the root becomes their parent. Only as many cells are taken as
+ * the parent has room for the separators of their leaves: n_done says how
+ * many. The run ends before a key that is in the leaf or in the run
+ * already, and CHIDB_EDUPLICATE is returned once the cells before it are
+ * in. If the last leaf is on the right edge of the tree, it and its
+ * largest key are stored in ac->nleaf and ac->max_key. */
+int batch_fill(BTree *bt, npage_t nroot, BTreeBatchLeaf *bl, BTreeCell **cells, uint32_t n, const BTreeSplitPolicy *policy, uint32_t *n_done, BTreeAppendCache *ac)
+{
+    int ret = CHIDB_OK;
+    BTreeNode *leaf = bl->leaf, *btn;
+    uint8_t type = leaf->type;
+    ncell_t n_old = leaf->n_cells;
+    BTreeCell *old, *merged, sep;
+    uint32_t *ends = NULL;
+    npage_t *pages = NULL;
+    *n_done = 0;
+
+    // no more cells than max_leaves leaves could ever hold are looked at
+    uint16_t page_size = bt->pager->page_size;
+    bool linked = bl->parent != NULL ? leaf->linked : type == PGTYPE_TABLE_LEAF;
+    uint16_t capacity = page_size - LEAFPG_CELLSOFFSET_OFFSET - (linked ? LEAFPG_LINKS_SIZE : 0);
+    sep.type = type == PGTYPE_TABLE_LEAF ? PGTYPE_TABLE_INTERNAL : PGTYPE_INDEX_INTERNAL;
+    uint32_t max_leaves, sep_size = cell_size(sep.type, &sep) + 2;
+    if (bl->parent != NULL) {
+        max_leaves = (bl->parent->cells_offset - bl->parent->free_offset) / sep_size + 1;
+    } else {
+        max_leaves = (page_size - (nroot == 1 ? HEADER_OFFSET : 0) - INTPG_CELLSOFFSET_OFFSET) / sep_size + 1;
+    }
+    BTreeCell empty;
+    empty.fields.tableLeaf.data_size = 0;
+    uint32_t most = max_leaves * (capacity / (cell_size(type, &empty) + 2) + 1);
+    if (n > most) {
+        n = most;
+    }
+
+    if ((old = malloc((2 * (uint32_t) n_old + n) * sizeof(BTreeCell))) == NULL) {
+        return CHIDB_ENOMEM;
+    }
+    merged = old + n_old;
+    for (ncell_t i = 0; i < n_old && ret == CHIDB_OK; i++) {
+        ret = chidb_Btree_getCell(leaf, i, &old[i]);
+    }
+
+    // cut the run before the first duplicate
+    uint32_t bytes = 0;
+    bool dup = false;
+    ncell_t pos = 0;
+    for (uint32_t j = 0; j < n && ret == CHIDB_OK; j++) {
+        while (pos < n_old && old[pos].key < cells[j]->key) {
+            pos++;
+        }
+        if ((pos < n_old && old[pos].key == cells[j]->key) || (j > 0 && cells[j - 1]->key == cells[j]->key)) {
+            n = j;
+            dup = true;
+            break;
+        }
+        bytes += cell_size(type, cells[j]) + 2;
+    }
+    if (ret != CHIDB_OK || n == 0) {
+        free(old);
+        return ret != CHIDB_OK ? ret : CHIDB_EDUPLICATE;
+    }
+
+    // if the run fits in the leaf, it goes in as it is
+    if (bytes <= leaf->cells_offset - leaf->free_offset) {
+        chidb_key_t max_key = cells[n - 1]->key;
+        if (n_old > 0 && old[n_old - 1].key > max_key) {
+            max_key = old[n_old - 1].key;
+        }
+        pos = 0;
+        for (uint32_t j = 0; j < n && ret == CHIDB_OK; j++) {
+            while (pos < n_old && old[pos].key < cells[j]->key) {
+                pos++;
+            }
+            ret = chidb_Btree_insertCell(leaf, pos + j, cells[j]);
+        }
+        if (ret == CHIDB_OK) {
+            ret = chidb_Btree_writeNode(bt, leaf);
+        }
+        if (ret == CHIDB_OK) {
+            *n_done = n;
+            if (bl->rightmost && ac != NULL) {
+                ac->nleaf = leaf->page->npage;
+                ac->max_key = max_key;
+            }
+        }
+        free(old);
+        return ret == CHIDB_OK && dup ? CHIDB_EDUPLICATE : ret;
+    }
+
+    // otherwise, cut it into leaves, as many as the parent has room for
+    uint32_t k, taken = n, total;
+    if ((ends = malloc(((uint32_t) n_old + n) * sizeof(uint32_t))) == NULL) {
+        free(old);
+        return CHIDB_ENOMEM;
+    }
+    bool append = bl->rightmost && (n_old == 0 || cells[0]->key > old[n_old - 1].key);
+    uint32_t min_leaves = bl->parent != NULL ? 1 : 2;
+    total = batch_merge(type, old, n_old, cells, n, merged);
+    if (append) {
+        k = batch_split_appends(type, merged, n_old + n, n_old, capacity, policy, max_leaves, ends);
+        if (k < min_leaves) {
+            k = batch_split_even(type, merged, n_old + n, total, capacity, min_leaves, ends);
+        }
+        taken = ends[k - 1] - n_old;
+    } else {
+        k = batch_split_even(type, merged, n_old + n, total, capacity, min_leaves, ends);
+        if (k > max_leaves) {
+            uint32_t lo = 0, hi = n;
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo + 1) / 2;
+                total = batch_merge(type, old, n_old, cells, mid, merged);
+                if (batch_split_even(type, merged, n_old + mid, total, capacity, min_leaves, ends) <= max_leaves) {
+                    lo = mid;
+                } else {
+                    hi = mid - 1;
+                }
+            }
+            taken = lo;
+            total = batch_merge(type, old, n_old, cells, taken, merged);
+            k = batch_split_even(type, merged, n_old + taken, total, capacity, min_leaves, ends);
+        }
+    }
+
+    // an append keeps the first leaf on the leaf's page, and anything else
+    // the last one (so the leaf before it only needs a new link), unless
+    // the leaf is the root
+    uint32_t keep = k;
+    if (bl->parent != NULL) {
+        keep = append ? 0 : k - 1;
+    }
+    if ((pages = malloc(k * sizeof(npage_t))) == NULL) {
+        ret = CHIDB_ENOMEM;
+    }
+    for (uint32_t j = 0; j < k && ret == CHIDB_OK; j++) {
+        if (j == keep) {
+            pages[j] = leaf->page->npage;
+        } else {
+            ret = node_alloc(bt, &pages[j]);
+        }
+    }
+    append_cache_invalidate(bt, leaf->page->npage);
+
+    // the leaf's own page is the only one anybody can reach yet, so it is
+    // written last; each leaf is laid out in memory and written once
+    bool index = type == PGTYPE_INDEX_LEAF;
+    for (uint32_t c = 0; c < k && ret == CHIDB_OK; c++) {
+        uint32_t j = keep == 0 ? (c + 1) % k : c;
+        uint32_t from = j == 0 ? 0 : (index ? ends[j - 1] + 1 : ends[j - 1]);
+        if ((ret = chidb_Btree_getNodeByPage(bt, pages[j], &btn)) != CHIDB_OK) {
+            break;
+        }
+        node_init(bt, btn->page, type);
+        node_read_header(bt, btn);
+        if (linked) {
+            chidb_Btree_linkLeaf(bt, btn, j > 0 ? pages[j - 1] : leaf->prev_leaf, j < k - 1 ? pages[j + 1] : leaf->next_leaf);
+        }
+        for (uint32_t i = from; i < ends[j] && ret == CHIDB_OK; i++) {
+            ret = chidb_Btree_insertCell(btn, i - from, &merged[i]);
+        }
+        if (ret == CHIDB_OK) {
+            ret = chidb_Btree_writeNode(bt, btn);
+        }
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+
+    // the leaves that now come before the leaf follow the one before it
+    if (ret == CHIDB_OK && linked && keep == k - 1 && k > 1 && leaf->prev_leaf != 0) {
+        if ((ret = chidb_Pager_latch(bt->pager, leaf->prev_leaf, true)) == CHIDB_OK) {
+            if ((ret = chidb_Btree_getNodeByPage(bt, leaf->prev_leaf, &btn)) == CHIDB_OK) {
+                btn->next_leaf = pages[0];
+                ret = chidb_Btree_writeNode(bt, btn);
+                chidb_Btree_freeMemNode(bt, btn);
+            }
+            chidb_Pager_unlatch(bt->pager, leaf->prev_leaf);
+        }
+    }
+
+    // add the separators to the parent, or turn the root into it
+    BTreeNode *parent = bl->parent;
+    ncell_t at = bl->parent_cell;
+    if (ret == CHIDB_OK && parent == NULL) {
+        if ((ret = chidb_Btree_getNodeByPage(bt, nroot, &parent)) == CHIDB_OK) {
+            node_init(bt, parent->page, sep.type);
+            node_read_header(bt, parent);
+            at = 0;
+        }
+    }
+    for (uint32_t j = 0; j + 1 < k && ret == CHIDB_OK; j++) {
+        BTreeCell *last = index ? &merged[ends[j]] : &merged[ends[j] - 1];
+        sep.key = last->key;
+        if (index) {
+            sep.fields.indexInternal.keyPk = last->fields.indexLeaf.keyPk;
+            sep.fields.indexInternal.child_page = pages[j];
+        } else {
+            sep.fields.tableInternal.child_page = pages[j];
+        }
+        ret = chidb_Btree_insertCell(parent, at + j, &sep);
+    }
+    if (ret == CHIDB_OK) {
+        if (keep != k - 1) {
+            parent->right_page = pages[k - 1];
+        }
+        ret = chidb_Btree_writeNode(bt, parent);
+    }
+    if (parent != NULL && bl->parent == NULL) {
+        chidb_Btree_freeMemNode(bt, parent);
+    }
+
+    if (ret == CHIDB_OK) {
+        *n_done = taken;
+        if (bl->rightmost && ac != NULL) {
+            ac->nleaf = pages[k - 1];
+            ac->max_key = merged[ends[k - 1] - 1].key;
+        }
+        if (dup && taken == n) {
+            ret = CHIDB_EDUPLICATE;
+        }
+    }
+    free(pages);
+    free(ends);
+    free(old);
+
+    return ret;
+}
+
+/* Returns the number of keys in a sorted, decoded keys array that are
+ * smaller than key. The range is narrowed down with a binary search, and
+ * the last few vectors are compared all at once with SIMD instructions
+ * (when available). Since SSE and AVX2 only have signed comparisons, both
+ * sides are biased by 0x80000000 first. */
+ncell_t search_keys(const chidb_key_t *keys, ncell_t n, chidb_key_t key)
+{
+    ncell_t lo = 0, hi = n;
+    while (hi - lo > 64) {
+        ncell_t mid = lo + (hi - lo) / 2;
+        if (keys[mid] < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+#if defined(__AVX2__)
+    __m256i bias = _mm256_set1_epi32((int) 0x80000000);
+    __m256i vkey = _mm256_xor_si256(_mm256_set1_epi32((int) key), bias);
+    ncell_t i = lo & ~7;
+    while (1) {
+        __m256i vkeys = _mm256_load_si256((const __m256i *) (keys + i));
+        __m256i lt = _mm256_cmpgt_epi32(vkey, _mm256_xor_si256(vkeys, bias));
+        unsigned int mask = _mm256_movemask_ps(_mm256_castsi256_ps(lt));
+        if (mask != 0xff) {
+            i += __builtin_ctz(~mask);
+            break;
+        }
+        i += 8;
+    }
+#elif defined(__SSE2__)
+    __m128i bias = _mm_set1_epi32((int) 0x80000000);
+    __m128i vkey = _mm_xor_si128(_mm_set1_epi32((int) key), bias);
+    ncell_t i = lo & ~3;
+    while (1) {
+        __m128i vkeys = _mm_load_si128((const __m128i *) (keys + i));
+        __m128i lt = _mm_cmpgt_epi32(vkey, _mm_xor_si128(vkeys, bias));
+        unsigned int mask = _mm_movemask_ps(_mm_castsi128_ps(lt));
+        if (mask != 0xf) {
+            i += __builtin_ctz(~mask);
+            break;
+        }
+        i += 4;
+    }
+#else
+    ncell_t i = lo;
+    while (i < hi && keys[i] < key) {
+        i++;
+    }
+#endif
+
+    return i > n ? n : i;
+}
+
+/* Loads the metadata directory (if the file has one) and the Bloom
+ * filters listed in it */
+int meta_load(BTree *bt)
+{
+    int ret;
+    MemPage *page;
+    uint16_t page_size = bt->pager->page_size;
+    if (bt->meta_page == 0) {
+        return CHIDB_OK;
+    }
+    if ((ret = chidb_Pager_readPage(bt->pager, bt->meta_page, &page)) != CHIDB_OK) {
+        return ret == CHIDB_EPAGENO ? CHIDB_ECORRUPTHEADER : ret;
+    }
+    uint16_t n_meta = get2byte(&page->data[METAPG_NENTRIES_OFFSET]);
+    if (METAPG_ENTRIES_OFFSET + n_meta * METAENTRY_SIZE > page_size) {
+        chidb_Pager_releaseMemPage(bt->pager, page);
+        return CHIDB_ECORRUPTHEADER;
+    }
+    if ((bt->meta = calloc(n_meta, sizeof(BTreeMeta))) == NULL) {
+        chidb_Pager_releaseMemPage(bt->pager, page);
+        return CHIDB_ENOMEM;
+    }
+
+    ret = CHIDB_OK;
+    for (uint16_t i = 0; i < n_meta && ret == CHIDB_OK; i++) {
+        uint8_t *entry = &page->data[METAPG_ENTRIES_OFFSET + i * METAENTRY_SIZE];
+        BTreeMeta *meta = &bt->meta[i];
+        meta->nroot = get4byte(&entry[METAENTRY_NROOT_OFFSET]);
+        meta->bloom = NULL;
+        meta->split.fill_factor = entry[METAENTRY_FILLFACTOR_OFFSET];
+        if (meta->split.fill_factor == 0) {
+            meta->split.fill_factor = DEFAULT_FILL_FACTOR;
+        }
+        meta->split.by_bytes = entry[METAENTRY_SPLITFLAGS_OFFSET] & METAFLAG_SPLIT_BY_BYTES;
+        bt->n_meta++;
+
+        npage_t bloom_page = get4byte(&entry[METAENTRY_BLOOMPG_OFFSET]);
+        if (bloom_page == 0) {
+            continue;
+        }
+        npage_t npages = get4byte(&entry[METAENTRY_BLOOMNPAGES_OFFSET]);
+        if ((ret = chidb_Bloom_create(&meta->bloom, bloom_page, npages, page_size,
+                entry[METAENTRY_BLOOMBPK_OFFSET])) != CHIDB_OK) {
+            break;
+        }
+        meta->bloom->n_keys = get4byte(&entry[METAENTRY_BLOOMNKEYS_OFFSET]);
+        for (npage_t j = 0; j < npages && ret == CHIDB_OK; j++) {
+            MemPage *bloom_mem_page;
+            if ((ret = chidb_Pager_readPage(bt->pager, bloom_page + j, &bloom_mem_page)) == CHIDB_OK) {
+                memcpy(meta->bloom->bits + j * page_size, bloom_mem_page->data, page_size);
+                chidb_Pager_releaseMemPage(bt->pager, bloom_mem_page);
+            }
+        }
+    }
+    chidb_Pager_releaseMemPage(bt->pager, page);
+
+    return ret;
+}
+
+/* Writes the metadata directory, allocating its page (and pointing the
+ * file header to it) the first time. The caller must hold the meta latch. */
+int meta_write(BTree *bt)
+{
+    int ret;
+    uint16_t page_size = bt->pager->page_size;
+    if (METAPG_ENTRIES_OFFSET + bt->n_meta * METAENTRY_SIZE > page_size) {
+        return CHIDB_EFULLDB;
+    }
+
+    if (bt->meta_page == 0) {
+        MemPage *header;
+        if ((ret = chidb_Pager_allocatePage(bt->pager, &bt->meta_page)) != CHIDB_OK) {
+            return ret;
+        }
+        // page 1 is also the root of the schema table, which may be in use
+        chidb_Pager_latch(bt->pager, 1, true);
+        if ((ret = chidb_Pager_readPage(bt->pager, 1, &header)) == CHIDB_OK) {
+            put4byte(&header->data[META_PAGE_OFFSET], bt->meta_page);
+            ret = chidb_Pager_writePage(bt->pager, header);
+            chidb_Pager_releaseMemPage(bt->pager, header);
+        }
+        chidb_Pager_unlatch(bt->pager, 1);
+        if (ret != CHIDB_OK) {
+            return ret;
+        }
+    }
+
+    MemPage page;
+    page.npage = bt->meta_page;
+    if ((page.data = calloc(1, page_size)) == NULL) {
+        return CHIDB_ENOMEM;
+    }
+    put2byte(&page.data[METAPG_NENTRIES_OFFSET], bt->n_meta);
+    for (uint16_t i = 0; i < bt->n_meta; i++) {
+        uint8_t *entry = &page.data[METAPG_ENTRIES_OFFSET + i * METAENTRY_SIZE];
+        BloomFilter *bf = bt->meta[i].bloom;
+        put4byte(&entry[METAENTRY_NROOT_OFFSET], bt->meta[i].nroot);
+        entry[METAENTRY_FILLFACTOR_OFFSET] = bt->meta[i].split.fill_factor;
+        entry[METAENTRY_SPLITFLAGS_OFFSET] = bt->meta[i].split.by_bytes ? METAFLAG_SPLIT_BY_BYTES : 0;
+        if (bf != NULL) {
+            put4byte(&entry[METAENTRY_BLOOMPG_OFFSET], bf->first_page);
+            put4byte(&entry[METAENTRY_BLOOMNPAGES_OFFSET], bf->npages);
+            put4byte(&entry[METAENTRY_BLOOMNKEYS_OFFSET], __atomic_load_n(&bf->n_keys, __ATOMIC_RELAXED));
+            entry[METAENTRY_BLOOMBPK_OFFSET] = bf->bits_per_key;
+        }
+    }
+    chidb_Pager_latch(bt->pager, bt->meta_page, true);
+    ret = chidb_Pager_writePage(bt->pager, &page);
+    chidb_Pager_unlatch(bt->pager, bt->meta_page);
+    free(page.data);
+
+    return ret;
+}
+
+/* Returns the Bloom filter of a B-Tree, or NULL if it has none. The caller
+ * must hold the meta latch. */
+BloomFilter *meta_bloom(BTree *bt, npage_t nroot)
+{
+    for (uint16_t i = 0; i < bt->n_meta; i++) {
+        if (bt->meta[i].nroot == nroot) {
+            return bt->meta[i].bloom;
+        }
+    }
+
+    return NULL;
+}
+
+/* Finds the entry of a B-Tree in the metadata directory, adding one (with
+ * no Bloom filter and the default split policy) if it has none. The entry
+ * is not written. The caller must hold the meta latch in exclusive mode. */
+int meta_entry(BTree *bt, npage_t nroot, BTreeMeta **meta)
+{
+    for (uint16_t i = 0; i < bt->n_meta; i++) {
+        if (bt->meta[i].nroot == nroot) {
+            *meta = &bt->meta[i];
+            return CHIDB_OK;
+        }
+    }
+    BTreeMeta *entries = realloc(bt->meta, (bt->n_meta + 1) * sizeof(BTreeMeta));
+    if (entries == NULL) {
+        return CHIDB_ENOMEM;
+    }
+    bt->meta = entries;
+    *meta = &bt->meta[bt->n_meta];
+    (*meta)->nroot = nroot;
+    (*meta)->bloom = NULL;
+    (*meta)->split.fill_factor = DEFAULT_FILL_FACTOR;
+    (*meta)->split.by_bytes = false;
+    __atomic_store_n(&bt->n_meta, bt->n_meta + 1, __ATOMIC_RELEASE);
+
+    return CHIDB_OK;
+}
+
+/* Returns the split policy of a B-Tree (the default one if it has no entry
+ * in the metadata directory). The caller must hold the meta latch. */
+BTreeSplitPolicy meta_split_policy(BTree *bt, npage_t nroot)
+{
+    BTreeSplitPolicy policy = { DEFAULT_FILL_FACTOR, false };
+    for (uint16_t i = 0; i < bt->n_meta; i++) {
+        if (bt->meta[i].nroot == nroot) {
+            policy = bt->meta[i].split;
+        }
+    }
+
+    return policy;
+}
+
+/* Returns the pinned top levels of a B-Tree (NULL if it is not pinned).
+ * The caller must hold the pin latch. */
+BTreePinnedTree *pin_find(BTree *bt, npage_t nroot)
+{
+    for (BTreePinnedTree *pt = bt->pinned; pt != NULL; pt = pt->next) {
+        if (pt->nroot == nroot) {
+            return pt;
+        }
+    }
+
+    return NULL;
+}
+
+/* Frees a pinned node and every pinned node below it */
+void pin_free(BTreePinnedNode *pn)
+{
+    if (pn == NULL) {
+        return;
+    }
+    for (ncell_t i = 0; i <= pn->n_cells; i++) {
+        pin_free(pn->pinned[i]);
+    }
+    free(pn->keys);
+    free(pn->pinned);
+    free(pn);
+}
+
+int pin_page_cmp(const void *a, const void *b)
+{
+    npage_t pa = *(const npage_t *) a, pb = *(const npage_t *) b;
+
+    return pa < pb ? -1 : pa > pb;
+}
+
+/* Makes the pages in pages evictable again, except those that are in keep
+ * (which must be sorted) */
+void pin_unmark(BTree *bt, npage_t *pages, npage_t n, npage_t *keep, npage_t n_keep)
+{
+    for (npage_t i = 0; i < n; i++) {
+        if (n_keep == 0 || bsearch(&pages[i], keep, n_keep, sizeof(npage_t), pin_page_cmp) == NULL) {
+            chidb_Pager_setResident(bt->pager, pages[i], false);
+        }
+    }
+}
+
+/* Reads the top levels of a pinned B-Tree again, replacing its pinned
+ * nodes. The caller must hold the pin latch in exclusive mode.
+ *
+ * Nodes are read breadth first, so the budget goes to the upper levels.
+ * Each page is made resident while it is latched, before it is decoded, so
+ * any write to it after that bumps pin_epoch (see pin_invalidate). If that
+ * happens while the nodes are being read, the tree is left stale and will
+ * be read again by the next descent. */
+int pin_build(BTree *bt, BTreePinnedTree *pt)
+{
+    int ret = CHIDB_OK;
+    struct pin_slot {
+        BTreePinnedNode **slot;  /* Where to link the node */
+        npage_t npage;
+        uint8_t level;
+    } *queue;
+    npage_t *old_pages = pt->pages, n_old = pt->n_pages;
+    uint32_t head = 0, tail = 0, capacity = 64;
+    uint8_t leaf_level = UINT8_MAX;  /* Level of the leaves, once one is seen */
+
+    pin_free(pt->root);
+    pt->root = NULL;
+    pt->pages = NULL;
+    pt->n_pages = 0;
+    pt->n_nodes = 0;
+    pt->epoch = __atomic_load_n(&bt->pin_epoch, __ATOMIC_SEQ_CST);
+    npage_t pages_cap = 0;
+    if ((queue = malloc(capacity * sizeof(struct pin_slot))) == NULL) {
+        ret = CHIDB_ENOMEM;
+    } else {
+        queue[tail++] = (struct pin_slot) { &pt->root, pt->nroot, 1 };
+    }
+
+    while (ret == CHIDB_OK && head < tail) {
+        struct pin_slot s = queue[head++];
+        if (pt->max_pages != 0 && pt->n_nodes >= pt->max_pages) {
+            break;
+        }
+        if (s.level >= leaf_level) {
+            continue;
+        }
+
+        BTreeNode *btn;
+        chidb_Pager_latch(bt->pager, s.npage, false);
+        if ((ret = chidb_Btree_getNodeByPage(bt, s.npage, &btn)) != CHIDB_OK) {
+            chidb_Pager_unlatch(bt->pager, s.npage);
+            break;
+        }
+        bool pin = btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL;
+        if (!pin && s.level > 1) {
+            // every node at this level is a leaf (variable-length key
+            // indexes are not searched by chidb_Btree_findLeaf, so their
+            // nodes are not worth pinning)
+            leaf_level = s.level;
+            chidb_Btree_releaseNode(bt, btn);
+            continue;
+        }
+        if (pt->n_pages == pages_cap) {
+            npage_t *pages = realloc(pt->pages, (pages_cap + 64) * sizeof(npage_t));
+            if (pages == NULL) {
+                chidb_Btree_releaseNode(bt, btn);
+                ret = CHIDB_ENOMEM;
+                break;
+            }
+            pt->pages = pages;
+            pages_cap += 64;
+        }
+        chidb_Pager_setResident(bt->pager, s.npage, true);
+        pt->pages[pt->n_pages++] = s.npage;
+        if (!pin) {
+            chidb_Btree_releaseNode(bt, btn);
+            break;
+        }
+
+        // the node's decoded sidecar becomes the pinned node's arrays; its
+        // padding leaves room for right_page after the last child
+        BTreePinnedNode *pn = malloc(sizeof(BTreePinnedNode));
+        if (pn == NULL || (ret = chidb_Btree_decodeNode(btn)) != CHIDB_OK
+            || (pn->pinned = calloc(btn->n_cells + 1, sizeof(BTreePinnedNode *))) == NULL) {
+            free(pn);
+            chidb_Btree_releaseNode(bt, btn);
+            ret = CHIDB_ENOMEM;
+            break;
+        }
+        pn->npage = s.npage;
+        pn->type = btn->type;
+        pn->n_cells = btn->n_cells;
+        pn->keys = btn->keys;
+        pn->children = btn->children;
+        pn->children[btn->n_cells] = btn->right_page;
+        btn->keys = NULL;
+        btn->children = NULL;
+        chidb_Btree_releaseNode(bt, btn);
+        *s.slot = pn;
+        pt->n_nodes++;
+
+        if (s.level >= pt->levels) {
+            continue;
+        }
+        for (ncell_t i = 0; i <= pn->n_cells; i++) {
+            if (pn->children[i] == 0) {
+                continue;
+            }
+            if (tail == capacity) {
+                struct pin_slot *q = realloc(queue, 2 * capacity * sizeof(struct pin_slot));
+                if (q == NULL) {
+                    ret = CHIDB_ENOMEM;
+                    break;
+                }
+                queue = q;
+                capacity *= 2;
+            }
+            queue[tail++] = (struct pin_slot) { &pn->pinned[i], pn->children[i], s.level + 1 };
+        }
+    }
+    free(queue);
+
+    if (pt->n_pages > 0) {
+        qsort(pt->pages, pt->n_pages, sizeof(npage_t), pin_page_cmp);
+    }
+    pin_unmark(bt, old_pages, n_old, pt->pages, pt->n_pages);
+    free(old_pages);
+    if (ret != CHIDB_OK) {
+        // leave the tree unpinned rather than half pinned
+        pin_unmark(bt, pt->pages, pt->n_pages, NULL, 0);
+        pin_free(pt->root);
+        free(pt->pages);
+        pt->root = NULL;
+        pt->pages = NULL;
+        pt->n_pages = 0;
+        pt->n_nodes = 0;
+    }
+
+    return ret;
+}
+
+/* Descends through the pinned top levels of a B-Tree, if it has any (see
+ * chidb_Btree_findLeaf). Returns with npage latched in shared mode, and its
+ * parent (if not 0) latched too, just like chidb_Btree_findLeaf's loop
+ * expects them: npage is nroot if the tree is not pinned, and otherwise the
+ * first node on the way to key that is not pinned. If the pinned nodes
+ * are stale, they are read again first, unless another thread is already
+ * doing it (in which case the tree is descended as if it was not pinned). */
+int pin_descend(BTree *bt, npage_t nroot, chidb_key_t key, npage_t *npage, npage_t *parent, bool *bounded, chidb_key_t *bound)
+{
+    int ret = CHIDB_OK;
+    BTreePinnedTree *pt = NULL;
+    BTreePinnedNode *pn = NULL;
+    *npage = nroot;
+    *parent = 0;
+
+    if (__atomic_load_n(&bt->pinned, __ATOMIC_ACQUIRE) != NULL) {
+        pthread_rwlock_rdlock(&bt->pin_latch);
+        pt = pin_find(bt, nroot);
+        if (pt != NULL && pt->epoch != __atomic_load_n(&bt->pin_epoch, __ATOMIC_SEQ_CST)) {
+            pthread_rwlock_unlock(&bt->pin_latch);
+            if (pthread_rwlock_trywrlock(&bt->pin_latch) == 0) {
+                pt = pin_find(bt, nroot);
+                if (pt != NULL && pt->epoch != __atomic_load_n(&bt->pin_epoch, __ATOMIC_SEQ_CST)) {
+                    ret = pin_build(bt, pt);
+                }
+                pthread_rwlock_unlock(&bt->pin_latch);
+                if (ret != CHIDB_OK) {
+                    return ret;
+                }
+            }
+            pthread_rwlock_rdlock(&bt->pin_latch);
+            pt = pin_find(bt, nroot);
+        }
+        if (pt != NULL) {
+            pn = pt->root;
+        } else {
+            pthread_rwlock_unlock(&bt->pin_latch);
+        }
+    }
+
+    if ((ret = chidb_Pager_latch(bt->pager, nroot, false)) != CHIDB_OK) {
+        if (pt != NULL) {
+            pthread_rwlock_unlock(&bt->pin_latch);
+        }
+        return ret;
+    }
+    while (pn != NULL) {
+        // the page is latched, so it cannot be written while we use the
+        // pinned node, but it may have been written before
+        if (pt->epoch != __atomic_load_n(&bt->pin_epoch, __ATOMIC_SEQ_CST)) {
+            break;
+        }
+        ncell_t ncell = search_keys(pn->keys, pn->n_cells, key);
+        npage_t child_page = pn->children[ncell];
+        if (ncell < pn->n_cells) {
+            if (pn->type == PGTYPE_INDEX_INTERNAL && pn->keys[ncell] == key) {
+                ret = CHIDB_EDUPLICATE;
+            }
+            if (bounded != NULL) {
+                *bounded = true;
+            }
+            if (bound != NULL) {
+                *bound = pn->keys[ncell];
+            }
+        }
+        if (ret == CHIDB_OK && child_page == 0) {
+            ret = CHIDB_ENOTFOUND;
+        }
+        if (ret == CHIDB_OK) {
+            ret = chidb_Pager_latch(bt->pager, child_page, false);
+        }
+        if (ret != CHIDB_OK) {
+            if (*parent != 0) {
+                chidb_Pager_unlatch(bt->pager, *parent);
+            }
+            chidb_Pager_unlatch(bt->pager, *npage);
+            break;
+        }
+        if (*parent != 0) {
+            chidb_Pager_unlatch(bt->pager, *parent);
+        }
+        *parent = *npage;
+        *npage = child_page;
+        pn = pn->pinned[ncell];
+    }
+    if (pt != NULL) {
+        pthread_rwlock_unlock(&bt->pin_latch);
+    }
+
+    return ret;
+}
+
+/* Called after a page is written: if it is pinned, the pinned nodes are
+ * now stale. Must be called before the page is unlatched. */
+void pin_invalidate(BTree *bt, npage_t npage)
+{
+    if (__atomic_load_n(&bt->pinned, __ATOMIC_ACQUIRE) != NULL
+        && chidb_Pager_isResident(bt->pager, npage)) {
+        __atomic_add_fetch(&bt->pin_epoch, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/* Builds a Bloom filter from the keys in a B-Tree, writes it to disk, and
+ * makes it the tree's filter. The pages of the tree's old filter are
+ * reused if there are enough of them and the bits per key do not change
+ * (the new filter then takes all of them), and go to the freelist
+ * otherwise. The caller must hold the meta
+ * latch in exclusive mode, so no insertion can happen in the meantime. */
+int bloom_install(BTree *bt, npage_t nroot, uint8_t bits_per_key)
+{
+    int ret;
+    chidb_key_t *keys = NULL;
+    uint32_t n = 0, size = 0;
+    if ((ret = bloom_collect_keys(bt, nroot, &keys, &n, &size)) != CHIDB_OK) {
+        free(keys);
+        return ret;
+    }
+
+    BloomFilter *bf, *old = meta_bloom(bt, nroot);
+    npage_t first_page, old_first = 0, old_npages = 0;
+    npage_t npages = chidb_Bloom_pagesFor(2 * n, bits_per_key, bt->pager->page_size);
+    if (old != NULL) {
+        old_first = old->first_page;
+        old_npages = old->npages;
+    }
+    // a filter written over the old one keeps its blocks and bits per key,
+    // so a write that fails half-way leaves every block with all the keys
+    // the old filter had in it
+    if (old != NULL && old_npages >= npages && old->bits_per_key == bits_per_key) {
+        first_page = old_first;
+        npages = old_npages;
+    } else if ((ret = chidb_Pager_allocatePages(bt->pager, npages, &first_page)) != CHIDB_OK) {
+        free(keys);
+        return ret;
+    }
+    if ((ret = chidb_Bloom_create(&bf, first_page, npages, bt->pager->page_size, bits_per_key)) != CHIDB_OK) {
+        free(keys);
+        return ret;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        chidb_Bloom_add(bf, keys[i]);
+    }
+    bf->n_keys = n;
+    free(keys);
+    for (npage_t npage = first_page; npage < first_page + npages && ret == CHIDB_OK; npage++) {
+        ret = bloom_write_page(bt, bf, npage);
+    }
+    if (ret != CHIDB_OK) {
+        chidb_Bloom_free(bf);
+        return ret;
+    }
+
+    BTreeMeta *meta;
+    if ((ret = meta_entry(bt, nroot, &meta)) != CHIDB_OK) {
+        chidb_Bloom_free(bf);
+        return ret;
+    }
+    if (meta->bloom != NULL) {
+        chidb_Bloom_free(meta->bloom);
+    }
+    meta->bloom = bf;
+    if ((ret = meta_write(bt)) != CHIDB_OK || old_first == 0 || old_first == first_page) {
+        return ret;
+    }
+
+    for (npage_t npage = old_first; npage < old_first + old_npages && ret == CHIDB_OK; npage++) {
+        ret = freelist_push(bt, npage);
+    }
+    if (ret != CHIDB_OK) {
+        return ret;
+    }
+    return freelist_save(bt);
+}
+
+/* Appends every key in the subtree rooted at npage to the keys array, which
+ * has room for size keys and is grown as needed. Separator keys of table
+ * internal nodes are skipped, since they are also in the leaves. */
+int bloom_collect_keys(BTree *bt, npage_t npage, chidb_key_t **keys, uint32_t *n, uint32_t *size)
+{
+    int ret;
+    BTreeNode *btn;
+    if ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = chidb_Btree_decodeNode(btn)) != CHIDB_OK) {
+        chidb_Btree_freeMemNode(bt, btn);
+        return ret;
+    }
+    if (btn->type != PGTYPE_TABLE_INTERNAL) {
+        if (*n + btn->n_cells > *size) {
+            uint32_t new_size = (*size == 0) ? 1024 : *size;
+            while (*n + btn->n_cells > new_size) {
+                new_size *= 2;
+            }
+            chidb_key_t *new_keys = realloc(*keys, new_size * sizeof(chidb_key_t));
+            if (new_keys == NULL) {
+                chidb_Btree_freeMemNode(bt, btn);
+                return CHIDB_ENOMEM;
+            }
+            *keys = new_keys;
+            *size = new_size;
+        }
+        memcpy(*keys + *n, btn->keys, btn->n_cells * sizeof(chidb_key_t));
+        *n += btn->n_cells;
+    }
+    if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL) {
+        for (ncell_t i = 0; i < btn->n_cells && ret == CHIDB_OK; i++) {
+            if (btn->children[i] != 0) {
+                ret = bloom_collect_keys(bt, btn->children[i], keys, n, size);
+            }
+        }
+        if (ret == CHIDB_OK && btn->right_page != 0) {
+            ret = bloom_collect_keys(bt, btn->right_page, keys, n, size);
+        }
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return ret;
+}
+
+/* Writes one page of a Bloom filter. The caller must hold the page's
+ * latch in exclusive mode, unless nobody else can see the filter yet. */
+int bloom_write_page(BTree *bt, BloomFilter *bf, npage_t npage)
+{
+    MemPage page;
+    page.npage = npage;
+    page.data = bf->bits + (npage - bf->first_page) * bf->page_size;
+
+    return chidb_Pager_writePage(bt->pager, &page);
+}
+
+/* Adds a key to a Bloom filter and writes the page that changed */
+int bloom_add_key(BTree *bt, BloomFilter *bf, chidb_key_t key)
+{
+    int ret;
+    // find out which page changes, so it can be latched
+    npage_t npage = chidb_Bloom_page(bf, key);
+    if ((ret = chidb_Pager_latch(bt->pager, npage, true)) != CHIDB_OK) {
+        return ret;
+    }
+    chidb_Bloom_add(bf, key);
+    ret = bloom_write_page(bt, bf, npage);
+    chidb_Pager_unlatch(bt->pager, npage);
+
+    return ret;
+}
+
+/* Adds the keys of a batch of cells to a Bloom filter, writing every page
+ * that changed once */
+int bloom_add_batch(BTree *bt, BloomFilter *bf, BTreeCell **cells, uint32_t n)
+{
+    int ret = CHIDB_OK;
+    bool *dirty = calloc(bf->npages, sizeof(bool));
+    if (dirty == NULL) {
+        return CHIDB_ENOMEM;
+    }
+    // latch the whole filter, in page order
+    for (npage_t npage = bf->first_page; npage < bf->first_page + bf->npages; npage++) {
+        chidb_Pager_latch(bt->pager, npage, true);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        dirty[chidb_Bloom_add(bf, cells[i]->key) - bf->first_page] = true;
+    }
+    for (npage_t npage = bf->first_page; npage < bf->first_page + bf->npages; npage++) {
+        if (dirty[npage - bf->first_page] && ret == CHIDB_OK) {
+            ret = bloom_write_page(bt, bf, npage);
+        }
+        chidb_Pager_unlatch(bt->pager, npage);
+    }
+    free(dirty);
+
+    return ret;
+}
+
+/* Adds the subtree rooted at npage, which is at the given level of the
+ * tree (1 for the root), to stats. Only one page is held at a time. */
+int analyze_node(BTree *bt, npage_t npage, uint32_t level, BTreeStats *stats)
+{
+    int ret;
+    BTreeNode *btn;
+    if ((ret = chidb_Pager_latch(bt->pager, npage, false)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+        chidb_Pager_unlatch(bt->pager, npage);
+        return ret;
+    }
+    if ((ret = chidb_Btree_decodeNode(btn)) != CHIDB_OK) {
+        chidb_Btree_releaseNode(bt, btn);
+        return ret;
+    }
+    if (level == 1) {
+        stats->type = btn->type;
+    }
+    if (level > stats->depth) {
+        stats->depth = level;
+    }
+    analyze_page(bt, btn, stats);
+
+    if (!PGTYPE_IS_INTERNAL(btn->type)) {
+        return chidb_Btree_releaseNode(bt, btn);
+    }
+    ncell_t n_children = btn->n_cells + 1;
+    npage_t *children = malloc(n_children * sizeof(npage_t));
+    if (children == NULL) {
+        chidb_Btree_releaseNode(bt, btn);
+        return CHIDB_ENOMEM;
+    }
+    memcpy(children, btn->children, btn->n_cells * sizeof(npage_t));
+    children[btn->n_cells] = btn->right_page;
+    chidb_Btree_releaseNode(bt, btn);
+
+    for (ncell_t i = 0; i < n_children && ret == CHIDB_OK; i++) {
+        if (children[i] != 0) {
+            ret = analyze_node(bt, children[i], level + 1, stats);
+        }
+    }
+    free(children);
+
+    return ret;
+}
+
+/* Adds the counts, space usage and keys of a single page to stats */
+void analyze_page(BTree *bt, BTreeNode *btn, BTreeStats *stats)
+{
+    bool internal = PGTYPE_IS_INTERNAL(btn->type);
+    uint16_t header = (btn->page->npage == 1 ? HEADER_OFFSET : 0) +
+            (internal ? INTPG_CELLSOFFSET_OFFSET : LEAFPG_CELLSOFFSET_OFFSET);
+    uint16_t end = bt->pager->page_size - (btn->linked ? LEAFPG_LINKS_SIZE : 0);
+
+    uint32_t cells_size;
+    switch (btn->type) {
+    case PGTYPE_TABLE_INTERNAL:
+        cells_size = btn->n_cells * TABLEINTCELL_SIZE;
+        break;
+    case PGTYPE_INDEX_INTERNAL:
+        cells_size = btn->n_cells * INDEXINTCELL_SIZE;
+        break;
+    case PGTYPE_INDEX_LEAF:
+        cells_size = btn->n_cells * INDEXLEAFCELL_SIZE;
+        break;
+    case PGTYPE_VARINDEX_INTERNAL:
+    case PGTYPE_VARINDEX_LEAF:
+        cells_size = 0;
+        for (ncell_t i = 0; i < btn->n_cells; i++) {
+            BTreeCell btc;
+            chidb_Btree_getCell(btn, i, &btc);
+            cells_size += varindex_cell_size(&btc);
+        }
+        break;
+    default:
+        cells_size = btn->n_cells * TABLELEAFCELL_SIZE_WITHOUTDATA;
+        for (ncell_t i = 0; i < btn->n_cells; i++) {
+            uint32_t data_size;
+            getVarint32(btn->page->data + get2byte(btn->celloffset_array + i * 2) +
+                    TABLELEAFCELL_SIZE_OFFSET, &data_size);
+            cells_size += data_size;
+        }
+        break;
+    }
+
+    uint32_t usable = end - header;
+    uint32_t used = btn->n_cells * 2 + cells_size;
+    stats->n_pages++;
+    if (internal) {
+        stats->n_internal++;
+    } else {
+        stats->n_leaf++;
+    }
+    if (btn->linked) {
+        stats->n_linked++;
+    }
+    stats->n_cells += btn->n_cells;
+    stats->usable_bytes += usable;
+    stats->used_bytes += used;
+    stats->free_bytes += btn->cells_offset - btn->free_offset;
+    stats->fragmented_bytes += end - btn->cells_offset - cells_size;
+    uint32_t bucket = (uint64_t) used * BTREE_FILL_BUCKETS / usable;
+    stats->fill_hist[bucket < BTREE_FILL_BUCKETS ? bucket : BTREE_FILL_BUCKETS - 1]++;
+
+    // separator keys of table internal nodes are also in the leaves, and
+    // the keys of variable-length key indexes are not integers
+    if (btn->type == PGTYPE_VARINDEX_LEAF) {
+        stats->n_entries += btn->n_cells;
+    } else if (btn->type != PGTYPE_TABLE_INTERNAL && btn->type != PGTYPE_VARINDEX_INTERNAL
+            && btn->n_cells > 0) {
+        stats->n_entries += btn->n_cells;
+        if (btn->keys[0] < stats->min_key) {
+            stats->min_key = btn->keys[0];
+        }
+        if (btn->keys[btn->n_cells - 1] > stats->max_key) {
+            stats->max_key = btn->keys[btn->n_cells - 1];
+        }
+    }
+}
+
+/* Returns the upper bound of the fill factor histogram bucket in which the
+ * given fraction p of the pages falls */
+double analyze_percentile(BTreeStats *stats, double p)
+{
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < BTREE_FILL_BUCKETS; i++) {
+        seen += stats->fill_hist[i];
+        if (seen > 0 && seen >= p * stats->n_pages) {
+            return (double) (i + 1) / BTREE_FILL_BUCKETS;
+        }
+    }
+
+    return 0;
+}
+
+/* Reads a node for chidb_Btree_estimateRange, and adds its size to the
+ * statistics of its level. The node is returned latched and decoded. */
+int estimate_read(BTree *bt, npage_t npage, BTreeLevelSizes *lvl, BTreeRangeEstimate *est, BTreeNode **btn)
+{
+    int ret;
+    if ((ret = chidb_Pager_latch(bt->pager, npage, false)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, npage, btn)) != CHIDB_OK) {
+        chidb_Pager_unlatch(bt->pager, npage);
+        return ret;
+    }
+    if ((ret = chidb_Btree_decodeNode(*btn)) != CHIDB_OK) {
+        chidb_Btree_releaseNode(bt, *btn);
+        return ret;
+    }
+    est->n_pages++;
+
+    uint32_t n_children = 0;
+    if (PGTYPE_IS_INTERNAL((*btn)->type)) {
+        n_children = (*btn)->n_cells + ((*btn)->right_page != 0 ? 1 : 0);
+    }
+    if (lvl->n_nodes == 0 || n_children < lvl->min_children) {
+        lvl->min_children = n_children;
+    }
+    if (lvl->n_nodes == 0 || (*btn)->n_cells < lvl->min_cells) {
+        lvl->min_cells = (*btn)->n_cells;
+    }
+    if (n_children > lvl->max_children) {
+        lvl->max_children = n_children;
+    }
+    if ((*btn)->n_cells > lvl->max_cells) {
+        lvl->max_cells = (*btn)->n_cells;
+    }
+    lvl->sum_children += n_children;
+    lvl->sum_cells += (*btn)->n_cells;
+    lvl->n_nodes++;
+
+    return CHIDB_OK;
+}
+
+/* Counts the children from..to-1 of an internal node (the last one being
+ * right_page) as subtrees within the range, and keeps a uniform random
+ * sample of n_samples of all the subtrees seen so far (reservoir sampling) */
+void estimate_cover(BTreeNode *btn, ncell_t from, ncell_t to, BTreeLevelSizes *lvl, npage_t *samples, uint32_t *sample_levels, uint32_t n_samples, uint32_t level, uint64_t *n_seen, uint64_t *rnd)
+{
+    for (ncell_t i = from; i < to; i++) {
+        npage_t child = i < btn->n_cells ? btn->children[i] : btn->right_page;
+        if (child == 0) {
+            continue;
+        }
+        lvl->n_covered++;
+        uint64_t j = (*n_seen)++;
+        if (j >= n_samples) {
+            j = estimate_random(rnd) % *n_seen;
+        }
+        if (j < n_samples) {
+            samples[j] = child;
+            sample_levels[j] = level;
+        }
+    }
+}
+
+/* xorshift64* pseudo-random number generator */
+uint64_t estimate_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/* Orders keys (used by chidb_Btree_partition) */
+int partition_key_cmp(const void *a, const void *b)
+{
+    chidb_key_t key_a = *(const chidb_key_t *) a;
+    chidb_key_t key_b = *(const chidb_key_t *) b;
+    if (key_a < key_b) {
+        return -1;
+    } else if (key_a > key_b) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Returns the insert buffer of a B-Tree, or NULL if it does not have one.
+ * Buffers are never freed while the file is open. */
+BTreeInsertBuffer *ibuf_find(BTree *bt, npage_t nroot)
+{
+    // most indexes are not buffered
+    if (__atomic_load_n(&bt->ibufs, __ATOMIC_ACQUIRE) == NULL) {
+        return NULL;
+    }
+    pthread_rwlock_rdlock(&bt->meta_latch);
+    BTreeInsertBuffer *ibuf = bt->ibufs;
+    while (ibuf != NULL && ibuf->nroot != nroot) {
+        ibuf = ibuf->next;
+    }
+    pthread_rwlock_unlock(&bt->meta_latch);
+
+    return ibuf;
+}
+
+/* Returns the position of the first buffered entry with a key >= key.
+ * Must be called with the buffer's lock held. */
+uint32_t ibuf_search(BTreeInsertBuffer *ibuf, chidb_key_t key)
+{
+    uint32_t lo = 0, hi = ibuf->n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (ibuf->cells[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/* Adds an entry to an insert buffer, and merges the buffer into its tree
+ * if that fills it up */
+int ibuf_insert(BTree *bt, BTreeInsertBuffer *ibuf, chidb_key_t keyIdx, chidb_key_t keyPk)
+{
+    int ret = CHIDB_OK;
+    chidb_key_t found_pk;
+    pthread_mutex_lock(&ibuf->lock);
+    uint32_t i = ibuf_search(ibuf, keyIdx);
+    if (i < ibuf->n && ibuf->cells[i].key == keyIdx) {
+        ret = CHIDB_EDUPLICATE;
+    } else if (chidb_Btree_bloomMayContain(bt, ibuf->nroot, keyIdx)) {
+        ret = index_find(bt, ibuf->nroot, keyIdx, &found_pk);
+        ret = ret == CHIDB_OK ? CHIDB_EDUPLICATE : ret == CHIDB_ENOTFOUND ? CHIDB_OK : ret;
+    }
+    if (ret == CHIDB_OK) {
+        memmove(&ibuf->cells[i + 1], &ibuf->cells[i], (ibuf->n - i) * sizeof(BTreeCell));
+        ibuf->cells[i].type = PGTYPE_INDEX_LEAF;
+        ibuf->cells[i].key = keyIdx;
+        ibuf->cells[i].fields.indexLeaf.keyPk = keyPk;
+        ibuf->n++;
+        if (ibuf->n == ibuf->capacity) {
+            ret = ibuf_merge(bt, ibuf);
+        }
+    }
+    pthread_mutex_unlock(&ibuf->lock);
+
+    return ret;
+}
+
+/* Inserts the entries of an insert buffer into its tree, in one batch, and
+ * empties the buffer. Must be called with the buffer's lock held, so that
+ * lookups wait until the entries are in the tree. */
+int ibuf_merge(BTree *bt, BTreeInsertBuffer *ibuf)
+{
+    int ret = chidb_Btree_insertBatch(bt, ibuf->nroot, ibuf->cells, ibuf->n);
+    ibuf->n = 0;
+
+    return ret;
+}
+
+/* Looks a key up in an index B-Tree, crabbing down with shared latches.
+ * Unlike in a table B-Tree, the key may be in an internal node. */
+int index_find(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t *keyPk)
+{
+    int ret;
+    BTreeNode *btn;
+    BTreeCell btc;
+    npage_t npage = nroot;
+    npage_t parent = 0;
+
+    if ((ret = chidb_Pager_latch(bt->pager, npage, false)) != CHIDB_OK) {
+        return ret;
+    }
+    while ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) == CHIDB_OK) {
+        if (parent != 0) {
+            chidb_Pager_unlatch(bt->pager, parent);
+            parent = 0;
+        }
+        npage_t child_page = 0;
+        ncell_t ncell;
+        if ((ret = chidb_Btree_searchNode(btn, keyIdx, &ncell)) == CHIDB_OK) {
+            if (ncell < btn->n_cells && btn->keys[ncell] == keyIdx) {
+                chidb_Btree_getCell(btn, ncell, &btc);
+                *keyPk = btc.type == PGTYPE_INDEX_LEAF ? btc.fields.indexLeaf.keyPk
+                                                       : btc.fields.indexInternal.keyPk;
+            } else if (btn->type == PGTYPE_INDEX_INTERNAL) {
+                child_page = ncell < btn->n_cells ? btn->children[ncell] : btn->right_page;
+                if (child_page == 0) {
+                    ret = CHIDB_ENOTFOUND;
+                }
+            } else {
+                ret = CHIDB_ENOTFOUND;
+            }
+        }
+        chidb_Btree_freeMemNode(bt, btn);
+        if (ret == CHIDB_OK && child_page != 0) {
+            ret = chidb_Pager_latch(bt->pager, child_page, false);
+        }
+        if (ret != CHIDB_OK || child_page == 0) {
+            break;
+        }
+        parent = npage;
+        npage = child_page;
+    }
+
+    if (parent != 0) {
+        chidb_Pager_unlatch(bt->pager, parent);
+    }
+    chidb_Pager_unlatch(bt->pager, npage);
+
+    return ret;
+}
+
+/* Returns the first four bytes of a variable-length key, big-endian and
+ * padded with zeros, which sort like the whole keys (except for ties). */
+chidb_key_t varindex_prefix(const uint8_t *key, uint16_t size)
+{
+    uint8_t buf[4] = {0, 0, 0, 0};
+    memcpy(buf, key, size < 4 ? size : 4);
+    return get4byte(buf);
+}
+
+/* Returns the number of bytes a variable-length key cell takes in a page */
+uint16_t varindex_cell_size(BTreeCell *btc)
+{
+    if (btc->type == PGTYPE_VARINDEX_INTERNAL) {
+        return VARINDEXINTCELL_SIZE_WITHOUTKEY + btc->fields.varIndex.key_size;
+    }
+    return VARINDEXLEAFCELL_SIZE_WITHOUTKEY + btc->fields.varIndex.key_size + btc->fields.varIndex.data_size;
+}
+
+/* Sets ncell to the first cell of a variable-length key node whose key is
+ * larger than or equal to the given one, and equal to whether it is the
+ * same key. The prefixes in the decoded sidecar narrow the search down to
+ * the cells with the same first four bytes, and only those are compared
+ * in full. */
+int varindex_search(BTreeNode *btn, const uint8_t *key, uint16_t size, ncell_t *ncell, bool *equal)
+{
+    int ret;
+    BTreeCell btc;
+    chidb_key_t prefix = varindex_prefix(key, size);
+    if ((ret = chidb_Btree_decodeNode(btn)) != CHIDB_OK) {
+        return ret;
+    }
+    ncell_t i = search_keys(btn->keys, btn->n_cells, prefix);
+    *equal = false;
+    while (i < btn->n_cells && btn->keys[i] == prefix) {
+        chidb_Btree_getCell(btn, i, &btc);
+        int cmp = chidb_Btree_varKeyCompare(btc.fields.varIndex.key_data,
+                btc.fields.varIndex.key_size, key, size);
+        if (cmp >= 0) {
+            *equal = cmp == 0;
+            break;
+        }
+        i++;
+    }
+    *ncell = i;
+
+    return CHIDB_OK;
+}
+
+/* Sets child_page to the child of an internal variable-length key node
+ * where the given key belongs, and ncell to the cell that points to it
+ * (n_cells if it is the right page). Children have the keys smaller than
+ * their separator. */
+int varindex_child(BTreeNode *btn, const uint8_t *key, uint16_t size, ncell_t *ncell, npage_t *child_page)
+{
+    int ret;
+    bool equal;
+    if ((ret = varindex_search(btn, key, size, ncell, &equal)) != CHIDB_OK) {
+        return ret;
+    }
+    if (equal) {
+        (*ncell)++;
+    }
+    *child_page = *ncell < btn->n_cells ? btn->children[*ncell] : btn->right_page;
+
+    return CHIDB_OK;
+}
+
+/* Returns whether a variable-length key node can take one more cell
+ * without splitting: the given leaf cell for leaves, and a separator as
+ * large as the largest key for internal nodes. */
+bool varindex_has_room(BTree *bt, BTreeNode *btn, BTreeCell *btc)
+{
+    uint16_t size = btn->type == PGTYPE_VARINDEX_INTERNAL ?
+            VARINDEXINTCELL_SIZE_WITHOUTKEY + chidb_Btree_varKeyMaxSize(bt) : varindex_cell_size(btc);
+    return btn->cells_offset - btn->free_offset >= size + 2;
+}
+
+/* Returns the size of the separator that goes up if a variable-length key
+ * node is split at cell ncell: the separator of that cell in an internal
+ * node, and the shortest prefix of the key of cell ncell + 1 that is larger
+ * than the key of cell ncell in a leaf. */
+uint16_t varindex_separator_size(BTreeNode *btn, ncell_t ncell)
+{
+    BTreeCell left, right;
+    uint16_t common = 0;
+    chidb_Btree_getCell(btn, ncell, &left);
+    if (btn->type == PGTYPE_VARINDEX_INTERNAL) {
+        return left.fields.varIndex.key_size;
+    }
+    chidb_Btree_getCell(btn, ncell + 1, &right);
+    while (common < left.fields.varIndex.key_size &&
+            left.fields.varIndex.key_data[common] == right.fields.varIndex.key_data[common]) {
+        common++;
+    }
+    return common + 1;
+}
+
+/* Splits a variable-length key node, which is the child of the given cell
+ * of its parent (or its right page, if parent_ncell is n_cells). The cells
+ * are divided near the middle of their bytes, where the separator that
+ * goes up is shortest: the ones with the smaller keys are moved to a new
+ * page, which is inserted into the parent with the separator, and the rest
+ * stay in the child's page, so the parent does not have to be updated
+ * otherwise. Splitting a leaf copies up the shortest prefix of the first
+ * key on the right that is still larger than the last key on the left;
+ * splitting an internal node moves one of its separators up. The parent
+ * must have room for the separator. All three nodes are written, and
+ * parent_btn is updated in memory too. */
+int varindex_split(BTree *bt, BTreeNode *parent_btn, ncell_t parent_ncell, BTreeNode *child_btn)
+{
+    int ret;
+    bool leaf = child_btn->type == PGTYPE_VARINDEX_LEAF;
+    ncell_t n = child_btn->n_cells;
+    npage_t left_page, child_page = child_btn->page->npage;
+    BTreeNode *left_btn, *right_btn;
+    BTreeCell btc, sep;
+    uint32_t total = 0, acc = 0;
+    ncell_t mid, j;
+
+    for (ncell_t i = 0; i < n; i++) {
+        chidb_Btree_getCell(child_btn, i, &btc);
+        total += varindex_cell_size(&btc) + 2;
+    }
+    // split where the separator is shortest among the cells in the middle
+    // fifth of the bytes (a leaf keeps cell mid on the left, and an
+    // internal node moves it up)
+    mid = n;
+    for (ncell_t i = 0; i < n - 1; i++) {
+        chidb_Btree_getCell(child_btn, i, &btc);
+        acc += varindex_cell_size(&btc) + 2;
+        if (acc * 5 < total * 2 || (!leaf && i == 0)) {
+            continue;
+        }
+        if (mid == n) {
+            mid = i;
+        }
+        if (acc * 5 > total * 3) {
+            break;
+        }
+        if (varindex_separator_size(child_btn, i) < varindex_separator_size(child_btn, mid)) {
+            mid = i;
+        }
+    }
+    if (mid > n - 2) {
+        mid = n - 2;
+    }
+    if (!leaf && mid < 1) {
+        mid = 1;
+    }
+
+    if ((ret = chidb_Btree_newNode(bt, &left_page, child_btn->type)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, left_page, &left_btn)) != CHIDB_OK) {
+        return ret;
+    }
+    for (j = 0; j < (leaf ? mid + 1 : mid); j++) {
+        chidb_Btree_getCell(child_btn, j, &btc);
+        chidb_Btree_insertCell(left_btn, j, &btc);
+    }
+    chidb_Btree_getCell(child_btn, mid, &btc);
+    if (!leaf) {
+        left_btn->right_page = btc.fields.varIndex.child_page;
+    }
+    if ((ret = chidb_Btree_writeNode(bt, left_btn)) != CHIDB_OK) {
+        chidb_Btree_freeMemNode(bt, left_btn);
+        return ret;
+    }
+    chidb_Btree_freeMemNode(bt, left_btn);
+
+    // child_btn is a private copy of the page, so its cells can still be
+    // read after the page is emptied
+    if ((ret = chidb_Btree_initEmptyNode(bt, child_page, child_btn->type)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, child_page, &right_btn)) != CHIDB_OK) {
+        return ret;
+    }
+    for (j = mid + 1; j < n; j++) {
+        BTreeCell cell;
+        chidb_Btree_getCell(child_btn, j, &cell);
+        chidb_Btree_insertCell(right_btn, j - mid - 1, &cell);
+    }
+    right_btn->right_page = child_btn->right_page;
+    if ((ret = chidb_Btree_writeNode(bt, right_btn)) != CHIDB_OK) {
+        chidb_Btree_freeMemNode(bt, right_btn);
+        return ret;
+    }
+    chidb_Btree_freeMemNode(bt, right_btn);
+
+    sep = btc;
+    if (leaf) {
+        chidb_Btree_getCell(child_btn, mid + 1, &sep);
+        sep.fields.varIndex.key_size = varindex_separator_size(child_btn, mid);
+    }
+    sep.type = PGTYPE_VARINDEX_INTERNAL;
+    sep.key = varindex_prefix(sep.fields.varIndex.key_data, sep.fields.varIndex.key_size);
+    sep.fields.varIndex.child_page = left_page;
+    sep.fields.varIndex.keyPk = 0;
+    sep.fields.varIndex.data_size = 0;
+    sep.fields.varIndex.data = NULL;
+    chidb_Btree_insertCell(parent_btn, parent_ncell, &sep);
+
+    return chidb_Btree_writeNode(bt, parent_btn);
+}
+
+/* Splits the root of a variable-length key index. The root keeps its page
+ * number, so its cells are moved to a new page, the root becomes an
+ * internal node whose only child is that page, and the child is split. */
+int varindex_split_root(BTree *bt, BTreeNode *root_btn)
+{
+    int ret;
+    npage_t nroot = root_btn->page->npage, child_page;
+    BTreeNode *child_btn, *new_root;
+    BTreeCell btc;
+
+    if ((ret = chidb_Btree_newNode(bt, &child_page, root_btn->type)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, child_page, &child_btn)) != CHIDB_OK) {
+        return ret;
+    }
+    for (ncell_t i = 0; i < root_btn->n_cells; i++) {
+        chidb_Btree_getCell(root_btn, i, &btc);
+        chidb_Btree_insertCell(child_btn, i, &btc);
+    }
+    child_btn->right_page = root_btn->right_page;
+    if ((ret = chidb_Btree_writeNode(bt, child_btn)) != CHIDB_OK) {
+        chidb_Btree_freeMemNode(bt, child_btn);
+        return ret;
+    }
+
+    if ((ret = chidb_Btree_initEmptyNode(bt, nroot, PGTYPE_VARINDEX_INTERNAL)) != CHIDB_OK) {
+        chidb_Btree_freeMemNode(bt, child_btn);
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, nroot, &new_root)) != CHIDB_OK) {
+        chidb_Btree_freeMemNode(bt, child_btn);
+        return ret;
+    }
+    new_root->right_page = child_page;
+    ret = varindex_split(bt, new_root, 0, child_btn);
+
+    chidb_Btree_freeMemNode(bt, new_root);
+    chidb_Btree_freeMemNode(bt, child_btn);
+    return ret;
+}
+
+/* Goes down a variable-length key index to the leaf where the given key
+ * is or would be, crabbing with shared latches, and returns a copy of the
+ * leaf (which is not latched). Also copies the smallest separator on the
+ * way that is larger than the key into bound, which must have room for
+ * chidb_Btree_varKeyMaxSize bytes, and sets bound_size to its size (0 if
+ * there is none, i.e., the leaf is the last one). */
+int varindex_find_leaf(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, BTreeNode **leaf, uint8_t *bound, uint16_t *bound_size)
+{
+    int ret;
+    BTreeNode *btn, *child_btn;
+    BTreeCell btc;
+    ncell_t ncell;
+    npage_t child_page;
+
+    *bound_size = 0;
+    if ((ret = chidb_Pager_latch(bt->pager, nroot, false)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, nroot, &btn)) != CHIDB_OK) {
+        chidb_Pager_unlatch(bt->pager, nroot);
+        return ret;
+    }
+    while (btn->type == PGTYPE_VARINDEX_INTERNAL) {
+        if ((ret = varindex_child(btn, key, size, &ncell, &child_page)) != CHIDB_OK) {
+            chidb_Btree_releaseNode(bt, btn);
+            return ret;
+        }
+        // separators further down are smaller than the ones above
+        if (ncell < btn->n_cells) {
+            chidb_Btree_getCell(btn, ncell, &btc);
+            memcpy(bound, btc.fields.varIndex.key_data, btc.fields.varIndex.key_size);
+            *bound_size = btc.fields.varIndex.key_size;
+        }
+        if ((ret = chidb_Pager_latch(bt->pager, child_page, false)) != CHIDB_OK) {
+            chidb_Btree_releaseNode(bt, btn);
+            return ret;
+        }
+        if ((ret = chidb_Btree_getNodeByPage(bt, child_page, &child_btn)) != CHIDB_OK) {
+            chidb_Pager_unlatch(bt->pager, child_page);
+            chidb_Btree_releaseNode(bt, btn);
+            return ret;
+        }
+        chidb_Btree_releaseNode(bt, btn);
+        btn = child_btn;
+    }
+    *leaf = btn;
+
+    return chidb_Pager_unlatch(bt->pager, btn->page->npage);
+}
+
+/* Finds the first entry of a variable-length key index with a key larger
+ * than (or equal to, if inclusive) the given one. Sets leaf to a copy of
+ * its leaf, which the caller must free, and ncell to its cell. If the
+ * entry is not in the leaf where the key would be, it is the first entry
+ * of a following leaf, which is found by seeking again to the separator
+ * that bounds that leaf. */
+int varindex_seek(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, bool inclusive, BTreeNode **leaf, ncell_t *ncell)
+{
+    int ret;
+    uint16_t max_size = chidb_Btree_varKeyMaxSize(bt), bound_size;
+    uint8_t *buf, *bound;
+    bool equal;
+
+    if ((buf = malloc(2 * max_size)) == NULL) {
+        return CHIDB_ENOMEM;
+    }
+    bound = buf;
+    while (true) {
+        if ((ret = varindex_find_leaf(bt, nroot, key, size, leaf, bound, &bound_size)) != CHIDB_OK) {
+            break;
+        }
+        if ((ret = varindex_search(*leaf, key, size, ncell, &equal)) != CHIDB_OK) {
+            chidb_Btree_freeMemNode(bt, *leaf);
+            break;
+        }
+        if (equal && !inclusive) {
+            (*ncell)++;
+        }
+        if (*ncell < (*leaf)->n_cells) {
+            break;
+        }
+        chidb_Btree_freeMemNode(bt, *leaf);
+        if (bound_size == 0) {
+            ret = CHIDB_ENOTFOUND;
+            break;
+        }
+        // every key in the following leaves is >= bound > key
+        key = bound;
+        size = bound_size;
+        inclusive = true;
+        bound = bound == buf ? buf + max_size : buf;
+    }
+    free(buf);
+
+    return ret;
+}
+
+/* Adds a page to the freelist. Nothing may point to the page anymore, and
+ * no thread may have it latched. The page is added to the first trunk page
+ * if it has room, and becomes the first trunk page otherwise. */
+int freelist_push(BTree *bt, npage_t npage)
+{
+    int ret = CHIDB_OK;
+    uint16_t page_size = bt->pager->page_size;
+    uint32_t capacity = (page_size - FREELIST_ENTRIES_OFFSET) / 4;
+    bool added = false;
+
+    pthread_mutex_lock(&bt->free_lock);
+    if (bt->free_head != 0) {
+        MemPage *trunk;
+        if ((ret = chidb_Pager_readPage(bt->pager, bt->free_head, &trunk)) != CHIDB_OK) {
+            pthread_mutex_unlock(&bt->free_lock);
+            return ret;
+        }
+        uint32_t n = get4byte(&trunk->data[FREELIST_NENTRIES_OFFSET]);
+        if (n < capacity) {
+            put4byte(&trunk->data[FREELIST_ENTRIES_OFFSET + n * 4], npage);
+            put4byte(&trunk->data[FREELIST_NENTRIES_OFFSET], n + 1);
+            ret = chidb_Pager_writePage(bt->pager, trunk);
+            added = true;
+        }
+        chidb_Pager_releaseMemPage(bt->pager, trunk);
+    }
+    if (!added) {
+        MemPage page;
+        page.npage = npage;
+        if ((page.data = calloc(1, page_size)) == NULL) {
+            pthread_mutex_unlock(&bt->free_lock);
+            return CHIDB_ENOMEM;
+        }
+        put4byte(&page.data[FREELIST_NEXT_OFFSET], bt->free_head);
+        if ((ret = chidb_Pager_writePage(bt->pager, &page)) == CHIDB_OK) {
+            bt->free_head = npage;
+        }
+        free(page.data);
+    }
+    if (ret == CHIDB_OK) {
+        bt->n_free++;
+        bt->free_dirty = true;
+    }
+    pthread_mutex_unlock(&bt->free_lock);
+
+    return ret;
+}
+
+/* Takes a page from the freelist: the last entry of the first trunk page,
+ * or the trunk page itself once it has no entries left. Returns 0 in
+ * npage if the freelist is empty. */
+int freelist_pop(BTree *bt, npage_t *npage)
+{
+    int ret = CHIDB_OK;
+    *npage = 0;
+
+    pthread_mutex_lock(&bt->free_lock);
+    if (bt->free_head != 0) {
+        MemPage *trunk;
+        if ((ret = chidb_Pager_readPage(bt->pager, bt->free_head, &trunk)) != CHIDB_OK) {
+            pthread_mutex_unlock(&bt->free_lock);
+            return ret;
+        }
+        uint32_t n = get4byte(&trunk->data[FREELIST_NENTRIES_OFFSET]);
+        if (n > 0) {
+            *npage = get4byte(&trunk->data[FREELIST_ENTRIES_OFFSET + (n - 1) * 4]);
+            put4byte(&trunk->data[FREELIST_NENTRIES_OFFSET], n - 1);
+            ret = chidb_Pager_writePage(bt->pager, trunk);
+        } else {
+            *npage = bt->free_head;
+            bt->free_head = get4byte(&trunk->data[FREELIST_NEXT_OFFSET]);
+        }
+        chidb_Pager_releaseMemPage(bt->pager, trunk);
+        if (ret == CHIDB_OK) {
+            bt->n_free--;
+            bt->free_dirty = true;
+        } else {
+            *npage = 0;
+        }
+    }
+    pthread_mutex_unlock(&bt->free_lock);
+
+    return ret;
+}
+
+/* Writes the first trunk page of the freelist and the number of free pages
+ * to the file header, if they changed. The caller must not hold any latch:
+ * page 1 is also the root of the schema table. */
+int freelist_save(BTree *bt)
+{
+    int ret;
+    MemPage *header;
+
+    pthread_mutex_lock(&bt->free_lock);
+    bool dirty = bt->free_dirty;
+    pthread_mutex_unlock(&bt->free_lock);
+    if (!dirty) {
+        return CHIDB_OK;
+    }
+
+    chidb_Pager_latch(bt->pager, 1, true);
+    if ((ret = chidb_Pager_readPage(bt->pager, 1, &header)) == CHIDB_OK) {
+        pthread_mutex_lock(&bt->free_lock);
+        put4byte(&header->data[FREELIST_PAGE_OFFSET], bt->free_head);
+        put4byte(&header->data[FREELIST_COUNT_OFFSET], bt->n_free);
+        bt->free_dirty = false;
+        pthread_mutex_unlock(&bt->free_lock);
+        ret = chidb_Pager_writePage(bt->pager, header);
+        chidb_Pager_releaseMemPage(bt->pager, header);
+    }
+    chidb_Pager_unlatch(bt->pager, 1);
+
+    return ret;
+}
+
+/* Counts the levels of the B-Tree whose (latched) root is root_btn, by
+ * following the first child of every node down to a leaf */
+int delete_height(BTree *bt, BTreeNode *root_btn, uint32_t *height)
+{
+    int ret = CHIDB_OK;
+    npage_t npage = 0;
+    BTreeCell btc;
+
+    *height = 1;
+    if (root_btn->type == PGTYPE_TABLE_LEAF) {
+        return CHIDB_OK;
+    }
+    npage = root_btn->right_page;
+    if (root_btn->n_cells > 0) {
+        chidb_Btree_getCell(root_btn, 0, &btc);
+        npage = btc.fields.tableInternal.child_page;
+    }
+    while (ret == CHIDB_OK && npage != 0) {
+        BTreeNode *btn;
+        (*height)++;
+        if ((ret = chidb_Pager_latch(bt->pager, npage, false)) != CHIDB_OK) {
+            break;
+        }
+        if ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+            chidb_Pager_unlatch(bt->pager, npage);
+            break;
+        }
+        npage = 0;
+        if (btn->type == PGTYPE_TABLE_INTERNAL) {
+            npage = btn->right_page;
+            if (btn->n_cells > 0) {
+                chidb_Btree_getCell(btn, 0, &btc);
+                npage = btc.fields.tableInternal.child_page;
+            }
+        }
+        chidb_Btree_releaseNode(bt, btn);
+    }
+
+    return ret;
+}
+
+/* Deletes the keys from lo to hi in the subtree of a node, which is
+ * latched in exclusive mode and has the given height, and whose keys are
+ * all between min and max. Children whose keys are all in the range are
+ * freed with delete_subtree; children that are partly in the range are
+ * trimmed recursively, and freed if they end up empty. The node is then
+ * written without the children that were freed (or, in a leaf, without the
+ * cells that were deleted), unless it is left empty: in that case, it is
+ * not written, and empty is set so the caller can free it.
+ *
+ * prev_leaf and next_leaf are set to the last leaf before the range and
+ * the first leaf after it, if they are in this subtree (they are left
+ * unchanged otherwise), so they can be linked to each other. */
+int delete_trim(BTree *bt, BTreeNode *btn, uint32_t height, chidb_key_t lo, chidb_key_t hi, chidb_key_t min, chidb_key_t max, npage_t *prev_leaf, npage_t *next_leaf, bool *empty)
+{
+    int ret;
+    npage_t npage = btn->page->npage;
+    BTreeCell btc;
+
+    if ((ret = chidb_Btree_decodeNode(btn)) != CHIDB_OK) {
+        return ret;
+    }
+
+    if (height == 1) {
+        ncell_t first = search_keys(btn->keys, btn->n_cells, lo);
+        ncell_t last = first;
+        while (last < btn->n_cells && btn->keys[last] <= hi) {
+            last++;
+        }
+        if (first > 0) {
+            *prev_leaf = npage;
+        }
+        if (last < btn->n_cells) {
+            *next_leaf = npage;
+        }
+        *empty = first == 0 && last == btn->n_cells;
+        if (first == last || *empty) {
+            return CHIDB_OK;
+        }
+
+        // rebuild the leaf with the cells outside the range
+        BTreeNode *new_btn;
+        if ((ret = chidb_Btree_initEmptyNode(bt, npage, btn->type)) != CHIDB_OK) {
+            return ret;
+        }
+        if ((ret = chidb_Btree_getNodeByPage(bt, npage, &new_btn)) != CHIDB_OK) {
+            return ret;
+        }
+        if (btn->linked) {
+            chidb_Btree_linkLeaf(bt, new_btn, btn->prev_leaf, btn->next_leaf);
+        }
+        ncell_t j = 0;
+        for (ncell_t i = 0; i < btn->n_cells && ret == CHIDB_OK; i++) {
+            if (i < first || i >= last) {
+                chidb_Btree_getCell(btn, i, &btc);
+                ret = chidb_Btree_insertCell(new_btn, j++, &btc);
+            }
+        }
+        if (ret == CHIDB_OK) {
+            ret = chidb_Btree_writeNode(bt, new_btn);
+        }
+        chidb_Btree_freeMemNode(bt, new_btn);
+
+        return ret;
+    }
+
+    npage_t *children = malloc((btn->n_cells + 1) * sizeof(npage_t));
+    chidb_key_t *keys = malloc((btn->n_cells + 1) * sizeof(chidb_key_t));
+    if (children == NULL || keys == NULL) {
+        free(children);
+        free(keys);
+        return CHIDB_ENOMEM;
+    }
+    ncell_t n = 0;
+    bool changed = false;
+    // leaves on either side of the range found in the trimmed children
+    npage_t child_prev = 0, child_next = 0;
+    // children on either side of the range, in case they were not found
+    npage_t last_left = 0, first_right = 0;
+    chidb_key_t c_min = min;
+
+    for (ncell_t i = 0; i <= btn->n_cells && ret == CHIDB_OK; i++) {
+        npage_t child_page = i < btn->n_cells ? btn->children[i] : btn->right_page;
+        chidb_key_t c_max = i < btn->n_cells ? btn->keys[i] : max;
+        bool keep = true;
+        if (child_page == 0) {
+            keep = false;
+        } else if (c_max < lo) {
+            last_left = child_page;
+        } else if (c_min > hi) {
+            if (first_right == 0) {
+                first_right = child_page;
+            }
+        } else if (lo <= c_min && c_max <= hi) {
+            ret = delete_subtree(bt, child_page, height - 1);
+            keep = false;
+            changed = true;
+        } else {
+            BTreeNode *child_btn;
+            bool child_empty;
+            if ((ret = chidb_Pager_latch(bt->pager, child_page, true)) != CHIDB_OK) {
+                break;
+            }
+            if ((ret = chidb_Btree_getNodeByPage(bt, child_page, &child_btn)) != CHIDB_OK) {
+                chidb_Pager_unlatch(bt->pager, child_page);
+                break;
+            }
+            ret = delete_trim(bt, child_btn, height - 1, lo, hi, c_min, c_max,
+                              &child_prev, &child_next, &child_empty);
+            chidb_Btree_releaseNode(bt, child_btn);
+            if (ret == CHIDB_OK && child_empty) {
+                ret = freelist_push(bt, child_page);
+                keep = false;
+                changed = true;
+            }
+        }
+        if (keep) {
+            children[n] = child_page;
+            keys[n] = c_max;
+            n++;
+        }
+        c_min = c_max + 1;
+    }
+
+    if (ret == CHIDB_OK && child_prev == 0 && last_left != 0) {
+        ret = delete_edge_leaf(bt, last_left, height - 1, true, &child_prev);
+    }
+    if (ret == CHIDB_OK && child_next == 0 && first_right != 0) {
+        ret = delete_edge_leaf(bt, first_right, height - 1, false, &child_next);
+    }
+    if (child_prev != 0) {
+        *prev_leaf = child_prev;
+    }
+    if (child_next != 0) {
+        *next_leaf = child_next;
+    }
+    *empty = n == 0;
+    if (ret == CHIDB_OK && changed && n > 0) {
+        ret = delete_rebuild(bt, npage, children, keys, n);
+    }
+    free(children);
+    free(keys);
+
+    return ret;
+}
+
+/* Frees every page of the subtree of the given height rooted at npage.
+ * Internal nodes are read to find their children; leaves are latched in
+ * exclusive mode, to wait for any thread that is using them, but not read */
+int delete_subtree(BTree *bt, npage_t npage, uint32_t height)
+{
+    int ret;
+    if ((ret = chidb_Pager_latch(bt->pager, npage, true)) != CHIDB_OK) {
+        return ret;
+    }
+    if (height > 1) {
+        BTreeNode *btn;
+        if ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+            chidb_Pager_unlatch(bt->pager, npage);
+            return ret;
+        }
+        if ((ret = chidb_Btree_decodeNode(btn)) == CHIDB_OK) {
+            for (ncell_t i = 0; i <= btn->n_cells && ret == CHIDB_OK; i++) {
+                npage_t child_page = i < btn->n_cells ? btn->children[i] : btn->right_page;
+                if (child_page != 0) {
+                    ret = delete_subtree(bt, child_page, height - 1);
+                }
+            }
+        }
+        chidb_Btree_freeMemNode(bt, btn);
+        if (ret != CHIDB_OK) {
+            chidb_Pager_unlatch(bt->pager, npage);
+            return ret;
+        }
+    }
+    chidb_Pager_unlatch(bt->pager, npage);
+
+    return freelist_push(bt, npage);
+}
+
+/* Finds the rightmost (or leftmost) leaf of the subtree of the given
+ * height rooted at npage, without reading the leaf itself. The caller must
+ * hold the root of the tree in exclusive mode, so internal nodes cannot
+ * change under us. */
+int delete_edge_leaf(BTree *bt, npage_t npage, uint32_t height, bool rightmost, npage_t *nleaf)
+{
+    int ret;
+    BTreeNode *btn;
+    BTreeCell btc;
+
+    for (; height > 1; height--) {
+        if ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+            return ret;
+        }
+        npage = btn->right_page;
+        if (btn->n_cells > 0 && (!rightmost || npage == 0)) {
+            chidb_Btree_getCell(btn, rightmost ? btn->n_cells - 1 : 0, &btc);
+            npage = btc.fields.tableInternal.child_page;
+        }
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+    *nleaf = npage;
+
+    return CHIDB_OK;
+}
+
+/* Rewrites a table internal node with the given children: each child but
+ * the last one gets a cell with its key, and the last one becomes the
+ * right page. The node must be latched in exclusive mode. */
+int delete_rebuild(BTree *bt, npage_t npage, npage_t *children, chidb_key_t *keys, ncell_t n)
+{
+    int ret;
+    BTreeNode *btn;
+    BTreeCell btc;
+
+    if ((ret = chidb_Btree_initEmptyNode(bt, npage, PGTYPE_TABLE_INTERNAL)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+        return ret;
+    }
+    btc.type = PGTYPE_TABLE_INTERNAL;
+    for (ncell_t i = 0; i + 1 < n && ret == CHIDB_OK; i++) {
+        btc.key = keys[i];
+        btc.fields.tableInternal.child_page = children[i];
+        ret = chidb_Btree_insertCell(btn, i, &btc);
+    }
+    btn->right_page = children[n - 1];
+    if (ret == CHIDB_OK) {
+        ret = chidb_Btree_writeNode(bt, btn);
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return ret;
+}
+
+/* Links the leaves on either side of a deleted range to each other (or
+ * marks them as the first or last leaf, if there is nothing on the other
+ * side), if the tree's leaves are linked */
+int delete_link(BTree *bt, npage_t prev_leaf, npage_t next_leaf)
+{
+    int ret = CHIDB_OK;
+    BTreeNode *btn;
+
+    if (prev_leaf == next_leaf) {
+        return CHIDB_OK;
+    }
+    for (int i = 0; i < 2 && ret == CHIDB_OK; i++) {
+        npage_t npage = i == 0 ? prev_leaf : next_leaf;
+        if (npage == 0) {
+            continue;
+        }
+        if ((ret = chidb_Pager_latch(bt->pager, npage, true)) != CHIDB_OK) {
+            break;
+        }
+        if ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+            chidb_Pager_unlatch(bt->pager, npage);
+            break;
+        }
+        if (btn->linked && i == 0 && btn->next_leaf != next_leaf) {
+            btn->next_leaf = next_leaf;
+            ret = chidb_Btree_writeNode(bt, btn);
+        } else if (btn->linked && i == 1 && btn->prev_leaf != prev_leaf) {
+            btn->prev_leaf = prev_leaf;
+            ret = chidb_Btree_writeNode(bt, btn);
+        }
+        chidb_Btree_releaseNode(bt, btn);
+    }
+
+    return ret;
+}
+
+/* Rebalances a table B-Tree after a range delete, along the path to lo
+ * (the hole left by the range): at every level, the child where lo goes
+ * is merged with the next child or, if they do not fit in one page, with
+ * the previous one. Finally, a root with a single child takes over the
+ * child's contents. The caller must hold the root in exclusive mode. */
+int delete_rebalance(BTree *bt, npage_t nroot, chidb_key_t lo)
+{
+    int ret = CHIDB_OK;
+    npage_t npage = nroot;
+
+    while (ret == CHIDB_OK) {
+        BTreeNode *btn;
+        ncell_t ncell;
+        bool merged = false;
+        if (npage != nroot && (ret = chidb_Pager_latch(bt->pager, npage, true)) != CHIDB_OK) {
+            break;
+        }
+        if ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) == CHIDB_OK) {
+            if ((ret = chidb_Btree_searchNode(btn, lo, &ncell)) == CHIDB_OK && btn->type == PGTYPE_TABLE_INTERNAL) {
+                if (ncell < btn->n_cells) {
+                    ret = delete_merge(bt, btn, ncell, &merged);
+                }
+                if (ret == CHIDB_OK && !merged && ncell > 0) {
+                    ret = delete_merge(bt, btn, ncell - 1, &merged);
+                }
+            }
+            chidb_Btree_freeMemNode(bt, btn);
+        }
+
+        // go down to the (possibly merged) child where lo goes
+        npage_t child_page = 0;
+        if (ret == CHIDB_OK && (ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) == CHIDB_OK) {
+            if (btn->type == PGTYPE_TABLE_INTERNAL && (ret = chidb_Btree_searchNode(btn, lo, &ncell)) == CHIDB_OK) {
+                child_page = ncell < btn->n_cells ? btn->children[ncell] : btn->right_page;
+            }
+            chidb_Btree_freeMemNode(bt, btn);
+        }
+        if (npage != nroot) {
+            chidb_Pager_unlatch(bt->pager, npage);
+        }
+        if (child_page == 0) {
+            break;
+        }
+        npage = child_page;
+    }
+    if (ret != CHIDB_OK) {
+        return ret;
+    }
+
+    return delete_collapse(bt, nroot);
+}
+
+/* Merges the children of cell ncell and ncell + 1 (or the right page) of a
+ * table internal node into the first one, if they fit in a single page,
+ * and frees the second one. The node must be latched in exclusive mode. */
+int delete_merge(BTree *bt, BTreeNode *parent_btn, ncell_t ncell, bool *merged)
+{
+    int ret;
+    BTreeNode *left_btn, *right_btn, *new_btn;
+    BTreeCell btc;
+    npage_t left_page = parent_btn->children[ncell];
+    npage_t right_page = ncell + 1 < parent_btn->n_cells ? parent_btn->children[ncell + 1] : parent_btn->right_page;
+
+    *merged = false;
+    if (left_page == 0 || right_page == 0) {
+        return CHIDB_OK;
+    }
+    if ((ret = chidb_Pager_latch(bt->pager, left_page, true)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, left_page, &left_btn)) != CHIDB_OK) {
+        chidb_Pager_unlatch(bt->pager, left_page);
+        return ret;
+    }
+    if ((ret = chidb_Pager_latch(bt->pager, right_page, true)) != CHIDB_OK) {
+        chidb_Btree_releaseNode(bt, left_btn);
+        return ret;
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, right_page, &right_btn)) != CHIDB_OK) {
+        chidb_Pager_unlatch(bt->pager, right_page);
+        chidb_Btree_releaseNode(bt, left_btn);
+        return ret;
+    }
+
+    // the merged node needs room for the cells of both nodes, plus the
+    // separator that takes the place of the left node's right page
+    uint32_t size = delete_node_bytes(bt, left_btn) + delete_node_bytes(bt, right_btn);
+    if (left_btn->type == PGTYPE_TABLE_INTERNAL) {
+        size += INTPG_CELLSOFFSET_OFFSET + TABLEINTCELL_SIZE + 2;
+    } else {
+        size += LEAFPG_CELLSOFFSET_OFFSET + (left_btn->linked ? LEAFPG_LINKS_SIZE : 0);
+    }
+    if (left_btn->type != right_btn->type || size > bt->pager->page_size) {
+        chidb_Btree_releaseNode(bt, right_btn);
+        chidb_Btree_releaseNode(bt, left_btn);
+        return CHIDB_OK;
+    }
+
+    if ((ret = chidb_Btree_initEmptyNode(bt, left_page, left_btn->type)) == CHIDB_OK
+        && (ret = chidb_Btree_getNodeByPage(bt, left_page, &new_btn)) == CHIDB_OK) {
+        ncell_t j = 0;
+        if (left_btn->linked) {
+            chidb_Btree_linkLeaf(bt, new_btn, left_btn->prev_leaf, right_btn->next_leaf);
+        }
+        for (ncell_t i = 0; i < left_btn->n_cells && ret == CHIDB_OK; i++) {
+            chidb_Btree_getCell(left_btn, i, &btc);
+            ret = chidb_Btree_insertCell(new_btn, j++, &btc);
+        }
+        if (ret == CHIDB_OK && left_btn->type == PGTYPE_TABLE_INTERNAL) {
+            btc.type = PGTYPE_TABLE_INTERNAL;
+            btc.key = parent_btn->keys[ncell];
+            btc.fields.tableInternal.child_page = left_btn->right_page;
+            ret = chidb_Btree_insertCell(new_btn, j++, &btc);
+        }
+        for (ncell_t i = 0; i < right_btn->n_cells && ret == CHIDB_OK; i++) {
+            chidb_Btree_getCell(right_btn, i, &btc);
+            ret = chidb_Btree_insertCell(new_btn, j++, &btc);
+        }
+        new_btn->right_page = right_btn->right_page;
+        if (ret == CHIDB_OK) {
+            ret = chidb_Btree_writeNode(bt, new_btn);
+        }
+        chidb_Btree_freeMemNode(bt, new_btn);
+    }
+    npage_t next_leaf = right_btn->linked ? right_btn->next_leaf : 0;
+    chidb_Btree_releaseNode(bt, right_btn);
+    chidb_Btree_releaseNode(bt, left_btn);
+    if (ret == CHIDB_OK && next_leaf != 0) {
+        ret = delete_link(bt, left_page, next_leaf);
+    }
+    if (ret != CHIDB_OK) {
+        return ret;
+    }
+
+    // the parent loses the left node's cell, and the right node's slot
+    // points to the merged node
+    ncell_t n = 0;
+    npage_t *children = malloc((parent_btn->n_cells + 1) * sizeof(npage_t));
+    chidb_key_t *keys = malloc((parent_btn->n_cells + 1) * sizeof(chidb_key_t));
+    if (children == NULL || keys == NULL) {
+        free(children);
+        free(keys);
+        return CHIDB_ENOMEM;
+    }
+    for (ncell_t i = 0; i <= parent_btn->n_cells; i++) {
+        if (i == ncell) {
+            continue;
+        }
+        children[n] = i < parent_btn->n_cells ? parent_btn->children[i] : parent_btn->right_page;
+        keys[n] = i < parent_btn->n_cells ? parent_btn->keys[i] : 0;
+        if (i == ncell + 1) {
+            children[n] = left_page;
+        }
+        n++;
+    }
+    ret = delete_rebuild(bt, parent_btn->page->npage, children, keys, n);
+    free(children);
+    free(keys);
+    if (ret == CHIDB_OK) {
+        ret = freelist_push(bt, right_page);
+        *merged = true;
+    }
+
+    return ret;
+}
+
+/* Replaces the contents of a root with a single child (and no cells) with
+ * the contents of the child, as long as they fit, and frees the child. The
+ * caller must hold the root in exclusive mode. */
+int delete_collapse(BTree *bt, npage_t nroot)
+{
+    int ret = CHIDB_OK;
+
+    while (ret == CHIDB_OK) {
+        BTreeNode *root_btn, *child_btn, *new_btn;
+        BTreeCell btc;
+        if ((ret = chidb_Btree_getNodeByPage(bt, nroot, &root_btn)) != CHIDB_OK) {
+            break;
+        }
+        npage_t child_page = root_btn->right_page;
+        bool single = root_btn->type == PGTYPE_TABLE_INTERNAL && root_btn->n_cells == 0 && child_page != 0;
+        chidb_Btree_freeMemNode(bt, root_btn);
+        if (!single) {
+            break;
+        }
+
+        if ((ret = chidb_Pager_latch(bt->pager, child_page, true)) != CHIDB_OK) {
+            break;
+        }
+        if ((ret = chidb_Btree_getNodeByPage(bt, child_page, &child_btn)) != CHIDB_OK) {
+            chidb_Pager_unlatch(bt->pager, child_page);
+            break;
+        }
+        // the root stays unlinked (it is the only leaf)
+        uint32_t size = delete_node_bytes(bt, child_btn) + (nroot == 1 ? HEADER_OFFSET : 0)
+            + (child_btn->type == PGTYPE_TABLE_INTERNAL ? INTPG_CELLSOFFSET_OFFSET : LEAFPG_CELLSOFFSET_OFFSET);
+        if (size > bt->pager->page_size) {
+            chidb_Btree_releaseNode(bt, child_btn);
+            break;
+        }
+        if ((ret = chidb_Btree_initEmptyNode(bt, nroot, child_btn->type)) == CHIDB_OK
+            && (ret = chidb_Btree_getNodeByPage(bt, nroot, &new_btn)) == CHIDB_OK) {
+            for (ncell_t i = 0; i < child_btn->n_cells && ret == CHIDB_OK; i++) {
+                chidb_Btree_getCell(child_btn, i, &btc);
+                ret = chidb_Btree_insertCell(new_btn, i, &btc);
+            }
+            new_btn->right_page = child_btn->right_page;
+            if (ret == CHIDB_OK) {
+                ret = chidb_Btree_writeNode(bt, new_btn);
+            }
+            chidb_Btree_freeMemNode(bt, new_btn);
+        }
+        chidb_Btree_releaseNode(bt, child_btn);
+        if (ret == CHIDB_OK) {
+            ret = freelist_push(bt, child_page);
+        }
+    }
+
+    return ret;
+}
+
+/* Number of bytes used in a node by its cells and their offsets */
+uint16_t delete_node_bytes(BTree *bt, BTreeNode *btn)
+{
+    uint16_t end = bt->pager->page_size - (btn->linked ? LEAFPG_LINKS_SIZE : 0);
+
+    return end - btn->cells_offset + 2 * btn->n_cells;
+}
+
+
+/* Reads the header of a B-Tree node from its in-memory page
+ *
+ * Fills in every field of btn except page (which must be set) and the
+ * decoded sidecar.
+ */
+void node_read_header(BTree *bt, BTreeNode *btn)
+{
+    uint8_t *data = btn->page->data;
+    if (btn->page->npage == 1) {
+        data += HEADER_BUF_SIZE;
+    }
+    btn->type = data[0];
+    btn->free_offset = (data[1] << 8) | data[2];
+    btn->n_cells = (data[3] << 8) | data[4];
+    btn->cells_offset = (data[5] << 8) | data[6];
+    if (PGTYPE_IS_INTERNAL(btn->type)) {
+        btn->right_page = (data[8] << 24) | (data[9] << 16) | (data[10] << 8) | data[11];
+        btn->celloffset_array = data + INTPG_CELLSOFFSET_OFFSET;
+    } else {
+        btn->right_page = 0;
+        btn->celloffset_array = data + LEAFPG_CELLSOFFSET_OFFSET;
+    }
+    btn->linked = false;
+    btn->next_leaf = 0;
+    btn->prev_leaf = 0;
+    if (btn->type == PGTYPE_TABLE_LEAF && (data[PGHEADER_ZERO_OFFSET] & PGFLAG_LINKED)) {
+        uint8_t *end = btn->page->data + bt->pager->page_size;
+        btn->linked = true;
+        btn->next_leaf = get4byte(end - LEAFPG_NEXT_OFFSET);
+        btn->prev_leaf = get4byte(end - LEAFPG_PREV_OFFSET);
+    }
+}
+
+
+/* Bumps the change counter of a B-Tree (see chidb_Btree_changes). Must
+ * be called after the change, not before, so that anyone who read the
+ * counter before reading a node that was changed sees it move. */
+void changes_bump(BTree *bt, npage_t nroot)
+{
+    __atomic_add_fetch(&bt->changes[nroot % CHANGE_SLOTS], 1, __ATOMIC_SEQ_CST);
+}
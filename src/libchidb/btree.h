@@ -42,6 +42,7 @@
 
 #include "chidbInt.h"
 #include "pager.h"
+#include "bloom.h"
 
 /* Page header offsets and sizes */
 
@@ -50,6 +51,15 @@
 #define PGTYPE_INDEX_INTERNAL (0x02)
 #define PGTYPE_INDEX_LEAF (0x0A)
 
+/* Index B-Trees with variable-length keys (see chidb_Btree_insertInVarIndex).
+ * These are not SQLite page types. */
+#define PGTYPE_VARINDEX_INTERNAL (0x03)
+#define PGTYPE_VARINDEX_LEAF (0x0B)
+
+#define PGTYPE_IS_INTERNAL(type) ((type) == PGTYPE_TABLE_INTERNAL || \
+                                  (type) == PGTYPE_INDEX_INTERNAL || \
+                                  (type) == PGTYPE_VARINDEX_INTERNAL)
+
 #define PGHEADER_PGTYPE_OFFSET (0)
 #define PGHEADER_FREE_OFFSET (1)
 #define PGHEADER_NCELLS_OFFSET (3)
@@ -57,6 +67,17 @@
 #define PGHEADER_ZERO_OFFSET (7)
 #define PGHEADER_RIGHTPG_OFFSET (8)
 
+/* Table leaf pages may have links to their siblings, so that leaves can be
+ * traversed in key order without going through their parents. If the
+ * PGFLAG_LINKED bit is set in the (otherwise zero) byte at
+ * PGHEADER_ZERO_OFFSET, the last LEAFPG_LINKS_SIZE bytes of the page hold
+ * the page number of the next leaf and of the previous leaf (0 at either
+ * end of the tree), and the cell area ends right before them. */
+#define PGFLAG_LINKED (0x01)
+#define LEAFPG_LINKS_SIZE (8)
+#define LEAFPG_NEXT_OFFSET (8)  /* From the end of the page */
+#define LEAFPG_PREV_OFFSET (4)  /* From the end of the page */
+
 #define LEAFPG_CELLSOFFSET_OFFSET (8)
 #define INTPG_CELLSOFFSET_OFFSET (12)
 
@@ -83,6 +104,27 @@
 #define INDEXINTCELL_SIZE (16)
 #define INDEXLEAFCELL_SIZE (12)
 
+/* Cells of variable-length key indexes. Keys are arbitrary byte strings,
+ * ordered by memcmp (a key that is a prefix of another one goes first).
+ * Like table B-Trees, these are B+-Trees: every entry is in a leaf, and
+ * internal cells only hold separators, which are truncated to the shortest
+ * prefix that still separates their children (see
+ * chidb_Btree_insertInVarIndex). The key of a leaf cell is followed by the
+ * size of the cell's data (VARINDEXLEAFCELL_DATASIZE_SIZE bytes) and the
+ * data itself, which covering indexes use to store columns that are not
+ * part of the key (see chidb_Btree_insertInCoveringIndex). */
+#define VARINDEXINTCELL_CHILD_OFFSET (0)
+#define VARINDEXINTCELL_KEYSIZE_OFFSET (4)
+#define VARINDEXINTCELL_KEY_OFFSET (8)
+
+#define VARINDEXLEAFCELL_KEYPK_OFFSET (0)
+#define VARINDEXLEAFCELL_KEYSIZE_OFFSET (4)
+#define VARINDEXLEAFCELL_KEY_OFFSET (8)
+#define VARINDEXLEAFCELL_DATASIZE_SIZE (4)
+
+#define VARINDEXINTCELL_SIZE_WITHOUTKEY (8)
+#define VARINDEXLEAFCELL_SIZE_WITHOUTKEY (12)
+
 #define HEADER_OFFSET (100)
 #define HEADER_BUF_SIZE (100)
 #define MAGIC_BUF_SIZE (16)
@@ -102,6 +144,23 @@
 #define MAGIC_NUM_7_OFFSET (56)
 #define MAGIC_NUM_8_OFFSET (64)
 
+/* Page number of the metadata directory (0 if the file has none). This
+ * field is not part of the SQLite header (where it is unused). */
+#define META_PAGE_OFFSET (72)
+
+/* First trunk page of the freelist (0 if it is empty) and number of pages
+ * in it, trunks included (see chidb_Btree_deleteRange). Not part of the
+ * SQLite header either. */
+#define FREELIST_PAGE_OFFSET (76)
+#define FREELIST_COUNT_OFFSET (80)
+
+/* A freelist trunk page holds the page number of the next trunk (0 if
+ * none), the number of entries in it, and the entries: the page numbers
+ * of free pages. */
+#define FREELIST_NEXT_OFFSET (0)
+#define FREELIST_NENTRIES_OFFSET (4)
+#define FREELIST_ENTRIES_OFFSET (8)
+
 #define DEFAULT_MAGIC_NUM_1 (0x0101)
 #define DEFAULT_MAGIC_NUM_2 (0x00402020)
 #define DEFAULT_MAGIC_NUM_3 (0x00)
@@ -117,15 +176,194 @@
 typedef struct BTreeCell BTreeCell;
 typedef struct BTreeNode BTreeNode;
 
+/* The metadata directory is a page with per-tree settings and structures
+ * that are not part of the trees themselves (such as Bloom filters). It
+ * starts with the number of entries, followed by one entry per B-Tree:
+ *
+ *   0  Root page of the B-Tree
+ *   4  First page of the Bloom filter (0 if the tree has no filter)
+ *   8  Number of pages of the Bloom filter
+ *  12  Number of keys added to the Bloom filter in bulk
+ *  16  Bits per key of the Bloom filter
+ *  17  Fill factor of the B-Tree (0 for DEFAULT_FILL_FACTOR)
+ *  18  Split flags of the B-Tree (see METAFLAG_SPLIT_BY_BYTES)
+ *  19  Unused (zero)
+ */
+#define METAPG_NENTRIES_OFFSET (0)
+#define METAPG_ENTRIES_OFFSET (4)
+#define METAENTRY_SIZE (24)
+#define METAENTRY_NROOT_OFFSET (0)
+#define METAENTRY_BLOOMPG_OFFSET (4)
+#define METAENTRY_BLOOMNPAGES_OFFSET (8)
+#define METAENTRY_BLOOMNKEYS_OFFSET (12)
+#define METAENTRY_BLOOMBPK_OFFSET (16)
+#define METAENTRY_FILLFACTOR_OFFSET (17)
+#define METAENTRY_SPLITFLAGS_OFFSET (18)
+
+#define METAFLAG_SPLIT_BY_BYTES (0x01)
+
+#define DEFAULT_FILL_FACTOR (100)
+#define MIN_FILL_FACTOR (10)
+
+/* How the full nodes of a B-Tree are split (see chidb_Btree_splitCell).
+ * When a node on the right edge of the tree overflows because of an
+ * append, fill_factor percent of it stays in the left node, so the nodes
+ * left behind by increasing insertions (and bulk loads) keep some room
+ * for later insertions. Any other node is split in half. Nodes are split
+ * by number of cells or, if by_bytes is set, by size, which keeps table
+ * leaves with records of very different sizes balanced. */
+typedef struct BTreeSplitPolicy
+{
+    uint8_t fill_factor;  /* Percentage, from MIN_FILL_FACTOR to 100 */
+    bool by_bytes;        /* Split by size instead of number of cells */
+} BTreeSplitPolicy;
+
+/* In-memory copy of an entry of the metadata directory */
+typedef struct BTreeMeta
+{
+    npage_t nroot;        /* Root page of the B-Tree */
+    BloomFilter *bloom;   /* Bloom filter of the B-Tree's keys (or NULL) */
+    BTreeSplitPolicy split;  /* How the B-Tree's nodes are split */
+} BTreeMeta;
+
+#define APPEND_CACHE_SIZE (8)
+
+/* Number of change counters of a B-Tree file (see chidb_Btree_changes).
+ * B-Trees whose root pages are equal modulo CHANGE_SLOTS share a counter,
+ * so a change to one of them is also seen as a change to the others. */
+#define CHANGE_SLOTS (64)
+
+/* The append cache remembers, for the B-Trees that were inserted into most
+ * recently, which page is the rightmost leaf of the tree and the largest key
+ * stored in it. A key larger than max_key can be inserted straight into that
+ * leaf without descending from the root (see chidb_Btree_insert). An entry
+ * with nleaf == 0, or looked up before the last time pages were freed, is
+ * stale. An entry is filled in by any insertion whose descent reaches the
+ * rightmost leaf, so keeping it up to date takes no extra descents. */
+typedef struct BTreeAppendCache
+{
+    npage_t nroot;        /* Root page of the B-Tree (0 if entry is unused) */
+    npage_t nleaf;        /* Rightmost leaf of the B-Tree */
+    chidb_key_t max_key;  /* Largest key in the B-Tree */
+    uint64_t epoch;       /* free_epoch when nleaf was looked up */
+} BTreeAppendCache;
+
+/* A leaf that chidb_Btree_insertBatch fills with a run of its cells, and
+ * the leaf's parent, both latched in exclusive mode */
+typedef struct BTreeBatchLeaf
+{
+    BTreeNode *leaf;      /* The leaf */
+    BTreeNode *parent;    /* Its parent (NULL if the leaf is the root) */
+    ncell_t parent_cell;  /* Cell of the parent that points to the leaf
+                           * (n_cells if it is the right page) */
+    bool rightmost;       /* The leaf is on the right edge of the tree */
+    bool bounded;         /* Keys in the leaf are <= bound (table) or < bound */
+    chidb_key_t bound;    /* (index); otherwise, they have no upper bound   */
+} BTreeBatchLeaf;
+
+#define DEFAULT_INSERT_BUFFER_SIZE (1024)
+
+/* An insert buffer collects the entries inserted into an index B-Tree (see
+ * chidb_Btree_bufferIndex), sorted by key, and merges them into the tree
+ * with chidb_Btree_insertBatch when it fills up. This turns a descent into
+ * the index for every insertion into a few descents per leaf. Lookups check
+ * the buffer before the tree. Buffers only live in memory, and are merged
+ * when the B-Tree file is closed. */
+typedef struct BTreeInsertBuffer
+{
+    npage_t nroot;          /* Root page of the index B-Tree */
+    pthread_mutex_t lock;   /* Protects cells and n. Held during a merge */
+    BTreeCell *cells;       /* Buffered entries, sorted by key */
+    uint32_t n;             /* Number of entries in cells */
+    uint32_t capacity;      /* Number of entries that fit in cells */
+    struct BTreeInsertBuffer *next;
+} BTreeInsertBuffer;
+
+/* A pinned node is a decoded copy of an internal node in the top levels of
+ * a B-Tree (see chidb_Btree_pinLevels). Descents search its keys instead of
+ * reading its page, and go down to the pinned nodes below it through the
+ * pinned array, without going through the pager. */
+typedef struct BTreePinnedNode
+{
+    npage_t npage;          /* Page of the node */
+    uint8_t type;           /* Type of the node (always internal) */
+    ncell_t n_cells;        /* Number of cells */
+    chidb_key_t *keys;      /* Keys, padded like a decoded sidecar */
+    npage_t *children;      /* Child page of each cell, and right_page after them */
+    struct BTreePinnedNode **pinned;  /* Pinned node of each child (or NULL) */
+} BTreePinnedNode;
+
+/* The pinned top levels of a B-Tree. They are rebuilt whenever a pinned
+ * page is written, which only happens when a node below them is split:
+ * every such write bumps the B-Tree file's pin_epoch, and the nodes are
+ * only used while epoch is still equal to it. */
+typedef struct BTreePinnedTree
+{
+    npage_t nroot;          /* Root page of the B-Tree */
+    uint8_t levels;         /* Number of levels to pin */
+    npage_t max_pages;      /* Most pages to pin (0 for no limit) */
+    uint64_t epoch;         /* pin_epoch when the nodes were read */
+    BTreePinnedNode *root;  /* Pinned root (NULL if the root is a leaf) */
+    npage_t n_nodes;        /* Number of pinned nodes */
+    npage_t *pages;         /* Resident pages (those of the pinned nodes, or
+                             * the root if it is a leaf, so that its first
+                             * split is noticed), sorted */
+    npage_t n_pages;        /* Number of resident pages */
+    struct BTreePinnedTree *next;
+} BTreePinnedTree;
+
 /* The BTree struct represent a "B-Tree file". It contains a pointer to the
  * chidb database it is a part of, and a pointer to a Pager, which it will
- * use to access pages on the file */
+ * use to access pages on the file
+ *
+ * A BTree can be searched and inserted into by several threads at once.
+ * Every node is latched (see chidb_Pager_latch) while it is being read or
+ * modified, and latches are acquired from the root down ("latch crabbing"):
+ * the latch of a node is only released once its child is latched and it is
+ * known that the child will not have to be split. Siblings are only latched
+ * right to left (when a split updates the link of the previous leaf), so
+ * threads can never wait on each other in a cycle. A range delete (see
+ * chidb_Btree_deleteRange) keeps the root latched in exclusive mode until
+ * it is done, so it can latch siblings in any order. */
 typedef struct BTree
 {
     chidb *db;
     Pager *pager;
+
+    pthread_mutex_t lock;  /* Protects append_cache and append_next */
+    BTreeAppendCache append_cache[APPEND_CACHE_SIZE];
+    uint8_t append_next;  /* Next entry of append_cache to replace */
+
+    /* Held in shared mode while reading meta or ibufs or inserting into a
+     * tree, and in exclusive mode while changing them or building a filter */
+    pthread_rwlock_t meta_latch;
+    npage_t meta_page;    /* Page of the metadata directory (0 if none) */
+    BTreeMeta *meta;      /* Entries of the metadata directory */
+    uint16_t n_meta;      /* Number of entries in meta */
+    BTreeInsertBuffer *ibufs;  /* Insert buffers of the index B-Trees */
+
+    /* Held in shared mode while descending through pinned nodes, and in
+     * exclusive mode while pinning, unpinning or rebuilding them */
+    pthread_rwlock_t pin_latch;
+    BTreePinnedTree *pinned;   /* B-Trees with pinned top levels */
+    uint64_t pin_epoch;        /* Bumped whenever a pinned page is written */
+
+    /* Pages freed by chidb_Btree_deleteRange, which chidb_Btree_newNode
+     * reuses before growing the file. The freelist is written to the file
+     * header at the end of every range delete and when the file is closed.
+     * No latch may be acquired while holding free_lock. */
+    pthread_mutex_t free_lock;
+    npage_t free_head;         /* First trunk page (0 if the freelist is empty) */
+    npage_t n_free;            /* Number of free pages, trunks included */
+    bool free_dirty;           /* Changed since it was last written */
+    uint64_t free_epoch;       /* Bumped before a range delete frees pages */
+
+    /* Change counter of each B-Tree, bumped after every insertion into
+     * it and every range delete (see chidb_Btree_changes) */
+    uint64_t changes[CHANGE_SLOTS];
 } Btree;
 
+
 /* The BTreeNode struct is an in-memory representation of a B-Tree node. Thus,
  * most of the values in this struct are simply a copy, for ease of access,
  * of what can be found in the raw disk page. When modifying type, free_offset,
@@ -147,6 +385,15 @@ struct BTreeNode
     uint16_t cells_offset;     /* Byte offset of start of cells in page */
     npage_t right_page;        /* Right page (internal nodes only) */
     uint8_t *celloffset_array; /* Pointer to start of cell offset array in the in-memory page */
+    bool linked;               /* Leaf with sibling links (see PGFLAG_LINKED) */
+    npage_t next_leaf;         /* Next leaf (linked leaves only, 0 if none) */
+    npage_t prev_leaf;         /* Previous leaf (linked leaves only, 0 if none) */
+
+    /* Decoded sidecar (see chidb_Btree_decodeNode). NULL until the node is
+     * searched, and discarded whenever a cell is inserted. */
+    chidb_key_t *keys;         /* Native-endian keys, padded with UINT32_MAX */
+    npage_t *children;         /* Child page of each cell (internal nodes only) */
+    Pager *pager;              /* Pager that caches the sidecar with the page */
 };
 
 /* BTreeCell is an in-memory representation of a cell. See The chidb File Format
@@ -154,7 +401,8 @@ struct BTreeNode
 struct BTreeCell
 {
     uint8_t type;  /* Type of page where this cell is contained */
-    chidb_key_t key;     /* Key */
+    chidb_key_t key;     /* Key (first four bytes of the key, big-endian and
+                          * padded with zeros, in variable-length key indexes) */
     union
     {
         struct
@@ -175,30 +423,156 @@ struct BTreeCell
         {
             chidb_key_t keyPk;         /* Primary key of row where the indexed field is equal to key */
         } indexLeaf;
+        struct
+        {
+            npage_t child_page;  /* Child page with keys < key_data (internal nodes only) */
+            chidb_key_t keyPk;   /* Primary key of the row (leaf nodes only) */
+            uint16_t key_size;   /* Number of bytes of the key */
+            uint8_t *key_data;   /* Pointer to in-memory copy of the key */
+            uint16_t data_size;  /* Number of bytes of data (leaf nodes only) */
+            uint8_t *data;       /* Pointer to in-memory copy of the data */
+        } varIndex;
     } fields;
 };
 
+/* Number of buckets in the fill factor histogram of BTreeStats. Bucket i
+ * counts the pages that are between i% and (i+1)% full. */
+#define BTREE_FILL_BUCKETS (100)
+
+/* BTreeStats holds the results of chidb_Btree_analyze. Byte counts only
+ * include the part of each page that can hold cells (i.e., they exclude
+ * the page header, the file header in page 1, and the sibling links of
+ * linked leaves), so used_bytes + free_bytes + fragmented_bytes is always
+ * equal to usable_bytes. */
+typedef struct BTreeStats
+{
+    uint8_t type;               /* Type of the root page */
+    uint32_t depth;             /* Number of levels (1 if the root is a leaf) */
+    uint32_t n_pages;           /* Number of pages */
+    uint32_t n_internal;        /* Number of internal pages */
+    uint32_t n_leaf;            /* Number of leaf pages */
+    uint32_t n_linked;          /* Number of leaves with sibling links */
+    uint64_t n_cells;           /* Number of cells (in all pages) */
+    uint64_t n_entries;         /* Number of entries (table rows or index keys) */
+    uint64_t usable_bytes;      /* Bytes that can hold cells */
+    uint64_t used_bytes;        /* Bytes used by cells and the cell offset arrays */
+    uint64_t free_bytes;        /* Bytes between the cell offset array and the cells */
+    uint64_t fragmented_bytes;  /* Bytes in the cell area not used by any cell */
+    uint32_t fill_hist[BTREE_FILL_BUCKETS];  /* Fill factor histogram */
+    double fill_avg;            /* Average fill factor (0 to 1) */
+    double fill_p10;            /* Fill factor percentiles (upper bound of the */
+    double fill_p50;            /* histogram bucket the percentile falls in)   */
+    double fill_p90;
+    chidb_key_t min_key;        /* Smallest key (0 if there are no integer keys) */
+    chidb_key_t max_key;        /* Largest key (0 if there are no integer keys) */
+    double key_density;         /* n_entries / (max_key - min_key + 1) */
+} BTreeStats;
+
+#define BTREE_MAX_DEPTH (32)
+
+/* Sizes of the nodes that chidb_Btree_estimateRange read at one level of a
+ * B-Tree, and the number of subtrees rooted at that level that lie entirely
+ * within the range. */
+typedef struct BTreeLevelSizes
+{
+    uint32_t n_nodes;           /* Nodes read at this level */
+    double sum_children;        /* Child pointers in those nodes */
+    double sum_cells;           /* Cells in those nodes */
+    uint32_t min_children, max_children;
+    uint32_t min_cells, max_cells;
+    uint64_t n_covered;         /* Subtrees entirely within the range */
+} BTreeLevelSizes;
+
+/* BTreeRangeEstimate holds the results of chidb_Btree_estimateRange. The
+ * entries in the pages that were read are counted exactly; the rest are
+ * extrapolated from the size of the nodes that were read. */
+typedef struct BTreeRangeEstimate
+{
+    uint8_t type;               /* Type of the root page */
+    uint32_t depth;             /* Number of levels */
+    uint32_t n_pages;           /* Pages read */
+    uint64_t exact;             /* Entries in range found in the pages read */
+    double estimate;            /* Estimated number of entries in range */
+    double low;                 /* Estimate with the smallest nodes read */
+    double high;                /* Estimate with the largest nodes read */
+} BTreeRangeEstimate;
+
+/* A cursor over a variable-length key index. It holds a copy of the leaf
+ * it is positioned on (which is not latched), so the entries of that leaf
+ * can be read with chidb_Btree_getCell(cursor->leaf, cursor->ncell, ...)
+ * even while other threads modify the index. */
+typedef struct BTreeVarIndexCursor
+{
+    npage_t nroot;     /* Root page of the index */
+    BTreeNode *leaf;   /* Copy of the current leaf (NULL if not positioned) */
+    ncell_t ncell;     /* Current cell in leaf */
+} BTreeVarIndexCursor;
+
 
 int chidb_Btree_open(const char *filename, chidb *db, BTree **bt);
 int chidb_Btree_close(BTree *bt);
 
 int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **node);
+int chidb_Btree_reloadNode(BTree *bt, npage_t npage, BTreeNode *btn);
 int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn);
 
 int chidb_Btree_newNode(BTree *bt, npage_t *npage, uint8_t type);
 int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type);
 int chidb_Btree_writeNode(BTree *bt, BTreeNode *node);
+int chidb_Btree_linkLeaf(BTree *bt, BTreeNode *btn, npage_t prev_leaf, npage_t next_leaf);
 
 int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
 int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
+int chidb_Btree_decodeNode(BTreeNode *btn);
+int chidb_Btree_searchNode(BTreeNode *btn, chidb_key_t key, ncell_t *ncell);
 
 int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size);
+int chidb_Btree_findLeaf(BTree *bt, npage_t nroot, chidb_key_t key, bool exclusive, BTreeNode **leaf, bool *bounded, chidb_key_t *bound);
+int chidb_Btree_releaseNode(BTree *bt, BTreeNode *btn);
 
 int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size);
 int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk);
 int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc);
-int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc);
+int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc, const BTreeSplitPolicy *policy);
+int chidb_Btree_insertBatch(BTree *bt, npage_t nroot, BTreeCell *cells, uint32_t n);
 int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_cell, npage_t *npage_child2);
+int chidb_Btree_splitAt(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_cell, ncell_t mid_cell, npage_t *npage_child2);
+
+bool chidb_Btree_isFull(BTreeNode *btn, BTreeCell *btc);
+ncell_t chidb_Btree_splitCell(BTreeNode *btn, BTreeCell *btc, bool rightmost, const BTreeSplitPolicy *policy);
+int chidb_Btree_findRightmostLeaf(BTree *bt, npage_t nroot, npage_t *nleaf, chidb_key_t *max_key);
+
+int chidb_Btree_deleteRange(BTree *bt, npage_t nroot, chidb_key_t lo, chidb_key_t hi);
+npage_t chidb_Btree_freePages(BTree *bt);
+uint64_t chidb_Btree_changes(BTree *bt, npage_t nroot);
+
+int chidb_Btree_setSplitPolicy(BTree *bt, npage_t nroot, uint8_t fill_factor, bool by_bytes);
+void chidb_Btree_getSplitPolicy(BTree *bt, npage_t nroot, BTreeSplitPolicy *policy);
+
+int chidb_Btree_pinLevels(BTree *bt, npage_t nroot, uint8_t levels, npage_t max_pages);
+npage_t chidb_Btree_pinnedPages(BTree *bt, npage_t nroot);
+
+int chidb_Btree_bloomCreate(BTree *bt, npage_t nroot, double fp_rate);
+int chidb_Btree_bloomRebuild(BTree *bt, npage_t nroot);
+bool chidb_Btree_bloomMayContain(BTree *bt, npage_t nroot, chidb_key_t key);
+
+int chidb_Btree_analyze(BTree *bt, npage_t nroot, BTreeStats *stats);
+int chidb_Btree_estimateRange(BTree *bt, npage_t nroot, chidb_key_t lo, chidb_key_t hi, uint32_t n_samples, BTreeRangeEstimate *est);
+int chidb_Btree_partition(BTree *bt, npage_t nroot, uint32_t n, chidb_key_t *bounds, uint32_t *n_bounds);
+
+int chidb_Btree_bufferIndex(BTree *bt, npage_t nroot, uint32_t capacity);
+int chidb_Btree_flushIndexBuffer(BTree *bt, npage_t nroot);
+int chidb_Btree_findIndexEntry(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t *keyPk);
+
+int chidb_Btree_varKeyCompare(const uint8_t *key1, uint16_t size1, const uint8_t *key2, uint16_t size2);
+uint16_t chidb_Btree_varKeyMaxSize(BTree *bt);
+uint16_t chidb_Btree_encodeTextKey(const char *text, chidb_key_t keyPk, uint8_t *key);
+int chidb_Btree_insertInVarIndex(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, chidb_key_t keyPk);
+int chidb_Btree_insertInCoveringIndex(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, chidb_key_t keyPk, const uint8_t *data, uint16_t data_size);
+int chidb_Btree_findInVarIndex(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, chidb_key_t *keyPk);
+int chidb_Btree_seekVarIndex(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, BTreeVarIndexCursor *cursor);
+int chidb_Btree_nextVarIndex(BTree *bt, BTreeVarIndexCursor *cursor);
+int chidb_Btree_closeVarIndex(BTree *bt, BTreeVarIndexCursor *cursor);
 
 
 #endif /*BTREE_H_*/
@@ -60,6 +60,7 @@
 #define CHIDB_EDUPLICATE (8)
 #define CHIDB_EEMPTY (9)
 #define CHIDB_EPARSE (10)
+#define CHIDB_ETOOBIG (11)
 
 
 #define DEFAULT_PAGE_SIZE (1024)
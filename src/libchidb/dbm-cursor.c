@@ -39,6 +39,27 @@
 
 
 #include "dbm-cursor.h"
+#include "hash.h"
+
+/* Forward declaration of auxiliary functions. */
+int chidb_cursor_hop(BTree *bt, chidb_dbm_cursor_t *cursor, bool forward);
+int cursor_load(BTree *bt, chidb_dbm_cursor_t *cursor, uint32_t level, npage_t npage);
+int cursor_descend(BTree *bt, chidb_dbm_cursor_t *cursor, npage_t npage, bool leftmost);
+int cursor_child(BTreeNode *btn, ncell_t ncell, npage_t *npage);
+int cursor_seek(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_key_t key);
+int cursor_restore(BTree *bt, chidb_dbm_cursor_t *cursor);
+bool cursor_finger(chidb_dbm_cursor_t *cursor, chidb_key_t key, uint32_t *level);
+int cursor_decode_row(chidb_dbm_cursor_t *cursor, uint8_t *data);
+int batch_reserve(chidb_dbm_vector_t *vector, uint32_t n_rows);
+int batch_put(chidb_dbm_vector_t *vector, uint32_t row, uint8_t *field, uint32_t field_len);
+void lookup_leave(chidb_dbm_cursor_t *cursor);
+int lookup_fill(BTree *bt, chidb_dbm_lookup_t *lookup);
+int lookup_copy(BTree *bt, chidb_dbm_cursor_t *cursor);
+int lookup_key_cmp(const void *a, const void *b);
+bool end_passed(chidb_dbm_cursor_t *cursor, chidb_key_t key);
+int cursor_check_end(chidb_dbm_cursor_t *cursor, int8_t dir);
+int cursor_leaf_end(chidb_dbm_cursor_t *cursor, int8_t dir);
+int cursor_end_cell(chidb_dbm_cursor_t *cursor, uint32_t *end);
 
 /* Your code goes here */
 
@@ -46,22 +67,46 @@ int chidb_cursor_open(chidb_dbm_cursor_type_t type, npage_t nroot, int32_t col_n
     cursor->type = type;
     cursor->nroot = nroot;
     cursor->col_num = col_num;
+    cursor->depth = 0;
+    cursor->n_nodes = 0;
+    cursor->spare = NULL;
+    cursor->changes = 0;
+    cursor->moved = 0;
+    cursor->end_dir = 0;
+    cursor->row_valid = false;
+    cursor->row_types = NULL;
+    cursor->row_offsets = NULL;
+    cursor->lookup = NULL;
 
     return CHIDB_OK;
 }
 
 int chidb_cursor_close(BTree *bt, chidb_dbm_cursor_t *cursor) {
     int ret;
-    while(1) {
-        if (cursor->node_list == NULL) {
-            break;
-        }
-        if ((ret = chidb_Btree_freeMemNode(bt, cursor->node_list->btn)) != CHIDB_OK) {
+    free(cursor->row_types);
+    free(cursor->row_offsets);
+    cursor->row_types = NULL;
+    cursor->row_offsets = NULL;
+    cursor->row_valid = false;
+    if (cursor->lookup != NULL) {
+        free(cursor->lookup->keys);
+        free(cursor->lookup->sorted);
+        free(cursor->lookup->offsets);
+        free(cursor->lookup->arena);
+        free(cursor->lookup);
+        cursor->lookup = NULL;
+    }
+    while (cursor->n_nodes > 0) {
+        cursor->n_nodes--;
+        if ((ret = chidb_Btree_freeMemNode(bt, cursor->path[cursor->n_nodes].btn)) != CHIDB_OK) {
             return ret;
         }
-        chidb_dbm_cursor_node_list_t *pcnl = cursor->node_list->parent;
-        free(cursor->node_list);
-        cursor->node_list = pcnl;
+    }
+    cursor->depth = 0;
+    if (cursor->spare != NULL) {
+        BTreeNode *spare = cursor->spare;
+        cursor->spare = NULL;
+        return chidb_Btree_freeMemNode(bt, spare);
     }
 
     return CHIDB_OK;
@@ -69,369 +114,399 @@ int chidb_cursor_close(BTree *bt, chidb_dbm_cursor_t *cursor) {
 
 int chidb_cursor_rewind(BTree *bt, chidb_dbm_cursor_t *cursor) {
     int ret;
-    chidb_dbm_cursor_node_list_t *pcnl = NULL;
-    npage_t npage = cursor->nroot;
-    while (1) {
-        BTreeNode *btn;
-        if ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
-            return ret;
-        }
-        if (btn->n_cells == 0) {
-            return CHIDB_EEMPTY;
-        }
-        chidb_dbm_cursor_node_list_t *cnl = malloc(sizeof(chidb_dbm_cursor_node_list_t));
-        if (cnl == NULL) {
-            return CHIDB_ENOMEM;
-        }
-        cnl->npage = npage;
-        cnl->ncell = 0;
-        cnl->is_right = 0;
-        cnl->btn = btn;
-        cnl->parent = pcnl;
-        pcnl = cnl;
-        cursor->node_list = cnl;
-        if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF) {
-            break;
-        }
-
-        BTreeCell btc;
-        if ((ret = chidb_Btree_getCell(btn, 0, &btc)) != CHIDB_OK) {
-            return ret;
-        }
-        switch (btc.type) {
-        case PGTYPE_TABLE_INTERNAL:
-            npage = btc.fields.tableInternal.child_page;
-            break;
-        case PGTYPE_TABLE_LEAF:
+    // buffered index entries have to be in the tree for the cursor to see them
+    if ((ret = chidb_Btree_flushIndexBuffer(bt, cursor->nroot)) != CHIDB_OK) {
+        return ret;
+    }
+    cursor->depth = 0;
+    cursor->changes = chidb_Btree_changes(bt, cursor->nroot);
+    cursor->moved = 0;
+    cursor->row_valid = false;
+    lookup_leave(cursor);
+    if ((ret = cursor_descend(bt, cursor, cursor->nroot, true)) != CHIDB_OK) {
+        return ret;
+    }
 
-            break;
-        case PGTYPE_INDEX_INTERNAL:
-            npage = btc.fields.indexInternal.child_page;
-            break;
-        case PGTYPE_INDEX_LEAF:
+    return cursor_check_end(cursor, 1);
+}
 
-            break;
-        }
+/* Moves a cursor to the last entry of its B-Tree
+ *
+ * The reverse of chidb_cursor_rewind: a reverse scan is a call to this
+ * followed by calls to chidb_cursor_prev, which go from leaf to leaf
+ * through the sibling links just like chidb_cursor_next does.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EEMPTY: The B-Tree is empty
+ * - Any other error from chidb_Btree_flushIndexBuffer or cursor_descend
+ */
+int chidb_cursor_last(BTree *bt, chidb_dbm_cursor_t *cursor) {
+    int ret;
+    if ((ret = chidb_Btree_flushIndexBuffer(bt, cursor->nroot)) != CHIDB_OK) {
+        return ret;
+    }
+    cursor->depth = 0;
+    cursor->changes = chidb_Btree_changes(bt, cursor->nroot);
+    cursor->moved = 0;
+    cursor->row_valid = false;
+    lookup_leave(cursor);
+    if ((ret = cursor_descend(bt, cursor, cursor->nroot, false)) != CHIDB_OK) {
+        return ret;
     }
 
-    return CHIDB_OK;
+    return cursor_check_end(cursor, -1);
 }
 
 
 int chidb_cursor_next(BTree *bt, chidb_dbm_cursor_t *cursor) {
     int ret;
-    chidb_dbm_cursor_node_list_t *cnl = cursor->node_list;
-    if (cnl == NULL) {
-        return CHIDB_EEMPTY;
+    lookup_leave(cursor);
+    if ((ret = cursor_restore(bt, cursor)) != CHIDB_OK) {
+        return ret;
     }
-    if (cnl->ncell < cnl->btn->n_cells - 1) {
-        cnl->ncell++;
-        return CHIDB_OK;
+    if (cursor->moved > 0) {
+        // the entry was deleted, and the cursor is already on the next one
+        cursor->moved = 0;
+        return cursor_check_end(cursor, 1);
+    }
+    cursor->moved = 0;
+    cursor->row_valid = false;
+    chidb_dbm_cursor_node_t *cn = CURSOR_LEAF(cursor);
+    if (cn->ncell < cn->btn->n_cells - 1) {
+        cn->ncell++;
+        return cursor_check_end(cursor, 1);
+    }
+    // the next leaf is not even read if the range ends in this one
+    if ((ret = cursor_leaf_end(cursor, 1)) != CHIDB_OK) {
+        return ret;
+    }
+    if (cn->btn->linked) {
+        if ((ret = chidb_cursor_hop(bt, cursor, true)) != CHIDB_OK) {
+            return ret;
+        }
+        return cursor_check_end(cursor, 1);
     }
 
-    int has_child = 0;
-    BTreeCell btc;
-    npage_t npage = 0;
-    chidb_dbm_cursor_node_list_t *pcnl = NULL;
+    npage_t npage;
     while (1) {
-        cnl = cnl->parent;
-        pcnl = cnl;
-        cursor->node_list = cnl;
-        if (cnl == NULL) {
+        cursor->depth--;
+        if (cursor->depth == 0) {
             return CHIDB_EEMPTY;
         }
-        if (cnl->is_right == 1) {
+        cn = CURSOR_LEAF(cursor);
+        if (cn->is_right == 1) {
             continue;
         }
-        if (cnl->ncell < cnl->btn->n_cells - 1) {
-            cnl->ncell++;
-            if ((ret = chidb_Btree_getCell(cnl->btn, cnl->ncell, &btc)) != CHIDB_OK) {
+        if (cn->ncell < cn->btn->n_cells - 1) {
+            cn->ncell++;
+            if ((ret = cursor_child(cn->btn, cn->ncell, &npage)) != CHIDB_OK) {
                 return ret;
             }
-            switch (btc.type) {
-            case PGTYPE_TABLE_INTERNAL:
-                npage = btc.fields.tableInternal.child_page;
-                has_child = 1;
-                break;
-            case PGTYPE_TABLE_LEAF:
-                break;
-            case PGTYPE_INDEX_INTERNAL:
-                npage = btc.fields.indexInternal.child_page;
-                has_child = 1;
-                break;
-            case PGTYPE_INDEX_LEAF:
-                break;
-            }
             break;
         }
-        if (cnl->btn->right_page != 0) {
-            npage = cnl->btn->right_page;
-            cnl->ncell = cnl->btn->n_cells;
-            cnl->is_right = 1;
-            has_child = 1;
+        if (cn->btn->right_page != 0) {
+            npage = cn->btn->right_page;
+            cn->ncell = cn->btn->n_cells;
+            cn->is_right = 1;
             break;
         }
     }
-    if (has_child == 0) {
-        return CHIDB_EEMPTY;
-    }
-
-    while (1) {
-        BTreeNode *btn;
-        if ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
-            return ret;
-        }
-        if (btn->n_cells == 0) {
-            return CHIDB_EEMPTY;
-        }
-        chidb_dbm_cursor_node_list_t *cnl = malloc(sizeof(chidb_dbm_cursor_node_list_t));
-        if (cnl == NULL) {
-            return CHIDB_ENOMEM;
-        }
-        cnl->npage = npage;
-        cnl->ncell = 0;
-        cnl->btn = btn;
-        cnl->parent = pcnl;
-        pcnl = cnl;
-        cursor->node_list = cnl;
-        if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF) {
-            break;
-        }
-
-        BTreeCell btc;
-        if ((ret = chidb_Btree_getCell(btn, 0, &btc)) != CHIDB_OK) {
-            return ret;
-        }
-        switch (btc.type) {
-        case PGTYPE_TABLE_INTERNAL:
-            npage = btc.fields.tableInternal.child_page;
-            break;
-        case PGTYPE_TABLE_LEAF:
-
-            break;
-        case PGTYPE_INDEX_INTERNAL:
-            npage = btc.fields.indexInternal.child_page;
-            break;
-        case PGTYPE_INDEX_LEAF:
-
-            break;
-        }
+    if ((ret = cursor_descend(bt, cursor, npage, true)) != CHIDB_OK) {
+        return ret;
     }
 
-    return CHIDB_OK;
+    return cursor_check_end(cursor, 1);
 }
 
 int chidb_cursor_prev(BTree *bt, chidb_dbm_cursor_t *cursor) {
     int ret;
-    chidb_dbm_cursor_node_list_t *cnl = cursor->node_list;
-    if (cnl == NULL) {
-        return CHIDB_EEMPTY;
+    lookup_leave(cursor);
+    if ((ret = cursor_restore(bt, cursor)) != CHIDB_OK) {
+        return ret;
     }
-    if (cnl->ncell > 0) {
-        cnl->ncell--;
-        return CHIDB_OK;
+    if (cursor->moved < 0) {
+        cursor->moved = 0;
+        return cursor_check_end(cursor, -1);
+    }
+    cursor->moved = 0;
+    cursor->row_valid = false;
+    chidb_dbm_cursor_node_t *cn = CURSOR_LEAF(cursor);
+    if (cn->ncell > 0) {
+        cn->ncell--;
+        return cursor_check_end(cursor, -1);
+    }
+    if ((ret = cursor_leaf_end(cursor, -1)) != CHIDB_OK) {
+        return ret;
+    }
+    if (cn->btn->linked) {
+        if ((ret = chidb_cursor_hop(bt, cursor, false)) != CHIDB_OK) {
+            return ret;
+        }
+        return cursor_check_end(cursor, -1);
     }
 
-    BTreeCell btc;
-    npage_t npage = 0;
-    chidb_dbm_cursor_node_list_t *pcnl = NULL;
+    npage_t npage;
     while (1) {
-        cnl = cnl->parent;
-        pcnl = cnl;
-        cursor->node_list = cnl;
-        if (cnl == NULL) {
+        cursor->depth--;
+        if (cursor->depth == 0) {
             return CHIDB_EEMPTY;
         }
-        if (cnl->ncell > 0) {
-            cnl->ncell--;
-            if ((ret = chidb_Btree_getCell(cnl->btn, cnl->ncell, &btc)) != CHIDB_OK) {
+        cn = CURSOR_LEAF(cursor);
+        if (cn->ncell > 0) {
+            cn->ncell--;
+            cn->is_right = 0;
+            if ((ret = cursor_child(cn->btn, cn->ncell, &npage)) != CHIDB_OK) {
                 return ret;
             }
-            switch (btc.type) {
-            case PGTYPE_TABLE_INTERNAL:
-                npage = btc.fields.tableInternal.child_page;
-                break;
-            case PGTYPE_TABLE_LEAF:
-                break;
-            case PGTYPE_INDEX_INTERNAL:
-                npage = btc.fields.indexInternal.child_page;
-                break;
-            case PGTYPE_INDEX_LEAF:
-                break;
-            }
             break;
         }
     }
+    if ((ret = cursor_descend(bt, cursor, npage, false)) != CHIDB_OK) {
+        return ret;
+    }
+
+    return cursor_check_end(cursor, -1);
+}
 
+/* Moves a cursor on a linked leaf to the next (or previous) leaf
+ *
+ * Follows the sibling links of the leaf (see PGFLAG_LINKED), skipping
+ * any empty leaves. The cursor's parent nodes no longer lead to the new
+ * leaf, so the new leaf becomes the only level of the cursor's path: from
+ * then on, the cursor keeps moving through the sibling links only. The
+ * leaves are read into the cursor's spare node, so no memory is allocated
+ * after the first hop.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - cursor: Cursor positioned on a linked leaf
+ * - forward: true to move to the next leaf, false to the previous one
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EEMPTY: There are no more leaves in that direction (the cursor
+ *                 is left where it was)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_cursor_hop(BTree *bt, chidb_dbm_cursor_t *cursor, bool forward) {
+    int ret;
+    chidb_dbm_cursor_node_t *cn = CURSOR_LEAF(cursor);
+    npage_t npage = forward ? cn->btn->next_leaf : cn->btn->prev_leaf;
     while (1) {
-        BTreeNode *btn;
-        if ((ret = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
-            return ret;
-        }
-        if (btn->n_cells == 0) {
+        if (npage == 0) {
             return CHIDB_EEMPTY;
         }
-        chidb_dbm_cursor_node_list_t *cnl = malloc(sizeof(chidb_dbm_cursor_node_list_t));
-        if (cnl == NULL) {
-            return CHIDB_ENOMEM;
-        }
-        cnl->npage = npage;
-        cnl->ncell = btn->n_cells - 1;
-        cnl->is_right = 0;
-        cnl->btn = btn;
-        cnl->parent = pcnl;
-        pcnl = cnl;
-        cursor->node_list = cnl;
-        if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF) {
-            break;
-        }
-        if (btn->right_page > 0) {
-            cnl->ncell = btn->n_cells;
-            cnl->is_right = 1;
-            npage = btn->right_page;
-            continue;
+        if (cursor->spare == NULL) {
+            ret = chidb_Btree_getNodeByPage(bt, npage, &cursor->spare);
+        } else {
+            ret = chidb_Btree_reloadNode(bt, npage, cursor->spare);
         }
-
-        BTreeCell btc;
-        if ((ret = chidb_Btree_getCell(btn, btn->n_cells - 1, &btc)) != CHIDB_OK) {
+        if (ret != CHIDB_OK) {
             return ret;
         }
-        switch (btc.type) {
-        case PGTYPE_TABLE_INTERNAL:
-            npage = btc.fields.tableInternal.child_page;
-            break;
-        case PGTYPE_TABLE_LEAF:
-
-            break;
-        case PGTYPE_INDEX_INTERNAL:
-            npage = btc.fields.indexInternal.child_page;
-            break;
-        case PGTYPE_INDEX_LEAF:
-
+        if (cursor->spare->n_cells > 0) {
             break;
         }
+        npage = forward ? cursor->spare->next_leaf : cursor->spare->prev_leaf;
     }
 
+    // the old leaf becomes the spare node, and the root's node is moved
+    // to where the old leaf was, so the cursor still owns every node
+    BTreeNode *btn = cursor->spare;
+    cursor->spare = cn->btn;
+    cn->btn = cursor->path[0].btn;
+    cursor->path[0].btn = btn;
+    cursor->path[0].ncell = forward ? 0 : btn->n_cells - 1;
+    cursor->path[0].is_right = 0;
+    cursor->depth = 1;
+
     return CHIDB_OK;
 }
 
+/* Moves a cursor to an entry with a given key
+ *
+ * Like the other seeks, this is a finger search (see cursor_seek): it
+ * starts from the cursor's current position, so a sequence of seeks on
+ * increasing keys reads each node at most once.
+ *
+ * Return
+ * - CHIDB_OK: The cursor is on the entry with the key
+ * - CHIDB_ENOTFOUND: The B-Tree's Bloom filter rules the key out (the
+ *                    cursor is left where it was)
+ * - CHIDB_EEMPTY: There is no entry with the key
+ * - Any other error from cursor_seek
+ */
 int chidb_cursor_seek(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_key_t key) {
     int ret;
-    if ((ret = chidb_cursor_rewind(bt, cursor)) != CHIDB_OK) {
+    // the filter does not know about buffered index entries yet
+    if ((ret = chidb_Btree_flushIndexBuffer(bt, cursor->nroot)) != CHIDB_OK) {
         return ret;
     }
-    BTreeCell btc;
-    while (1) {
-        if ((ret = chidb_Btree_getCell(cursor->node_list->btn, cursor->node_list->ncell, &btc)) != CHIDB_OK) {
-            break;
-        }
-        if (key == btc.key) {
-            return CHIDB_OK;
-        }
-        if ((ret = chidb_cursor_next(bt, cursor)) != CHIDB_OK) {
-            break;
-        }
+    // the cursor is left where it was if the key is certainly not there
+    if (!chidb_Btree_bloomMayContain(bt, cursor->nroot, key)) {
+        return CHIDB_ENOTFOUND;
+    }
+    if ((ret = cursor_seek(bt, cursor, key)) != CHIDB_OK) {
+        return ret;
+    }
+    chidb_dbm_cursor_node_t *cn = CURSOR_LEAF(cursor);
+    if (cn->ncell == cn->btn->n_cells || cn->btn->keys[cn->ncell] != key) {
+        return CHIDB_EEMPTY;
     }
-    return ret;
+
+    return CHIDB_OK;
 }
 
 int chidb_cursor_seek_gt(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_key_t key) {
     int ret;
-    if ((ret = chidb_cursor_rewind(bt, cursor)) != CHIDB_OK) {
+    if ((ret = chidb_cursor_seek_ge(bt, cursor, key)) != CHIDB_OK) {
         return ret;
     }
+    // the cursor may have moved on to a leaf that was not searched
     BTreeCell btc;
-    while (1) {
-        if ((ret = chidb_Btree_getCell(cursor->node_list->btn, cursor->node_list->ncell, &btc)) != CHIDB_OK) {
-            break;
-        }
-        if (key == btc.key) {
-            if ((ret = chidb_cursor_next(bt, cursor)) != CHIDB_OK) {
-                break;
-            }
-            return CHIDB_OK;
-        } else if (key < btc.key) {
-            return CHIDB_OK;
-        }
-        if ((ret = chidb_cursor_next(bt, cursor)) != CHIDB_OK) {
-            break;
-        }
+    if ((ret = chidb_Btree_getCell(CURSOR_LEAF(cursor)->btn, CURSOR_LEAF(cursor)->ncell, &btc)) != CHIDB_OK) {
+        return ret;
+    }
+    if (btc.key == key) {
+        return chidb_cursor_next(bt, cursor);
     }
-    return ret;
+
+    return CHIDB_OK;
 }
 
 int chidb_cursor_seek_ge(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_key_t key) {
     int ret;
-    if ((ret = chidb_cursor_rewind(bt, cursor)) != CHIDB_OK) {
+    if ((ret = chidb_Btree_flushIndexBuffer(bt, cursor->nroot)) != CHIDB_OK) {
         return ret;
     }
-    BTreeCell btc;
-    while (1) {
-        if ((ret = chidb_Btree_getCell(cursor->node_list->btn, cursor->node_list->ncell, &btc)) != CHIDB_OK) {
-            break;
-        }
-        if (key <= btc.key) {
-            return CHIDB_OK;
-        }
-        if ((ret = chidb_cursor_next(bt, cursor)) != CHIDB_OK) {
-            break;
-        }
+    if ((ret = cursor_seek(bt, cursor, key)) != CHIDB_OK) {
+        return ret;
+    }
+    chidb_dbm_cursor_node_t *cn = CURSOR_LEAF(cursor);
+    if (cn->ncell == cn->btn->n_cells) {
+        // every entry in the leaf is smaller: the next one is the first
+        // entry of the next leaf
+        cn->ncell--;
+        return chidb_cursor_next(bt, cursor);
     }
-    return ret;
+
+    return cursor_check_end(cursor, 1);
 }
 
 int chidb_cursor_seek_lt(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_key_t key) {
     int ret;
-    if ((ret = chidb_cursor_rewind(bt, cursor)) != CHIDB_OK) {
+    if ((ret = chidb_Btree_flushIndexBuffer(bt, cursor->nroot)) != CHIDB_OK) {
         return ret;
     }
-    BTreeCell btc;
-    while (1) {
-        if ((ret = chidb_Btree_getCell(cursor->node_list->btn, cursor->node_list->ncell, &btc)) != CHIDB_OK) {
-            break;
-        }
-        if (key <= btc.key) {
-            if ((ret = chidb_cursor_prev(bt, cursor)) != CHIDB_OK) {
-                break;
-            }
-            return CHIDB_OK;
-        }
-        if ((ret = chidb_cursor_next(bt, cursor)) != CHIDB_OK) {
-            break;
-        }
+    if ((ret = cursor_seek(bt, cursor, key)) != CHIDB_OK) {
+        return ret;
+    }
+    chidb_dbm_cursor_node_t *cn = CURSOR_LEAF(cursor);
+    if (cn->ncell == cn->btn->n_cells) {
+        // every entry in the leaf is smaller, and the next one is not
+        cn->ncell--;
+        return cursor_check_end(cursor, -1);
     }
-    return ret;
+
+    return chidb_cursor_prev(bt, cursor);
 }
 
 int chidb_cursor_seek_le(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_key_t key) {
     int ret;
-    if ((ret = chidb_cursor_rewind(bt, cursor)) != CHIDB_OK) {
+    if ((ret = chidb_Btree_flushIndexBuffer(bt, cursor->nroot)) != CHIDB_OK) {
         return ret;
     }
-    BTreeCell btc;
-    while (1) {
-        if ((ret = chidb_Btree_getCell(cursor->node_list->btn, cursor->node_list->ncell, &btc)) != CHIDB_OK) {
-            break;
-        }
-        if (key == btc.key) {
-            return CHIDB_OK;
-        } else if (key < btc.key) {
-            if ((ret = chidb_cursor_prev(bt, cursor)) != CHIDB_OK) {
-                break;
-            }
-            return CHIDB_OK;
-        }
-        if ((ret = chidb_cursor_next(bt, cursor)) != CHIDB_OK) {
-            break;
-        }
+    if ((ret = cursor_seek(bt, cursor, key)) != CHIDB_OK) {
+        return ret;
     }
-    return ret;
+    chidb_dbm_cursor_node_t *cn = CURSOR_LEAF(cursor);
+    if (cn->ncell == cn->btn->n_cells) {
+        cn->ncell--;
+        return cursor_check_end(cursor, -1);
+    }
+    if (cn->btn->keys[cn->ncell] == key) {
+        return cursor_check_end(cursor, -1);
+    }
+
+    return chidb_cursor_prev(bt, cursor);
+}
+
+/* Looks a key up in a hash index
+ *
+ * A hash index has no order, so a cursor on one cannot be moved: it can
+ * only be positioned on a key with this function, after which
+ * chidb_cursor_fetch_hash_pkey returns the primary key of the entry. The
+ * cursor is left where it was if the key is not there.
+ *
+ * Return
+ * - CHIDB_OK: The key was found
+ * - CHIDB_ENOTFOUND: The index has no entry for the key
+ * - Any other error from chidb_Hash_find
+ */
+int chidb_cursor_seek_hash(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_key_t key) {
+    int ret;
+    chidb_key_t keyPk;
+    if ((ret = chidb_Hash_find(bt->pager, cursor->nroot, key, &keyPk)) != CHIDB_OK) {
+        return ret;
+    }
+    cursor->hash_keyPk = keyPk;
+
+    return CHIDB_OK;
+}
+
+/* Sets the end of a cursor's range
+ *
+ * A range scan that checks the key of every entry with a comparison op
+ * pays for an extra instruction, and a register, per row. Instead, a
+ * cursor with an end stops by itself: once it is moved past the end (by
+ * chidb_cursor_next if the end is an upper bound, or chidb_cursor_prev if
+ * it is a lower one), the move returns CHIDB_EEMPTY and the cursor is no
+ * longer positioned, as if it had reached the end of the B-Tree. Seeks in
+ * the direction of the range (chidb_cursor_seek_ge and seek_gt for an
+ * upper bound, seek_le and seek_lt for a lower one), chidb_cursor_rewind,
+ * chidb_cursor_last, chidb_cursor_fetch_batch and chidb_cursor_lookup_start
+ * stop at it too. When the last entry in the range is the last one of its
+ * leaf, the next leaf is not read at all.
+ *
+ * The end is kept until it is set again or cleared with
+ * chidb_cursor_clear_end.
+ *
+ * Parameters
+ * - cursor: Cursor
+ * - key: Last key in the range (or first key after it, if inclusive is
+ *        false)
+ * - inclusive: Whether key itself is in the range
+ * - reverse: false if the range ends at its largest key (for scans with
+ *            chidb_cursor_next), true if it ends at its smallest one (for
+ *            scans with chidb_cursor_prev)
+ */
+void chidb_cursor_set_end(chidb_dbm_cursor_t *cursor, chidb_key_t key, bool inclusive, bool reverse) {
+    cursor->end_dir = reverse ? -1 : 1;
+    cursor->end_key = key;
+    cursor->end_inclusive = inclusive;
+}
+
+/* Removes the end of a cursor's range (see chidb_cursor_set_end) */
+void chidb_cursor_clear_end(chidb_dbm_cursor_t *cursor) {
+    cursor->end_dir = 0;
 }
 
 int chidb_cursor_fetch_key(BTree *bt, chidb_dbm_cursor_t *cursor, int32_t *key) {
     int ret;
     BTreeCell btc;
-    if ((ret = chidb_Btree_getCell(cursor->node_list->btn, cursor->node_list->ncell, &btc)) != CHIDB_OK) {
+    if (cursor->lookup != NULL && cursor->lookup->row >= 0) {
+        *key = cursor->lookup->keys[cursor->lookup->row];
+        return CHIDB_OK;
+    }
+    if ((ret = cursor_restore(bt, cursor)) != CHIDB_OK) {
+        return ret;
+    }
+    if (cursor->moved != 0) {
+        return CHIDB_EEMPTY;
+    }
+    if ((ret = chidb_Btree_getCell(CURSOR_LEAF(cursor)->btn, CURSOR_LEAF(cursor)->ncell, &btc)) != CHIDB_OK) {
         return ret;
     }
     *key = btc.key;
@@ -439,73 +514,976 @@ int chidb_cursor_fetch_key(BTree *bt, chidb_dbm_cursor_t *cursor, int32_t *key)
     return CHIDB_OK;
 }
 
+/* Reads a column of the row a cursor is on
+ *
+ * The type of the column is returned in type (1 for NULL, 2 for integers,
+ * 3 for strings) and its value in num or str. Strings are not copied: str
+ * points into the cursor's leaf, is not NUL-terminated (its length is
+ * returned in len), and is only valid until the cursor moves or its
+ * B-Tree changes. Rows returned from a copy by chidb_cursor_lookup_next
+ * are read from the copy.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EEMPTY: The cursor is not positioned, or its row was deleted
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - Any error from chidb_Btree_getCell or cursor_restore
+ */
 int chidb_cursor_fetch_col(BTree *bt, chidb_dbm_cursor_t *cursor, int n,
-                uint8_t *type, int32_t *num, char **str) {
+                uint8_t *type, int32_t *num, char **str, uint32_t *len) {
     int ret;
     BTreeCell btc;
-    if ((ret = chidb_Btree_getCell(cursor->node_list->btn, cursor->node_list->ncell, &btc)) != CHIDB_OK) {
+    uint8_t *data;
+    if (cursor->lookup != NULL && cursor->lookup->row >= 0) {
+        data = cursor->lookup->arena + cursor->lookup->offsets[cursor->lookup->row];
+    } else {
+        if ((ret = cursor_restore(bt, cursor)) != CHIDB_OK) {
+            return ret;
+        }
+        if (cursor->moved != 0) {
+            return CHIDB_EEMPTY;
+        }
+        if ((ret = chidb_Btree_getCell(CURSOR_LEAF(cursor)->btn, CURSOR_LEAF(cursor)->ncell, &btc)) != CHIDB_OK) {
+            return ret;
+        }
+        data = btc.fields.tableLeaf.data;
+    }
+    // the header is only decoded once per row, however many columns are read
+    if (!cursor->row_valid && (ret = cursor_decode_row(cursor, data)) != CHIDB_OK) {
         return ret;
     }
-    //uint32_t data_size = btc.fields.tableLeaf.data_size;
-    uint8_t *data = btc.fields.tableLeaf.data;
-    uint8_t header_size = data[0];
-
-    int cell_off = 1;
-    int data_off = header_size;
-    int field_len;
-    for (int i = 0; i < cursor->col_num; i++) {
-        if ((data[cell_off] & 0x80) == 0x80) {
-            field_len = (data[cell_off] & 0x7f) << 21 |
-                (data[cell_off + 1] & 0x7f) << 14 |
-                (data[cell_off + 2] & 0x7f) << 7 |
-                (data[cell_off + 3] & 0x7f);
-            cell_off += 4;
-        } else {
-            field_len = data[cell_off] & 0x7f;
-            cell_off += 1;
-        }
+    if (n < 0 || n >= cursor->col_num) {
+        return CHIDB_OK;
+    }
 
-        if (field_len == 0) {
-            if (i == n) {
-                *type = 1;
-                return CHIDB_OK;
-            }
-            continue;
-        } else if (field_len == 1) {
-            if (i == n) {
-                *type = 2;
-                *num = data[data_off];
-                return CHIDB_OK;
-            }
-            data_off++;
-        } else if (field_len == 2) {
-            if (i == n) {
-                *type = 2;
-                *num = data[data_off] << 8 | data[data_off + 1];
-                return CHIDB_OK;
-            }
-            data_off += 2;
-        } else if (field_len == 4) {
-            if (i == n) {
-                *type = 2;
-                *num = data[data_off] << 24 | data[data_off + 1] << 16 |
-                        data[data_off + 2] << 8 | data[data_off + 3];
-                return CHIDB_OK;
-            }
-            data_off += 4;
-        } else {
-            field_len = (field_len - 13) / 2;
-            if (i == n) {
-                *str = malloc(field_len + 1);
-                memset(*str, '\0', field_len + 1);
-                memcpy(*str, &data[data_off], field_len);
-                *type = 3;
-                return CHIDB_OK;
-            }
-            data_off += field_len;
-        }
+    uint8_t *field = data + cursor->row_offsets[n];
+    uint32_t field_len = cursor->row_types[n];
+    switch (field_len) {
+    case 0:
+        *type = 1;
+        break;
+    case 1:
+        *type = 2;
+        *num = field[0];
+        break;
+    case 2:
+        *type = 2;
+        *num = field[0] << 8 | field[1];
+        break;
+    case 4:
+        *type = 2;
+        *num = field[0] << 24 | field[1] << 16 | field[2] << 8 | field[3];
+        break;
+    default:
+        // the string is not copied: it is only valid until the cursor moves
+        *str = (char *) field;
+        *len = (field_len - 13) / 2;
+        *type = 3;
+        break;
     }
 
     return CHIDB_OK;
 }
 
+int chidb_cursor_fetch_hash_pkey(BTree *bt, chidb_dbm_cursor_t *cursor, int32_t *pkey) {
+    *pkey = cursor->hash_keyPk;
+
+    return CHIDB_OK;
+}
+
+/* Reads some columns of a batch of rows into column vectors
+ *
+ * Starting at the row the cursor is on, reads up to n_rows rows of a
+ * table B-Tree, and stores the values of columns cols[0..ncols-1] of each
+ * of them in vectors[0..ncols-1] (see chidb_dbm_vector_t). The rows of
+ * each leaf are decoded in a single loop over its cells, instead of
+ * moving the cursor and fetching the columns one row at a time. The
+ * cursor is left on the row after the last one read, so the next call
+ * continues from there; once the last row of the B-Tree has been read,
+ * the cursor is no longer positioned.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - cursor: Cursor on a table B-Tree
+ * - cols: Columns to read (each of them less than the cursor's col_num)
+ * - ncols: Number of columns to read
+ * - n_rows: Maximum number of rows to read
+ * - vectors: One vector per column, either zero-initialized or used in
+ *            a previous call (its arrays are reused)
+ * - n_fetched: Out parameter. Number of rows read, which is less than
+ *              n_rows only if the last row of the B-Tree (or of the
+ *              cursor's range, see chidb_cursor_set_end) was read
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EEMPTY: The cursor is not positioned on a row (nothing is read)
+ * - CHIDB_EMISMATCH: The cursor is not on a table B-Tree
+ * - CHIDB_EMISUSE: A column is not one of the cursor's columns
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_cursor_fetch_batch(BTree *bt, chidb_dbm_cursor_t *cursor, const int32_t *cols, int ncols,
+                             uint32_t n_rows, chidb_dbm_vector_t *vectors, uint32_t *n_fetched) {
+    int ret;
+    *n_fetched = 0;
+    for (int c = 0; c < ncols; c++) {
+        if (cols[c] < 0 || cols[c] >= cursor->col_num) {
+            return CHIDB_EMISUSE;
+        }
+    }
+    if ((ret = cursor_restore(bt, cursor)) != CHIDB_OK) {
+        return ret;
+    }
+    if (cursor->moved < 0 && (ret = chidb_cursor_next(bt, cursor)) != CHIDB_OK) {
+        // the row the cursor was on was deleted, and so were those after it
+        cursor->depth = 0;
+        return ret;
+    }
+    cursor->moved = 0;
+    if (CURSOR_LEAF(cursor)->btn->type != PGTYPE_TABLE_LEAF) {
+        return CHIDB_EMISMATCH;
+    }
+    if (n_rows == 0) {
+        return CHIDB_OK;
+    }
+    for (int c = 0; c < ncols; c++) {
+        if ((ret = batch_reserve(&vectors[c], n_rows)) != CHIDB_OK) {
+            return ret;
+        }
+    }
+
+    while (*n_fetched < n_rows) {
+        chidb_dbm_cursor_node_t *cn = CURSOR_LEAF(cursor);
+        BTreeNode *btn = cn->btn;
+        uint32_t end;
+        if ((ret = cursor_end_cell(cursor, &end)) != CHIDB_OK) {
+            return ret;
+        }
+        if (end <= cn->ncell) {
+            cursor->depth = 0;
+            break;
+        }
+        if (end - cn->ncell > n_rows - *n_fetched) {
+            end = cn->ncell + (n_rows - *n_fetched);
+        }
+
+        // the rest of the leaf (or of the batch) in one go
+        for (uint32_t i = cn->ncell; i < end; i++) {
+            BTreeCell btc;
+            if ((ret = chidb_Btree_getCell(btn, i, &btc)) != CHIDB_OK) {
+                return ret;
+            }
+            uint8_t *data = btc.fields.tableLeaf.data;
+            if ((ret = cursor_decode_row(cursor, data)) != CHIDB_OK) {
+                return ret;
+            }
+            for (int c = 0; c < ncols; c++) {
+                uint32_t col = cols[c];
+                ret = batch_put(&vectors[c], *n_fetched, data + cursor->row_offsets[col], cursor->row_types[col]);
+                if (ret != CHIDB_OK) {
+                    return ret;
+                }
+            }
+            (*n_fetched)++;
+        }
+        cn->ncell = end - 1;
+
+        ret = chidb_cursor_next(bt, cursor);
+        if (ret == CHIDB_EEMPTY) {
+            cursor->depth = 0;
+            break;
+        } else if (ret != CHIDB_OK) {
+            return ret;
+        }
+    }
+    cursor->row_valid = false;
+
+    return CHIDB_OK;
+}
+
+/* Frees the arrays of the column vectors filled by chidb_cursor_fetch_batch */
+void chidb_cursor_batch_free(chidb_dbm_vector_t *vectors, int ncols) {
+    for (int c = 0; c < ncols; c++) {
+        free(vectors[c].ints);
+        free(vectors[c].nulls);
+        free(vectors[c].texts);
+        free(vectors[c].offsets);
+        free(vectors[c].arena);
+        memset(&vectors[c], 0, sizeof(chidb_dbm_vector_t));
+    }
+}
+
+/* Collects a batch of rows of an index to look up in its table
+ *
+ * An index scan that looks every entry up in the table as it goes reads
+ * the table's leaves in the order of the index, which is usually as good
+ * as random. Instead, this collects the primary keys of up to size
+ * entries of the index, starting at the one the index cursor is on, and
+ * sorts them: chidb_cursor_lookup_next then moves the table cursor
+ * through their rows in increasing key order, with finger searches (see
+ * cursor_seek), so each leaf of the table is read at most once per batch.
+ * The index cursor is left on the entry after the last one collected (or
+ * not positioned, if there are none left), so calling this again collects
+ * the next batch.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - cursor: Cursor on a table B-Tree
+ * - index: Cursor on an index of the table. It must be kept open, and not
+ *          be moved, until the last batch has been looked up.
+ * - size: Number of keys to collect in each batch
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EEMPTY: The index cursor has no entries left
+ * - CHIDB_EMISMATCH: The index cursor is not on an index B-Tree
+ * - CHIDB_EMISUSE: The size is zero
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_cursor_lookup_start(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_dbm_cursor_t *index, uint32_t size) {
+    if (size == 0) {
+        return CHIDB_EMISUSE;
+    }
+    if (cursor->lookup == NULL && (cursor->lookup = calloc(1, sizeof(chidb_dbm_lookup_t))) == NULL) {
+        return CHIDB_ENOMEM;
+    }
+    chidb_dbm_lookup_t *lookup = cursor->lookup;
+    if (size > lookup->size) {
+        chidb_key_t *keys = realloc(lookup->keys, size * sizeof(chidb_key_t));
+        if (keys != NULL) {
+            lookup->keys = keys;
+        }
+        chidb_dbm_lookup_key_t *sorted = realloc(lookup->sorted, size * sizeof(chidb_dbm_lookup_key_t));
+        if (sorted != NULL) {
+            lookup->sorted = sorted;
+        }
+        uint32_t *offsets = realloc(lookup->offsets, size * sizeof(uint32_t));
+        if (offsets != NULL) {
+            lookup->offsets = offsets;
+        }
+        if (keys == NULL || sorted == NULL || offsets == NULL) {
+            return CHIDB_ENOMEM;
+        }
+    }
+    lookup->index = index;
+    lookup->size = size;
+    lookup->n = 0;
+    lookup->next = 0;
+    lookup->row = -1;
+
+    return lookup_fill(bt, lookup);
+}
+
+/* Moves a cursor to the next row of its lookup batch
+ *
+ * Moves the cursor to the row of the next key of the batch collected by
+ * chidb_cursor_lookup_start. Keys that are not in the table are skipped.
+ *
+ * If ordered is false, the rows of each batch are returned in key order,
+ * and the cursor is moved to each of them. If it is true, the rows are
+ * returned in the order of the index: the first call on a batch looks
+ * every key up in key order, copying the records of the rows, and then
+ * the cursor reads each row from the copy (see chidb_cursor_fetch_key and
+ * chidb_cursor_fetch_col) instead of moving. The copies, and the strings
+ * read from them, are only valid until the next batch is collected.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - cursor: Cursor on a table B-Tree, with a batch
+ * - ordered: true to return the rows in the order of the index (it must
+ *            be the same in every call for a batch)
+ *
+ * Return
+ * - CHIDB_OK: The cursor is on the next row
+ * - CHIDB_EEMPTY: There are no rows left in the batch (or the cursor has
+ *                 no batch)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_cursor_lookup_next(BTree *bt, chidb_dbm_cursor_t *cursor, bool ordered) {
+    int ret;
+    chidb_dbm_lookup_t *lookup = cursor->lookup;
+    if (lookup == NULL) {
+        return CHIDB_EEMPTY;
+    }
+    lookup->row = -1;
+    cursor->row_valid = false;
+    if (ordered && !lookup->copied && (ret = lookup_copy(bt, cursor)) != CHIDB_OK) {
+        return ret;
+    }
+
+    while (lookup->next < lookup->n) {
+        if (ordered) {
+            uint32_t pos = lookup->next++;
+            if (lookup->offsets[pos] != UINT32_MAX) {
+                lookup->row = pos;
+                return CHIDB_OK;
+            }
+            continue;
+        }
+        chidb_key_t key = lookup->sorted[lookup->next++].key;
+        ret = cursor_seek(bt, cursor, key);
+        if (ret == CHIDB_EEMPTY) {
+            continue;
+        } else if (ret != CHIDB_OK) {
+            return ret;
+        }
+        chidb_dbm_cursor_node_t *cn = CURSOR_LEAF(cursor);
+        if (cn->ncell < cn->btn->n_cells && cn->btn->keys[cn->ncell] == key) {
+            return CHIDB_OK;
+        }
+    }
+
+    return CHIDB_EEMPTY;
+}
+
+
+/* Loads a node into a level of a cursor's path
+ *
+ * Reuses the node already kept at that level, if any, so memory is only
+ * allocated the first time the cursor goes that deep.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The B-Tree is deeper than CURSOR_MAX_DEPTH
+ * - Any other error from chidb_Btree_getNodeByPage or chidb_Btree_reloadNode
+ */
+int cursor_load(BTree *bt, chidb_dbm_cursor_t *cursor, uint32_t level, npage_t npage) {
+    int ret;
+    if (level >= CURSOR_MAX_DEPTH) {
+        return CHIDB_ECORRUPT;
+    }
+    if (level < cursor->n_nodes) {
+        return chidb_Btree_reloadNode(bt, npage, cursor->path[level].btn);
+    }
+    if ((ret = chidb_Btree_getNodeByPage(bt, npage, &cursor->path[level].btn)) != CHIDB_OK) {
+        return ret;
+    }
+    cursor->n_nodes = level + 1;
+
+    return CHIDB_OK;
+}
+
+/* Extends a cursor's path from a node down to its leftmost (or rightmost)
+ * entry, starting at level cursor->depth
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EEMPTY: A node in the way is empty
+ * - Any other error from cursor_load or cursor_child
+ */
+int cursor_descend(BTree *bt, chidb_dbm_cursor_t *cursor, npage_t npage, bool leftmost) {
+    int ret;
+    while (1) {
+        if ((ret = cursor_load(bt, cursor, cursor->depth, npage)) != CHIDB_OK) {
+            return ret;
+        }
+        chidb_dbm_cursor_node_t *cn = &cursor->path[cursor->depth];
+        BTreeNode *btn = cn->btn;
+        if (btn->n_cells == 0) {
+            return CHIDB_EEMPTY;
+        }
+        cursor->depth++;
+        cn->ncell = leftmost ? 0 : btn->n_cells - 1;
+        cn->is_right = 0;
+        if (!PGTYPE_IS_INTERNAL(btn->type)) {
+            return CHIDB_OK;
+        }
+        if (!leftmost && btn->right_page != 0) {
+            cn->ncell = btn->n_cells;
+            cn->is_right = 1;
+            npage = btn->right_page;
+            continue;
+        }
+        if ((ret = cursor_child(btn, cn->ncell, &npage)) != CHIDB_OK) {
+            return ret;
+        }
+    }
+}
+
+/* Returns the child page of a cell of an internal node */
+int cursor_child(BTreeNode *btn, ncell_t ncell, npage_t *npage) {
+    int ret;
+    BTreeCell btc;
+    if ((ret = chidb_Btree_getCell(btn, ncell, &btc)) != CHIDB_OK) {
+        return ret;
+    }
+    switch (btc.type) {
+    case PGTYPE_TABLE_INTERNAL:
+        *npage = btc.fields.tableInternal.child_page;
+        break;
+    case PGTYPE_INDEX_INTERNAL:
+        *npage = btc.fields.indexInternal.child_page;
+        break;
+    case PGTYPE_VARINDEX_INTERNAL:
+        *npage = btc.fields.varIndex.child_page;
+        break;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Moves a cursor to where a key is, or would be, in its leaf
+ *
+ * Leaves the cursor on the first entry of the leaf with a key greater
+ * than or equal to the given one, or just past the last entry of the
+ * leaf (ncell == n_cells) if they are all smaller; in that case, the
+ * cursor's next entry (if any) is the first one greater than the key.
+ * The keys of the leaf are decoded (see chidb_Btree_decodeNode).
+ *
+ * This is a finger search: instead of starting from the root, the search
+ * starts from the lowest node of the cursor's path whose subtree covers
+ * the key (see cursor_finger), which is the leaf itself if the key is
+ * close enough to the current entry.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EEMPTY: The B-Tree is empty (or a node in the way is)
+ * - Any other error from cursor_load or chidb_Btree_searchNode
+ */
+int cursor_seek(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_key_t key) {
+    int ret;
+    uint32_t level;
+    cursor->row_valid = false;
+    cursor->moved = 0;
+    lookup_leave(cursor);
+    // the path is of no use if the B-Tree has changed since it was read
+    uint64_t changes = chidb_Btree_changes(bt, cursor->nroot);
+    if (changes != cursor->changes) {
+        cursor->changes = changes;
+        cursor->depth = 0;
+    }
+    if (!cursor_finger(cursor, key, &level)) {
+        level = 0;
+        if ((ret = cursor_load(bt, cursor, 0, cursor->nroot)) != CHIDB_OK) {
+            cursor->depth = 0;
+            return ret;
+        }
+    }
+    cursor->depth = level;
+
+    while (1) {
+        chidb_dbm_cursor_node_t *cn = &cursor->path[cursor->depth];
+        BTreeNode *btn = cn->btn;
+        ncell_t ncell;
+        if (btn->n_cells == 0) {
+            cursor->depth = 0;
+            return CHIDB_EEMPTY;
+        }
+        if ((ret = chidb_Btree_searchNode(btn, key, &ncell)) != CHIDB_OK) {
+            cursor->depth = 0;
+            return ret;
+        }
+        cursor->depth++;
+        cn->ncell = ncell;
+        cn->is_right = 0;
+        if (!PGTYPE_IS_INTERNAL(btn->type)) {
+            return CHIDB_OK;
+        }
+
+        npage_t npage;
+        if (ncell < btn->n_cells) {
+            npage = btn->children[ncell];
+        } else if (btn->right_page != 0) {
+            cn->is_right = 1;
+            npage = btn->right_page;
+        } else {
+            cn->ncell = ncell - 1;
+            npage = btn->children[ncell - 1];
+        }
+        if ((ret = cursor_load(bt, cursor, cursor->depth, npage)) != CHIDB_OK) {
+            cursor->depth = 0;
+            return ret;
+        }
+    }
+}
+
+/* Puts a cursor back on its entry after its B-Tree has changed
+ *
+ * If the B-Tree has changed since the cursor's path was read (see
+ * chidb_Btree_changes), an insertion may have split the nodes in the
+ * path, or moved the entry to another leaf, and a range delete may have
+ * freed them. The cursor's position is then saved as the key of its
+ * entry, read from its own copy of the leaf, and the key is looked up
+ * again from the root. Cursors only pay for this when they are used
+ * after a change, so a cursor can keep scanning a B-Tree while the
+ * B-Tree is inserted into.
+ *
+ * If the entry is no longer there, the cursor is left on the entry after
+ * it (and moved is set to 1) or, if that one is not in the same leaf, on
+ * the entry before it (and moved is set to -1).
+ *
+ * Return
+ * - CHIDB_OK: The cursor is positioned (or did not have to move)
+ * - CHIDB_EEMPTY: The cursor is not positioned, or the B-Tree is now empty
+ * - Any other error from cursor_seek
+ */
+int cursor_restore(BTree *bt, chidb_dbm_cursor_t *cursor) {
+    int ret;
+    if (cursor->depth == 0) {
+        return CHIDB_EEMPTY;
+    }
+    if (chidb_Btree_changes(bt, cursor->nroot) == cursor->changes) {
+        return CHIDB_OK;
+    }
+
+    BTreeCell btc;
+    chidb_dbm_cursor_node_t *cn = CURSOR_LEAF(cursor);
+    if ((ret = chidb_Btree_getCell(cn->btn, cn->ncell, &btc)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = cursor_seek(bt, cursor, btc.key)) != CHIDB_OK) {
+        return ret;
+    }
+    cn = CURSOR_LEAF(cursor);
+    if (cn->ncell == cn->btn->n_cells) {
+        cn->ncell--;
+        cursor->moved = -1;
+    } else if (cn->btn->keys[cn->ncell] != btc.key) {
+        cursor->moved = 1;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Finds where a finger search for a key can start
+ *
+ * Goes down the cursor's path, keeping track of the range of keys that
+ * the subtree of each node can hold (given by the keys of its parent),
+ * and stops at the first node whose range does not include the key.
+ *
+ * Parameters
+ * - cursor: Cursor
+ * - key: Key to look for
+ * - level: Out parameter. Level of the lowest node in the cursor's path
+ *          whose subtree covers the key
+ *
+ * Return
+ * - true: The search can start at path[*level]
+ * - false: The search has to start from the root, which has to be loaded
+ *          again (the cursor is not positioned, or is on a leaf reached
+ *          through a sibling link that does not hold the key)
+ */
+bool cursor_finger(chidb_dbm_cursor_t *cursor, chidb_key_t key, uint32_t *level) {
+    if (cursor->depth == 0) {
+        return false;
+    }
+    BTreeNode *btn = cursor->path[0].btn;
+    if (btn->page->npage != cursor->nroot) {
+        // a leaf reached through a sibling link, with no parents: all we
+        // know about it is its own keys
+        *level = 0;
+        return chidb_Btree_decodeNode(btn) == CHIDB_OK && btn->n_cells > 0 &&
+               key >= btn->keys[0] && key <= btn->keys[btn->n_cells - 1];
+    }
+
+    bool has_lo = false, has_hi = false;
+    chidb_key_t lo = 0, hi = 0;
+    for (*level = 0; *level + 1 < cursor->depth; (*level)++) {
+        chidb_dbm_cursor_node_t *cn = &cursor->path[*level];
+        if (chidb_Btree_decodeNode(cn->btn) != CHIDB_OK) {
+            break;
+        }
+        if (cn->is_right) {
+            has_lo = true;
+            lo = cn->btn->keys[cn->btn->n_cells - 1];
+        } else {
+            if (cn->ncell > 0) {
+                has_lo = true;
+                lo = cn->btn->keys[cn->ncell - 1];
+            }
+            has_hi = true;
+            hi = cn->btn->keys[cn->ncell];
+        }
+        if ((has_lo && key <= lo) || (has_hi && key > hi)) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+/* Decodes the header of the row a cursor is on
+ *
+ * Fills in the type code and data offset of each of the cursor's columns,
+ * allocating the arrays for them the first time.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int cursor_decode_row(chidb_dbm_cursor_t *cursor, uint8_t *data) {
+    if (cursor->row_types == NULL && cursor->col_num > 0) {
+        cursor->row_types = malloc(cursor->col_num * sizeof(uint32_t));
+        cursor->row_offsets = malloc(cursor->col_num * sizeof(uint32_t));
+        if (cursor->row_types == NULL || cursor->row_offsets == NULL) {
+            free(cursor->row_types);
+            free(cursor->row_offsets);
+            cursor->row_types = NULL;
+            cursor->row_offsets = NULL;
+            return CHIDB_ENOMEM;
+        }
+    }
+
+    uint32_t cell_off = 1;
+    uint32_t data_off = data[0];
+    for (int i = 0; i < cursor->col_num; i++) {
+        uint32_t field_len;
+        if ((data[cell_off] & 0x80) == 0x80) {
+            field_len = (data[cell_off] & 0x7f) << 21 |
+                (data[cell_off + 1] & 0x7f) << 14 |
+                (data[cell_off + 2] & 0x7f) << 7 |
+                (data[cell_off + 3] & 0x7f);
+            cell_off += 4;
+        } else {
+            field_len = data[cell_off] & 0x7f;
+            cell_off += 1;
+        }
+        cursor->row_types[i] = field_len;
+        cursor->row_offsets[i] = data_off;
+
+        switch (field_len) {
+        case 0:
+            break;
+        case 1:
+        case 2:
+        case 4:
+            data_off += field_len;
+            break;
+        default:
+            data_off += (field_len - 13) / 2;
+            break;
+        }
+    }
+    cursor->row_valid = true;
+
+    return CHIDB_OK;
+}
+
+/* Makes room for a batch of n_rows rows in a column vector, and clears
+ * its bitmaps
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int batch_reserve(chidb_dbm_vector_t *vector, uint32_t n_rows) {
+    uint32_t bitmap_size = (n_rows + 7) / 8;
+    if (vector->capacity < n_rows || vector->offsets == NULL) {
+        int32_t *ints = realloc(vector->ints, n_rows * sizeof(int32_t));
+        if (ints == NULL) {
+            return CHIDB_ENOMEM;
+        }
+        vector->ints = ints;
+        uint8_t *nulls = realloc(vector->nulls, bitmap_size);
+        if (nulls == NULL) {
+            return CHIDB_ENOMEM;
+        }
+        vector->nulls = nulls;
+        uint8_t *texts = realloc(vector->texts, bitmap_size);
+        if (texts == NULL) {
+            return CHIDB_ENOMEM;
+        }
+        vector->texts = texts;
+        uint32_t *offsets = realloc(vector->offsets, (n_rows + 1) * sizeof(uint32_t));
+        if (offsets == NULL) {
+            return CHIDB_ENOMEM;
+        }
+        vector->offsets = offsets;
+        vector->capacity = n_rows;
+    }
+    memset(vector->nulls, 0, bitmap_size);
+    memset(vector->texts, 0, bitmap_size);
+    vector->offsets[0] = 0;
+
+    return CHIDB_OK;
+}
+
+/* Stores the value of a column in a row of a column vector, given the
+ * column's type code in the record header and its data
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int batch_put(chidb_dbm_vector_t *vector, uint32_t row, uint8_t *field, uint32_t field_len) {
+    uint32_t start = vector->offsets[row];
+    vector->ints[row] = 0;
+    vector->offsets[row + 1] = start;
+
+    switch (field_len) {
+    case 0:
+        vector->nulls[row / 8] |= 1 << (row % 8);
+        break;
+    case 1:
+        vector->ints[row] = field[0];
+        break;
+    case 2:
+        vector->ints[row] = field[0] << 8 | field[1];
+        break;
+    case 4:
+        vector->ints[row] = field[0] << 24 | field[1] << 16 | field[2] << 8 | field[3];
+        break;
+    default: {
+        uint32_t len = (field_len - 13) / 2;
+        if (start + len > vector->arena_size) {
+            uint32_t size = vector->arena_size == 0 ? 256 : vector->arena_size;
+            while (start + len > size) {
+                size *= 2;
+            }
+            char *arena = realloc(vector->arena, size);
+            if (arena == NULL) {
+                return CHIDB_ENOMEM;
+            }
+            vector->arena = arena;
+            vector->arena_size = size;
+        }
+        memcpy(vector->arena + start, field, len);
+        vector->offsets[row + 1] = start + len;
+        vector->texts[row / 8] |= 1 << (row % 8);
+        break;
+    }
+    }
+
+    return CHIDB_OK;
+}
+
+/* Stops reading a cursor's row from the copies of its lookup batch (see
+ * chidb_cursor_lookup_next), once the cursor moves */
+void lookup_leave(chidb_dbm_cursor_t *cursor) {
+    if (cursor->lookup != NULL) {
+        cursor->lookup->row = -1;
+    }
+}
+
+/* Collects the next batch of primary keys of a lookup from its index
+ * cursor, and sorts them
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EEMPTY: The index cursor has no entries left (the batch is empty)
+ * - CHIDB_EMISMATCH: The index cursor is not on an index B-Tree
+ * - Any other error from cursor_restore, chidb_Btree_getCell or
+ *   chidb_cursor_next
+ */
+int lookup_fill(BTree *bt, chidb_dbm_lookup_t *lookup) {
+    int ret;
+    chidb_dbm_cursor_t *index = lookup->index;
+    lookup->n = 0;
+    lookup->next = 0;
+    lookup->copied = false;
+    lookup->row = -1;
+    if ((ret = cursor_restore(bt, index)) != CHIDB_OK) {
+        return ret;
+    }
+    if (index->moved < 0 && (ret = chidb_cursor_next(bt, index)) != CHIDB_OK) {
+        index->depth = 0;
+        return ret;
+    }
+    index->moved = 0;
+    if (CURSOR_LEAF(index)->btn->type != PGTYPE_INDEX_LEAF) {
+        return CHIDB_EMISMATCH;
+    }
+
+    while (lookup->n < lookup->size) {
+        chidb_dbm_cursor_node_t *cn = CURSOR_LEAF(index);
+        uint32_t end;
+        if ((ret = cursor_end_cell(index, &end)) != CHIDB_OK) {
+            return ret;
+        }
+        if (end <= cn->ncell) {
+            index->depth = 0;
+            break;
+        }
+        if (end - cn->ncell > lookup->size - lookup->n) {
+            end = cn->ncell + (lookup->size - lookup->n);
+        }
+        // the rest of the leaf (or of the batch) in one go
+        for (uint32_t i = cn->ncell; i < end; i++) {
+            BTreeCell btc;
+            if ((ret = chidb_Btree_getCell(cn->btn, i, &btc)) != CHIDB_OK) {
+                return ret;
+            }
+            lookup->keys[lookup->n] = btc.fields.indexLeaf.keyPk;
+            lookup->sorted[lookup->n].key = btc.fields.indexLeaf.keyPk;
+            lookup->sorted[lookup->n].pos = lookup->n;
+            lookup->n++;
+        }
+        cn->ncell = end - 1;
+
+        ret = chidb_cursor_next(bt, index);
+        if (ret == CHIDB_EEMPTY) {
+            index->depth = 0;
+            break;
+        } else if (ret != CHIDB_OK) {
+            return ret;
+        }
+    }
+    index->row_valid = false;
+    if (lookup->n == 0) {
+        // the range of the index ended right where the cursor was
+        return CHIDB_EEMPTY;
+    }
+    qsort(lookup->sorted, lookup->n, sizeof(chidb_dbm_lookup_key_t), lookup_key_cmp);
+
+    return CHIDB_OK;
+}
+
+/* Looks up every key of a cursor's lookup batch, in key order, and copies
+ * the records of the rows to the batch's arena
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - Any other error from cursor_seek or chidb_Btree_getCell
+ */
+int lookup_copy(BTree *bt, chidb_dbm_cursor_t *cursor) {
+    int ret;
+    chidb_dbm_lookup_t *lookup = cursor->lookup;
+    lookup->arena_used = 0;
+    for (uint32_t i = 0; i < lookup->n; i++) {
+        chidb_key_t key = lookup->sorted[i].key;
+        uint32_t pos = lookup->sorted[i].pos;
+        lookup->offsets[pos] = UINT32_MAX;
+        ret = cursor_seek(bt, cursor, key);
+        if (ret == CHIDB_EEMPTY) {
+            continue;
+        } else if (ret != CHIDB_OK) {
+            return ret;
+        }
+        chidb_dbm_cursor_node_t *cn = CURSOR_LEAF(cursor);
+        if (cn->ncell == cn->btn->n_cells || cn->btn->keys[cn->ncell] != key) {
+            continue;
+        }
+
+        BTreeCell btc;
+        if ((ret = chidb_Btree_getCell(cn->btn, cn->ncell, &btc)) != CHIDB_OK) {
+            return ret;
+        }
+        uint32_t size = btc.fields.tableLeaf.data_size;
+        if (lookup->arena_used + size > lookup->arena_size) {
+            uint32_t arena_size = lookup->arena_size == 0 ? 1024 : lookup->arena_size;
+            while (lookup->arena_used + size > arena_size) {
+                arena_size *= 2;
+            }
+            uint8_t *arena = realloc(lookup->arena, arena_size);
+            if (arena == NULL) {
+                return CHIDB_ENOMEM;
+            }
+            lookup->arena = arena;
+            lookup->arena_size = arena_size;
+        }
+        memcpy(lookup->arena + lookup->arena_used, btc.fields.tableLeaf.data, size);
+        lookup->offsets[pos] = lookup->arena_used;
+        lookup->arena_used += size;
+    }
+    lookup->copied = true;
+
+    return CHIDB_OK;
+}
+
+/* Compares two keys of a lookup batch, for qsort */
+int lookup_key_cmp(const void *a, const void *b) {
+    chidb_key_t ka = ((const chidb_dbm_lookup_key_t *) a)->key;
+    chidb_key_t kb = ((const chidb_dbm_lookup_key_t *) b)->key;
+
+    return ka < kb ? -1 : ka > kb;
+}
+
+/* Returns whether a key is past the end of a cursor's range (see
+ * chidb_cursor_set_end), in the direction of the range */
+bool end_passed(chidb_dbm_cursor_t *cursor, chidb_key_t key) {
+    if (cursor->end_dir > 0) {
+        return cursor->end_inclusive ? key > cursor->end_key : key >= cursor->end_key;
+    } else if (cursor->end_dir < 0) {
+        return cursor->end_inclusive ? key < cursor->end_key : key <= cursor->end_key;
+    }
+
+    return false;
+}
+
+/* Stops a cursor that has just moved in direction dir (1 forward, -1
+ * backward) if its entry is past the end of its range
+ *
+ * Return
+ * - CHIDB_OK: The entry is in the range (or the range does not end in
+ *             that direction)
+ * - CHIDB_EEMPTY: The entry is past the end (the cursor is no longer
+ *                 positioned)
+ * - Any other error from chidb_Btree_decodeNode
+ */
+int cursor_check_end(chidb_dbm_cursor_t *cursor, int8_t dir) {
+    int ret;
+    if (cursor->end_dir != dir) {
+        return CHIDB_OK;
+    }
+    chidb_dbm_cursor_node_t *cn = CURSOR_LEAF(cursor);
+    if ((ret = chidb_Btree_decodeNode(cn->btn)) != CHIDB_OK) {
+        return ret;
+    }
+    if (end_passed(cursor, cn->btn->keys[cn->ncell])) {
+        cursor->depth = 0;
+        return CHIDB_EEMPTY;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Stops a cursor on the last entry of its leaf in direction dir (1
+ * forward, -1 backward) if every entry after the leaf in that direction
+ * is past the end of its range, so that the next leaf is not read. Keys
+ * are unique, so the entries after the leaf have keys greater than its
+ * last key (or smaller than its first key, backward).
+ *
+ * Return
+ * - CHIDB_OK: The range may go on after the leaf
+ * - CHIDB_EEMPTY: The range ends in the leaf (the cursor is no longer
+ *                 positioned)
+ * - Any other error from chidb_Btree_decodeNode
+ */
+int cursor_leaf_end(chidb_dbm_cursor_t *cursor, int8_t dir) {
+    int ret;
+    if (cursor->end_dir != dir) {
+        return CHIDB_OK;
+    }
+    BTreeNode *btn = CURSOR_LEAF(cursor)->btn;
+    if ((ret = chidb_Btree_decodeNode(btn)) != CHIDB_OK) {
+        return ret;
+    }
+    chidb_key_t key = btn->keys[dir > 0 ? btn->n_cells - 1 : 0];
+    if (dir > 0 ? (key == UINT32_MAX || end_passed(cursor, key + 1))
+                : (key == 0 || end_passed(cursor, key - 1))) {
+        cursor->depth = 0;
+        return CHIDB_EEMPTY;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Finds the first cell of a cursor's leaf that is past the end of the
+ * cursor's range, for the loops that read the rest of a leaf in one go
+ * (*end is the leaf's number of cells if there is none, or if the range
+ * is not an upper one)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - Any other error from chidb_Btree_searchNode
+ */
+int cursor_end_cell(chidb_dbm_cursor_t *cursor, uint32_t *end) {
+    int ret;
+    BTreeNode *btn = CURSOR_LEAF(cursor)->btn;
+    *end = btn->n_cells;
+    if (cursor->end_dir <= 0 || (cursor->end_inclusive && cursor->end_key == UINT32_MAX)) {
+        return CHIDB_OK;
+    }
+    // the first key greater than the end (or equal to it, if exclusive)
+    ncell_t ncell;
+    chidb_key_t key = cursor->end_inclusive ? cursor->end_key + 1 : cursor->end_key;
+    if ((ret = chidb_Btree_searchNode(btn, key, &ncell)) != CHIDB_OK) {
+        return ret;
+    }
+    *end = ncell;
+
+    return CHIDB_OK;
+}
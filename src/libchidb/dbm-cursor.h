@@ -51,14 +51,52 @@ typedef enum chidb_dbm_cursor_type
     CURSOR_WRITE
 } chidb_dbm_cursor_type_t;
 
-typedef struct chidb_dbm_cursor_node_list {
-    npage_t npage;
+/* Maximum number of levels of a B-Tree a cursor can go through. Every
+ * node has at least two children, so this is never reached by a valid
+ * file (see chidb_cursor_rewind) */
+#define CURSOR_MAX_DEPTH (32)
+
+/* A primary key of a lookup batch, and its position in the batch (the
+ * order in which it was collected from the index) */
+typedef struct chidb_dbm_lookup_key {
+    chidb_key_t key;
+    uint32_t pos;
+} chidb_dbm_lookup_key_t;
+
+/* A batch of primary keys collected from a cursor on an index, to be
+ * looked up in a cursor on the index's table (see
+ * chidb_cursor_lookup_start). The keys are looked up in increasing order,
+ * so that each leaf of the table is read at most once per batch, however
+ * scattered the keys are in the index. If the rows have to be returned in
+ * the order of the index instead, their records are copied to arena as
+ * they are found, and read from there. The arrays are allocated once, and
+ * kept until the cursor is closed. */
+typedef struct chidb_dbm_lookup
+{
+    struct chidb_dbm_cursor *index;   /* Cursor the keys are collected from */
+    uint32_t size;                    /* Most keys collected at a time */
+    uint32_t n;                       /* Number of keys in the batch */
+    chidb_key_t *keys;                /* Key at each position */
+    chidb_dbm_lookup_key_t *sorted;   /* Keys and their positions, sorted by key */
+    uint32_t next;                    /* Next key (in sorted, or position if
+                                       * the records are copied) to move to */
+    bool copied;                      /* The records are in arena */
+    int64_t row;                      /* Position of the row the cursor is on,
+                                       * if it is read from arena (or -1) */
+    uint32_t *offsets;                /* Start of the record at each position
+                                       * in arena (UINT32_MAX if not found) */
+    uint8_t *arena;                   /* Records of the batch, in key order */
+    uint32_t arena_used;              /* Bytes used in arena */
+    uint32_t arena_size;              /* Bytes allocated for arena */
+} chidb_dbm_lookup_t;
+
+/* A level of the path from the root of the B-Tree to the cursor's current
+ * entry: the node, and the cell (or right page) followed in it */
+typedef struct chidb_dbm_cursor_node {
     ncell_t ncell;
     uint8_t is_right;
     BTreeNode *btn;
-
-    struct chidb_dbm_cursor_node_list *parent;
-} chidb_dbm_cursor_node_list_t;
+} chidb_dbm_cursor_node_t;
 
 typedef struct chidb_dbm_cursor
 {
@@ -68,15 +106,80 @@ typedef struct chidb_dbm_cursor
     npage_t nroot;
     int32_t col_num;
 
-    chidb_dbm_cursor_node_list_t *node_list;
+    /* path[0] is the root and path[depth - 1] the leaf the cursor is on
+     * (depth is 0 if the cursor is not positioned). The first n_nodes
+     * nodes (and spare) are kept from one operation to the next, and
+     * reloaded in place with chidb_Btree_reloadNode, so moving the cursor
+     * does not allocate memory once the path has been loaded. */
+    chidb_dbm_cursor_node_t path[CURSOR_MAX_DEPTH];
+    uint32_t depth;
+    uint32_t n_nodes;
+    BTreeNode *spare;
+
+    /* Change counter of the B-Tree (see chidb_Btree_changes) when the
+     * path was read from the root. If the B-Tree has changed since, the
+     * path may be stale, and the next operation looks the key of the
+     * cursor's entry up again before using it (see cursor_restore). If
+     * the entry is gone by then, the cursor is left on the entry after
+     * it (moved is 1) or before it (moved is -1) instead, and the next
+     * move in that direction only clears moved. */
+    uint64_t changes;
+    int8_t moved;
+
+    /* End of the cursor's range (see chidb_cursor_set_end): moving
+     * forward (if end_dir is 1) or backward (if it is -1) stops at the
+     * first entry past end_key, or at end_key itself if end_inclusive is
+     * false. end_dir is 0 if the cursor has no end. */
+    int8_t end_dir;
+    bool end_inclusive;
+    chidb_key_t end_key;
+
+    /* Header of the row the cursor is on, decoded by the first
+     * chidb_cursor_fetch_col after the cursor moves (row_valid is false
+     * until then): the type code and data offset of each of the col_num
+     * columns. The arrays are allocated once, and kept until the cursor
+     * is closed. */
+    bool row_valid;
+    uint32_t *row_types;
+    uint32_t *row_offsets;
+
+    /* Batch of primary keys to look up (NULL until
+     * chidb_cursor_lookup_start is first called) */
+    chidb_dbm_lookup_t *lookup;
+
+    /* Primary key found by the last chidb_cursor_seek_hash, for cursors
+     * on hash indexes, which have no nodes to be positioned on */
+    chidb_key_t hash_keyPk;
 } chidb_dbm_cursor_t;
 
+/* The level of the path with the leaf the cursor is on (the cursor must be
+ * positioned) */
+#define CURSOR_LEAF(cursor) (&(cursor)->path[(cursor)->depth - 1])
+
+/* The values of a column in a batch of rows fetched with
+ * chidb_cursor_fetch_batch. Bit r of a bitmap is bit (r % 8) of byte
+ * r / 8. The string in row r (empty if the value is not a string) is
+ * arena[offsets[r]] to arena[offsets[r + 1] - 1], and is not
+ * NUL-terminated. The arrays are grown as needed by every batch, and
+ * freed by chidb_cursor_batch_free. */
+typedef struct chidb_dbm_vector
+{
+    int32_t *ints;        /* Integer value of each row (0 if not an integer) */
+    uint8_t *nulls;       /* Bitmap of the rows where the value is NULL */
+    uint8_t *texts;       /* Bitmap of the rows where the value is a string */
+    uint32_t *offsets;    /* Start of the string of each row in arena */
+    char *arena;          /* Strings of all the rows, one after the other */
+    uint32_t capacity;    /* Rows allocated for ints, nulls, texts and offsets */
+    uint32_t arena_size;  /* Bytes allocated for arena */
+} chidb_dbm_vector_t;
+
 /* Cursor function definitions go here */
 
 int chidb_cursor_open(chidb_dbm_cursor_type_t type, npage_t nroot, int32_t col_num, chidb_dbm_cursor_t *cursor);
 int chidb_cursor_close(BTree *bt, chidb_dbm_cursor_t *cursor);
 
 int chidb_cursor_rewind(BTree *bt, chidb_dbm_cursor_t *cursor);
+int chidb_cursor_last(BTree *bt, chidb_dbm_cursor_t *cursor);
 int chidb_cursor_next(BTree *bt, chidb_dbm_cursor_t *cursor);
 int chidb_cursor_prev(BTree *bt, chidb_dbm_cursor_t *cursor);
 
@@ -86,8 +189,20 @@ int chidb_cursor_seek_ge(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_key_t key)
 int chidb_cursor_seek_lt(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_key_t key);
 int chidb_cursor_seek_le(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_key_t key);
 
+int chidb_cursor_seek_hash(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_key_t key);
+
+void chidb_cursor_set_end(chidb_dbm_cursor_t *cursor, chidb_key_t key, bool inclusive, bool reverse);
+void chidb_cursor_clear_end(chidb_dbm_cursor_t *cursor);
+
 int chidb_cursor_fetch_key(BTree *bt, chidb_dbm_cursor_t *cursor, int32_t *key);
 int chidb_cursor_fetch_col(BTree *bt, chidb_dbm_cursor_t *cursor, int n,
-                            uint8_t *type, int32_t *num, char **str);
+                            uint8_t *type, int32_t *num, char **str, uint32_t *len);
+int chidb_cursor_fetch_hash_pkey(BTree *bt, chidb_dbm_cursor_t *cursor, int32_t *pkey);
+int chidb_cursor_fetch_batch(BTree *bt, chidb_dbm_cursor_t *cursor, const int32_t *cols, int ncols,
+                             uint32_t n_rows, chidb_dbm_vector_t *vectors, uint32_t *n_fetched);
+void chidb_cursor_batch_free(chidb_dbm_vector_t *vectors, int ncols);
+
+int chidb_cursor_lookup_start(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_dbm_cursor_t *index, uint32_t size);
+int chidb_cursor_lookup_next(BTree *bt, chidb_dbm_cursor_t *cursor, bool ordered);
 
 #endif /* DBM_CURSOR_H_ */
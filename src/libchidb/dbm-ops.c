@@ -41,6 +41,7 @@
 #include "dbm.h"
 #include "btree.h"
 #include "record.h"
+#include "hash.h"
 
 
 /* Function pointer for dispatch table */
@@ -78,6 +79,10 @@ int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* Forward declaration of auxiliary functions. */
+int reg_strcmp(chidb_dbm_register_t *r1, chidb_dbm_register_t *r2);
+
+
 /*** INSTRUCTION HANDLER IMPLEMENTATIONS ***/
 
 
@@ -113,6 +118,10 @@ int chidb_dbm_op_Close (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
     int ret;
+    // strings borrowed from the cursor's rows outlive it
+    if ((ret = chidb_stmt_materialize(stmt, op->p1)) != CHIDB_OK) {
+        return ret;
+    }
     if ((ret = chidb_cursor_close(stmt->db->bt, &stmt->cursors[op->p1])) != CHIDB_OK) {
         return ret;
     }
@@ -137,6 +146,28 @@ int chidb_dbm_op_Rewind (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* Last p1 p2 * *
+ *
+ * p1: cursor
+ * p2: jump addr
+ *
+ * make cursor p1 point to the last entry in the B-Tree (the reverse of
+ * Rewind, for scans with Prev); if the B-Tree is empty, jump
+ */
+int chidb_dbm_op_Last (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int ret;
+    ret = chidb_cursor_last(stmt->db->bt, &stmt->cursors[op->p1]);
+    if (ret == CHIDB_EEMPTY) {
+        stmt->pc = op->p2;
+    } else if (ret != CHIDB_OK) {
+        return ret;
+    }
+
+    return CHIDB_OK;
+}
+
+
 int chidb_dbm_op_Next (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -231,6 +262,75 @@ int chidb_dbm_op_SeekLe (chidb_stmt *stmt, chidb_dbm_op_t *op)
     return CHIDB_OK;
 }
 
+
+/* EndLe p1 * p3 *
+ *
+ * p1: cursor
+ * p3: register containing a key
+ *
+ * the range of cursor p1 ends at the last key <= the key in register p3,
+ * for scans with Next (see chidb_cursor_set_end): from then on, Next and
+ * the Seek ops stop there as if the B-Tree ended there, so a range scan
+ * needs no comparison op per row
+ */
+int chidb_dbm_op_EndLe (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int32_t key = stmt->reg[op->p3].value.i;
+    chidb_cursor_set_end(&stmt->cursors[op->p1], key, true, false);
+
+    return CHIDB_OK;
+}
+
+
+/* EndLt p1 * p3 *
+ *
+ * p1: cursor
+ * p3: register containing a key
+ *
+ * like EndLe, but the range ends at the last key < the key in register p3
+ */
+int chidb_dbm_op_EndLt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int32_t key = stmt->reg[op->p3].value.i;
+    chidb_cursor_set_end(&stmt->cursors[op->p1], key, false, false);
+
+    return CHIDB_OK;
+}
+
+
+/* EndGe p1 * p3 *
+ *
+ * p1: cursor
+ * p3: register containing a key
+ *
+ * like EndLe, but for scans with Prev: the range ends at the last key >=
+ * the key in register p3
+ */
+int chidb_dbm_op_EndGe (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int32_t key = stmt->reg[op->p3].value.i;
+    chidb_cursor_set_end(&stmt->cursors[op->p1], key, true, true);
+
+    return CHIDB_OK;
+}
+
+
+/* EndGt p1 * p3 *
+ *
+ * p1: cursor
+ * p3: register containing a key
+ *
+ * like EndLe, but for scans with Prev: the range ends at the last key >
+ * the key in register p3
+ */
+int chidb_dbm_op_EndGt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int32_t key = stmt->reg[op->p3].value.i;
+    chidb_cursor_set_end(&stmt->cursors[op->p1], key, false, true);
+
+    return CHIDB_OK;
+}
+
 int chidb_dbm_op_Column (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -239,8 +339,9 @@ int chidb_dbm_op_Column (chidb_stmt *stmt, chidb_dbm_op_t *op)
     uint8_t type;
     int32_t num;
     char *str;
+    uint32_t len;
     ret = chidb_cursor_fetch_col(stmt->db->bt, &stmt->cursors[op->p1], n,
-                                &type, &num, &str);
+                                &type, &num, &str, &len);
 
     if (ret != CHIDB_OK) {
         return ret;
@@ -253,7 +354,11 @@ int chidb_dbm_op_Column (chidb_stmt *stmt, chidb_dbm_op_t *op)
         stmt->reg[op->p3].value.i = num;
         break;
     case 3:
+        // the register borrows the string from the cursor's row
         stmt->reg[op->p3].value.s = str;
+        stmt->reg[op->p3].borrowed = true;
+        stmt->reg[op->p3].cursor = op->p1;
+        stmt->reg[op->p3].len = len;
         break;
     default:
         break;
@@ -294,6 +399,7 @@ int chidb_dbm_op_String (chidb_stmt *stmt, chidb_dbm_op_t *op)
     /* Your code goes here */
     stmt->reg[op->p2].type = REG_STRING;
     stmt->reg[op->p2].value.s = op->p4;
+    stmt->reg[op->p2].borrowed = false;
 
     return CHIDB_OK;
 }
@@ -348,7 +454,7 @@ int chidb_dbm_op_Eq (chidb_stmt *stmt, chidb_dbm_op_t *op)
         }
         break;
     case REG_STRING:
-        if (strcmp(stmt->reg[op->p3].value.s, stmt->reg[op->p1].value.s) == 0) {
+        if (reg_strcmp(&stmt->reg[op->p3], &stmt->reg[op->p1]) == 0) {
             stmt->pc = op->p2;
         }
         break;
@@ -373,7 +479,7 @@ int chidb_dbm_op_Ne (chidb_stmt *stmt, chidb_dbm_op_t *op)
         }
         break;
     case REG_STRING:
-        if (strcmp(stmt->reg[op->p3].value.s, stmt->reg[op->p1].value.s) != 0) {
+        if (reg_strcmp(&stmt->reg[op->p3], &stmt->reg[op->p1]) != 0) {
             stmt->pc = op->p2;
         }
         break;
@@ -398,7 +504,7 @@ int chidb_dbm_op_Lt (chidb_stmt *stmt, chidb_dbm_op_t *op)
         }
         break;
     case REG_STRING:
-        if (strcmp(stmt->reg[op->p3].value.s, stmt->reg[op->p1].value.s) < 0) {
+        if (reg_strcmp(&stmt->reg[op->p3], &stmt->reg[op->p1]) < 0) {
             stmt->pc = op->p2;
         }
         break;
@@ -423,7 +529,7 @@ int chidb_dbm_op_Le (chidb_stmt *stmt, chidb_dbm_op_t *op)
         }
         break;
     case REG_STRING:
-        if (strcmp(stmt->reg[op->p3].value.s, stmt->reg[op->p1].value.s) <= 0) {
+        if (reg_strcmp(&stmt->reg[op->p3], &stmt->reg[op->p1]) <= 0) {
             stmt->pc = op->p2;
         }
         break;
@@ -448,7 +554,7 @@ int chidb_dbm_op_Gt (chidb_stmt *stmt, chidb_dbm_op_t *op)
         }
         break;
     case REG_STRING:
-        if (strcmp(stmt->reg[op->p3].value.s, stmt->reg[op->p1].value.s) > 0) {
+        if (reg_strcmp(&stmt->reg[op->p3], &stmt->reg[op->p1]) > 0) {
             stmt->pc = op->p2;
         }
         break;
@@ -473,7 +579,7 @@ int chidb_dbm_op_Ge (chidb_stmt *stmt, chidb_dbm_op_t *op)
         }
         break;
     case REG_STRING:
-        if (strcmp(stmt->reg[op->p3].value.s, stmt->reg[op->p1].value.s) >= 0) {
+        if (reg_strcmp(&stmt->reg[op->p3], &stmt->reg[op->p1]) >= 0) {
             stmt->pc = op->p2;
         }
         break;
@@ -559,14 +665,143 @@ int chidb_dbm_op_IdxPKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
  *
  * p1: cursor
  * p2: register containing IdxKey
- * p2: register containing PKey
+ * p3: register containing PKey
  *
  * add new (IdkKey,PKey) entry in index BTree pointed at by cursor at p1
  */
 int chidb_dbm_op_IdxInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-  fprintf(stderr,"todo: chidb_dbm_op_IdxInsert\n");
-  exit(1);
+    /* Your code goes here */
+    int32_t keyIdx = stmt->reg[op->p2].value.i;
+    int32_t keyPk = stmt->reg[op->p3].value.i;
+
+    // goes through the index's insert buffer, if it has one
+    return chidb_Btree_insertInIndex(stmt->db->bt, stmt->cursors[op->p1].nroot, keyIdx, keyPk);
+}
+
+
+/* IdxBatch p1 p2 p3 *
+ *
+ * p1: cursor on an index
+ * p2: jump addr
+ * p3: cursor on the table of the index
+ *
+ * collect the pkeys of the entries of cursor p1, from the one it is on,
+ * to be looked up in cursor p3 by BatchNext, DBM_LOOKUP_SIZE at a time
+ * (see chidb_cursor_lookup_start); if there are none, jump
+ */
+int chidb_dbm_op_IdxBatch (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int ret;
+    // the copies of the previous batch's rows are about to be reused
+    if ((ret = chidb_stmt_materialize(stmt, op->p3)) != CHIDB_OK) {
+        return ret;
+    }
+    ret = chidb_cursor_lookup_start(stmt->db->bt, &stmt->cursors[op->p3], &stmt->cursors[op->p1], DBM_LOOKUP_SIZE);
+    if (ret == CHIDB_EEMPTY) {
+        stmt->pc = op->p2;
+        return CHIDB_OK;
+    }
+
+    return ret;
+}
+
+
+/* BatchNext p1 p2 p3 *
+ *
+ * p1: cursor on a table, with pkeys collected by IdxBatch
+ * p2: jump addr
+ * p3: 0 to go through the rows in pkey order, or 1 to go through them
+ *     in the order of the index
+ *
+ * move cursor p1 to the row of the next pkey (see
+ * chidb_cursor_lookup_next), collecting the next batch of pkeys from the
+ * index when the current one is done; if there is one, jump
+ */
+int chidb_dbm_op_BatchNext (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int ret;
+    chidb_dbm_cursor_t *cursor = &stmt->cursors[op->p1];
+    while ((ret = chidb_cursor_lookup_next(stmt->db->bt, cursor, op->p3 != 0)) == CHIDB_EEMPTY
+            && cursor->lookup != NULL) {
+        // the copies of this batch's rows are about to be reused
+        if ((ret = chidb_stmt_materialize(stmt, op->p1)) != CHIDB_OK) {
+            return ret;
+        }
+        ret = chidb_cursor_lookup_start(stmt->db->bt, cursor, cursor->lookup->index, cursor->lookup->size);
+        if (ret != CHIDB_OK) {
+            break;
+        }
+    }
+    if (ret == CHIDB_OK) {
+        stmt->pc = op->p2;
+    } else if (ret != CHIDB_EEMPTY) {
+        return ret;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* HashSeek p1 p2 p3 *
+ *
+ * p1: cursor on a hash index
+ * p2: jump addr
+ * p3: register containing IdxKey
+ *
+ * position cursor p1 on the entry for IdxKey; if there is none, jump
+ */
+int chidb_dbm_op_HashSeek (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int ret;
+    int32_t key = stmt->reg[op->p3].value.i;
+    ret = chidb_cursor_seek_hash(stmt->db->bt, &stmt->cursors[op->p1], key);
+    if (ret == CHIDB_ENOTFOUND) {
+        stmt->pc = op->p2;
+        return CHIDB_OK;
+    }
+
+    return ret;
+}
+
+
+/* HashPKey p1 p2 * *
+ *
+ * p1: cursor on a hash index
+ * p2: register
+ *
+ * store pkey of the entry cursor p1 was positioned on by HashSeek
+ * in (register at p2)
+ */
+int chidb_dbm_op_HashPKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int ret;
+    int32_t pkey;
+    ret = chidb_cursor_fetch_hash_pkey(stmt->db->bt, &stmt->cursors[op->p1], &pkey);
+    if (ret != CHIDB_OK) {
+        return ret;
+    }
+    stmt->reg[op->p2].type = REG_INT32;
+    stmt->reg[op->p2].value.i = pkey;
+
+    return CHIDB_OK;
+}
+
+
+/* HashInsert p1 p2 p3 *
+ *
+ * p1: cursor on a hash index
+ * p2: register containing IdxKey
+ * p3: register containing PKey
+ *
+ * add new (IdxKey,PKey) entry in hash index pointed at by cursor at p1
+ */
+int chidb_dbm_op_HashInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int32_t keyIdx = stmt->reg[op->p2].value.i;
+    int32_t keyPk = stmt->reg[op->p3].value.i;
+
+    return chidb_Hash_insert(stmt->db->bt->pager, stmt->cursors[op->p1].nroot, keyIdx, keyPk);
 }
 
 
@@ -610,3 +845,15 @@ int chidb_dbm_op_Halt (chidb_stmt *stmt, chidb_dbm_op_t *op)
     return op->p1;
 }
 
+
+/* Compares the values of two string registers, like strcmp (borrowed
+ * values are not NUL-terminated) */
+int reg_strcmp(chidb_dbm_register_t *r1, chidb_dbm_register_t *r2)
+{
+    uint32_t len1 = reg_strlen(r1), len2 = reg_strlen(r2);
+    int cmp = memcmp(r1->value.s, r2->value.s, len1 < len2 ? len1 : len2);
+
+    if (cmp != 0)
+        return cmp;
+    return len1 < len2 ? -1 : len1 > len2;
+}
@@ -0,0 +1,274 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine parallel scans
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include "dbm-scan.h"
+
+/* Forward declaration of auxiliary functions. */
+bool scan_steal(chidb_dbm_scan_t *scan, uint32_t worker);
+
+
+/* Opens a parallel scan of a table B-Tree
+ *
+ * Splits the keys of the B-Tree into one range per worker, at separator
+ * keys of its internal nodes (see chidb_Btree_partition), and opens a
+ * cursor for each worker. Worker i then goes through the rows of its
+ * range by calling chidb_scan_next(scan, i), and reads them with the
+ * usual cursor functions on scan->workers[i].cursor, until it returns
+ * CHIDB_EEMPTY. Each worker can run in its own thread; a worker must only
+ * be used by one thread at a time, and every worker has to be run until
+ * it is done, since it may be left with part of its range.
+ *
+ * Every row of the B-Tree is returned to exactly one worker. When a worker
+ * is done with its range, it takes the upper half of what is left of the
+ * largest remaining range of another worker, so all the workers keep busy
+ * until the whole B-Tree has been read, even if the ranges turn out to
+ * have different sizes (or the tree has fewer separator keys than there
+ * are workers, in which case some workers start without a range).
+ * Rows inserted after the scan is opened may or may not be returned.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the table B-Tree
+ * - col_num: Number of columns of the table (see chidb_cursor_open)
+ * - n_workers: Number of workers (at least 1)
+ * - scan: Out parameter. The scan, to be closed with chidb_scan_close.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: n_workers is 0
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - Any other error from chidb_Btree_partition
+ */
+int chidb_scan_open(BTree *bt, npage_t nroot, int32_t col_num, uint32_t n_workers, chidb_dbm_scan_t **scan) {
+    int ret;
+    if (n_workers == 0) {
+        return CHIDB_EMISUSE;
+    }
+    chidb_key_t *bounds = malloc(n_workers * sizeof(chidb_key_t));
+    chidb_dbm_scan_t *s = malloc(sizeof(chidb_dbm_scan_t));
+    chidb_dbm_scan_worker_t *workers = malloc(n_workers * sizeof(chidb_dbm_scan_worker_t));
+    if (bounds == NULL || s == NULL || workers == NULL) {
+        free(bounds);
+        free(s);
+        free(workers);
+        return CHIDB_ENOMEM;
+    }
+    uint32_t n_bounds;
+    if ((ret = chidb_Btree_partition(bt, nroot, n_workers, bounds, &n_bounds)) != CHIDB_OK) {
+        free(bounds);
+        free(s);
+        free(workers);
+        return ret;
+    }
+    // the last range ends at the largest key, so that the keys above it
+    // (which are not there) are not handed from worker to worker
+    npage_t nleaf;
+    chidb_key_t max_key;
+    if (chidb_Btree_findRightmostLeaf(bt, nroot, &nleaf, &max_key) != CHIDB_OK) {
+        max_key = UINT32_MAX;
+    }
+
+    s->bt = bt;
+    s->nroot = nroot;
+    s->n_workers = n_workers;
+    s->workers = workers;
+    pthread_mutex_init(&s->steal_lock, NULL);
+    for (uint32_t i = 0; i < n_workers; i++) {
+        chidb_dbm_scan_worker_t *w = &workers[i];
+        chidb_cursor_open(CURSOR_READ, nroot, col_num, &w->cursor);
+        pthread_mutex_init(&w->lock, NULL);
+        w->positioned = false;
+        w->n_rows = 0;
+        w->n_steals = 0;
+        if (i <= n_bounds) {
+            w->next = i == 0 ? 0 : (uint64_t) bounds[i - 1] + 1;
+            w->end = i == n_bounds ? max_key : bounds[i];
+        } else {
+            w->next = 1;
+            w->end = 0;
+        }
+    }
+    free(bounds);
+    *scan = s;
+
+    return CHIDB_OK;
+}
+
+/* Moves a worker of a parallel scan to its next row
+ *
+ * The first call positions the worker's cursor on the first row of its
+ * range. Once the range is done, the worker takes part of another
+ * worker's range, and goes on from there.
+ *
+ * Parameters
+ * - scan: Parallel scan
+ * - worker: Number of the worker (less than scan->n_workers)
+ *
+ * Return
+ * - CHIDB_OK: The worker's cursor is on a row it has to process
+ * - CHIDB_EEMPTY: There are no rows left for any worker
+ * - Any other error from chidb_cursor_seek_ge or chidb_cursor_next
+ */
+int chidb_scan_next(chidb_dbm_scan_t *scan, uint32_t worker) {
+    int ret;
+    chidb_dbm_scan_worker_t *w = &scan->workers[worker];
+    while (1) {
+        if (w->positioned) {
+            ret = chidb_cursor_next(scan->bt, &w->cursor);
+        } else {
+            pthread_mutex_lock(&w->lock);
+            uint64_t next = w->next;
+            bool empty = w->next > w->end;
+            pthread_mutex_unlock(&w->lock);
+            ret = empty ? CHIDB_EEMPTY : chidb_cursor_seek_ge(scan->bt, &w->cursor, next);
+        }
+
+        if (ret == CHIDB_OK) {
+            int32_t key;
+            if ((ret = chidb_cursor_fetch_key(scan->bt, &w->cursor, &key)) != CHIDB_OK) {
+                return ret;
+            }
+            // the row is only the worker's if no one has taken it yet
+            pthread_mutex_lock(&w->lock);
+            bool mine = (chidb_key_t) key <= w->end;
+            if (mine) {
+                w->next = (uint64_t) (chidb_key_t) key + 1;
+            } else {
+                w->next = w->end + 1;
+            }
+            pthread_mutex_unlock(&w->lock);
+            if (mine) {
+                w->positioned = true;
+                w->n_rows++;
+                return CHIDB_OK;
+            }
+        } else if (ret != CHIDB_EEMPTY) {
+            return ret;
+        } else {
+            pthread_mutex_lock(&w->lock);
+            w->next = w->end + 1;
+            pthread_mutex_unlock(&w->lock);
+        }
+
+        // the range is done
+        w->positioned = false;
+        if (!scan_steal(scan, worker)) {
+            return CHIDB_EEMPTY;
+        }
+    }
+}
+
+/* Closes a parallel scan, and the cursors of all its workers */
+int chidb_scan_close(chidb_dbm_scan_t *scan) {
+    int ret = CHIDB_OK;
+    for (uint32_t i = 0; i < scan->n_workers; i++) {
+        int r = chidb_cursor_close(scan->bt, &scan->workers[i].cursor);
+        if (ret == CHIDB_OK) {
+            ret = r;
+        }
+        pthread_mutex_destroy(&scan->workers[i].lock);
+    }
+    pthread_mutex_destroy(&scan->steal_lock);
+    free(scan->workers);
+    free(scan);
+
+    return ret;
+}
+
+
+/* Gives a worker that is done with its range the upper half of what is
+ * left of the largest range of another worker
+ *
+ * Ranges are split by key, not by number of rows, so a worker may end up
+ * taking a part of a range that has few rows; it then simply comes back
+ * for more.
+ *
+ * Return
+ * - true: The worker has a new range
+ * - false: No worker has more than one key left
+ */
+bool scan_steal(chidb_dbm_scan_t *scan, uint32_t worker) {
+    chidb_dbm_scan_worker_t *w = &scan->workers[worker];
+    bool found = false;
+
+    // only one worker at a time looks for a range, so no two of them pick
+    // the same one
+    pthread_mutex_lock(&scan->steal_lock);
+    while (!found) {
+        chidb_dbm_scan_worker_t *victim = NULL;
+        uint64_t largest = 1;
+        for (uint32_t i = 0; i < scan->n_workers; i++) {
+            chidb_dbm_scan_worker_t *v = &scan->workers[i];
+            if (i == worker) {
+                continue;
+            }
+            pthread_mutex_lock(&v->lock);
+            if (v->next <= v->end && v->end - v->next + 1 > largest) {
+                largest = v->end - v->next + 1;
+                victim = v;
+            }
+            pthread_mutex_unlock(&v->lock);
+        }
+        if (victim == NULL) {
+            break;
+        }
+
+        // the victim may have moved on since it was picked
+        pthread_mutex_lock(&victim->lock);
+        if (victim->next <= victim->end && victim->end - victim->next + 1 > 1) {
+            uint64_t mid = victim->next + (victim->end - victim->next + 1) / 2;
+            pthread_mutex_lock(&w->lock);
+            w->next = mid;
+            w->end = victim->end;
+            pthread_mutex_unlock(&w->lock);
+            victim->end = mid - 1;
+            found = true;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    pthread_mutex_unlock(&scan->steal_lock);
+
+    if (found) {
+        w->n_steals++;
+    }
+
+    return found;
+}
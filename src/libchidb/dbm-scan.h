@@ -0,0 +1,81 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine parallel scans -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef DBM_SCAN_H_
+#define DBM_SCAN_H_
+
+#include <pthread.h>
+#include "chidbInt.h"
+#include "btree.h"
+#include "dbm-cursor.h"
+
+/* A worker of a parallel scan, with its own cursor and range of keys.
+ * The keys from next to end (inclusive) are the part of the range that
+ * the worker has not reached yet; other workers that run out of keys
+ * take the upper half of it, by lowering end. next and end are 64 bits
+ * wide so that a range can end at UINT32_MAX and still be empty. */
+typedef struct chidb_dbm_scan_worker
+{
+    chidb_dbm_cursor_t cursor;
+    pthread_mutex_t lock;  /* Protects next and end */
+    uint64_t next;
+    uint64_t end;
+    bool positioned;       /* The cursor is on a row of the range */
+    uint32_t n_rows;       /* Rows returned by chidb_scan_next */
+    uint32_t n_steals;     /* Ranges taken from other workers */
+} chidb_dbm_scan_worker_t;
+
+/* A scan of a table B-Tree split among several workers, which can run in
+ * different threads (see chidb_scan_open) */
+typedef struct chidb_dbm_scan
+{
+    BTree *bt;
+    npage_t nroot;
+    pthread_mutex_t steal_lock;  /* Held while a worker takes a range */
+    uint32_t n_workers;
+    chidb_dbm_scan_worker_t *workers;
+} chidb_dbm_scan_t;
+
+
+int chidb_scan_open(BTree *bt, npage_t nroot, int32_t col_num, uint32_t n_workers, chidb_dbm_scan_t **scan);
+int chidb_scan_next(chidb_dbm_scan_t *scan, uint32_t worker);
+int chidb_scan_close(chidb_dbm_scan_t *scan);
+
+#endif /* DBM_SCAN_H_ */
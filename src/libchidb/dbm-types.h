@@ -50,6 +50,9 @@
 #define DEFAULT_REG_SIZE (10)
 #define DEFAULT_CUR_SIZE (10)
 
+/* Number of primary keys collected from an index at a time by IdxBatch */
+#define DBM_LOOKUP_SIZE (256)
+
 /* We define a "for each" macro to generate the various portions
  * of code that relate to opcodes. This is based on the solution
  * shown at http://stackoverflow.com/questions/9907160/how-to-convert-enum-names-to-string-in-c
@@ -61,6 +64,7 @@
         OP(OpenWrite)   \
         OP(Close)       \
         OP(Rewind)      \
+        OP(Last)        \
         OP(Next)        \
         OP(Prev)        \
         OP(Seek)        \
@@ -68,6 +72,10 @@
         OP(SeekGe)      \
         OP(SeekLt)      \
         OP(SeekLe)      \
+        OP(EndLe)       \
+        OP(EndLt)       \
+        OP(EndGe)       \
+        OP(EndGt)       \
         OP(Column)      \
         OP(Key)         \
         OP(Integer)     \
@@ -88,6 +96,11 @@
         OP(IdxLe)       \
         OP(IdxPKey)     \
         OP(IdxInsert)   \
+        OP(IdxBatch)    \
+        OP(BatchNext)   \
+        OP(HashSeek)    \
+        OP(HashPKey)    \
+        OP(HashInsert)  \
         OP(CreateTable) \
         OP(CreateIndex) \
         OP(Copy)        \
@@ -205,8 +218,25 @@ typedef struct chidb_dbm_register
         } bin;
     } value;
 
+    /* A string register set by a Column instruction is borrowed: value.s
+     * points into the row the cursor is on, is not NUL-terminated, and is
+     * only valid until that cursor moves. Values that must outlive the
+     * row are copied into owned (see chidb_stmt_reg_materialize), which
+     * is kept from one copy to the next. */
+    bool borrowed;
+    int32_t cursor;     /* Cursor the value is borrowed from */
+    uint32_t len;       /* Length of a borrowed value */
+    char *owned;
+    uint32_t owned_size;
+
 } chidb_dbm_register_t;
 
+/* Length of the value of a string register */
+static inline uint32_t reg_strlen(const chidb_dbm_register_t *r)
+{
+    return r->borrowed ? r->len : strlen(r->value.s);
+}
+
 /*  This is the struct that represents a single DBM program.
  *
  *  Notice how a single DBM program has its own registers and cursors;
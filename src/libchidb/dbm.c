@@ -126,6 +126,8 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
 int chidb_stmt_free(chidb_stmt *stmt)
 {
 	free(stmt->ops);
+	for(int i=0; i < stmt->nReg; i++)
+		free(stmt->reg[i].owned);
 	free(stmt->reg);
 	free(stmt->cursors);
     return CHIDB_OK;
@@ -213,9 +215,84 @@ int chidb_stmt_exec(chidb_stmt *stmt)
     if (rc == CHIDB_OK || rc == CHIDB_DONE)
         rc = CHIDB_DONE;
 
+    /* Once the program stops, its cursors may be closed at any time, so
+     * the registers cannot borrow from them any more */
+    if (rc != CHIDB_ROW)
+    {
+        int mrc = chidb_stmt_materialize(stmt, -1);
+        if (mrc != CHIDB_OK)
+            rc = mrc;
+    }
+
     return rc;
 }
 
+
+/* Make a string register own its value
+ *
+ * If the register borrows its value from a cursor's row (see
+ * chidb_dbm_op_Column), the value is copied into the register's own
+ * buffer, and NUL-terminated, so it remains valid after the cursor moves.
+ * The buffer is reused by later copies into the same register, and freed
+ * by chidb_stmt_free. Does nothing for any other register.
+ *
+ * Parameters
+ * - r: Register
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_stmt_reg_materialize(chidb_dbm_register_t *r)
+{
+    if (r->type != REG_STRING || !r->borrowed)
+        return CHIDB_OK;
+
+    if (r->owned_size < r->len + 1)
+    {
+        char *owned = realloc(r->owned, r->len + 1);
+        if (owned == NULL)
+            return CHIDB_ENOMEM;
+        r->owned = owned;
+        r->owned_size = r->len + 1;
+    }
+    memcpy(r->owned, r->value.s, r->len);
+    r->owned[r->len] = '\0';
+    r->value.s = r->owned;
+    r->borrowed = false;
+
+    return CHIDB_OK;
+}
+
+
+/* Make the registers that borrow from a cursor own their values
+ *
+ * See chidb_stmt_reg_materialize.
+ *
+ * Parameters
+ * - stmt: DBM
+ * - ncursor: Cursor whose rows the registers borrow from, or -1 for
+ *            any cursor
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_stmt_materialize(chidb_stmt *stmt, int32_t ncursor)
+{
+    int rc;
+
+    for(int i=0; i < stmt->nReg; i++)
+    {
+        chidb_dbm_register_t *r = &stmt->reg[i];
+        if (r->type == REG_STRING && r->borrowed && (ncursor < 0 || r->cursor == ncursor))
+            if ((rc = chidb_stmt_reg_materialize(r)) != CHIDB_OK)
+                return rc;
+    }
+
+    return CHIDB_OK;
+}
+
 /* Prints a human-readable representation of an instruction */
 int chidb_stmt_op_print(chidb_dbm_op_t *op)
 {
@@ -253,7 +330,7 @@ char* chidb_stmt_reg_str(chidb_dbm_register_t *r)
         snprintf(s, MAX_STR_LEN, "%i", r->value.i);
         break;
     case REG_STRING:
-        snprintf(s, MAX_STR_LEN, "\"%s\"", r->value.s);
+        snprintf(s, MAX_STR_LEN, "\"%.*s\"", (int) reg_strlen(r), r->value.s);
         break;
     case REG_BINARY:
         snprintf(s, MAX_STR_LEN, "(%i bytes)", r->value.bin.nbytes);
@@ -389,6 +466,9 @@ int realloc_reg(chidb_stmt *stmt, uint32_t size)
     for(int i=stmt->nReg; i < size; i++)
     {
         stmt->reg[i].type = REG_UNSPECIFIED;
+        stmt->reg[i].borrowed = false;
+        stmt->reg[i].owned = NULL;
+        stmt->reg[i].owned_size = 0;
     }
 
     stmt->nReg = size;
@@ -407,6 +487,16 @@ int realloc_cur(chidb_stmt *stmt, uint32_t size)
     for(int i=stmt->nCursors; i < size; i++)
     {
         stmt->cursors[i].type = CURSOR_UNSPECIFIED;
+        stmt->cursors[i].depth = 0;
+        stmt->cursors[i].n_nodes = 0;
+        stmt->cursors[i].spare = NULL;
+        stmt->cursors[i].changes = 0;
+        stmt->cursors[i].moved = 0;
+        stmt->cursors[i].end_dir = 0;
+        stmt->cursors[i].row_valid = false;
+        stmt->cursors[i].row_types = NULL;
+        stmt->cursors[i].row_offsets = NULL;
+        stmt->cursors[i].lookup = NULL;
     }
 
     stmt->nCursors = size;
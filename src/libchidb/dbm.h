@@ -48,6 +48,8 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db);
 int chidb_stmt_free(chidb_stmt *stmt);
 int chidb_stmt_set_op(chidb_stmt *stmt, chidb_dbm_op_t *op, uint32_t pos);
 int chidb_stmt_exec(chidb_stmt *stmt);
+int chidb_stmt_reg_materialize(chidb_dbm_register_t *r);
+int chidb_stmt_materialize(chidb_stmt *stmt, int32_t ncursor);
 char* chidb_stmt_rr_str(chidb_stmt *stmt, char sep);
 int chidb_stmt_rr_print(chidb_stmt *stmt, char sep);
 int chidb_stmt_print(chidb_stmt *stmt);
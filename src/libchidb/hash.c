@@ -0,0 +1,555 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Extendible hash indexes
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "util.h"
+
+/* Forward declaration of auxiliary functions. */
+uint32_t hash_key(chidb_key_t key);
+uint32_t hash_root_entries(uint16_t page_size);
+uint8_t hash_max_depth(uint16_t page_size);
+int hash_read_dir(Pager *pager, npage_t nroot, MemPage **root);
+int hash_new_page(Pager *pager, uint8_t type, MemPage **page);
+void hash_free_page(MemPage *page);
+void hash_entry_page(MemPage *root, uint16_t page_size, uint32_t i, npage_t *npage, uint32_t *offset);
+int hash_dir_get(Pager *pager, MemPage *root, uint32_t i, npage_t *nbucket);
+int hash_dir_set(Pager *pager, MemPage *root, uint32_t i, npage_t nbucket);
+int hash_dir_double(Pager *pager, MemPage *root);
+int hash_split(Pager *pager, MemPage *root, MemPage *bucket, uint32_t i);
+int hash_bucket_find(MemPage *bucket, chidb_key_t keyIdx, chidb_key_t *keyPk);
+
+
+/* Create an empty hash index
+ *
+ * Extendible hashing keeps a directory of 2^d bucket pointers, where d is
+ * the global depth, and looks a key up in the bucket of the entry given by
+ * the last d bits of its hash. Several entries can point to the same
+ * bucket: a bucket with local depth l holds every key whose hash ends in
+ * the same l bits. When a bucket fills up, it is split in two with local
+ * depth l + 1; if l was already d, the directory doubles first. So an
+ * equality lookup reads the directory page, at most one more directory
+ * page, and one bucket, however large the index is, and an insertion only
+ * ever splits one bucket at a time.
+ *
+ * Like index B-Trees, a hash index maps index keys to primary keys, and
+ * every index key can only appear once.
+ *
+ * The new index has a single bucket and a global depth of 0.
+ *
+ * Parameters
+ * - pager: Pager of the database file
+ * - nroot: Out parameter. Page number of the directory page, which
+ *          identifies the index.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Hash_create(Pager *pager, npage_t *nroot)
+{
+    int ret;
+    MemPage *root, *bucket;
+    if ((ret = hash_new_page(pager, PGTYPE_HASH_BUCKET, &bucket)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((ret = hash_new_page(pager, PGTYPE_HASH_DIRECTORY, &root)) != CHIDB_OK) {
+        hash_free_page(bucket);
+        return ret;
+    }
+    put4byte(&root->data[HASHDIR_NBUCKETS_OFFSET], 1);
+    put4byte(&root->data[HASHDIR_ENTRIES_OFFSET], bucket->npage);
+
+    if ((ret = chidb_Pager_writePage(pager, bucket)) == CHIDB_OK) {
+        ret = chidb_Pager_writePage(pager, root);
+    }
+    *nroot = root->npage;
+    hash_free_page(bucket);
+    hash_free_page(root);
+
+    return ret;
+}
+
+
+/* Insert an entry into a hash index
+ *
+ * The entry is added to the bucket its key hashes to. If the bucket is
+ * full, it is split (doubling the directory if needed) until the key's
+ * bucket has room for it.
+ *
+ * The directory page is latched exclusively for the whole insertion, so
+ * lookups and other insertions into the same index wait for it.
+ *
+ * Parameters
+ * - pager: Pager of the database file
+ * - nroot: Directory page of the hash index
+ * - keyIdx: Index key
+ * - keyPk: Primary key
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: The index already has an entry for keyIdx
+ * - CHIDB_EMISMATCH: nroot is not the directory page of a hash index
+ * - CHIDB_EFULLDB: The directory cannot grow any more
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Hash_insert(Pager *pager, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk)
+{
+    int ret;
+    MemPage *root, *bucket;
+    npage_t nbucket;
+    chidb_key_t found;
+    uint32_t h = hash_key(keyIdx);
+    uint16_t capacity = (pager->page_size - HASHBUCKET_ENTRIES_OFFSET) / HASHENTRY_SIZE;
+
+    chidb_Pager_latch(pager, nroot, true);
+    if ((ret = hash_read_dir(pager, nroot, &root)) != CHIDB_OK) {
+        chidb_Pager_unlatch(pager, nroot);
+        return ret;
+    }
+
+    while (1) {
+        uint8_t depth = root->data[HASHDIR_GDEPTH_OFFSET];
+        uint32_t i = h & (((uint32_t) 1 << depth) - 1);
+        if ((ret = hash_dir_get(pager, root, i, &nbucket)) != CHIDB_OK) {
+            break;
+        }
+        if ((ret = chidb_Pager_readPage(pager, nbucket, &bucket)) != CHIDB_OK) {
+            break;
+        }
+        if (bucket->data[PGHEADER_PGTYPE_OFFSET] != PGTYPE_HASH_BUCKET) {
+            chidb_Pager_releaseMemPage(pager, bucket);
+            ret = CHIDB_ECORRUPT;
+            break;
+        }
+        if (hash_bucket_find(bucket, keyIdx, &found) == CHIDB_OK) {
+            chidb_Pager_releaseMemPage(pager, bucket);
+            ret = CHIDB_EDUPLICATE;
+            break;
+        }
+
+        uint16_t n = get2byte(&bucket->data[HASHBUCKET_NENTRIES_OFFSET]);
+        if (n < capacity) {
+            uint8_t *entry = &bucket->data[HASHBUCKET_ENTRIES_OFFSET + n * HASHENTRY_SIZE];
+            put4byte(&entry[HASHENTRY_KEYIDX_OFFSET], keyIdx);
+            put4byte(&entry[HASHENTRY_KEYPK_OFFSET], keyPk);
+            put2byte(&bucket->data[HASHBUCKET_NENTRIES_OFFSET], n + 1);
+            ret = chidb_Pager_writePage(pager, bucket);
+            chidb_Pager_releaseMemPage(pager, bucket);
+            uint8_t *nkeys = &root->data[HASHDIR_NKEYS_OFFSET];
+            put4byte(nkeys, get4byte(nkeys) + 1);
+            break;
+        }
+
+        // the bucket is full: split it, doubling the directory first if
+        // only one entry points to it, and try again
+        if (bucket->data[HASHBUCKET_LDEPTH_OFFSET] == depth) {
+            ret = hash_dir_double(pager, root);
+        }
+        if (ret == CHIDB_OK) {
+            ret = hash_split(pager, root, bucket, i);
+        }
+        chidb_Pager_releaseMemPage(pager, bucket);
+        if (ret != CHIDB_OK) {
+            break;
+        }
+    }
+
+    if (ret == CHIDB_OK) {
+        ret = chidb_Pager_writePage(pager, root);
+    }
+    chidb_Pager_releaseMemPage(pager, root);
+    chidb_Pager_unlatch(pager, nroot);
+
+    return ret;
+}
+
+
+/* Find an entry in a hash index
+ *
+ * Reads at most three pages: the directory page, the directory segment
+ * page with the key's entry (if it is not in the directory page), and the
+ * key's bucket.
+ *
+ * Parameters
+ * - pager: Pager of the database file
+ * - nroot: Directory page of the hash index
+ * - keyIdx: Index key
+ * - keyPk: Out parameter. Primary key of the entry.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The index has no entry for keyIdx
+ * - CHIDB_EMISMATCH: nroot is not the directory page of a hash index
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Hash_find(Pager *pager, npage_t nroot, chidb_key_t keyIdx, chidb_key_t *keyPk)
+{
+    int ret;
+    MemPage *root, *bucket;
+    npage_t nbucket;
+
+    chidb_Pager_latch(pager, nroot, false);
+    if ((ret = hash_read_dir(pager, nroot, &root)) != CHIDB_OK) {
+        chidb_Pager_unlatch(pager, nroot);
+        return ret;
+    }
+    uint8_t depth = root->data[HASHDIR_GDEPTH_OFFSET];
+    uint32_t i = hash_key(keyIdx) & (((uint32_t) 1 << depth) - 1);
+    ret = hash_dir_get(pager, root, i, &nbucket);
+    chidb_Pager_releaseMemPage(pager, root);
+    if (ret == CHIDB_OK && (ret = chidb_Pager_readPage(pager, nbucket, &bucket)) == CHIDB_OK) {
+        if (bucket->data[PGHEADER_PGTYPE_OFFSET] != PGTYPE_HASH_BUCKET) {
+            ret = CHIDB_ECORRUPT;
+        } else {
+            ret = hash_bucket_find(bucket, keyIdx, keyPk);
+        }
+        chidb_Pager_releaseMemPage(pager, bucket);
+    }
+    chidb_Pager_unlatch(pager, nroot);
+
+    return ret;
+}
+
+
+/* Get the size of a hash index
+ *
+ * Parameters
+ * - pager: Pager of the database file
+ * - nroot: Directory page of the hash index
+ * - info: Out parameter. Size of the index.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: nroot is not the directory page of a hash index
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Hash_info(Pager *pager, npage_t nroot, HashIndexInfo *info)
+{
+    int ret;
+    MemPage *root;
+
+    chidb_Pager_latch(pager, nroot, false);
+    if ((ret = hash_read_dir(pager, nroot, &root)) == CHIDB_OK) {
+        info->global_depth = root->data[HASHDIR_GDEPTH_OFFSET];
+        info->n_keys = get4byte(&root->data[HASHDIR_NKEYS_OFFSET]);
+        info->n_buckets = get4byte(&root->data[HASHDIR_NBUCKETS_OFFSET]);
+        info->n_segments = 0;
+        while (info->n_segments < HASH_MAX_SEGMENTS &&
+               get4byte(&root->data[HASHDIR_SEGMENTS_OFFSET + 4 * info->n_segments]) != 0) {
+            info->n_segments++;
+        }
+        info->bucket_capacity = (pager->page_size - HASHBUCKET_ENTRIES_OFFSET) / HASHENTRY_SIZE;
+        chidb_Pager_releaseMemPage(pager, root);
+    }
+    chidb_Pager_unlatch(pager, nroot);
+
+    return ret;
+}
+
+
+/*** AUXILIARY FUNCTIONS ***/
+
+
+/* Hashes a key (MurmurHash3's finalizer, which is a bijection, so two
+ * different keys never have the same hash) */
+uint32_t hash_key(chidb_key_t key)
+{
+    uint32_t h = key;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+/* Returns the number of directory entries stored in the directory page
+ * (R in hash.h): the largest power of two that fits */
+uint32_t hash_root_entries(uint16_t page_size)
+{
+    uint32_t fit = (page_size - HASHDIR_ENTRIES_OFFSET) / 4;
+    uint32_t r = 1;
+    while (r * 2 <= fit) {
+        r *= 2;
+    }
+
+    return r;
+}
+
+/* Returns the largest global depth the directory can reach */
+uint8_t hash_max_depth(uint16_t page_size)
+{
+    uint8_t depth = 0;
+    for (uint32_t r = hash_root_entries(page_size); r > 1; r /= 2) {
+        depth++;
+    }
+    depth += HASH_MAX_SEGMENTS;
+
+    return depth > HASH_MAX_DEPTH ? HASH_MAX_DEPTH : depth;
+}
+
+/* Reads the directory page of a hash index, checking that it is one */
+int hash_read_dir(Pager *pager, npage_t nroot, MemPage **root)
+{
+    int ret;
+    if ((ret = chidb_Pager_readPage(pager, nroot, root)) != CHIDB_OK) {
+        return ret;
+    }
+    if ((*root)->data[PGHEADER_PGTYPE_OFFSET] != PGTYPE_HASH_DIRECTORY) {
+        chidb_Pager_releaseMemPage(pager, *root);
+        return CHIDB_EMISMATCH;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Allocates a page and returns an empty copy of it of the given type,
+ * which the caller must write and free with hash_free_page */
+int hash_new_page(Pager *pager, uint8_t type, MemPage **page)
+{
+    if ((*page = malloc(sizeof(MemPage))) == NULL) {
+        return CHIDB_ENOMEM;
+    }
+    if (((*page)->data = calloc(1, pager->page_size)) == NULL) {
+        free(*page);
+        return CHIDB_ENOMEM;
+    }
+    chidb_Pager_allocatePage(pager, &(*page)->npage);
+    (*page)->data[PGHEADER_PGTYPE_OFFSET] = type;
+
+    return CHIDB_OK;
+}
+
+void hash_free_page(MemPage *page)
+{
+    free(page->data);
+    free(page);
+}
+
+/* Finds where entry i of the directory is stored, if it is past the
+ * directory page: the page of its segment, and its offset in that page */
+void hash_entry_page(MemPage *root, uint16_t page_size, uint32_t i, npage_t *npage, uint32_t *offset)
+{
+    uint32_t r = hash_root_entries(page_size);
+    uint32_t per_page = page_size / 4;
+    uint32_t s = 31 - __builtin_clz(i / r);
+    uint32_t o = i - (r << s);
+    *npage = get4byte(&root->data[HASHDIR_SEGMENTS_OFFSET + 4 * s]) + o / per_page;
+    *offset = (o % per_page) * 4;
+}
+
+/* Reads entry i of the directory */
+int hash_dir_get(Pager *pager, MemPage *root, uint32_t i, npage_t *nbucket)
+{
+    int ret;
+    MemPage *page;
+    npage_t npage;
+    uint32_t offset;
+    if (i < hash_root_entries(pager->page_size)) {
+        *nbucket = get4byte(&root->data[HASHDIR_ENTRIES_OFFSET + 4 * i]);
+        return CHIDB_OK;
+    }
+    hash_entry_page(root, pager->page_size, i, &npage, &offset);
+    if ((ret = chidb_Pager_readPage(pager, npage, &page)) != CHIDB_OK) {
+        return ret;
+    }
+    *nbucket = get4byte(&page->data[offset]);
+    chidb_Pager_releaseMemPage(pager, page);
+
+    return CHIDB_OK;
+}
+
+/* Sets entry i of the directory. Entries in the directory page are only
+ * updated in memory (the caller writes the page). */
+int hash_dir_set(Pager *pager, MemPage *root, uint32_t i, npage_t nbucket)
+{
+    int ret;
+    MemPage *page;
+    npage_t npage;
+    uint32_t offset;
+    if (i < hash_root_entries(pager->page_size)) {
+        put4byte(&root->data[HASHDIR_ENTRIES_OFFSET + 4 * i], nbucket);
+        return CHIDB_OK;
+    }
+    hash_entry_page(root, pager->page_size, i, &npage, &offset);
+    if ((ret = chidb_Pager_readPage(pager, npage, &page)) != CHIDB_OK) {
+        return ret;
+    }
+    put4byte(&page->data[offset], nbucket);
+    ret = chidb_Pager_writePage(pager, page);
+    chidb_Pager_releaseMemPage(pager, page);
+
+    return ret;
+}
+
+/* Doubles the directory: the new entries 2^d + j point to the same bucket
+ * as entries j. While the directory fits in the directory page, they are
+ * copied within it; after that, they go to a new segment, and the entries
+ * that were already there stay where they are. */
+int hash_dir_double(Pager *pager, MemPage *root)
+{
+    int ret = CHIDB_OK;
+    uint16_t page_size = pager->page_size;
+    uint8_t depth = root->data[HASHDIR_GDEPTH_OFFSET];
+    uint32_t n = (uint32_t) 1 << depth;
+    uint32_t r = hash_root_entries(page_size);
+    if (depth >= hash_max_depth(page_size)) {
+        return CHIDB_EFULLDB;
+    }
+
+    if (2 * n <= r) {
+        memcpy(&root->data[HASHDIR_ENTRIES_OFFSET + 4 * n], &root->data[HASHDIR_ENTRIES_OFFSET], 4 * n);
+        root->data[HASHDIR_GDEPTH_OFFSET] = depth + 1;
+        return CHIDB_OK;
+    }
+
+    // the new segment is as large as the whole directory so far, which is
+    // the directory page followed by every other segment, in order
+    uint32_t s = 0;
+    while ((r << s) < n) {
+        s++;
+    }
+    npage_t npages = ((uint64_t) n * 4 + page_size - 1) / page_size;
+    uint8_t *entries = calloc(npages, page_size);
+    if (entries == NULL) {
+        return CHIDB_ENOMEM;
+    }
+    memcpy(entries, &root->data[HASHDIR_ENTRIES_OFFSET], 4 * r);
+    uint32_t copied = r;
+    for (uint32_t t = 0; t < s && ret == CHIDB_OK; t++) {
+        npage_t first = get4byte(&root->data[HASHDIR_SEGMENTS_OFFSET + 4 * t]);
+        uint32_t left = (r << t) * 4;
+        for (npage_t npage = first; left > 0 && ret == CHIDB_OK; npage++) {
+            MemPage *page;
+            uint32_t len = left < page_size ? left : page_size;
+            if ((ret = chidb_Pager_readPage(pager, npage, &page)) == CHIDB_OK) {
+                memcpy(&entries[copied * 4], page->data, len);
+                chidb_Pager_releaseMemPage(pager, page);
+                copied += len / 4;
+                left -= len;
+            }
+        }
+    }
+
+    npage_t first;
+    chidb_Pager_allocatePages(pager, npages, &first);
+    for (npage_t j = 0; j < npages && ret == CHIDB_OK; j++) {
+        MemPage page = { first + j, &entries[j * page_size] };
+        ret = chidb_Pager_writePage(pager, &page);
+    }
+    free(entries);
+    if (ret == CHIDB_OK) {
+        put4byte(&root->data[HASHDIR_SEGMENTS_OFFSET + 4 * s], first);
+        root->data[HASHDIR_GDEPTH_OFFSET] = depth + 1;
+    }
+
+    return ret;
+}
+
+/* Splits the bucket that entry i of the directory points to (whose local
+ * depth must be smaller than the global depth): the keys whose hash has a
+ * 1 in bit l (the local depth) move to a new bucket, and the entries of
+ * the directory that end in that bit and the last l bits of i are pointed
+ * to it. Both buckets get local depth l + 1. */
+int hash_split(Pager *pager, MemPage *root, MemPage *bucket, uint32_t i)
+{
+    int ret;
+    MemPage *new_bucket;
+    uint8_t depth = root->data[HASHDIR_GDEPTH_OFFSET];
+    uint8_t ldepth = bucket->data[HASHBUCKET_LDEPTH_OFFSET];
+    if ((ret = hash_new_page(pager, PGTYPE_HASH_BUCKET, &new_bucket)) != CHIDB_OK) {
+        return ret;
+    }
+
+    uint16_t n = get2byte(&bucket->data[HASHBUCKET_NENTRIES_OFFSET]);
+    uint16_t kept = 0, moved = 0;
+    for (uint16_t j = 0; j < n; j++) {
+        uint8_t *entry = &bucket->data[HASHBUCKET_ENTRIES_OFFSET + j * HASHENTRY_SIZE];
+        if ((hash_key(get4byte(&entry[HASHENTRY_KEYIDX_OFFSET])) >> ldepth) & 1) {
+            memcpy(&new_bucket->data[HASHBUCKET_ENTRIES_OFFSET + moved * HASHENTRY_SIZE], entry, HASHENTRY_SIZE);
+            moved++;
+        } else {
+            memmove(&bucket->data[HASHBUCKET_ENTRIES_OFFSET + kept * HASHENTRY_SIZE], entry, HASHENTRY_SIZE);
+            kept++;
+        }
+    }
+    bucket->data[HASHBUCKET_LDEPTH_OFFSET] = ldepth + 1;
+    put2byte(&bucket->data[HASHBUCKET_NENTRIES_OFFSET], kept);
+    new_bucket->data[HASHBUCKET_LDEPTH_OFFSET] = ldepth + 1;
+    put2byte(&new_bucket->data[HASHBUCKET_NENTRIES_OFFSET], moved);
+
+    if ((ret = chidb_Pager_writePage(pager, new_bucket)) == CHIDB_OK) {
+        ret = chidb_Pager_writePage(pager, bucket);
+    }
+    uint32_t step = (uint32_t) 1 << (ldepth + 1);
+    uint32_t j = (i & (((uint32_t) 1 << ldepth) - 1)) | ((uint32_t) 1 << ldepth);
+    for (; j < ((uint32_t) 1 << depth) && ret == CHIDB_OK; j += step) {
+        ret = hash_dir_set(pager, root, j, new_bucket->npage);
+    }
+    if (ret == CHIDB_OK) {
+        uint8_t *nbuckets = &root->data[HASHDIR_NBUCKETS_OFFSET];
+        put4byte(nbuckets, get4byte(nbuckets) + 1);
+    }
+    hash_free_page(new_bucket);
+
+    return ret;
+}
+
+/* Looks for a key in a bucket */
+int hash_bucket_find(MemPage *bucket, chidb_key_t keyIdx, chidb_key_t *keyPk)
+{
+    uint16_t n = get2byte(&bucket->data[HASHBUCKET_NENTRIES_OFFSET]);
+    for (uint16_t j = 0; j < n; j++) {
+        uint8_t *entry = &bucket->data[HASHBUCKET_ENTRIES_OFFSET + j * HASHENTRY_SIZE];
+        if (get4byte(&entry[HASHENTRY_KEYIDX_OFFSET]) == keyIdx) {
+            *keyPk = get4byte(&entry[HASHENTRY_KEYPK_OFFSET]);
+            return CHIDB_OK;
+        }
+    }
+
+    return CHIDB_ENOTFOUND;
+}
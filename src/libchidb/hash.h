@@ -0,0 +1,105 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Extendible hash indexes
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef HASH_H_
+#define HASH_H_
+
+#include "chidbInt.h"
+#include "pager.h"
+
+/* Page types of hash indexes. These are not SQLite page types. */
+#define PGTYPE_HASH_DIRECTORY (0x10)
+#define PGTYPE_HASH_BUCKET (0x18)
+
+/* A hash index is identified by its directory page, which starts with a
+ * header and the first entries of the directory (as many as fit, rounded
+ * down to a power of two). Entry i of the directory is the page number of
+ * the bucket that holds the keys whose hash ends in the bits of i. When
+ * the directory doubles beyond the directory page, the new half goes into
+ * a segment of consecutive pages (with no header); segment s holds entries
+ * [R * 2^s, R * 2^(s+1)), where R is the number of entries in the
+ * directory page, so the entries that were already there never move.
+ *
+ *   0  Page type (PGTYPE_HASH_DIRECTORY)
+ *   1  Global depth (the directory has 2^depth entries)
+ *   2  Unused (zero)
+ *   4  Number of keys
+ *   8  Number of buckets
+ *  12  First page of each segment (HASH_MAX_SEGMENTS page numbers)
+ */
+#define HASHDIR_GDEPTH_OFFSET (1)
+#define HASHDIR_NKEYS_OFFSET (4)
+#define HASHDIR_NBUCKETS_OFFSET (8)
+#define HASHDIR_SEGMENTS_OFFSET (12)
+#define HASHDIR_ENTRIES_OFFSET (HASHDIR_SEGMENTS_OFFSET + 4 * HASH_MAX_SEGMENTS)
+#define HASH_MAX_SEGMENTS (20)
+#define HASH_MAX_DEPTH (30)
+
+/* A bucket page holds the (index key, primary key) entries whose hash
+ * ends in the same local depth bits, in no particular order.
+ *
+ *   0  Page type (PGTYPE_HASH_BUCKET)
+ *   1  Local depth
+ *   2  Number of entries
+ *   4  Entries (HASHENTRY_SIZE bytes each)
+ */
+#define HASHBUCKET_LDEPTH_OFFSET (1)
+#define HASHBUCKET_NENTRIES_OFFSET (2)
+#define HASHBUCKET_ENTRIES_OFFSET (4)
+
+#define HASHENTRY_KEYIDX_OFFSET (0)
+#define HASHENTRY_KEYPK_OFFSET (4)
+#define HASHENTRY_SIZE (8)
+
+/* Size of a hash index (see chidb_Hash_info) */
+typedef struct HashIndexInfo
+{
+    uint8_t global_depth;     /* The directory has 2^global_depth entries */
+    uint32_t n_keys;          /* Number of keys */
+    uint32_t n_buckets;       /* Number of bucket pages */
+    uint32_t n_segments;      /* Number of directory segments */
+    uint16_t bucket_capacity; /* Entries per bucket page */
+} HashIndexInfo;
+
+int chidb_Hash_create(Pager *pager, npage_t *nroot);
+int chidb_Hash_insert(Pager *pager, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk);
+int chidb_Hash_find(Pager *pager, npage_t nroot, chidb_key_t keyIdx, chidb_key_t *keyPk);
+int chidb_Hash_info(Pager *pager, npage_t nroot, HashIndexInfo *info);
+
+#endif /*HASH_H_*/
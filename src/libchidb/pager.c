@@ -64,10 +64,28 @@
 
 #include "pager.h"
 
+/* Forward declaration of auxiliary functions. */
+PagerFrame *pager_frame(Pager *pager, npage_t npage);
+int pager_cache_page(Pager *pager, PagerFrame *frame, const uint8_t *data);
+PagerFrame *pager_evict_page(Pager *pager, uint8_t **data);
+void pager_free_evicted(PagerFrame *frame, uint8_t *data);
+void pager_drop_decoded(PagerFrame *frame);
+void pager_drop_cache(Pager *pager);
+
 /* Open a file
  *
  * This function opens a file for paged access.
  *
+ * The pager keeps a write-through cache of up to cache_size pages (see
+ * chidb_Pager_setCacheSize). The cache does not change the interface:
+ * chidb_Pager_readPage still returns a private copy of the page, which
+ * is simply copied from the cache instead of read from the file.
+ *
+ * A Pager can be used by several threads at once. Reading, writing and
+ * allocating pages are thread-safe, and every page has a reader/writer
+ * latch (see chidb_Pager_latch) that callers can use to keep a group of
+ * pages consistent while they operate on them.
+ *
  * Parameters
  * - pager: An out parameter. Used to return a pointer to the
  *			 newly created Pager.
@@ -83,6 +101,15 @@ int chidb_Pager_open(Pager **pager, const char *filename)
     *pager = malloc(sizeof(Pager));
     if (pager == NULL)
         return CHIDB_ENOMEM;
+    (*pager)->n_pages = 0;
+    (*pager)->page_size = 0;
+    (*pager)->frames = calloc(PAGER_MAX_CHUNKS, sizeof(PagerFrame *));
+    if ((*pager)->frames == NULL)
+        return CHIDB_ENOMEM;
+    (*pager)->cache_size = PAGER_DEFAULT_CACHE_SIZE;
+    (*pager)->n_cached = 0;
+    (*pager)->clock_hand = 1;
+    pthread_mutex_init(&(*pager)->lock, NULL);
     (*pager)->f = fopen(filename, "r+");
 
     if ((*pager)->f == NULL)
@@ -111,13 +138,98 @@ int chidb_Pager_open(Pager **pager, const char *filename)
  */
 int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize)
 {
+    pthread_mutex_lock(&pager->lock);
+    pager_drop_cache(pager);
     pager->page_size = pagesize;
     chidb_Pager_getRealDBSize(pager, &pager->n_pages);
+    pthread_mutex_unlock(&pager->lock);
+
+    return CHIDB_OK;
+}
+
+
+/* Set the size of the page cache
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npages: Maximum number of pages to keep in memory (0 disables
+ *           the cache)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_setCacheSize(Pager *pager, npage_t npages)
+{
+    pthread_mutex_lock(&pager->lock);
+    pager->cache_size = npages;
+    while (pager->n_cached > pager->cache_size) {
+        uint8_t *data;
+        PagerFrame *frame = pager_evict_page(pager, &data);
+        if (frame == NULL)
+            break;
+        pthread_mutex_unlock(&pager->lock);
+        pager_free_evicted(frame, data);
+        pthread_mutex_lock(&pager->lock);
+    }
+    pthread_mutex_unlock(&pager->lock);
+
+    return CHIDB_OK;
+}
+
+
+/* Keep a page in the cache
+ *
+ * A resident page is never evicted from the cache once it has been read
+ * or written, so it can always be read without going to the file. It
+ * still counts towards the size of the cache, but if every cached page
+ * is resident, the cache grows past its size instead of evicting them.
+ *
+ * The B-Tree module makes the pages it pins in memory resident (see
+ * chidb_Btree_pinLevels).
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number
+ * - resident: true to keep the page in the cache, false to let it be
+ *             evicted again
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Pager_setResident(Pager *pager, npage_t npage, bool resident)
+{
+    PagerFrame *frame = pager_frame(pager, npage);
+    if (frame == NULL)
+        return CHIDB_ENOMEM;
+    __atomic_store_n(&frame->resident, resident, __ATOMIC_SEQ_CST);
 
     return CHIDB_OK;
 }
 
 
+/* Check whether a page is resident (see chidb_Pager_setResident)
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number
+ *
+ * Return
+ * - true if the page is resident, false otherwise
+ */
+bool chidb_Pager_isResident(Pager *pager, npage_t npage)
+{
+    npage_t chunk = (npage - 1) / PAGER_CHUNK_SIZE;
+    if (npage < 1 || chunk >= PAGER_MAX_CHUNKS)
+        return false;
+    PagerFrame *frames = __atomic_load_n(&pager->frames[chunk], __ATOMIC_ACQUIRE);
+    if (frames == NULL)
+        return false;
+
+    return __atomic_load_n(&frames[(npage - 1) % PAGER_CHUNK_SIZE].resident, __ATOMIC_SEQ_CST);
+}
+
+
 /* Read the chidb file header
  *
  * This function reads in the header of a chidb file and returns it
@@ -135,9 +247,7 @@ int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize)
  */
 int chidb_Pager_readHeader(Pager *pager, uint8_t *header)
 {
-    int count;
-    count = fseek(pager->f, 0, SEEK_SET);
-    count = fread(header, 1, 100, pager->f);
+    ssize_t count = pread(fileno(pager->f), header, 100, 0);
     if (count != 100)
         return CHIDB_NOHEADER;
     else
@@ -159,7 +269,30 @@ int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
 {
     /* We simply increment the page number counter. readPage
      * and writePage take care of the rest. */
-    *npage = ++pager->n_pages;
+    pthread_mutex_lock(&pager->lock);
+    *npage = __atomic_add_fetch(&pager->n_pages, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pager->lock);
+
+    return CHIDB_OK;
+}
+
+
+/* Allocate several consecutive pages on the file
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - n: Number of pages to allocate
+ * - first: An out parameter that will contain the page number of the
+ *          first page. The pages are first, first + 1, ..., first + n - 1.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_allocatePages(Pager *pager, npage_t n, npage_t *first)
+{
+    pthread_mutex_lock(&pager->lock);
+    *first = __atomic_add_fetch(&pager->n_pages, n, __ATOMIC_SEQ_CST) - n + 1;
+    pthread_mutex_unlock(&pager->lock);
 
     return CHIDB_OK;
 }
@@ -186,20 +319,101 @@ int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
  */
 int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
 {
-    if (npage > pager->n_pages || npage <= 0)
+    if (npage > __atomic_load_n(&pager->n_pages, __ATOMIC_SEQ_CST) || npage <= 0)
         return CHIDB_EPAGENO;
-    int n;
 
     *page = malloc(sizeof(MemPage));
-    if (page == NULL)
+    if (*page == NULL)
         return CHIDB_ENOMEM;
-    (*page)->npage = npage;
-    (*page)->data = calloc(pager->page_size, 1);
+    (*page)->data = malloc(pager->page_size);
     if ((*page)->data == NULL)
         return CHIDB_ENOMEM;
-    fseek(pager->f, (npage - 1) * pager->page_size, SEEK_SET);
-    n = fread((*page)->data, 1, pager->page_size, pager->f);
-    chilog(TRACE, "Read %i bytes from page %i into memory [%x data: %x]", n, npage, *page, (*page)->data);
+
+    return chidb_Pager_readPageInto(pager, npage, *page);
+}
+
+
+/* Read a page from file into an existing MemPage
+ *
+ * Like chidb_Pager_readPage, but the page is copied into a MemPage
+ * previously returned by chidb_Pager_readPage, which is reused instead
+ * of allocating a new one. This allows callers that move from page to
+ * page (such as cursors) to do so without allocating memory.
+ *
+ * A cached page is copied without taking any lock. If a write to the page
+ * overlaps the copy (the page's version is odd, or changes while it is
+ * copied), the copy is thrown away and made again. After PAGER_READ_TRIES
+ * such attempts, the page is read while holding its write lock, which no
+ * write can overlap. Either way, the copy is always of a single version
+ * of the page, so callers that do not latch the page still never see a
+ * half-written one.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number of page to read.
+ * - page: MemPage to read the page into. Its contents are overwritten.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_readPageInto(Pager *pager, npage_t npage, MemPage *page)
+{
+    if (npage > __atomic_load_n(&pager->n_pages, __ATOMIC_SEQ_CST) || npage <= 0)
+        return CHIDB_EPAGENO;
+    int n;
+    PagerFrame *frame = pager_frame(pager, npage);
+    if (frame == NULL)
+        return CHIDB_ENOMEM;
+
+    page->npage = npage;
+
+    /* The pin keeps the cached copy from being freed while we copy it
+     * (see pager_evict_page) */
+    for (int i = 0; i < PAGER_READ_TRIES; i++)
+    {
+        __atomic_add_fetch(&frame->pins, 1, __ATOMIC_SEQ_CST);
+        uint8_t *cached = __atomic_load_n(&frame->data, __ATOMIC_SEQ_CST);
+        if (cached == NULL)
+        {
+            __atomic_sub_fetch(&frame->pins, 1, __ATOMIC_SEQ_CST);
+            break;
+        }
+        uint32_t version = __atomic_load_n(&frame->version, __ATOMIC_ACQUIRE);
+        if (version % 2 == 0)
+        {
+            memcpy(page->data, cached, pager->page_size);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        }
+        bool torn = version % 2 != 0 || __atomic_load_n(&frame->version, __ATOMIC_RELAXED) != version;
+        __atomic_sub_fetch(&frame->pins, 1, __ATOMIC_SEQ_CST);
+        if (!torn)
+        {
+            page->version = version;
+            __atomic_store_n(&frame->ref, true, __ATOMIC_RELAXED);
+            return CHIDB_OK;
+        }
+    }
+
+    /* Pages are only written (and cached) with their write lock held, so
+     * nothing can change the page while we read it */
+    pthread_mutex_lock(&frame->write_lock);
+    __atomic_add_fetch(&frame->pins, 1, __ATOMIC_SEQ_CST);
+    uint8_t *cached = __atomic_load_n(&frame->data, __ATOMIC_SEQ_CST);
+    if (cached != NULL)
+        memcpy(page->data, cached, pager->page_size);
+    __atomic_sub_fetch(&frame->pins, 1, __ATOMIC_SEQ_CST);
+    if (cached == NULL)
+    {
+        memset(page->data, 0, pager->page_size);
+        n = pread(fileno(pager->f), page->data, pager->page_size, (off_t) (npage - 1) * pager->page_size);
+        chilog(TRACE, "Read %i bytes from page %i into memory [%x data: %x]", n, npage, page, page->data);
+        pager_cache_page(pager, frame, page->data);
+    }
+    page->version = frame->version;
+    pthread_mutex_unlock(&frame->write_lock);
 
     return CHIDB_OK;
 }
@@ -210,6 +424,11 @@ int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
  * This page writes the in-memory copy of a page (stored in a MemPage
  * struct) back to disk.
  *
+ * Writes to the same page are serialized by the page's write lock, but
+ * writes to different pages (and reads of cached pages) proceed in
+ * parallel. The page's version is odd while it is being written, which
+ * makes chidb_Pager_readPageInto retry copies that overlap the write.
+ *
  * Parameters
  * - pager: A Pager.
  * - page: In-memory copy of page to write
@@ -221,12 +440,123 @@ int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
  */
 int	chidb_Pager_writePage(Pager *pager, MemPage *page)
 {
-    if (page->npage > pager->n_pages)
+    if (page->npage > __atomic_load_n(&pager->n_pages, __ATOMIC_SEQ_CST))
         return CHIDB_EPAGENO;
     int n;
-    fseek(pager->f, (page->npage - 1) * pager->page_size, SEEK_SET);
-    n = fwrite(page->data, 1, pager->page_size, pager->f);
+    PagerFrame *frame = pager_frame(pager, page->npage);
+    if (frame == NULL)
+        return CHIDB_ENOMEM;
+
+    pthread_mutex_lock(&frame->write_lock);
+    __atomic_add_fetch(&frame->version, 1, __ATOMIC_SEQ_CST);
+    n = pwrite(fileno(pager->f), page->data, pager->page_size, (off_t) (page->npage - 1) * pager->page_size);
     chilog(TRACE, "Wrote %i bytes to page %i", n, page->npage);
+    __atomic_add_fetch(&frame->pins, 1, __ATOMIC_SEQ_CST);
+    uint8_t *cached = __atomic_load_n(&frame->data, __ATOMIC_SEQ_CST);
+    if (cached != NULL)
+        memcpy(cached, page->data, pager->page_size);
+    __atomic_sub_fetch(&frame->pins, 1, __ATOMIC_SEQ_CST);
+    if (cached == NULL)
+        pager_cache_page(pager, frame, page->data);
+    pager_drop_decoded(frame);
+    __atomic_add_fetch(&frame->version, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&frame->write_lock);
+
+    return CHIDB_OK;
+}
+
+
+/* Get the decoded form of a page
+ *
+ * Copies the decoded form of a cached page (see chidb_Pager_setDecoded)
+ * into a buffer, if the page has not changed since a MemPage was read
+ * from it. This lets clients that derive something from the contents of
+ * a page (such as the B-Tree module, which decodes the keys of its nodes)
+ * do so once per version of the page, instead of once per read.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - page: In-memory copy of the page, returned by chidb_Pager_readPage
+ *         (and not modified since, or with its version set to 0)
+ * - data: Buffer to copy the decoded form into
+ * - size: Size of the buffer. The decoded form is only copied if it has
+ *         this size.
+ *
+ * Return
+ * - true if the decoded form was copied into the buffer, false if the
+ *   page has none, or has changed since it was read
+ */
+bool chidb_Pager_getDecoded(Pager *pager, MemPage *page, void *data, size_t size)
+{
+    if (page->version == 0)
+        return false;
+    PagerFrame *frame = pager_frame(pager, page->npage);
+    if (frame == NULL)
+        return false;
+
+    bool found = false;
+    __atomic_add_fetch(&frame->pins, 1, __ATOMIC_SEQ_CST);
+    PagerDecoded *decoded = __atomic_load_n(&frame->decoded, __ATOMIC_SEQ_CST);
+    if (decoded != NULL && decoded->version == page->version && decoded->size == size)
+    {
+        memcpy(data, decoded->data, size);
+        found = true;
+    }
+    __atomic_sub_fetch(&frame->pins, 1, __ATOMIC_SEQ_CST);
+
+    return found;
+}
+
+
+/* Set the decoded form of a page
+ *
+ * Keeps a copy of the decoded form of a page along with the cached page,
+ * for chidb_Pager_getDecoded to return. The decoded form must have been
+ * built from a MemPage that has not been modified since it was read. It
+ * is not kept if the page is not cached, has changed since the MemPage
+ * was read, or already has a decoded form. Decoded forms do not count
+ * towards the size of the cache.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - page: In-memory copy of the page the decoded form was built from
+ * - data: Decoded form of the page
+ * - size: Size of the decoded form, in bytes
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (even if the decoded form was not kept)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Pager_setDecoded(Pager *pager, MemPage *page, const void *data, size_t size)
+{
+    if (page->version == 0)
+        return CHIDB_OK;
+    PagerFrame *frame = pager_frame(pager, page->npage);
+    if (frame == NULL)
+        return CHIDB_ENOMEM;
+
+    PagerDecoded *decoded = malloc(sizeof(PagerDecoded) + size);
+    if (decoded == NULL)
+        return CHIDB_ENOMEM;
+    decoded->version = page->version;
+    decoded->size = size;
+    memcpy(decoded->data, data, size);
+
+    /* If the page is being written, the decoded form is already stale. The
+     * pager lock keeps the page from being evicted in the meantime. */
+    if (pthread_mutex_trylock(&frame->write_lock) == 0)
+    {
+        pthread_mutex_lock(&pager->lock);
+        if (frame->data != NULL && frame->decoded == NULL && frame->version == page->version)
+        {
+            __atomic_store_n(&frame->decoded, decoded, __ATOMIC_SEQ_CST);
+            decoded = NULL;
+        }
+        pthread_mutex_unlock(&pager->lock);
+        pthread_mutex_unlock(&frame->write_lock);
+    }
+    free(decoded);
+
     return CHIDB_OK;
 }
 
@@ -243,7 +573,7 @@ int	chidb_Pager_writePage(Pager *pager, MemPage *page)
  */
 int	chidb_Pager_releaseMemPage(Pager *pager, MemPage *page)
 {
-    if (page->npage > pager->n_pages)
+    if (page->npage > __atomic_load_n(&pager->n_pages, __ATOMIC_SEQ_CST))
         return CHIDB_EPAGENO;
 
     chilog(TRACE, "Releasing page %i from memory [%x data: %x]", page->npage, page, page->data);
@@ -285,7 +615,217 @@ int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
 int chidb_Pager_close(Pager *pager)
 {
     fclose(pager->f);
+    pager_drop_cache(pager);
+    for (int i = 0; i < PAGER_MAX_CHUNKS; i++)
+    {
+        if (pager->frames[i] == NULL)
+            continue;
+        for (int j = 0; j < PAGER_CHUNK_SIZE; j++)
+        {
+            pthread_rwlock_destroy(&pager->frames[i][j].latch);
+            pthread_mutex_destroy(&pager->frames[i][j].write_lock);
+        }
+        free(pager->frames[i]);
+    }
+    free(pager->frames);
+    pthread_mutex_destroy(&pager->lock);
     free(pager);
 
     return CHIDB_OK;
 }
+
+
+/* Latch a page
+ *
+ * Acquires the reader/writer latch of a page, blocking until it is
+ * available. Latches are purely advisory: the pager itself does not
+ * check them. Callers that access the same pages from several threads
+ * (such as the B-Tree module) must latch a page before reading it
+ * (shared) or modifying it (exclusive).
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number of the page to latch.
+ * - exclusive: true for a writer (exclusive) latch, false for a
+ *              reader (shared) latch.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page number is not valid
+ */
+int chidb_Pager_latch(Pager *pager, npage_t npage, bool exclusive)
+{
+    PagerFrame *frame = pager_frame(pager, npage);
+    if (frame == NULL)
+        return CHIDB_EPAGENO;
+
+    if (exclusive)
+        pthread_rwlock_wrlock(&frame->latch);
+    else
+        pthread_rwlock_rdlock(&frame->latch);
+
+    return CHIDB_OK;
+}
+
+
+/* Release the latch of a page
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number of a page latched with chidb_Pager_latch.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page number is not valid
+ */
+int chidb_Pager_unlatch(Pager *pager, npage_t npage)
+{
+    PagerFrame *frame = pager_frame(pager, npage);
+    if (frame == NULL)
+        return CHIDB_EPAGENO;
+
+    pthread_rwlock_unlock(&frame->latch);
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the frame of a page, creating its chunk of frames if needed
+ * (NULL if out of memory or the page number is too large) */
+PagerFrame *pager_frame(Pager *pager, npage_t npage)
+{
+    if (npage < 1 || (npage - 1) / PAGER_CHUNK_SIZE >= PAGER_MAX_CHUNKS)
+        return NULL;
+
+    npage_t chunk = (npage - 1) / PAGER_CHUNK_SIZE;
+    PagerFrame *frames = __atomic_load_n(&pager->frames[chunk], __ATOMIC_ACQUIRE);
+    if (frames == NULL)
+    {
+        pthread_mutex_lock(&pager->lock);
+        frames = pager->frames[chunk];
+        if (frames == NULL && (frames = calloc(PAGER_CHUNK_SIZE, sizeof(PagerFrame))) != NULL)
+        {
+            /* 0 is never the version of a page (see MemPage) */
+            for (int i = 0; i < PAGER_CHUNK_SIZE; i++)
+            {
+                pthread_rwlock_init(&frames[i].latch, NULL);
+                pthread_mutex_init(&frames[i].write_lock, NULL);
+                frames[i].version = 2;
+            }
+            __atomic_store_n(&pager->frames[chunk], frames, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&pager->lock);
+        if (frames == NULL)
+            return NULL;
+    }
+
+    return &frames[(npage - 1) % PAGER_CHUNK_SIZE];
+}
+
+/* Stores a copy of a page in its (uncached) frame, evicting another page
+ * first if the cache is full. Must be called with the frame's write lock
+ * held, and without the pager lock, which is only taken to update the
+ * cache; the evicted page is freed after it is released. */
+int pager_cache_page(Pager *pager, PagerFrame *frame, const uint8_t *data)
+{
+    if (__atomic_load_n(&pager->cache_size, __ATOMIC_RELAXED) == 0)
+        return CHIDB_OK;
+
+    uint8_t *cached = malloc(pager->page_size);
+    if (cached == NULL)
+        return CHIDB_ENOMEM;
+    memcpy(cached, data, pager->page_size);
+
+    uint8_t *evicted_data = NULL;
+    PagerFrame *evicted = NULL;
+    pthread_mutex_lock(&pager->lock);
+    if (pager->n_cached >= pager->cache_size)
+        evicted = pager_evict_page(pager, &evicted_data);
+    frame->ref = true;
+    __atomic_store_n(&frame->data, cached, __ATOMIC_SEQ_CST);
+    pager->n_cached++;
+    pthread_mutex_unlock(&pager->lock);
+    if (evicted != NULL)
+        pager_free_evicted(evicted, evicted_data);
+
+    return CHIDB_OK;
+}
+
+/* Evicts one page from the cache, using the clock algorithm: pages that
+ * have been used since the hand last went by get a second chance, and
+ * resident pages are skipped. The cache is write-through, so evicted pages
+ * never have to be written. Returns the frame of the evicted page, and its
+ * cached copy in data, which must be passed to pager_free_evicted once the
+ * pager lock is released; returns NULL if no page could be evicted. Must
+ * be called with the pager lock held. */
+PagerFrame *pager_evict_page(Pager *pager, uint8_t **data)
+{
+    for (npage_t i = 0; i < 2 * pager->n_pages + 1 && pager->n_cached > 0; i++)
+    {
+        if (pager->clock_hand > pager->n_pages)
+            pager->clock_hand = 1;
+        npage_t chunk = (pager->clock_hand - 1) / PAGER_CHUNK_SIZE;
+        PagerFrame *frame = NULL;
+        if (chunk < PAGER_MAX_CHUNKS && pager->frames[chunk] != NULL)
+            frame = &pager->frames[chunk][(pager->clock_hand - 1) % PAGER_CHUNK_SIZE];
+        pager->clock_hand++;
+
+        if (frame == NULL || frame->data == NULL)
+            continue;
+        if (__atomic_load_n(&frame->resident, __ATOMIC_SEQ_CST))
+            continue;
+        if (__atomic_load_n(&frame->ref, __ATOMIC_RELAXED))
+        {
+            __atomic_store_n(&frame->ref, false, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        *data = __atomic_exchange_n(&frame->data, NULL, __ATOMIC_SEQ_CST);
+        pager->n_cached--;
+        return frame;
+    }
+
+    return NULL;
+}
+
+/* Frees the cached copy (and the decoded form) of a page evicted by
+ * pager_evict_page. Readers that got the pointer before it was cleared may
+ * still be pinning the frame, so this waits for them to finish copying;
+ * it must not be called with the pager lock held. */
+void pager_free_evicted(PagerFrame *frame, uint8_t *data)
+{
+    while (__atomic_load_n(&frame->pins, __ATOMIC_SEQ_CST) > 0)
+        ;
+    free(data);
+    pager_drop_decoded(frame);
+}
+
+/* Frees the decoded form of a page, once no reader is copying it */
+void pager_drop_decoded(PagerFrame *frame)
+{
+    PagerDecoded *decoded = __atomic_exchange_n(&frame->decoded, NULL, __ATOMIC_SEQ_CST);
+    if (decoded == NULL)
+        return;
+    while (__atomic_load_n(&frame->pins, __ATOMIC_SEQ_CST) > 0)
+        ;
+    free(decoded);
+}
+
+/* Frees every cached page. Must be called with the pager lock held
+ * (or when no other thread can use the pager). */
+void pager_drop_cache(Pager *pager)
+{
+    for (int i = 0; i < PAGER_MAX_CHUNKS; i++)
+    {
+        if (pager->frames[i] == NULL)
+            continue;
+        for (int j = 0; j < PAGER_CHUNK_SIZE; j++)
+        {
+            free(pager->frames[i][j].data);
+            pager->frames[i][j].data = NULL;
+            free(pager->frames[i][j].decoded);
+            pager->frames[i][j].decoded = NULL;
+        }
+    }
+    pager->n_cached = 0;
+}
@@ -41,31 +41,87 @@
 #define PAGER_H_
 
 #include <stdio.h>
+#include <pthread.h>
 #include "chidbInt.h"
 
+#define PAGER_DEFAULT_CACHE_SIZE (20000)
+#define PAGER_CHUNK_SIZE (1024)
+#define PAGER_MAX_CHUNKS (65536)
+#define PAGER_READ_TRIES (8)
+
 struct MemPage
 {
     npage_t npage;
     uint8_t *data;
+    uint32_t version;  /* Version of the page it was read from (see
+                          chidb_Pager_getDecoded), 0 if unknown */
 };
 typedef struct MemPage MemPage;
 
+/* A decoded form of a cached page, built by a client of the pager from a
+ * copy of the page (see chidb_Pager_setDecoded). It belongs to the version
+ * of the page it was built from, and is dropped when the page is written
+ * or leaves the cache. */
+struct PagerDecoded
+{
+    uint32_t version;        /* Version of the page it was built from */
+    size_t size;             /* Size of data, in bytes */
+    uint8_t data[];
+};
+typedef struct PagerDecoded PagerDecoded;
+
+/* A frame holds the latch of a page and, if the page is in the cache, a
+ * copy of its contents. Frames are allocated in chunks of PAGER_CHUNK_SIZE
+ * and are not freed until the pager is closed, so a frame (and its latch)
+ * never moves once it has been created. */
+struct PagerFrame
+{
+    pthread_rwlock_t latch;  /* See chidb_Pager_latch */
+    pthread_mutex_t write_lock;  /* Held while the page is written, or read
+                                    into the cache (see chidb_Pager_writePage) */
+    uint8_t *data;           /* Cached copy of the page (NULL if not cached) */
+    uint32_t pins;           /* Number of threads copying data right now */
+    bool ref;                /* Used since the clock hand last went by */
+    bool resident;           /* Never evicted (see chidb_Pager_setResident) */
+    uint32_t version;        /* Even, and bumped twice by every write (odd
+                                while the page is being written) */
+    PagerDecoded *decoded;   /* Decoded form of the cached page (or NULL) */
+};
+typedef struct PagerFrame PagerFrame;
+
 struct Pager
 {
     FILE *f;
     npage_t n_pages;
     uint16_t page_size;
+
+    pthread_mutex_t lock;    /* Protects the cache (which frames have data, n_cached
+                                and clock_hand); page I/O happens outside of it */
+    PagerFrame **frames;     /* PAGER_MAX_CHUNKS pointers to chunks of frames */
+    npage_t cache_size;      /* Maximum number of cached pages */
+    npage_t n_cached;        /* Number of cached pages */
+    npage_t clock_hand;      /* Next page to consider for eviction */
 };
 typedef struct Pager Pager;
 
 int chidb_Pager_open(Pager **pager, const char *filename);
 int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize);
+int chidb_Pager_setCacheSize(Pager *pager, npage_t npages);
+int chidb_Pager_setResident(Pager *pager, npage_t npage, bool resident);
+bool chidb_Pager_isResident(Pager *pager, npage_t npage);
 int chidb_Pager_readHeader(Pager *pager, uint8_t *header);
 int chidb_Pager_allocatePage(Pager *pager, npage_t *npage);
+int chidb_Pager_allocatePages(Pager *pager, npage_t n, npage_t *first);
 int chidb_Pager_releaseMemPage(Pager *pager, MemPage *page);
 int	chidb_Pager_readPage(Pager *pager, npage_t page_num, MemPage **page);
+int chidb_Pager_readPageInto(Pager *pager, npage_t page_num, MemPage *page);
 int chidb_Pager_writePage(Pager *pager, MemPage *page);
+bool chidb_Pager_getDecoded(Pager *pager, MemPage *page, void *data, size_t size);
+int chidb_Pager_setDecoded(Pager *pager, MemPage *page, const void *data, size_t size);
 int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages);
 int chidb_Pager_close(Pager *pager);
 
+int chidb_Pager_latch(Pager *pager, npage_t npage, bool exclusive);
+int chidb_Pager_unlatch(Pager *pager, npage_t npage);
+
 #endif /*PAGER_H_*/
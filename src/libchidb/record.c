@@ -547,6 +547,233 @@ int chidb_DBRecord_print(DBRecord *dbr)
 }
 
 
+/* Encode some fields of a record as an index key
+ *
+ * Creates a key for a variable-length key index (see
+ * chidb_Btree_insertInVarIndex) from the given fields of a record, in the
+ * given order. Keys are compared with memcmp, so the values are encoded in
+ * a way that makes that order the order of the values: every value starts
+ * with a tag (so NULLs go before integers, which go before text), integers
+ * are stored in big-endian order with their sign bit flipped, and text is
+ * followed by a zero byte (so a text goes before all the longer texts it
+ * is a prefix of). The key of the first k fields of a record is a prefix
+ * of the key of all its fields, so it can be used to seek to all the
+ * entries whose first k fields have some values.
+ *
+ * The keys of an index must be unique, so if several rows can have the
+ * same values in the indexed fields, their primary key must be appended
+ * to the key.
+ *
+ * Parameters
+ * - dbr: The DBRecord
+ * - fields: Indexes of the fields that make up the key
+ * - nfields: Number of fields in the key
+ * - keyPk: Primary key to append to the key, or NULL to not append one
+ * - key: Buffer for the key
+ * - size: In: size of the buffer. Out: size of the key.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ETOOBIG: The key does not fit in the buffer
+ */
+int chidb_DBRecord_encodeKey(DBRecord *dbr, const uint8_t *fields, uint8_t nfields,
+                             const chidb_key_t *keyPk, uint8_t *key, uint16_t *size)
+{
+    uint32_t len = 0;
+
+    for(int i=0; i<nfields; i++)
+    {
+        uint8_t field = fields[i];
+        int type = chidb_DBRecord_getType(dbr, field);
+        if (type == SQL_TEXT)
+        {
+            int slen;
+            chidb_DBRecord_getStringLength(dbr, field, &slen);
+            if (len + slen + 2 > *size)
+                return CHIDB_ETOOBIG;
+            key[len] = DBRECORD_KEY_TEXT;
+            memcpy(&key[len + 1], &dbr->data[dbr->offsets[field]], slen);
+            key[len + slen + 1] = 0;
+            len += slen + 2;
+        }
+        else if (type == SQL_NULL)
+        {
+            if (len + 1 > *size)
+                return CHIDB_ETOOBIG;
+            key[len++] = DBRECORD_KEY_NULL;
+        }
+        else
+        {
+            int8_t i8;
+            int16_t i16;
+            int32_t v;
+            if (type == SQL_INTEGER_1BYTE)
+            {
+                chidb_DBRecord_getInt8(dbr, field, &i8);
+                v = i8;
+            }
+            else if (type == SQL_INTEGER_2BYTE)
+            {
+                chidb_DBRecord_getInt16(dbr, field, &i16);
+                v = i16;
+            }
+            else
+                chidb_DBRecord_getInt32(dbr, field, &v);
+            if (len + 5 > *size)
+                return CHIDB_ETOOBIG;
+            key[len] = DBRECORD_KEY_INTEGER;
+            put4byte(&key[len + 1], (uint32_t) v ^ 0x80000000);
+            len += 5;
+        }
+    }
+    if (keyPk != NULL)
+    {
+        if (len + 4 > *size)
+            return CHIDB_ETOOBIG;
+        put4byte(&key[len], *keyPk);
+        len += 4;
+    }
+    *size = len;
+
+    return CHIDB_OK;
+}
+
+
+/* Decode an index key into a record
+ *
+ * Does the opposite of chidb_DBRecord_encodeKey: creates a record with
+ * the values in the key. Integers are always returned as 4-byte integers.
+ *
+ * Parameters
+ * - dbr: Out parameter used to return the DBRecord
+ * - key, size: The key and its size in bytes
+ * - keyPk: If not NULL, the key ends with a primary key, which is returned
+ *          in this out parameter.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECORRUPT: The key is not a valid encoded key
+ */
+int chidb_DBRecord_decodeKey(DBRecord **dbr, const uint8_t *key, uint16_t size, chidb_key_t *keyPk)
+{
+    DBRecordBuffer dbrb;
+    uint16_t end = size, pos = 0;
+    uint8_t nfields = 0;
+
+    if (keyPk != NULL)
+    {
+        if (size < 4)
+            return CHIDB_ECORRUPT;
+        end -= 4;
+        *keyPk = get4byte(&key[end]);
+    }
+
+    /* Count the fields first, so the record can be sized */
+    while (pos < end)
+    {
+        if (key[pos] == DBRECORD_KEY_NULL)
+            pos += 1;
+        else if (key[pos] == DBRECORD_KEY_INTEGER)
+            pos += 5;
+        else if (key[pos] == DBRECORD_KEY_TEXT)
+        {
+            const uint8_t *nul = memchr(&key[pos + 1], 0, end - pos - 1);
+            if (nul == NULL)
+                return CHIDB_ECORRUPT;
+            pos = nul - key + 1;
+        }
+        else
+            return CHIDB_ECORRUPT;
+        nfields++;
+    }
+    if (pos != end)
+        return CHIDB_ECORRUPT;
+
+    chidb_DBRecord_create_empty(&dbrb, nfields);
+    pos = 0;
+    while (pos < end)
+    {
+        if (key[pos] == DBRECORD_KEY_NULL)
+        {
+            chidb_DBRecord_appendNull(&dbrb);
+            pos += 1;
+        }
+        else if (key[pos] == DBRECORD_KEY_INTEGER)
+        {
+            chidb_DBRecord_appendInt32(&dbrb, get4byte(&key[pos + 1]) ^ 0x80000000);
+            pos += 5;
+        }
+        else
+        {
+            /* the text is followed by a zero byte, so it is a C string */
+            chidb_DBRecord_appendString(&dbrb, (char *) &key[pos + 1]);
+            pos += strlen((char *) &key[pos + 1]) + 2;
+        }
+    }
+
+    return chidb_DBRecord_finalize(&dbrb, dbr);
+}
+
+
+/* Create a record with some of the fields of another record
+ *
+ * This is how the payload of a covering index entry (the INCLUDE columns
+ * of the index) is made from a row of a table.
+ *
+ * Parameters
+ * - dbr: The DBRecord
+ * - fields: Indexes of the fields to copy, in the order they will have in
+ *           the new record
+ * - nfields: Number of fields to copy
+ * - proj: Out parameter used to return the new DBRecord
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_project(DBRecord *dbr, const uint8_t *fields, uint8_t nfields, DBRecord **proj)
+{
+    DBRecordBuffer dbrb;
+
+    chidb_DBRecord_create_empty(&dbrb, nfields);
+    for(int i=0; i<nfields; i++)
+    {
+        uint8_t field = fields[i];
+        int type = chidb_DBRecord_getType(dbr, field);
+        if (type == SQL_INTEGER_1BYTE)
+        {
+            int8_t v;
+            chidb_DBRecord_getInt8(dbr, field, &v);
+            chidb_DBRecord_appendInt8(&dbrb, v);
+        }
+        else if (type == SQL_INTEGER_2BYTE)
+        {
+            int16_t v;
+            chidb_DBRecord_getInt16(dbr, field, &v);
+            chidb_DBRecord_appendInt16(&dbrb, v);
+        }
+        else if (type == SQL_INTEGER_4BYTE)
+        {
+            int32_t v;
+            chidb_DBRecord_getInt32(dbr, field, &v);
+            chidb_DBRecord_appendInt32(&dbrb, v);
+        }
+        else if (type == SQL_TEXT)
+        {
+            char *v;
+            chidb_DBRecord_getString(dbr, field, &v);
+            chidb_DBRecord_appendString(&dbrb, v);
+            free(v);
+        }
+        else
+            chidb_DBRecord_appendNull(&dbrb);
+    }
+
+    return chidb_DBRecord_finalize(&dbrb, proj);
+}
+
+
 /* Creates a DBRecord based on a specification string and all the values
  * in the record.
  *
@@ -86,6 +86,16 @@ int chidb_DBRecord_getStringLength(DBRecord *dbr, uint8_t field, int *len);
 
 int chidb_DBRecord_print(DBRecord *dbr);
 
+/* Tags of the values in an index key (see chidb_DBRecord_encodeKey) */
+#define DBRECORD_KEY_NULL (0x01)
+#define DBRECORD_KEY_INTEGER (0x02)
+#define DBRECORD_KEY_TEXT (0x03)
+
+int chidb_DBRecord_encodeKey(DBRecord *dbr, const uint8_t *fields, uint8_t nfields,
+                             const chidb_key_t *keyPk, uint8_t *key, uint16_t *size);
+int chidb_DBRecord_decodeKey(DBRecord **dbr, const uint8_t *key, uint16_t size, chidb_key_t *keyPk);
+int chidb_DBRecord_project(DBRecord *dbr, const uint8_t *fields, uint8_t nfields, DBRecord **proj);
+
 
 int chidb_DBRecord_destroy(DBRecord *dbr);
 
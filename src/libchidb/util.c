@@ -44,6 +44,7 @@
 #include "chidbInt.h"
 #include "util.h"
 #include "record.h"
+#include "dbm-cursor.h"
 
 /*
 ** Read or write a four-byte big-endian integer value.
@@ -198,6 +199,116 @@ int chidb_Btree_print(BTree *bt, npage_t npage, fBTreeCellPrinter printer, bool
     return CHIDB_OK;
 }
 
+/* Prints the statistics collected by chidb_Btree_analyze */
+void chidb_Btree_printStats(BTreeStats *stats)
+{
+    bool table = stats->type == PGTYPE_TABLE_INTERNAL || stats->type == PGTYPE_TABLE_LEAF;
+    bool varindex = stats->type == PGTYPE_VARINDEX_INTERNAL || stats->type == PGTYPE_VARINDEX_LEAF;
+
+    printf("B-Tree type ........................ %s\n",
+           table ? "table" : (varindex ? "index (variable-length keys)" : "index"));
+    printf("Depth .............................. %u\n", stats->depth);
+    printf("Pages .............................. %u\n", stats->n_pages);
+    printf("  Internal pages ................... %u\n", stats->n_internal);
+    printf("  Leaf pages ....................... %u\n", stats->n_leaf);
+    if (table)
+        printf("  Linked leaf pages ................ %u\n", stats->n_linked);
+    printf("Cells .............................. %llu\n", (unsigned long long) stats->n_cells);
+    printf("Entries ............................ %llu\n", (unsigned long long) stats->n_entries);
+    if (stats->n_entries > 0 && !varindex)
+    {
+        printf("Key range .......................... %u to %u\n", stats->min_key, stats->max_key);
+        printf("Key density ........................ %.4f\n", stats->key_density);
+    }
+    printf("Usable bytes ....................... %llu\n", (unsigned long long) stats->usable_bytes);
+    printf("  Used bytes ....................... %llu\n", (unsigned long long) stats->used_bytes);
+    printf("  Free bytes ....................... %llu\n", (unsigned long long) stats->free_bytes);
+    printf("  Fragmented bytes ................. %llu\n", (unsigned long long) stats->fragmented_bytes);
+    printf("Average fill factor ................ %.1f%%\n", stats->fill_avg * 100);
+    printf("Fill factor percentiles (10/50/90) . %.0f%% / %.0f%% / %.0f%%\n",
+           stats->fill_p10 * 100, stats->fill_p50 * 100, stats->fill_p90 * 100);
+}
+
+
+int chidb_analyze(chidb *db, uint32_t nroot)
+{
+    int rc;
+    BTreeStats stats;
+    chidb_dbm_cursor_t cursor;
+    npage_t *roots = NULL;
+    char **names = NULL;
+    int nroots = 0;
+
+    if (nroot != 0)
+    {
+        rc = chidb_Btree_analyze(db->bt, nroot, &stats);
+        if (rc == CHIDB_OK)
+            chidb_Btree_printStats(&stats);
+        return rc;
+    }
+
+    /* Collect the root pages of every table and index in the schema table
+     * (fields: type, name, table name, root page, SQL) before walking them */
+    chidb_cursor_open(CURSOR_READ, 1, 5, &cursor);
+    for (rc = chidb_cursor_rewind(db->bt, &cursor); rc == CHIDB_OK; rc = chidb_cursor_next(db->bt, &cursor))
+    {
+        BTreeCell btc;
+        DBRecord *dbr;
+        int32_t root = 0;
+
+        chidb_Btree_getCell(CURSOR_LEAF(&cursor)->btn, CURSOR_LEAF(&cursor)->ncell, &btc);
+        if (chidb_DBRecord_unpack(&dbr, btc.fields.tableLeaf.data) != CHIDB_OK)
+            continue;
+
+        switch (chidb_DBRecord_getType(dbr, 3))
+        {
+        case SQL_INTEGER_1BYTE:
+            chidb_DBRecord_getInt8(dbr, 3, (int8_t *) &root);
+            root &= 0xFF;
+            break;
+        case SQL_INTEGER_2BYTE:
+            chidb_DBRecord_getInt16(dbr, 3, (int16_t *) &root);
+            root &= 0xFFFF;
+            break;
+        case SQL_INTEGER_4BYTE:
+            chidb_DBRecord_getInt32(dbr, 3, &root);
+            break;
+        }
+
+        if (root > 0 && chidb_DBRecord_getType(dbr, 1) == SQL_TEXT)
+        {
+            roots = realloc(roots, (nroots + 1) * sizeof(npage_t));
+            names = realloc(names, (nroots + 1) * sizeof(char *));
+            roots[nroots] = root;
+            chidb_DBRecord_getString(dbr, 1, &names[nroots]);
+            nroots++;
+        }
+        chidb_DBRecord_destroy(dbr);
+    }
+    chidb_cursor_close(db->bt, &cursor);
+
+    printf("*** Schema table (page 1) ***\n\n");
+    rc = chidb_Btree_analyze(db->bt, 1, &stats);
+    if (rc == CHIDB_OK)
+        chidb_Btree_printStats(&stats);
+
+    for (int i = 0; i < nroots; i++)
+    {
+        if (rc == CHIDB_OK)
+        {
+            printf("\n*** %s (page %u) ***\n\n", names[i], roots[i]);
+            rc = chidb_Btree_analyze(db->bt, roots[i], &stats);
+            if (rc == CHIDB_OK)
+                chidb_Btree_printStats(&stats);
+        }
+        free(names[i]);
+    }
+    free(roots);
+    free(names);
+
+    return rc;
+}
+
 FILE *copy(const char *from, const char *to)
 {
     FILE *fromf, *tof;
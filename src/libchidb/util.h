@@ -65,6 +65,7 @@ typedef void (*fBTreeCellPrinter)(BTreeNode *, BTreeCell*);
 int chidb_Btree_print(BTree *bt, npage_t nroot, fBTreeCellPrinter printer, bool verbose);
 void chidb_BTree_recordPrinter(BTreeNode *btn, BTreeCell *btc);
 void chidb_BTree_stringPrinter(BTreeNode *btn, BTreeCell *btc);
+void chidb_Btree_printStats(BTreeStats *stats);
 
 FILE *copy(const char *from, const char *to);
 
@@ -1,4 +1,5 @@
 #include <chisql/chisql.h>
+#include <strings.h>
 
 static Table_t *Table_addPrimaryKey(Table_t *table, const char *col_name);
 
@@ -72,6 +73,37 @@ Table_t *Table_make(char *name, Column_t *columns, KeyDec_t *decs)
     return Table_addKeyDecs(new_table, decs);
 }
 
+Table_t *Table_setOptions(Table_t *table, StorageOptions_t options)
+{
+    table->options = options;
+    return table;
+}
+
+StorageOptions_t StorageOptions_set(StorageOptions_t options, char *name, int value)
+{
+    if (!strcasecmp(name, "fillfactor"))
+    {
+        if (value < 10 || value > 100)
+            fprintf(stderr, "Error: fillfactor must be between 10 and 100\n");
+        else
+            options.fill_factor = value;
+    }
+    else if (!strcasecmp(name, "split_by_bytes"))
+        options.split_by_bytes = value != 0;
+    else
+        fprintf(stderr, "Error: unknown storage option '%s'\n", name);
+    free(name);
+    return options;
+}
+
+void StorageOptions_print(StorageOptions_t options)
+{
+    if (options.fill_factor)
+        printf(", fillfactor %d", options.fill_factor);
+    if (options.split_by_bytes)
+        printf(", split by bytes");
+}
+
 static Table_t *Table_addPrimaryKey(Table_t *table, const char *col_name)
 {
     Column_t *col = table->columns;
@@ -122,7 +154,9 @@ void Table_print(Table_t *table)
         Constraint_printList(col->constraints);
         if (++count == 10) break;
     }
-    printf("\n)\n");
+    printf("\n)");
+    StorageOptions_print(table->options);
+    puts("");
 }
 
 KeyDec_t *KeyDec_append(KeyDec_t *decs, KeyDec_t *dec)
@@ -139,12 +173,14 @@ TableReference_t *TableReference_make(char *table_name, char *alias)
     return ref;
 }
 
-Index_t *Index_make(char *name, char *table_name, char *column_name)
+Index_t *Index_make(char *name, char *table_name, StrList_t *columns, StrList_t *include)
 {
     Index_t *idx = (Index_t *)calloc(1, sizeof(Index_t));
     idx->name = name;
     idx->table_name = table_name;
-    idx->column_name = column_name;
+    idx->column_name = columns->str;
+    idx->columns = columns;
+    idx->include = include;
     return idx;
 }
 
@@ -156,18 +192,57 @@ Index_t *Index_makeUnique(Index_t *idx)
 
 void Index_print(Index_t *idx)
 {
-    printf("Index '%s' on %s (%s)", idx->column_name,
-           idx->table_name,
-           idx->column_name);
+    printf("Index '%s' on %s ", idx->name, idx->table_name);
+    StrList_print(idx->columns);
+    if (idx->include)
+    {
+        printf(", include ");
+        StrList_print(idx->include);
+    }
     if (idx->unique) printf(", unique");
+    if (idx->method == INDEX_HASH) printf(", using hash");
+    StorageOptions_print(idx->options);
     puts("");
 }
 
+Index_t *Index_setOptions(Index_t *idx, StorageOptions_t options)
+{
+    idx->options = options;
+    return idx;
+}
+
+Index_t *Index_setMethod(Index_t *idx, char *method)
+{
+    if (!method)
+        return idx;
+    if (!strcasecmp(method, "hash"))
+    {
+        /* Hash indexes map a single integer key to a primary key */
+        if (idx->columns->next || idx->include)
+            fprintf(stderr, "Error: hash indexes must have a single column "
+                            "and no INCLUDE columns\n");
+        else
+            idx->method = INDEX_HASH;
+    }
+    else if (strcasecmp(method, "btree"))
+        fprintf(stderr, "Error: unknown index method '%s'\n", method);
+    free(method);
+    return idx;
+}
+
+static void Index_freeColumns(StrList_t *list)
+{
+    for (StrList_t *l = list; l; l = l->next)
+        free(l->str);
+    StrList_free(list);
+}
+
 void Index_free(Index_t *idx)
 {
     free(idx->name);
-    free(idx->column_name);
     free(idx->table_name);
+    Index_freeColumns(idx->columns);
+    Index_freeColumns(idx->include);
     free(idx);
 }
 
@@ -42,6 +42,7 @@ chisql_statement_t *__stmt;
 	JoinCondition_t *jcond;
 	Index_t *idx;
 	Create_t *cre;
+	StorageOptions_t sopts;
 }
 
 %token CREATE TABLE INSERT INTO SELECT FROM WHERE FULL
@@ -52,7 +53,7 @@ chisql_statement_t *__stmt;
 %token VALUES AUTO_INCREMENT ASC DESC UNIQUE IN ON
 %token COUNT SUM AVG MIN MAX INTERSECT EXCEPT DISTINCT
 %token CONCAT TRUE FALSE CASE WHEN DECLARE BIT GROUP
-%token INDEX EXPLAIN
+%token INDEX EXPLAIN INCLUDE WITH
 %token <strval> IDENTIFIER
 %token <strval> STRING_LITERAL
 %token <dval> DOUBLE_LITERAL
@@ -61,8 +62,8 @@ chisql_statement_t *__stmt;
 %type <ival> column_type bool_op comp_op select_combo
 %type <ival> function_name opt_distinct join opt_unique
 %type <strval> column_name table_name opt_alias 
-%type <strval> index_name column_name_or_star
-%type <slist> column_names_list opt_column_names
+%type <strval> index_name column_name_or_star opt_index_method
+%type <slist> column_names_list opt_column_names opt_include
 %type <constr> opt_constraints constraints constraint
 %type <lval> literal_value values_list in_statement
 %type <fkeyref> references_stmt
@@ -80,6 +81,7 @@ chisql_statement_t *__stmt;
 %type <jcond> join_condition opt_join_condition
 %type <idx> create_index
 %type <cre> create
+%type <sopts> opt_storage_options storage_options_list
 
 %start sql_queries
 
@@ -109,13 +111,25 @@ create
 	;
 
 create_index
-        : CREATE opt_unique INDEX index_name ON table_name '(' column_name ')'
+        : CREATE opt_unique INDEX index_name ON table_name opt_index_method '(' column_names_list ')' opt_include opt_storage_options
 		{ 
-			$$ = Index_make($4, $6, $8); 
+			$$ = Index_make($4, $6, $9, $11); 
 		  	if ($2 == UNIQUE) $$ = Index_makeUnique($$); 
+			$$ = Index_setMethod($$, $7);
+			$$ = Index_setOptions($$, $12);
 		}
 	;
 
+opt_index_method
+	: USING IDENTIFIER { $$ = $2; }
+	| /* empty */ { $$ = NULL; }
+	;
+
+opt_include
+	: INCLUDE '(' column_names_list ')' { $$ = $3; }
+	| /* empty */ { $$ = NULL; }
+	;
+
 opt_unique
 	: UNIQUE { $$ = UNIQUE; }
 	| /* empty */ { $$ = 0; }
@@ -126,12 +140,25 @@ index_name
 	;
 
 create_table
-	: CREATE TABLE table_name '(' column_dec_list opt_key_dec_list ')' 
+	: CREATE TABLE table_name '(' column_dec_list opt_key_dec_list ')' opt_storage_options
 		{
 			$$ = Table_make($3, $5, $6);
+			$$ = Table_setOptions($$, $8);
 		}
 	;
 
+opt_storage_options
+	: WITH '(' storage_options_list ')' { $$ = $3; }
+	| /* empty */ { $$ = (StorageOptions_t) { 0, 0 }; }
+	;
+
+storage_options_list
+	: IDENTIFIER '=' INT_LITERAL
+		{ $$ = StorageOptions_set((StorageOptions_t) { 0, 0 }, $1, $3); }
+	| storage_options_list ',' IDENTIFIER '=' INT_LITERAL
+		{ $$ = StorageOptions_set($1, $3, $5); }
+	;
+
 column_dec_list
 	: column_dec
 	| column_dec_list ',' column_dec { $$ = Column_append($1, $3); }
@@ -20,6 +20,7 @@ struct handler_entry handlers[] =
     		                  "                     column  Left-aligned columns\n"
     		                  "                     list    Values delimited by | (default)"),
     HANDLER_ENTRY (explain,   ".explain on|off    Turn output mode suitable for EXPLAIN on or off."),
+    HANDLER_ENTRY (analyze,   ".analyze [PAGE]    Show statistics of the B-Tree rooted at PAGE (default: all B-Trees)"),
     HANDLER_ENTRY (help,      ".help              Show this message"),
 
     NULL_ENTRY
@@ -444,6 +445,45 @@ int chidb_shell_handle_cmd_explain(chidb_shell_ctx_t *ctx, struct handler_entry
     return CHIDB_OK;
 }
 
+int chidb_shell_handle_cmd_analyze(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    int rc;
+    char *end;
+    unsigned long nroot = 0;
+
+    if(ntokens > 2)
+    {
+    	usage_error(e, "Invalid arguments");
+    	return 1;
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    if(ntokens == 2)
+    {
+        nroot = strtoul(tokens[1], &end, 10);
+        if(*end != '\0' || nroot == 0)
+        {
+            usage_error(e, "Invalid page number");
+            return 1;
+        }
+    }
+
+    rc = chidb_analyze(ctx->db, nroot);
+
+    if(rc != CHIDB_OK)
+    {
+        fprintf(stderr, "ERROR: Could not analyze the database (error %i).\n", rc);
+        return 1;
+    }
+
+    return CHIDB_OK;
+}
+
 int chidb_shell_handle_cmd_help(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
 {
     for(int h=0; handlers[h].name != NULL; h++)
@@ -0,0 +1,375 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  B-Tree micro-benchmarks. Not part of "make check"; build them with
+ *  "make tests/bench_btree" and run "tests/bench_btree [benchmark...]"
+ *  (all the benchmarks are run if none is given).
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "libchidb/btree.h"
+#include "libchidb/dbm-cursor.h"
+#include "libchidb/util.h"
+
+#define BENCH_NROWS (100000)
+#define BENCH_ROWSIZE (64)
+#define BENCH_NLOOKUPS (1000000)
+#define BENCH_THREAD_OPS (200000)
+#define BENCH_NRANGES (2000)
+#define BENCH_RANGE_KEYS (1 << 16)
+
+typedef int (*bench_func)(BTree *bt);
+
+typedef struct bench_entry
+{
+    const char *name;
+    bench_func func;
+} bench_entry;
+
+int bench_search(BTree *bt);
+int bench_descend(BTree *bt);
+int bench_find(BTree *bt);
+int bench_threads(BTree *bt);
+int bench_scan(BTree *bt);
+
+bench_entry benchmarks[] = {
+    {"search", bench_search},
+    {"descend", bench_descend},
+    {"find", bench_find},
+    {"threads", bench_threads},
+    {"scan", bench_scan},
+    {NULL, NULL}
+};
+
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Keys are spread out over the key space in a fixed pseudo-random order
+ * (multiplying by an odd number is a bijection modulo 2^20, so there are
+ * no duplicates as long as BENCH_NROWS <= 2^20) */
+chidb_key_t bench_key(uint32_t i)
+{
+    return (chidb_key_t) ((i * 2654435761u) & 0xfffff) * 8 + 1;
+}
+
+ncell_t search_getcell(BTreeNode *btn, chidb_key_t key)
+{
+    BTreeCell btc;
+    for (ncell_t i = 0; i < btn->n_cells; i++) {
+        chidb_Btree_getCell(btn, i, &btc);
+        if (btc.key >= key) {
+            return i;
+        }
+    }
+    return btn->n_cells;
+}
+
+/* Searches the root node (an internal node) with getCell and with the
+ * decoded sidecar */
+int bench_search(BTree *bt)
+{
+    BTreeNode *btn;
+    ncell_t ncell;
+    unsigned long sum = 0;
+    double t;
+
+    chidb_Btree_getNodeByPage(bt, 1, &btn);
+    printf("  root node: %d cells\n", btn->n_cells);
+
+    t = now();
+    for (uint32_t i = 0; i < BENCH_NLOOKUPS; i++) {
+        sum += search_getcell(btn, bench_key(i));
+    }
+    t = now() - t;
+    printf("  getCell scan:    %7.1f ns/search\n", t * 1e9 / BENCH_NLOOKUPS);
+
+    t = now();
+    for (uint32_t i = 0; i < BENCH_NLOOKUPS; i++) {
+        chidb_Btree_searchNode(btn, bench_key(i), &ncell);
+        sum -= ncell;
+    }
+    t = now() - t;
+    printf("  sidecar search:  %7.1f ns/search\n", t * 1e9 / BENCH_NLOOKUPS);
+
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return sum == 0 ? 0 : 1;
+}
+
+/* Goes down from the root to the leaf where a key is, reading every node
+ * on the way from the pager: searching it with getCell (SEARCH_GETCELL),
+ * decoding it on every read (SEARCH_DECODE, as if the sidecar was not
+ * cached with the page), or with the sidecar from the cache (SEARCH_CACHED) */
+enum { SEARCH_GETCELL, SEARCH_DECODE, SEARCH_CACHED };
+
+npage_t descend(BTree *bt, chidb_key_t key, int mode)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+    ncell_t ncell;
+    npage_t npage = 1;
+
+    while (1) {
+        chidb_Btree_getNodeByPage(bt, npage, &btn);
+        if (btn->type != PGTYPE_TABLE_INTERNAL) {
+            chidb_Btree_freeMemNode(bt, btn);
+            return npage;
+        }
+        if (mode == SEARCH_GETCELL) {
+            ncell = search_getcell(btn, key);
+            if (ncell < btn->n_cells) {
+                chidb_Btree_getCell(btn, ncell, &btc);
+                npage = btc.fields.tableInternal.child_page;
+            } else {
+                npage = btn->right_page;
+            }
+        } else {
+            if (mode == SEARCH_DECODE) {
+                btn->page->version = 0;
+            }
+            chidb_Btree_searchNode(btn, key, &ncell);
+            npage = ncell < btn->n_cells ? btn->children[ncell] : btn->right_page;
+        }
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+}
+
+int bench_descend(BTree *bt)
+{
+    const char *label[] = {"getCell:", "decode per read:", "cached sidecar:"};
+    npage_t leaves[3] = {0, 0, 0};
+    double t;
+
+    for (int mode = SEARCH_GETCELL; mode <= SEARCH_CACHED; mode++) {
+        t = now();
+        for (uint32_t i = 0; i < BENCH_NROWS; i++) {
+            leaves[mode] += descend(bt, bench_key(i), mode);
+        }
+        t = now() - t;
+        printf("  %-17s%7.1f ns/descent\n", label[mode], t * 1e9 / BENCH_NROWS);
+    }
+
+    return leaves[0] == leaves[1] && leaves[1] == leaves[2] ? 0 : 1;
+}
+
+int bench_find(BTree *bt)
+{
+    uint8_t *data;
+    uint16_t size;
+    double t;
+
+    t = now();
+    for (uint32_t i = 0; i < BENCH_NROWS; i++) {
+        if (chidb_Btree_find(bt, 1, bench_key(i), &data, &size) != CHIDB_OK) {
+            return 1;
+        }
+        free(data);
+    }
+    t = now() - t;
+    printf("  find:            %7.1f us/lookup\n", t * 1e6 / BENCH_NROWS);
+
+    return 0;
+}
+
+typedef struct bench_thread
+{
+    pthread_t thread;
+    BTree *bt;
+    uint32_t seed;
+    int errors;
+} bench_thread;
+
+/* Inserted keys go above the ones loaded in main, in a pseudo-random
+ * order; the counter is shared so that every thread gets different keys */
+uint32_t bench_next_insert = 0;
+
+void *bench_thread_run(void *arg)
+{
+    bench_thread *bth = arg;
+    uint8_t buf[BENCH_ROWSIZE];
+    uint8_t *data;
+    uint16_t size;
+
+    memset(buf, 0, sizeof(buf));
+    for (uint32_t i = 0; i < BENCH_THREAD_OPS; i++) {
+        bth->seed = bth->seed * 1103515245 + 12345;
+        if ((bth->seed >> 16) % 10 == 0) {
+            uint32_t n = __atomic_fetch_add(&bench_next_insert, 1, __ATOMIC_RELAXED);
+            chidb_key_t key = (1 << 24) + ((n * 2654435761u) & 0xffffff);
+            if (chidb_Btree_insertInTable(bth->bt, 1, key, buf, sizeof(buf)) != CHIDB_OK) {
+                bth->errors++;
+            }
+        } else {
+            chidb_key_t key = bench_key((bth->seed >> 8) % BENCH_NROWS);
+            if (chidb_Btree_find(bth->bt, 1, key, &data, &size) != CHIDB_OK) {
+                bth->errors++;
+                continue;
+            }
+            free(data);
+        }
+    }
+
+    return NULL;
+}
+
+/* Runs a mix of 90% lookups and 10% insertions with an increasing number
+ * of threads, each of them doing BENCH_THREAD_OPS operations */
+int bench_threads(BTree *bt)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    bench_thread *bths = malloc(ncpus * sizeof(bench_thread));
+    double base = 0;
+    int errors = 0;
+
+    for (long nthreads = 1; nthreads <= ncpus; nthreads *= 2) {
+        double t = now();
+        for (long i = 0; i < nthreads; i++) {
+            bths[i].bt = bt;
+            bths[i].seed = i + 1;
+            bths[i].errors = 0;
+            pthread_create(&bths[i].thread, NULL, bench_thread_run, &bths[i]);
+        }
+        for (long i = 0; i < nthreads; i++) {
+            pthread_join(bths[i].thread, NULL);
+            errors += bths[i].errors;
+        }
+        t = now() - t;
+        double ops = nthreads * BENCH_THREAD_OPS / t;
+        if (nthreads == 1) {
+            base = ops;
+        }
+        printf("  %3ld thread(s):  %9.0f ops/s  (%.2fx)\n", nthreads, ops, ops / base);
+    }
+    free(bths);
+
+    return errors == 0 ? 0 : 1;
+}
+
+/* Goes through the rows with keys from lo to hi, in increasing order if
+ * desc is false and in decreasing order if it is true (as ORDER BY ...
+ * DESC does), returning the number of rows */
+uint32_t scan_range(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_key_t lo, chidb_key_t hi, bool desc)
+{
+    uint32_t n = 0;
+    int32_t key;
+    int ret;
+
+    if (desc) {
+        ret = chidb_cursor_seek_le(bt, cursor, hi);
+    } else {
+        ret = chidb_cursor_seek_ge(bt, cursor, lo);
+    }
+    while (ret == CHIDB_OK) {
+        chidb_cursor_fetch_key(bt, cursor, &key);
+        if ((chidb_key_t) key < lo || (chidb_key_t) key > hi) {
+            break;
+        }
+        n++;
+        ret = desc ? chidb_cursor_prev(bt, cursor) : chidb_cursor_next(bt, cursor);
+    }
+
+    return n;
+}
+
+/* Scans the whole table, and BENCH_NRANGES ranges of it, in increasing
+ * and in decreasing key order */
+int bench_scan(BTree *bt)
+{
+    chidb_dbm_cursor_t cursor;
+    BTreeStats stats;
+    uint32_t n[2] = {0, 0}, ranges[2] = {0, 0};
+    const char *order[2] = {"ASC", "DESC"};
+    char label[32];
+    double t;
+    int ret;
+
+    chidb_cursor_open(CURSOR_READ, 1, 0, &cursor);
+    for (int desc = 0; desc <= 1; desc++) {
+        t = now();
+        ret = desc ? chidb_cursor_last(bt, &cursor) : chidb_cursor_rewind(bt, &cursor);
+        while (ret == CHIDB_OK) {
+            n[desc]++;
+            ret = desc ? chidb_cursor_prev(bt, &cursor) : chidb_cursor_next(bt, &cursor);
+        }
+        t = now() - t;
+        snprintf(label, sizeof(label), "full scan %s:", order[desc]);
+        printf("  %-17s%7.1f ns/row\n", label, t * 1e9 / n[desc]);
+    }
+    for (int desc = 0; desc <= 1; desc++) {
+        t = now();
+        for (uint32_t i = 0; i < BENCH_NRANGES; i++) {
+            chidb_key_t lo = bench_key(i);
+            ranges[desc] += scan_range(bt, &cursor, lo, lo + BENCH_RANGE_KEYS, desc);
+        }
+        t = now() - t;
+        snprintf(label, sizeof(label), "range scan %s:", order[desc]);
+        printf("  %-17s%7.1f ns/row  (%u rows)\n", label, t * 1e9 / ranges[desc], ranges[desc]);
+    }
+    chidb_cursor_close(bt, &cursor);
+
+    // other benchmarks (threads) may have added rows to the table
+    if (chidb_Btree_analyze(bt, 1, &stats) != CHIDB_OK) {
+        return 1;
+    }
+    return n[0] == stats.n_entries && n[1] == n[0] && ranges[1] == ranges[0] ? 0 : 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    chidb db;
+    BTree *bt;
+    char fname[] = "/tmp/chidb-bench-XXXXXX";
+    uint8_t buf[BENCH_ROWSIZE];
+    BTreeCell *cells;
+    int ret = 0;
+
+    close(mkstemp(fname));
+    if (chidb_Btree_open(fname, &db, &bt) != CHIDB_OK) {
+        fprintf(stderr, "Could not open %s\n", fname);
+        return 1;
+    }
+
+    memset(buf, 0, sizeof(buf));
+    cells = malloc(BENCH_NROWS * sizeof(BTreeCell));
+    for (uint32_t i = 0; i < BENCH_NROWS; i++) {
+        cells[i].type = PGTYPE_TABLE_LEAF;
+        cells[i].key = bench_key(i);
+        cells[i].fields.tableLeaf.data_size = sizeof(buf);
+        cells[i].fields.tableLeaf.data = buf;
+    }
+    double t = now();
+    if (chidb_Btree_insertBatch(bt, 1, cells, BENCH_NROWS) != CHIDB_OK) {
+        fprintf(stderr, "Could not load the table\n");
+        return 1;
+    }
+    printf("load: %d rows, %u pages, %.2f s\n", BENCH_NROWS, bt->pager->n_pages, now() - t);
+    free(cells);
+
+    for (bench_entry *b = benchmarks; b->name != NULL; b++) {
+        bool run = (argc == 1);
+        for (int i = 1; i < argc; i++) {
+            run = run || !strcmp(argv[i], b->name);
+        }
+        if (run) {
+            printf("%s:\n", b->name);
+            ret |= b->func(bt);
+        }
+    }
+
+    chidb_Btree_close(bt);
+    remove(fname);
+
+    return ret;
+}
@@ -15,6 +15,30 @@ Suite* make_btree_suite (void)
     suite_add_tcase (s, make_btree_6_tc());
     suite_add_tcase (s, make_btree_7_tc());
     suite_add_tcase (s, make_btree_8_tc());
+    suite_add_tcase (s, make_btree_9_tc());
+    suite_add_tcase (s, make_btree_10_tc());
+    suite_add_tcase (s, make_btree_11_tc());
+    suite_add_tcase (s, make_btree_12_tc());
+    suite_add_tcase (s, make_btree_13_tc());
+    suite_add_tcase (s, make_btree_14_tc());
+    suite_add_tcase (s, make_btree_15_tc());
+    suite_add_tcase (s, make_btree_16_tc());
+    suite_add_tcase (s, make_btree_17_tc());
+    suite_add_tcase (s, make_btree_18_tc());
+    suite_add_tcase (s, make_btree_19_tc());
+    suite_add_tcase (s, make_btree_20_tc());
+    suite_add_tcase (s, make_btree_21_tc());
+    suite_add_tcase (s, make_btree_22_tc());
+    suite_add_tcase (s, make_btree_23_tc());
+    suite_add_tcase (s, make_btree_24_tc());
+    suite_add_tcase (s, make_btree_25_tc());
+    suite_add_tcase (s, make_btree_26_tc());
+    suite_add_tcase (s, make_btree_27_tc());
+    suite_add_tcase (s, make_btree_28_tc());
+    suite_add_tcase (s, make_btree_29_tc());
+    suite_add_tcase (s, make_btree_30_tc());
+    suite_add_tcase (s, make_btree_31_tc());
+    suite_add_tcase (s, make_btree_32_tc());
 
     return s;
 }
@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define BATCH_NKEYS (10000)
+
+START_TEST (test_10_1)
+{
+    chidb *db;
+    int rc;
+    BTreeCell *cells;
+    uint8_t (*bufs)[192];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    cells = malloc(bigfile_nvalues * sizeof(BTreeCell));
+    bufs = malloc(bigfile_nvalues * sizeof(*bufs));
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        for(int j=0; j<48; j++)
+            put4byte(bufs[i] + (4*j), bigfile_ikeys[i]);
+        cells[i].type = PGTYPE_TABLE_LEAF;
+        cells[i].key = bigfile_pkeys[i];
+        cells[i].fields.tableLeaf.data_size = ((bigfile_pkeys[i] % 3) + 1) * 64;
+        cells[i].fields.tableLeaf.data = bufs[i];
+    }
+
+    /* Insert the first half one by one, and the rest in two batches */
+    int half = bigfile_nvalues / 2;
+    for(int i=0; i<half; i++)
+        insert_bigfile(db, i);
+    rc = chidb_Btree_insertBatch(db->bt, 1, cells + half, (bigfile_nvalues - half) / 2);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Btree_insertBatch(db->bt, 1, cells + half + (bigfile_nvalues - half) / 2,
+                                 bigfile_nvalues - half - (bigfile_nvalues - half) / 2);
+    ck_assert(rc == CHIDB_OK);
+
+    test_bigfile(db);
+
+    /* Everything is a duplicate now */
+    rc = chidb_Btree_insertBatch(db->bt, 1, cells, bigfile_nvalues);
+    ck_assert(rc == CHIDB_EDUPLICATE);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(cells);
+    free(bufs);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_10_2)
+{
+    chidb *db;
+    int rc;
+    BTreeCell *cells;
+    uint8_t buf[64];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* A large batch of increasing keys into an empty table, in reverse order */
+    memset(buf, 0, sizeof(buf));
+    cells = malloc(BATCH_NKEYS * sizeof(BTreeCell));
+    for(int i=0; i<BATCH_NKEYS; i++)
+    {
+        cells[i].type = PGTYPE_TABLE_LEAF;
+        cells[i].key = BATCH_NKEYS - i;
+        cells[i].fields.tableLeaf.data_size = sizeof(buf);
+        cells[i].fields.tableLeaf.data = buf;
+    }
+    rc = chidb_Btree_insertBatch(db->bt, 1, cells, BATCH_NKEYS);
+    ck_assert(rc == CHIDB_OK);
+
+    for(chidb_key_t k = 1; k <= BATCH_NKEYS; k++)
+    {
+        uint8_t *data;
+        uint16_t size;
+        rc = chidb_Btree_find(db->bt, 1, k, &data, &size);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(size == sizeof(buf));
+        free(data);
+    }
+
+    /* Duplicates within the batch itself */
+    cells[0].key = BATCH_NKEYS + 1;
+    cells[1].key = BATCH_NKEYS + 2;
+    cells[2].key = BATCH_NKEYS + 1;
+    rc = chidb_Btree_insertBatch(db->bt, 1, cells, 3);
+    ck_assert(rc == CHIDB_EDUPLICATE);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(cells);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_10_3)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    BTreeCell *cells;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    cells = malloc(bigfile_nvalues * sizeof(BTreeCell));
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        cells[i].type = PGTYPE_INDEX_LEAF;
+        cells[i].key = bigfile_ikeys[i];
+        cells[i].fields.indexLeaf.keyPk = bigfile_pkeys[i];
+    }
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    rc = chidb_Btree_insertBatch(db->bt, npage, cells, bigfile_nvalues);
+    ck_assert(rc == CHIDB_OK);
+
+    test_index_bigfile(db, npage);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(cells);
+    free(db);
+}
+END_TEST
+
+
+/* Inserts the rows with keys from, from + step, ... up to to in a batch,
+ * with their key as data, and marks them as present */
+int insert_rows_batch(BTree *bt, npage_t nroot, chidb_key_t from, chidb_key_t to, chidb_key_t step, bool *present)
+{
+    uint32_t n = 0;
+    BTreeCell *cells = malloc(((to - from) / step + 1) * sizeof(BTreeCell));
+    uint8_t (*data)[32] = malloc(((to - from) / step + 1) * sizeof(*data));
+
+    for(chidb_key_t k = from; k <= to; k += step, n++)
+    {
+        memset(data[n], 0, sizeof(data[n]));
+        put4byte(data[n], k);
+        cells[n].type = PGTYPE_TABLE_LEAF;
+        cells[n].key = k;
+        cells[n].fields.tableLeaf.data_size = sizeof(data[n]);
+        cells[n].fields.tableLeaf.data = data[n];
+        present[k] = true;
+    }
+    int rc = chidb_Btree_insertBatch(bt, nroot, cells, n);
+    free(cells);
+    free(data);
+
+    return rc;
+}
+
+START_TEST (test_10_4)
+{
+    chidb *db;
+    int rc;
+    npage_t npage, npage_small, npage_index;
+    uint8_t data[32];
+    BTreeStats stats;
+    BTreeCell *cells;
+    chidb_key_t pkey;
+    bool *present = calloc(7 * BATCH_NKEYS + 1, sizeof(bool));
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* A full tree, inserted one row at a time... */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_TABLE_LEAF);
+    memset(data, 0, sizeof(data));
+    for(chidb_key_t k = 4; k <= 4 * BATCH_NKEYS; k += 4)
+    {
+        put4byte(data, k);
+        rc = chidb_Btree_insertInTable(db->bt, npage, k, data, sizeof(data));
+        ck_assert(rc == CHIDB_OK);
+        present[k] = true;
+    }
+
+    /* ...that a batch fills in between every pair of rows: the leaves are
+     * split evenly, and stay linked in key order */
+    rc = insert_rows_batch(db->bt, npage, 2, 4 * BATCH_NKEYS, 4, present);
+    ck_assert(rc == CHIDB_OK);
+    test_rows(db->bt, npage, present, 7 * BATCH_NKEYS);
+    check_page_use(db->bt, npage);
+    rc = chidb_Btree_analyze(db->bt, npage, &stats);
+    ck_assert(rc == CHIDB_OK);
+    stats_sanity_check(&stats);
+    ck_assert_int_eq(stats.n_entries, 2 * BATCH_NKEYS);
+    ck_assert(stats.fill_p10 >= 0.5);
+
+    /* Rows in between and at the end at once */
+    rc = insert_rows_batch(db->bt, npage, 1, 7 * BATCH_NKEYS, 4, present);
+    ck_assert(rc == CHIDB_OK);
+    rc = insert_rows_batch(db->bt, npage, 4 * BATCH_NKEYS + 3, 7 * BATCH_NKEYS, 4, present);
+    ck_assert(rc == CHIDB_OK);
+    test_rows(db->bt, npage, present, 7 * BATCH_NKEYS);
+    check_page_use(db->bt, npage);
+
+    /* A batch stops at a duplicate, after inserting the keys before it */
+    cells = malloc(2 * sizeof(BTreeCell));
+    for(int i = 0; i < 2; i++)
+    {
+        cells[i].type = PGTYPE_TABLE_LEAF;
+        cells[i].key = i == 0 ? 3 : 4;
+        cells[i].fields.tableLeaf.data_size = sizeof(data);
+        cells[i].fields.tableLeaf.data = data;
+    }
+    put4byte(data, 3);
+    rc = chidb_Btree_insertBatch(db->bt, npage, cells, 2);
+    ck_assert(rc == CHIDB_EDUPLICATE);
+    present[3] = true;
+    test_rows(db->bt, npage, present, 7 * BATCH_NKEYS);
+    free(cells);
+
+    /* A root leaf that a batch splits in the middle */
+    memset(present, 0, (7 * BATCH_NKEYS + 1) * sizeof(bool));
+    chidb_Btree_newNode(db->bt, &npage_small, PGTYPE_TABLE_LEAF);
+    rc = insert_rows_batch(db->bt, npage_small, 10, 100, 10, present);
+    ck_assert(rc == CHIDB_OK);
+    rc = insert_rows_batch(db->bt, npage_small, 1, 99, 2, present);
+    ck_assert(rc == CHIDB_OK);
+    test_rows(db->bt, npage_small, present, 100);
+
+    /* The same in an index, one half at a time */
+    chidb_Btree_newNode(db->bt, &npage_index, PGTYPE_INDEX_LEAF);
+    cells = malloc(BATCH_NKEYS * sizeof(BTreeCell));
+    for(int half = 0; half < 2; half++)
+    {
+        for(int i = 0; i < BATCH_NKEYS; i++)
+        {
+            cells[i].type = PGTYPE_INDEX_LEAF;
+            cells[i].key = 2 * i + 1 + half;
+            cells[i].fields.indexLeaf.keyPk = 3 * (2 * i + 1 + half);
+        }
+        rc = chidb_Btree_insertBatch(db->bt, npage_index, cells, BATCH_NKEYS);
+        ck_assert(rc == CHIDB_OK);
+    }
+    for(chidb_key_t k = 1; k <= 2 * BATCH_NKEYS; k++)
+    {
+        rc = chidb_Btree_findInIndex(db->bt, npage_index, k, &pkey);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert_int_eq(pkey, 3 * k);
+    }
+    rc = chidb_Btree_analyze(db->bt, npage_index, &stats);
+    ck_assert(rc == CHIDB_OK);
+    stats_sanity_check(&stats);
+    ck_assert_int_eq(stats.n_entries, 2 * BATCH_NKEYS);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(cells);
+    free(present);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_10_tc(void)
+{
+    TCase *tc = tcase_create ("Step 10: Batch insertion");
+    tcase_add_test (tc, test_10_1);
+    tcase_add_test (tc, test_10_2);
+    tcase_add_test (tc, test_10_3);
+    tcase_add_test (tc, test_10_4);
+
+    return tc;
+}
@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+/* Position of the first cell with a key >= key, without the sidecar */
+ncell_t search_node_scan(BTreeNode *btn, chidb_key_t key)
+{
+    BTreeCell btc;
+
+    for(ncell_t i = 0; i < btn->n_cells; i++)
+    {
+        chidb_Btree_getCell(btn, i, &btc);
+        if(btc.key >= key)
+            return i;
+    }
+    return btn->n_cells;
+}
+
+void test_search_node(BTree *bt, BTreeNode *btn, chidb_key_t key)
+{
+    ncell_t ncell;
+    int rc;
+
+    rc = chidb_Btree_searchNode(btn, key, &ncell);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(ncell == search_node_scan(btn, key));
+}
+
+void test_search_all_nodes(BTree *bt)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+    int rc;
+
+    for(npage_t npage = 1; npage <= bt->pager->n_pages; npage++)
+    {
+        rc = chidb_Btree_getNodeByPage(bt, npage, &btn);
+        ck_assert(rc == CHIDB_OK);
+
+        test_search_node(bt, btn, 0);
+        test_search_node(bt, btn, UINT32_MAX);
+        for(ncell_t i = 0; i < btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &btc);
+            test_search_node(bt, btn, btc.key - 1);
+            test_search_node(bt, btn, btc.key);
+            test_search_node(bt, btn, btc.key + 1);
+
+            if(btn->type == PGTYPE_TABLE_INTERNAL)
+                ck_assert(btn->children[i] == btc.fields.tableInternal.child_page);
+            else if(btn->type == PGTYPE_INDEX_INTERNAL)
+                ck_assert(btn->children[i] == btc.fields.indexInternal.child_page);
+        }
+
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+}
+
+
+START_TEST (test_11_1)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    for(int i=0; i<bigfile_nvalues; i++)
+        chidb_Btree_insertInIndex(db->bt, npage, bigfile_ikeys[i], bigfile_pkeys[i]);
+
+    test_search_all_nodes(db->bt);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_11_2)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    BTreeNode *btn;
+    BTreeCell btc;
+    ncell_t ncell;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* The sidecar must be rebuilt after the node changes */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    chidb_Btree_getNodeByPage(db->bt, npage, &btn);
+
+    rc = chidb_Btree_searchNode(btn, 10, &ncell);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(ncell == 0);
+
+    btc.type = PGTYPE_INDEX_LEAF;
+    for(chidb_key_t k = 1; k <= 20; k++)
+    {
+        btc.key = k * 2;
+        btc.fields.indexLeaf.keyPk = k;
+        chidb_Btree_insertCell(btn, k - 1, &btc);
+
+        rc = chidb_Btree_searchNode(btn, 10, &ncell);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(ncell == (k < 5 ? k : 4));
+        rc = chidb_Btree_searchNode(btn, k * 2 + 1, &ncell);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(ncell == k);
+    }
+
+    chidb_Btree_freeMemNode(db->bt, btn);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_11_3)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    BTreeNode *btn, *other;
+    BTreeCell btc;
+    ncell_t ncell;
+    MemPage *page;
+    size_t size;
+    uint8_t *decoded;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    /* The sidecars kept in the cache give the same results as decoding
+     * the nodes again */
+    test_search_all_nodes(db->bt);
+    test_search_all_nodes(db->bt);
+
+    /* A node read from the cache takes the sidecar of the last node that
+     * was decoded from the same version of the page */
+    chidb_Btree_getNodeByPage(db->bt, 1, &btn);
+    ck_assert(chidb_Btree_decodeNode(btn) == CHIDB_OK);
+    size = ((btn->n_cells + 8) & ~7) * (sizeof(chidb_key_t) + sizeof(npage_t));
+    decoded = malloc(size);
+    chidb_Pager_readPage(db->bt->pager, 1, &page);
+    ck_assert(chidb_Pager_getDecoded(db->bt->pager, page, decoded, size));
+    ck_assert(memcmp(decoded, btn->keys, size) == 0);
+    ck_assert(!chidb_Pager_getDecoded(db->bt->pager, page, decoded, size - 4));
+    chidb_Pager_releaseMemPage(db->bt->pager, page);
+    chidb_Btree_freeMemNode(db->bt, btn);
+    free(decoded);
+
+    /* A node that is changed does not use it, and once the node is
+     * written, nothing does */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    chidb_Btree_getNodeByPage(db->bt, npage, &btn);
+    btc.type = PGTYPE_INDEX_LEAF;
+    for(chidb_key_t k = 1; k <= 20; k++)
+    {
+        btc.key = k * 2;
+        btc.fields.indexLeaf.keyPk = k;
+        chidb_Btree_insertCell(btn, k - 1, &btc);
+    }
+    ck_assert(chidb_Btree_writeNode(db->bt, btn) == CHIDB_OK);
+    chidb_Btree_freeMemNode(db->bt, btn);
+    chidb_Btree_getNodeByPage(db->bt, npage, &other);
+    ck_assert(chidb_Btree_searchNode(other, 11, &ncell) == CHIDB_OK);
+    ck_assert(ncell == 5);
+    chidb_Btree_getNodeByPage(db->bt, npage, &btn);
+    btc.key = 1;
+    btc.fields.indexLeaf.keyPk = 100;
+    chidb_Btree_insertCell(btn, 0, &btc);
+    ck_assert(chidb_Btree_searchNode(btn, 11, &ncell) == CHIDB_OK);
+    ck_assert(ncell == 6);
+    ck_assert(chidb_Btree_writeNode(db->bt, btn) == CHIDB_OK);
+    size = ((other->n_cells + 8) & ~7) * (sizeof(chidb_key_t) + sizeof(npage_t));
+    decoded = malloc(size);
+    ck_assert(!chidb_Pager_getDecoded(db->bt->pager, other->page, decoded, size));
+    free(decoded);
+    chidb_Btree_freeMemNode(db->bt, other);
+    chidb_Btree_freeMemNode(db->bt, btn);
+    chidb_Btree_getNodeByPage(db->bt, npage, &btn);
+    test_search_node(db->bt, btn, 11);
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    /* Without a cache, every node is decoded on its own */
+    chidb_Pager_setCacheSize(db->bt->pager, 0);
+    test_search_all_nodes(db->bt);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_11_tc(void)
+{
+    TCase *tc = tcase_create ("Step 11: Decoded node search");
+    tcase_add_test (tc, test_11_1);
+    tcase_add_test (tc, test_11_2);
+    tcase_add_test (tc, test_11_3);
+
+    return tc;
+}
@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+
+npage_t leftmost_leaf(BTree *bt, npage_t nroot)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+    npage_t npage = nroot;
+
+    while(1)
+    {
+        chidb_Btree_getNodeByPage(bt, npage, &btn);
+        if(btn->type == PGTYPE_TABLE_LEAF)
+            break;
+        chidb_Btree_getCell(btn, 0, &btc);
+        npage = btc.fields.tableInternal.child_page;
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return npage;
+}
+
+int cmp_keys(const void *a, const void *b)
+{
+    chidb_key_t ka = *(const chidb_key_t *) a;
+    chidb_key_t kb = *(const chidb_key_t *) b;
+    return ka < kb ? -1 : ka > kb;
+}
+
+
+START_TEST (test_12_1)
+{
+    chidb *db;
+    int rc;
+    BTreeNode *btn;
+    BTreeCell btc;
+    chidb_key_t *keys;
+    int nkeys = 0;
+    npage_t npage, prev = 0;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    keys = malloc(bigfile_nvalues * sizeof(chidb_key_t));
+    memcpy(keys, bigfile_pkeys, bigfile_nvalues * sizeof(chidb_key_t));
+    qsort(keys, bigfile_nvalues, sizeof(chidb_key_t), cmp_keys);
+
+    /* Follow the next links from the leftmost leaf */
+    npage = leftmost_leaf(db->bt, 1);
+    while(npage != 0)
+    {
+        rc = chidb_Btree_getNodeByPage(db->bt, npage, &btn);
+        ck_assert(rc == CHIDB_OK);
+        btn_sanity_check(db->bt, btn, false);
+        ck_assert(btn->linked);
+        ck_assert(btn->prev_leaf == prev);
+        ck_assert(btn->cells_offset <= db->bt->pager->page_size - LEAFPG_LINKS_SIZE);
+        for(ncell_t i = 0; i < btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &btc);
+            ck_assert(nkeys < bigfile_nvalues);
+            ck_assert(btc.key == keys[nkeys]);
+            nkeys++;
+        }
+        prev = npage;
+        npage = btn->next_leaf;
+        chidb_Btree_freeMemNode(db->bt, btn);
+    }
+    ck_assert(nkeys == bigfile_nvalues);
+
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(keys);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_12_2)
+{
+    chidb *db;
+    int rc;
+    chidb_dbm_cursor_t cursor;
+    chidb_key_t *keys;
+    int32_t key;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    keys = malloc(bigfile_nvalues * sizeof(chidb_key_t));
+    memcpy(keys, bigfile_pkeys, bigfile_nvalues * sizeof(chidb_key_t));
+    qsort(keys, bigfile_nvalues, sizeof(chidb_key_t), cmp_keys);
+
+    /* A cursor scan goes through every leaf, in both directions */
+    memset(&cursor, 0, sizeof(cursor));
+    chidb_cursor_open(CURSOR_READ, 1, 0, &cursor);
+    rc = chidb_cursor_rewind(db->bt, &cursor);
+    ck_assert(rc == CHIDB_OK);
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        chidb_cursor_fetch_key(db->bt, &cursor, &key);
+        ck_assert(key == keys[i]);
+        rc = chidb_cursor_next(db->bt, &cursor);
+        ck_assert(rc == (i < bigfile_nvalues - 1 ? CHIDB_OK : CHIDB_EEMPTY));
+    }
+    for(int i=bigfile_nvalues-1; i>=0; i--)
+    {
+        chidb_cursor_fetch_key(db->bt, &cursor, &key);
+        ck_assert(key == keys[i]);
+        rc = chidb_cursor_prev(db->bt, &cursor);
+        ck_assert(rc == (i > 0 ? CHIDB_OK : CHIDB_EEMPTY));
+    }
+    chidb_cursor_close(db->bt, &cursor);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(keys);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_12_3)
+{
+    chidb *db;
+    BTreeNode *btn;
+
+    /* Leaves in existing files have no links, and new leaves neither */
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-12-3.dat");
+    db = malloc(sizeof(chidb));
+    chidb_Btree_open(fname, db, &db->bt);
+
+    for(npage_t npage = 1; npage <= db->bt->pager->n_pages; npage++)
+    {
+        chidb_Btree_getNodeByPage(db->bt, npage, &btn);
+        ck_assert(!btn->linked);
+        chidb_Btree_freeMemNode(db->bt, btn);
+    }
+
+    test_values(db->bt, file1_keys, file1_values, file1_nvalues);
+
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_12_tc(void)
+{
+    TCase *tc = tcase_create ("Step 12: Leaf sibling links");
+    tcase_add_test (tc, test_12_1);
+    tcase_add_test (tc, test_12_2);
+    tcase_add_test (tc, test_12_3);
+
+    return tc;
+}
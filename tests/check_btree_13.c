@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define NTHREADS (4)
+
+/* check's assertions can only be used from the main thread, so the
+ * threads count their errors and the test checks them at the end */
+struct worker
+{
+    pthread_t thread;
+    chidb *db;
+    npage_t index_nroot;
+    int n;
+    int errors;
+};
+
+void *insert_worker(void *arg)
+{
+    struct worker *w = arg;
+    uint8_t buf[192];
+
+    for(int i=w->n; i<bigfile_nvalues; i+=NTHREADS)
+    {
+        int datalen = ((bigfile_pkeys[i] % 3) + 1) * 64;
+        for(int j=0; j<48; j++)
+            put4byte(buf + (4*j), bigfile_ikeys[i]);
+
+        if(chidb_Btree_insertInTable(w->db->bt, 1, bigfile_pkeys[i], buf, datalen) != CHIDB_OK)
+            w->errors++;
+        if(w->index_nroot != 0 &&
+           chidb_Btree_insertInIndex(w->db->bt, w->index_nroot, bigfile_ikeys[i], bigfile_pkeys[i]) != CHIDB_OK)
+            w->errors++;
+    }
+
+    return NULL;
+}
+
+void *find_worker(void *arg)
+{
+    struct worker *w = arg;
+    uint8_t *data;
+    uint16_t size;
+
+    /* The first half of the keys is already in the tree */
+    for(int round=0; round<4; round++)
+        for(int i=w->n; i<bigfile_nvalues/2; i+=NTHREADS)
+        {
+            if(chidb_Btree_find(w->db->bt, 1, bigfile_pkeys[i], &data, &size) != CHIDB_OK)
+            {
+                w->errors++;
+                continue;
+            }
+            if(size != ((bigfile_pkeys[i] % 3) + 1) * 64 || get4byte(data) != bigfile_ikeys[i])
+                w->errors++;
+            free(data);
+        }
+
+    return NULL;
+}
+
+
+START_TEST (test_13_1)
+{
+    chidb *db;
+    int rc;
+    struct worker w[NTHREADS];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Several writers insert into the same tree at once */
+    for(int t=0; t<NTHREADS; t++)
+    {
+        w[t] = (struct worker) { .db = db, .index_nroot = 0, .n = t, .errors = 0 };
+        pthread_create(&w[t].thread, NULL, insert_worker, &w[t]);
+    }
+    for(int t=0; t<NTHREADS; t++)
+    {
+        pthread_join(w[t].thread, NULL);
+        ck_assert_int_eq(w[t].errors, 0);
+    }
+
+    bt_sanity_check(db->bt, 1);
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_13_2)
+{
+    chidb *db;
+    int rc;
+    struct worker writers[NTHREADS], readers[NTHREADS];
+    int half = bigfile_nvalues / 2;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<half; i++)
+        insert_bigfile(db, i);
+
+    /* Readers keep finding the first half of the keys while writers
+     * insert the second half (and split the nodes under the readers) */
+    for(int t=0; t<NTHREADS; t++)
+    {
+        writers[t] = (struct worker) { .db = db, .index_nroot = 0, .n = half + t, .errors = 0 };
+        readers[t] = (struct worker) { .db = db, .index_nroot = 0, .n = t, .errors = 0 };
+        pthread_create(&writers[t].thread, NULL, insert_worker, &writers[t]);
+        pthread_create(&readers[t].thread, NULL, find_worker, &readers[t]);
+    }
+    for(int t=0; t<NTHREADS; t++)
+    {
+        pthread_join(writers[t].thread, NULL);
+        pthread_join(readers[t].thread, NULL);
+        ck_assert_int_eq(writers[t].errors, 0);
+        ck_assert_int_eq(readers[t].errors, 0);
+    }
+
+    bt_sanity_check(db->bt, 1);
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_13_3)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    struct worker w[NTHREADS];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Writers fill a table and an index B-Tree at the same time */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    for(int t=0; t<NTHREADS; t++)
+    {
+        w[t] = (struct worker) { .db = db, .index_nroot = npage, .n = t, .errors = 0 };
+        pthread_create(&w[t].thread, NULL, insert_worker, &w[t]);
+    }
+    for(int t=0; t<NTHREADS; t++)
+    {
+        pthread_join(w[t].thread, NULL);
+        ck_assert_int_eq(w[t].errors, 0);
+    }
+
+    test_bigfile(db);
+    test_index_bigfile(db, npage);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_13_tc(void)
+{
+    TCase *tc = tcase_create ("Step 13: Concurrent access");
+    tcase_add_test (tc, test_13_1);
+    tcase_add_test (tc, test_13_2);
+    tcase_add_test (tc, test_13_3);
+
+    return tc;
+}
@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+
+/* Keys that are not in bigfile (all its keys are below 2^24) */
+#define ABSENT_KEY(i) ((chidb_key_t) ((1 << 24) + (i)))
+#define NABSENT (10000)
+
+int count_false_positives(BTree *bt, npage_t nroot)
+{
+    int nfp = 0;
+    for(int i=0; i<NABSENT; i++)
+        if(chidb_Btree_bloomMayContain(bt, nroot, ABSENT_KEY(i)))
+            nfp++;
+    return nfp;
+}
+
+
+START_TEST (test_14_1)
+{
+    chidb *db;
+    int rc;
+    uint8_t *data;
+    uint16_t size;
+    chidb_dbm_cursor_t cursor;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    /* Without a filter, every key may be in the tree */
+    ck_assert(count_false_positives(db->bt, 1) == NABSENT);
+
+    rc = chidb_Btree_bloomCreate(db->bt, 1, 0.01);
+    ck_assert(rc == CHIDB_OK);
+
+    /* No false negatives, and few false positives */
+    for(int i=0; i<bigfile_nvalues; i++)
+        ck_assert(chidb_Btree_bloomMayContain(db->bt, 1, bigfile_pkeys[i]));
+    ck_assert(count_false_positives(db->bt, 1) < NABSENT / 50);
+    test_bigfile(db);
+
+    rc = chidb_Btree_find(db->bt, 1, ABSENT_KEY(0), &data, &size);
+    ck_assert(rc == CHIDB_ENOTFOUND);
+
+    memset(&cursor, 0, sizeof(cursor));
+    chidb_cursor_open(CURSOR_READ, 1, 0, &cursor);
+    rc = chidb_cursor_seek(db->bt, &cursor, bigfile_pkeys[0]);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_cursor_seek(db->bt, &cursor, ABSENT_KEY(1));
+    ck_assert(rc == CHIDB_ENOTFOUND);
+    chidb_cursor_close(db->bt, &cursor);
+
+    /* A lower false-positive rate takes more bits */
+    rc = chidb_Btree_bloomCreate(db->bt, 1, 0.0001);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(count_false_positives(db->bt, 1) < NABSENT / 1000);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_14_2)
+{
+    chidb *db;
+    int rc;
+    int half = bigfile_nvalues / 2;
+    uint8_t header[100];
+    FILE *f;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* The filter is kept up to date by insertions, and saved in the file */
+    rc = chidb_Btree_bloomCreate(db->bt, 1, 0.01);
+    ck_assert(rc == CHIDB_OK);
+    for(int i=0; i<half; i++)
+        insert_bigfile(db, i);
+    chidb_Btree_close(db->bt);
+
+    f = fopen(fname, "r");
+    ck_assert(fread(header, 1, sizeof(header), f) == sizeof(header));
+    fclose(f);
+    ck_assert(get4byte(&header[META_PAGE_OFFSET]) != 0);
+
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    for(int i=0; i<half; i++)
+        ck_assert(chidb_Btree_bloomMayContain(db->bt, 1, bigfile_pkeys[i]));
+    ck_assert(count_false_positives(db->bt, 1) < NABSENT / 50);
+    for(int i=half; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_14_3)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    BTreeCell *cells;
+    uint32_t capacity;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* A bulk load that overflows the filter of an index rebuilds it */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    rc = chidb_Btree_bloomCreate(db->bt, npage, 0.01);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Btree_bloomRebuild(db->bt, 1);
+    ck_assert(rc == CHIDB_ENOTFOUND);
+
+    pthread_rwlock_rdlock(&db->bt->meta_latch);
+    capacity = chidb_Bloom_capacity(db->bt->meta[0].bloom);
+    pthread_rwlock_unlock(&db->bt->meta_latch);
+    ck_assert(capacity < bigfile_nvalues);
+
+    cells = malloc(bigfile_nvalues * sizeof(BTreeCell));
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        cells[i].type = PGTYPE_INDEX_LEAF;
+        cells[i].key = bigfile_ikeys[i];
+        cells[i].fields.indexLeaf.keyPk = bigfile_pkeys[i];
+    }
+    rc = chidb_Btree_insertBatch(db->bt, npage, cells, bigfile_nvalues);
+    ck_assert(rc == CHIDB_OK);
+
+    pthread_rwlock_rdlock(&db->bt->meta_latch);
+    capacity = chidb_Bloom_capacity(db->bt->meta[0].bloom);
+    pthread_rwlock_unlock(&db->bt->meta_latch);
+    ck_assert(capacity >= bigfile_nvalues);
+    for(int i=0; i<bigfile_nvalues; i++)
+        ck_assert(chidb_Btree_bloomMayContain(db->bt, npage, bigfile_ikeys[i]));
+    ck_assert(count_false_positives(db->bt, npage) < NABSENT / 50);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(cells);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_14_4)
+{
+    chidb *db;
+    int rc;
+    int half = bigfile_nvalues / 2;
+    npage_t npages, nfree, first_page;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<half; i++)
+        insert_bigfile(db, i);
+    rc = chidb_Btree_bloomCreate(db->bt, 1, 0.01);
+    ck_assert(rc == CHIDB_OK);
+
+    /* A filter that fits in the old one's pages is written over it */
+    npages = db->bt->pager->n_pages;
+    nfree = chidb_Btree_freePages(db->bt);
+    first_page = db->bt->meta[0].bloom->first_page;
+    for(int i=0; i<5; i++)
+    {
+        rc = chidb_Btree_bloomRebuild(db->bt, 1);
+        ck_assert(rc == CHIDB_OK);
+    }
+    ck_assert(db->bt->pager->n_pages == npages);
+    ck_assert(chidb_Btree_freePages(db->bt) == nfree);
+    ck_assert(db->bt->meta[0].bloom->first_page == first_page);
+
+    /* A bigger filter goes to new pages, and the old ones are freed */
+    for(int i=half; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+    nfree = chidb_Btree_freePages(db->bt);
+    npages = db->bt->meta[0].bloom->npages;
+    rc = chidb_Btree_bloomCreate(db->bt, 1, 0.0001);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(db->bt->meta[0].bloom->first_page != first_page);
+    ck_assert(chidb_Btree_freePages(db->bt) == nfree + npages);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        ck_assert(chidb_Btree_bloomMayContain(db->bt, 1, bigfile_pkeys[i]));
+    ck_assert(count_false_positives(db->bt, 1) < NABSENT / 1000);
+    test_bigfile(db);
+
+    /* The freed pages, and the new filter, are still there after a reopen */
+    chidb_Btree_close(db->bt);
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(chidb_Btree_freePages(db->bt) == nfree + npages);
+    for(int i=0; i<bigfile_nvalues; i++)
+        ck_assert(chidb_Btree_bloomMayContain(db->bt, 1, bigfile_pkeys[i]));
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_14_tc(void)
+{
+    TCase *tc = tcase_create ("Step 14: Bloom filters");
+    tcase_add_test (tc, test_14_1);
+    tcase_add_test (tc, test_14_2);
+    tcase_add_test (tc, test_14_3);
+    tcase_add_test (tc, test_14_4);
+
+    return tc;
+}
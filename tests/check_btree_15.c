@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+/* Checks the invariants that hold for the statistics of any B-Tree */
+void stats_sanity_check(BTreeStats *stats)
+{
+    uint32_t hist_total = 0;
+
+    ck_assert(stats->depth >= 1);
+    ck_assert_int_eq(stats->n_pages, stats->n_internal + stats->n_leaf);
+    ck_assert(stats->n_linked <= stats->n_leaf);
+    ck_assert(stats->usable_bytes == stats->used_bytes + stats->free_bytes + stats->fragmented_bytes);
+    for(int i=0; i<BTREE_FILL_BUCKETS; i++)
+        hist_total += stats->fill_hist[i];
+    ck_assert_int_eq(hist_total, stats->n_pages);
+    ck_assert(stats->fill_p10 <= stats->fill_p50);
+    ck_assert(stats->fill_p50 <= stats->fill_p90);
+    ck_assert(stats->fill_p90 <= 1.0);
+    ck_assert(stats->fill_avg > 0 && stats->fill_avg <= 1.0);
+}
+
+
+START_TEST (test_15_1)
+{
+    chidb *db;
+    int rc;
+    BTreeStats stats;
+    chidb_key_t min_key = UINT32_MAX, max_key = 0;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* An empty tree is a single leaf with no entries */
+    rc = chidb_Btree_analyze(db->bt, 1, &stats);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(stats.type, PGTYPE_TABLE_LEAF);
+    ck_assert_int_eq(stats.depth, 1);
+    ck_assert_int_eq(stats.n_pages, 1);
+    ck_assert(stats.n_entries == 0);
+    ck_assert(stats.used_bytes == 0);
+    ck_assert(stats.key_density == 0);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        insert_bigfile(db, i);
+        if(bigfile_pkeys[i] < min_key) min_key = bigfile_pkeys[i];
+        if(bigfile_pkeys[i] > max_key) max_key = bigfile_pkeys[i];
+    }
+
+    rc = chidb_Btree_analyze(db->bt, 1, &stats);
+    ck_assert(rc == CHIDB_OK);
+    stats_sanity_check(&stats);
+    ck_assert_int_eq(stats.type, PGTYPE_TABLE_INTERNAL);
+    ck_assert(stats.depth >= 2);
+    ck_assert(stats.n_entries == bigfile_nvalues);
+    ck_assert(stats.n_cells > stats.n_entries);
+    ck_assert_int_eq(stats.min_key, min_key);
+    ck_assert_int_eq(stats.max_key, max_key);
+    ck_assert(stats.key_density == (double) bigfile_nvalues / (max_key - min_key + 1));
+
+    /* Insertions in random order leave the leaves between half and fully
+     * used, and split nodes are never fragmented */
+    ck_assert(stats.fill_p10 >= 0.4);
+    ck_assert(stats.fragmented_bytes == 0);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_15_2)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    BTreeStats stats;
+    uint8_t buf[128];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Appending in key order keeps the pages almost full */
+    memset(buf, 0, sizeof(buf));
+    for(int i=1; i<=4096; i++)
+    {
+        rc = chidb_Btree_insertInTable(db->bt, 1, i, buf, sizeof(buf));
+        ck_assert(rc == CHIDB_OK);
+    }
+    rc = chidb_Btree_analyze(db->bt, 1, &stats);
+    ck_assert(rc == CHIDB_OK);
+    stats_sanity_check(&stats);
+    ck_assert(stats.n_entries == 4096);
+    ck_assert(stats.key_density == 1.0);
+    ck_assert(stats.fill_p50 >= 0.8);
+
+    /* Every key of an index B-Tree is an entry, including the ones in
+     * internal nodes */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        rc = chidb_Btree_insertInIndex(db->bt, npage, bigfile_ikeys[i], bigfile_pkeys[i]);
+        ck_assert(rc == CHIDB_OK);
+    }
+    rc = chidb_Btree_analyze(db->bt, npage, &stats);
+    ck_assert(rc == CHIDB_OK);
+    stats_sanity_check(&stats);
+    ck_assert_int_eq(stats.type, PGTYPE_INDEX_INTERNAL);
+    ck_assert(stats.n_entries == bigfile_nvalues);
+    ck_assert(stats.n_cells == bigfile_nvalues);
+    ck_assert_int_eq(stats.n_linked, 0);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_15_3)
+{
+    chidb *db;
+    int rc;
+    BTreeStats stats;
+
+    db = malloc(sizeof(chidb));
+    char *fname = create_copy(TESTFILE_STRINGS2, "btree-test-15-3.dat");
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* The file has two B-Trees, in pages 1-4 and 5-7 */
+    rc = chidb_Btree_analyze(db->bt, 1, &stats);
+    ck_assert(rc == CHIDB_OK);
+    stats_sanity_check(&stats);
+    ck_assert_int_eq(stats.depth, 2);
+    ck_assert_int_eq(stats.n_pages, 4);
+
+    rc = chidb_Btree_analyze(db->bt, 5, &stats);
+    ck_assert(rc == CHIDB_OK);
+    stats_sanity_check(&stats);
+    ck_assert_int_eq(stats.depth, 2);
+    ck_assert_int_eq(stats.n_pages, 3);
+
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_15_tc(void)
+{
+    TCase *tc = tcase_create ("Step 15: Analyzer");
+    tcase_add_test (tc, test_15_1);
+    tcase_add_test (tc, test_15_2);
+    tcase_add_test (tc, test_15_3);
+
+    return tc;
+}
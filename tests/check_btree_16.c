@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define NVARTHREADS (4)
+#define NNAMES (300)
+
+/* The text indexed for row i of bigfile. Names share a long prefix and
+ * repeat, so the index has duplicate texts with different primary keys. */
+void var_name(int i, char *text)
+{
+    sprintf(text, "customer-%05u@example.com", bigfile_ikeys[i] % NNAMES);
+}
+
+uint16_t var_key(int i, uint8_t *key)
+{
+    char text[64];
+    var_name(i, text);
+    return chidb_Btree_encodeTextKey(text, bigfile_pkeys[i], key);
+}
+
+/* Checks that the index has every row of bigfile, in order */
+void test_var_index(BTree *bt, npage_t nroot)
+{
+    int rc, n = 0;
+    uint8_t key[64], prev[64];
+    uint16_t size, prev_size = 0;
+    chidb_key_t keyPk;
+    BTreeVarIndexCursor cursor;
+    BTreeCell btc;
+
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        size = var_key(i, key);
+        rc = chidb_Btree_findInVarIndex(bt, nroot, key, size, &keyPk);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert_int_eq(keyPk, bigfile_pkeys[i]);
+    }
+
+    rc = chidb_Btree_seekVarIndex(bt, nroot, key, 0, &cursor);
+    ck_assert(rc == CHIDB_OK);
+    do
+    {
+        chidb_Btree_getCell(cursor.leaf, cursor.ncell, &btc);
+        if(n > 0)
+            ck_assert(chidb_Btree_varKeyCompare(prev, prev_size,
+                      btc.fields.varIndex.key_data, btc.fields.varIndex.key_size) < 0);
+        memcpy(prev, btc.fields.varIndex.key_data, btc.fields.varIndex.key_size);
+        prev_size = btc.fields.varIndex.key_size;
+        n++;
+    } while((rc = chidb_Btree_nextVarIndex(bt, &cursor)) == CHIDB_OK);
+    ck_assert(rc == CHIDB_ENOTFOUND);
+    ck_assert_int_eq(n, bigfile_nvalues);
+    chidb_Btree_closeVarIndex(bt, &cursor);
+}
+
+/* Counts the rows whose text is the given one, with a prefix seek */
+int count_var_name(BTree *bt, npage_t nroot, const char *text)
+{
+    int n = 0;
+    BTreeVarIndexCursor cursor;
+    BTreeCell btc;
+    uint16_t len = strlen(text) + 1;
+
+    if(chidb_Btree_seekVarIndex(bt, nroot, (uint8_t *) text, len, &cursor) != CHIDB_OK)
+        return 0;
+    do
+    {
+        chidb_Btree_getCell(cursor.leaf, cursor.ncell, &btc);
+        if(btc.fields.varIndex.key_size < len ||
+           memcmp(btc.fields.varIndex.key_data, text, len) != 0)
+            break;
+        n++;
+    } while(chidb_Btree_nextVarIndex(bt, &cursor) == CHIDB_OK);
+    chidb_Btree_closeVarIndex(bt, &cursor);
+
+    return n;
+}
+
+struct var_worker
+{
+    pthread_t thread;
+    BTree *bt;
+    npage_t nroot;
+    int n;
+    int errors;
+};
+
+void *var_insert_worker(void *arg)
+{
+    struct var_worker *w = arg;
+    uint8_t key[64];
+
+    for(int i=w->n; i<bigfile_nvalues; i+=NVARTHREADS)
+    {
+        uint16_t size = var_key(i, key);
+        if(chidb_Btree_insertInVarIndex(w->bt, w->nroot, key, size, bigfile_pkeys[i]) != CHIDB_OK)
+            w->errors++;
+    }
+
+    return NULL;
+}
+
+
+START_TEST (test_16_1)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    uint8_t key[64];
+    uint16_t size;
+    chidb_key_t keyPk;
+    BTreeNode *btn;
+    BTreeCell btc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_VARINDEX_LEAF);
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        size = var_key(i, key);
+        rc = chidb_Btree_insertInVarIndex(db->bt, npage, key, size, bigfile_pkeys[i]);
+        ck_assert(rc == CHIDB_OK);
+    }
+    test_var_index(db->bt, npage);
+
+    size = var_key(0, key);
+    rc = chidb_Btree_insertInVarIndex(db->bt, npage, key, size, bigfile_pkeys[0]);
+    ck_assert(rc == CHIDB_EDUPLICATE);
+    rc = chidb_Btree_findInVarIndex(db->bt, npage, key, size - 1, &keyPk);
+    ck_assert(rc == CHIDB_ENOTFOUND);
+
+    /* The separators in the root only have the bytes that tell the
+     * children apart, which is much less than a whole key */
+    rc = chidb_Btree_getNodeByPage(db->bt, npage, &btn);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(btn->type, PGTYPE_VARINDEX_INTERNAL);
+    ck_assert(btn->n_cells > 0);
+    for(int i=0; i<btn->n_cells; i++)
+    {
+        chidb_Btree_getCell(btn, i, &btc);
+        ck_assert(btc.fields.varIndex.key_size < size / 2);
+    }
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_16_2)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    char text[64];
+    uint8_t *key;
+    uint16_t max_size;
+    BTreeStats stats;
+    int counts[NNAMES];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_VARINDEX_LEAF);
+    memset(counts, 0, sizeof(counts));
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        uint8_t buf[64];
+        uint16_t size = var_key(i, buf);
+        rc = chidb_Btree_insertInVarIndex(db->bt, npage, buf, size, bigfile_pkeys[i]);
+        ck_assert(rc == CHIDB_OK);
+        counts[bigfile_ikeys[i] % NNAMES]++;
+    }
+
+    /* Seeking to a text finds all the rows with that text */
+    for(int i=0; i<NNAMES; i++)
+    {
+        sprintf(text, "customer-%05u@example.com", i);
+        ck_assert_int_eq(count_var_name(db->bt, npage, text), counts[i]);
+    }
+    ck_assert_int_eq(count_var_name(db->bt, npage, "customer-"), 0);
+    ck_assert_int_eq(count_var_name(db->bt, npage, "zzz"), 0);
+
+    /* Keys of up to the maximum size are accepted (and split nodes) */
+    max_size = chidb_Btree_varKeyMaxSize(db->bt);
+    key = malloc(max_size + 1);
+    for(int i=0; i<64; i++)
+    {
+        memset(key, 'a' + (i % 26), max_size + 1);
+        put4byte(key + max_size - 4, i);
+        rc = chidb_Btree_insertInVarIndex(db->bt, npage, key, max_size, i);
+        ck_assert(rc == CHIDB_OK);
+    }
+    rc = chidb_Btree_insertInVarIndex(db->bt, npage, key, max_size + 1, 0);
+    ck_assert(rc == CHIDB_ETOOBIG);
+    free(key);
+
+    rc = chidb_Btree_analyze(db->bt, npage, &stats);
+    ck_assert(rc == CHIDB_OK);
+    stats_sanity_check(&stats);
+    ck_assert_int_eq(stats.type, PGTYPE_VARINDEX_INTERNAL);
+    ck_assert(stats.n_entries == bigfile_nvalues + 64);
+    ck_assert(stats.key_density == 0);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_16_3)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    struct var_worker w[NVARTHREADS];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Several writers insert into the same index at once */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_VARINDEX_LEAF);
+    for(int t=0; t<NVARTHREADS; t++)
+    {
+        w[t] = (struct var_worker) { .bt = db->bt, .nroot = npage, .n = t, .errors = 0 };
+        pthread_create(&w[t].thread, NULL, var_insert_worker, &w[t]);
+    }
+    for(int t=0; t<NVARTHREADS; t++)
+    {
+        pthread_join(w[t].thread, NULL);
+        ck_assert_int_eq(w[t].errors, 0);
+    }
+    test_var_index(db->bt, npage);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_16_tc(void)
+{
+    TCase *tc = tcase_create ("Step 16: Variable-length keys");
+    tcase_add_test (tc, test_16_1);
+    tcase_add_test (tc, test_16_2);
+    tcase_add_test (tc, test_16_3);
+
+    return tc;
+}
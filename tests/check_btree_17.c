@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/record.h"
+
+#define NCUSTOMERS (50)
+#define NSTATUSES (3)
+
+static char *statuses[] = {"new", "paid", "shipped"};
+static const uint8_t key_fields[] = {0, 1};
+static const uint8_t include_fields[] = {2};
+
+/* Row i of bigfile, as a (customer, status, amount) record */
+DBRecord *covering_row(int i)
+{
+    DBRecord *dbr;
+    chidb_DBRecord_create(&dbr, "|i4|s|i4|",
+                          bigfile_ikeys[i] % NCUSTOMERS,
+                          statuses[bigfile_pkeys[i] % NSTATUSES],
+                          bigfile_ikeys[i]);
+    return dbr;
+}
+
+/* Inserts row i into an index on (customer, status) INCLUDE (amount) */
+int insert_covering_row(BTree *bt, npage_t nroot, int i)
+{
+    DBRecord *dbr, *proj;
+    uint8_t key[128], *data;
+    uint16_t size = sizeof(key);
+    int rc;
+
+    dbr = covering_row(i);
+    rc = chidb_DBRecord_encodeKey(dbr, key_fields, 2, &bigfile_pkeys[i], key, &size);
+    ck_assert(rc == CHIDB_OK);
+    chidb_DBRecord_project(dbr, include_fields, 1, &proj);
+    chidb_DBRecord_pack(proj, &data);
+
+    rc = chidb_Btree_insertInCoveringIndex(bt, nroot, key, size, bigfile_pkeys[i],
+                                           data, proj->packed_len);
+
+    free(data);
+    chidb_DBRecord_destroy(proj);
+    chidb_DBRecord_destroy(dbr);
+    return rc;
+}
+
+/* Adds up the amounts of a customer's rows with the given status, and
+ * checks every primary key, only reading the index */
+int32_t sum_covering(BTree *bt, npage_t nroot, int32_t customer, char *status, int *n)
+{
+    DBRecord *dbr, *keyRec, *dataRec;
+    uint8_t prefix[64];
+    uint16_t len = sizeof(prefix);
+    BTreeVarIndexCursor cursor;
+    BTreeCell btc;
+    chidb_key_t keyPk;
+    int32_t amount, c, sum = 0;
+
+    chidb_DBRecord_create(&dbr, "|i4|s|", customer, status);
+    ck_assert(chidb_DBRecord_encodeKey(dbr, key_fields, 2, NULL, prefix, &len) == CHIDB_OK);
+    chidb_DBRecord_destroy(dbr);
+
+    *n = 0;
+    if(chidb_Btree_seekVarIndex(bt, nroot, prefix, len, &cursor) != CHIDB_OK)
+        return 0;
+    do
+    {
+        chidb_Btree_getCell(cursor.leaf, cursor.ncell, &btc);
+        if(btc.fields.varIndex.key_size < len ||
+           memcmp(btc.fields.varIndex.key_data, prefix, len) != 0)
+            break;
+
+        ck_assert(chidb_DBRecord_decodeKey(&keyRec, btc.fields.varIndex.key_data,
+                                           btc.fields.varIndex.key_size, &keyPk) == CHIDB_OK);
+        ck_assert_int_eq(keyPk, btc.fields.varIndex.keyPk);
+        chidb_DBRecord_getInt32(keyRec, 0, &c);
+        ck_assert_int_eq(c, customer);
+        chidb_DBRecord_destroy(keyRec);
+
+        ck_assert(btc.fields.varIndex.data_size > 0);
+        chidb_DBRecord_unpack(&dataRec, btc.fields.varIndex.data);
+        chidb_DBRecord_getInt32(dataRec, 0, &amount);
+        chidb_DBRecord_destroy(dataRec);
+
+        sum += amount;
+        (*n)++;
+    } while(chidb_Btree_nextVarIndex(bt, &cursor) == CHIDB_OK);
+    chidb_Btree_closeVarIndex(bt, &cursor);
+
+    return sum;
+}
+
+
+START_TEST (test_17_1)
+{
+    chidb *db;
+    int rc, n;
+    npage_t npage;
+    int32_t sums[NCUSTOMERS][NSTATUSES];
+    int counts[NCUSTOMERS][NSTATUSES];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_VARINDEX_LEAF);
+    memset(sums, 0, sizeof(sums));
+    memset(counts, 0, sizeof(counts));
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        rc = insert_covering_row(db->bt, npage, i);
+        ck_assert(rc == CHIDB_OK);
+        sums[bigfile_ikeys[i] % NCUSTOMERS][bigfile_pkeys[i] % NSTATUSES] += bigfile_ikeys[i];
+        counts[bigfile_ikeys[i] % NCUSTOMERS][bigfile_pkeys[i] % NSTATUSES]++;
+    }
+    rc = insert_covering_row(db->bt, npage, 0);
+    ck_assert(rc == CHIDB_EDUPLICATE);
+
+    /* A query on a prefix of the key that only needs the included columns
+     * is answered from the index alone */
+    for(int c=0; c<NCUSTOMERS; c++)
+        for(int s=0; s<NSTATUSES; s++)
+        {
+            ck_assert_int_eq(sum_covering(db->bt, npage, c, statuses[s], &n), sums[c][s]);
+            ck_assert_int_eq(n, counts[c][s]);
+        }
+    sum_covering(db->bt, npage, NCUSTOMERS, "new", &n);
+    ck_assert_int_eq(n, 0);
+    sum_covering(db->bt, npage, 0, "pai", &n);
+    ck_assert_int_eq(n, 0);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_17_2)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    uint8_t key[16], *data;
+    uint16_t max_size;
+    BTreeStats stats;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* The maximum size covers the key and the included columns together */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_VARINDEX_LEAF);
+    max_size = chidb_Btree_varKeyMaxSize(db->bt);
+    data = malloc(max_size);
+    memset(data, 0, max_size);
+    for(int i=0; i<64; i++)
+    {
+        put4byte(key, i);
+        rc = chidb_Btree_insertInCoveringIndex(db->bt, npage, key, 4, i, data, max_size - 4);
+        ck_assert(rc == CHIDB_OK);
+    }
+    put4byte(key, 64);
+    rc = chidb_Btree_insertInCoveringIndex(db->bt, npage, key, 4, 64, data, max_size - 3);
+    ck_assert(rc == CHIDB_ETOOBIG);
+    free(data);
+
+    rc = chidb_Btree_analyze(db->bt, npage, &stats);
+    ck_assert(rc == CHIDB_OK);
+    stats_sanity_check(&stats);
+    ck_assert_int_eq(stats.type, PGTYPE_VARINDEX_INTERNAL);
+    ck_assert(stats.n_entries == 64);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_17_tc(void)
+{
+    TCase *tc = tcase_create ("Step 17: Covering indexes");
+    tcase_add_test (tc, test_17_1);
+    tcase_add_test (tc, test_17_2);
+
+    return tc;
+}
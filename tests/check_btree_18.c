@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+
+#define NBUFTHREADS (4)
+
+struct ibuf_worker
+{
+    pthread_t thread;
+    BTree *bt;
+    npage_t nroot;
+    int n;
+    int errors;
+};
+
+/* Checks that every entry of bigfile made it into the index tree itself */
+void test_index_merged(BTree *bt, npage_t nroot)
+{
+    chidb_key_t keyPk;
+
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        ck_assert(chidb_Btree_findInIndex(bt, nroot, bigfile_ikeys[i], &keyPk) == CHIDB_OK);
+        ck_assert_int_eq(keyPk, bigfile_pkeys[i]);
+    }
+}
+
+void *ibuf_insert_worker(void *arg)
+{
+    struct ibuf_worker *w = arg;
+    chidb_key_t keyPk;
+
+    for(int i=w->n; i<bigfile_nvalues; i+=NBUFTHREADS)
+    {
+        if(chidb_Btree_insertInIndex(w->bt, w->nroot, bigfile_ikeys[i], bigfile_pkeys[i]) != CHIDB_OK)
+            w->errors++;
+        if(chidb_Btree_findIndexEntry(w->bt, w->nroot, bigfile_ikeys[i], &keyPk) != CHIDB_OK
+           || keyPk != bigfile_pkeys[i])
+            w->errors++;
+    }
+
+    return NULL;
+}
+
+
+START_TEST (test_18_1)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    chidb_key_t keyPk;
+    int last = bigfile_nvalues - 1;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    rc = chidb_Btree_bufferIndex(db->bt, 1, 0);
+    ck_assert(rc == CHIDB_EMISMATCH);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    rc = chidb_Btree_bufferIndex(db->bt, npage, 100);
+    ck_assert(rc == CHIDB_OK);
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        rc = chidb_Btree_insertInIndex(db->bt, npage, bigfile_ikeys[i], bigfile_pkeys[i]);
+        ck_assert(rc == CHIDB_OK);
+        rc = chidb_Btree_findIndexEntry(db->bt, npage, bigfile_ikeys[i], &keyPk);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert_int_eq(keyPk, bigfile_pkeys[i]);
+    }
+
+    /* The last entries are still in the buffer, not in the tree, but
+     * duplicates are caught wherever they are */
+    rc = chidb_Btree_findInIndex(db->bt, npage, bigfile_ikeys[last], &keyPk);
+    ck_assert(rc == CHIDB_ENOTFOUND);
+    rc = chidb_Btree_insertInIndex(db->bt, npage, bigfile_ikeys[last], 0);
+    ck_assert(rc == CHIDB_EDUPLICATE);
+    rc = chidb_Btree_insertInIndex(db->bt, npage, bigfile_ikeys[0], 0);
+    ck_assert(rc == CHIDB_EDUPLICATE);
+    rc = chidb_Btree_findIndexEntry(db->bt, npage, 10000, &keyPk);
+    ck_assert(rc == CHIDB_ENOTFOUND);
+
+    rc = chidb_Btree_flushIndexBuffer(db->bt, npage);
+    ck_assert(rc == CHIDB_OK);
+    test_index_merged(db->bt, npage);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_18_2)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    chidb_key_t keyPk;
+    int half = DEFAULT_INSERT_BUFFER_SIZE - 1;
+    chidb_dbm_cursor_t cursor;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* All the entries fit in the buffer, so the tree is still empty, but
+     * positioning a cursor on the index merges them */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    rc = chidb_Btree_bufferIndex(db->bt, npage, 0);
+    ck_assert(rc == CHIDB_OK);
+    for(int i=0; i<half; i++)
+    {
+        rc = chidb_Btree_insertInIndex(db->bt, npage, bigfile_ikeys[i], bigfile_pkeys[i]);
+        ck_assert(rc == CHIDB_OK);
+    }
+    rc = chidb_Btree_findInIndex(db->bt, npage, bigfile_ikeys[0], &keyPk);
+    ck_assert(rc == CHIDB_ENOTFOUND);
+    memset(&cursor, 0, sizeof(cursor));
+    chidb_cursor_open(CURSOR_READ, npage, 0, &cursor);
+    rc = chidb_cursor_rewind(db->bt, &cursor);
+    ck_assert(rc == CHIDB_OK);
+    chidb_cursor_close(db->bt, &cursor);
+    for(int i=0; i<half; i++)
+    {
+        rc = chidb_Btree_findInIndex(db->bt, npage, bigfile_ikeys[i], &keyPk);
+        ck_assert(rc == CHIDB_OK);
+    }
+
+    /* Closing the file merges the buffers */
+    for(int i=half; i<bigfile_nvalues; i++)
+    {
+        rc = chidb_Btree_insertInIndex(db->bt, npage, bigfile_ikeys[i], bigfile_pkeys[i]);
+        ck_assert(rc == CHIDB_OK);
+    }
+    chidb_Btree_close(db->bt);
+
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    test_index_merged(db->bt, npage);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_18_3)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    struct ibuf_worker w[NBUFTHREADS];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Several writers share the buffer, which is merged many times */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    rc = chidb_Btree_bufferIndex(db->bt, npage, 64);
+    ck_assert(rc == CHIDB_OK);
+    for(int t=0; t<NBUFTHREADS; t++)
+    {
+        w[t] = (struct ibuf_worker) { .bt = db->bt, .nroot = npage, .n = t, .errors = 0 };
+        pthread_create(&w[t].thread, NULL, ibuf_insert_worker, &w[t]);
+    }
+    for(int t=0; t<NBUFTHREADS; t++)
+    {
+        pthread_join(w[t].thread, NULL);
+        ck_assert_int_eq(w[t].errors, 0);
+    }
+    rc = chidb_Btree_flushIndexBuffer(db->bt, npage);
+    ck_assert(rc == CHIDB_OK);
+    test_index_merged(db->bt, npage);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_18_tc(void)
+{
+    TCase *tc = tcase_create ("Step 18: Insert buffers");
+    tcase_add_test (tc, test_18_1);
+    tcase_add_test (tc, test_18_2);
+    tcase_add_test (tc, test_18_3);
+
+    return tc;
+}
@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define NSAMPLES (8)
+
+static chidb_key_t ranges[][2] = {{0, 10000}, {100, 200}, {1000, 5000}, {2500, 2600},
+                                  {0, 500}, {9000, 9999}, {4000, 8000}};
+#define NRANGES (sizeof(ranges) / sizeof(ranges[0]))
+
+int count_range(chidb_key_t *keys, chidb_key_t lo, chidb_key_t hi)
+{
+    int n = 0;
+    for(int i=0; i<bigfile_nvalues; i++)
+        if(keys[i] >= lo && keys[i] <= hi)
+            n++;
+    return n;
+}
+
+/* Checks the estimates for every range in ranges against the real counts */
+void test_estimates(BTree *bt, npage_t nroot, chidb_key_t *keys)
+{
+    BTreeRangeEstimate est;
+
+    for(int r=0; r<NRANGES; r++)
+    {
+        int n = count_range(keys, ranges[r][0], ranges[r][1]);
+
+        /* Only the two paths to the ends of the range are read */
+        ck_assert(chidb_Btree_estimateRange(bt, nroot, ranges[r][0], ranges[r][1], 0, &est) == CHIDB_OK);
+        ck_assert(est.n_pages <= 2 * est.depth);
+        ck_assert(est.exact <= n);
+        ck_assert(est.low <= est.estimate && est.estimate <= est.high);
+        if(est.estimate == est.exact)
+            ck_assert_int_eq(est.exact, n);
+        ck_assert(est.estimate > 0.5 * n && est.estimate < 1.5 * n);
+
+        /* Sampling reads a path per sample, and gets closer */
+        ck_assert(chidb_Btree_estimateRange(bt, nroot, ranges[r][0], ranges[r][1], NSAMPLES, &est) == CHIDB_OK);
+        ck_assert(est.n_pages <= (2 + NSAMPLES) * est.depth);
+        ck_assert(est.exact <= n);
+        ck_assert(est.low <= est.estimate && est.estimate <= est.high);
+        ck_assert(est.estimate > 0.75 * n && est.estimate < 1.25 * n);
+    }
+}
+
+
+START_TEST (test_19_1)
+{
+    chidb *db;
+    int rc;
+    BTreeRangeEstimate est;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* In a single leaf, the count is exact */
+    for(int i=0; i<4; i++)
+        insert_bigfile(db, i);
+    rc = chidb_Btree_estimateRange(db->bt, 1, bigfile_pkeys[1], bigfile_pkeys[3], 0, &est);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(est.depth, 1);
+    ck_assert_int_eq(est.n_pages, 1);
+    ck_assert(est.exact == 3);
+    ck_assert(est.estimate == 3 && est.low == 3 && est.high == 3);
+
+    for(int i=4; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+    test_estimates(db->bt, 1, bigfile_pkeys);
+
+    /* An empty range */
+    rc = chidb_Btree_estimateRange(db->bt, 1, 5000, 4000, NSAMPLES, &est);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(est.estimate == 0 && est.n_pages == 0);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_19_2)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    BTreeRangeEstimate est;
+    uint8_t key[64];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* The keys in internal nodes of an index B-Tree are entries too */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        rc = chidb_Btree_insertInIndex(db->bt, npage, bigfile_ikeys[i], bigfile_pkeys[i]);
+        ck_assert(rc == CHIDB_OK);
+    }
+    test_estimates(db->bt, npage, bigfile_ikeys);
+
+    /* Variable-length keys cannot be compared with integer bounds */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_VARINDEX_LEAF);
+    rc = chidb_Btree_insertInVarIndex(db->bt, npage, key, chidb_Btree_encodeTextKey("x", 1, key), 1);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Btree_estimateRange(db->bt, npage, 0, 10, 0, &est);
+    ck_assert(rc == CHIDB_EMISMATCH);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_19_tc(void)
+{
+    TCase *tc = tcase_create ("Step 19: Range estimation");
+    tcase_add_test (tc, test_19_1);
+    tcase_add_test (tc, test_19_2);
+
+    return tc;
+}
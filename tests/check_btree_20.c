@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define NROWS (2000)
+#define SMALL_SIZE (10)
+#define BIG_SIZE (300)
+
+/* Inserts keys 1..NROWS in increasing order, with records of the given size */
+void insert_increasing(BTree *bt, npage_t nroot, uint16_t size)
+{
+    uint8_t data[BIG_SIZE];
+
+    memset(data, 0, sizeof(data));
+    for(int i=1; i<=NROWS; i++)
+    {
+        put4byte(data, i);
+        ck_assert(chidb_Btree_insertInTable(bt, nroot, i, data, size) == CHIDB_OK);
+    }
+}
+
+/* Checks that keys 1..NROWS are in the tree, with records of the given size */
+void test_increasing(BTree *bt, npage_t nroot, uint16_t size)
+{
+    uint8_t *data;
+    uint16_t data_size;
+
+    bt_sanity_check(bt, nroot);
+    for(int i=1; i<=NROWS; i++)
+    {
+        ck_assert(chidb_Btree_find(bt, nroot, i, &data, &data_size) == CHIDB_OK);
+        ck_assert_int_eq(data_size, size);
+        ck_assert_int_eq(get4byte(data), i);
+        free(data);
+    }
+}
+
+
+START_TEST (test_20_1)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    BTreeSplitPolicy policy;
+    uint8_t *data;
+    uint16_t size;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_getSplitPolicy(db->bt, 1, &policy);
+    ck_assert_int_eq(policy.fill_factor, DEFAULT_FILL_FACTOR);
+    ck_assert(!policy.by_bytes);
+
+    rc = chidb_Btree_setSplitPolicy(db->bt, 1, MIN_FILL_FACTOR - 1, false);
+    ck_assert(rc == CHIDB_EMISUSE);
+    rc = chidb_Btree_setSplitPolicy(db->bt, 1, 101, false);
+    ck_assert(rc == CHIDB_EMISUSE);
+
+    /* The policy is stored in the metadata directory, next to the Bloom
+     * filter, and both survive reopening the file */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    rc = chidb_Btree_insertInTable(db->bt, 1, 1, (uint8_t *) "one", 4);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Btree_setSplitPolicy(db->bt, 1, 70, true);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Btree_bloomCreate(db->bt, 1, 0.01);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Btree_setSplitPolicy(db->bt, npage, 90, false);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Btree_close(db->bt);
+
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Btree_getSplitPolicy(db->bt, 1, &policy);
+    ck_assert_int_eq(policy.fill_factor, 70);
+    ck_assert(policy.by_bytes);
+    chidb_Btree_getSplitPolicy(db->bt, npage, &policy);
+    ck_assert_int_eq(policy.fill_factor, 90);
+    ck_assert(!policy.by_bytes);
+    ck_assert(chidb_Btree_bloomMayContain(db->bt, 1, 1));
+    ck_assert(chidb_Btree_find(db->bt, 1, 1, &data, &size) == CHIDB_OK);
+    free(data);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_20_2)
+{
+    chidb *db;
+    int rc;
+    npage_t npage_packed, npage_loose, npage_batch;
+    BTreeStats packed, loose, batch;
+    BTreeCell cells[NROWS];
+    uint8_t data[NROWS][SMALL_SIZE];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &npage_packed, PGTYPE_TABLE_LEAF);
+    chidb_Btree_newNode(db->bt, &npage_loose, PGTYPE_TABLE_LEAF);
+    chidb_Btree_newNode(db->bt, &npage_batch, PGTYPE_TABLE_LEAF);
+    rc = chidb_Btree_setSplitPolicy(db->bt, npage_loose, 60, false);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Btree_setSplitPolicy(db->bt, npage_batch, 60, false);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Appends leave the nodes behind them full by default... */
+    insert_increasing(db->bt, npage_packed, SMALL_SIZE);
+    test_increasing(db->bt, npage_packed, SMALL_SIZE);
+    rc = chidb_Btree_analyze(db->bt, npage_packed, &packed);
+    ck_assert(rc == CHIDB_OK);
+    stats_sanity_check(&packed);
+    ck_assert(packed.fill_p50 >= 0.9);
+
+    /* ...and as full as the fill factor says otherwise */
+    insert_increasing(db->bt, npage_loose, SMALL_SIZE);
+    test_increasing(db->bt, npage_loose, SMALL_SIZE);
+    rc = chidb_Btree_analyze(db->bt, npage_loose, &loose);
+    ck_assert(rc == CHIDB_OK);
+    stats_sanity_check(&loose);
+    ck_assert(loose.fill_p50 >= 0.5 && loose.fill_p50 <= 0.7);
+    ck_assert(loose.n_leaf > packed.n_leaf);
+
+    /* The bulk loader honors it too */
+    for(int i=0; i<NROWS; i++)
+    {
+        memset(data[i], 0, SMALL_SIZE);
+        put4byte(data[i], i + 1);
+        cells[i].type = PGTYPE_TABLE_LEAF;
+        cells[i].key = i + 1;
+        cells[i].fields.tableLeaf.data_size = SMALL_SIZE;
+        cells[i].fields.tableLeaf.data = data[i];
+    }
+    rc = chidb_Btree_insertBatch(db->bt, npage_batch, cells, NROWS);
+    ck_assert(rc == CHIDB_OK);
+    test_increasing(db->bt, npage_batch, SMALL_SIZE);
+    rc = chidb_Btree_analyze(db->bt, npage_batch, &batch);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(batch.fill_p50 >= 0.5 && batch.fill_p50 <= 0.7);
+    ck_assert_int_eq(batch.n_leaf, loose.n_leaf);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_20_3)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    BTreeNode *btn;
+    BTreeCell btc;
+    uint8_t data[BIG_SIZE];
+    BTreeSplitPolicy by_cells = { 60, false }, by_bytes = { 50, true };
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Two big records followed by 18 small ones */
+    memset(data, 0, sizeof(data));
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_TABLE_LEAF);
+    chidb_Btree_getNodeByPage(db->bt, npage, &btn);
+    btc.type = PGTYPE_TABLE_LEAF;
+    btc.fields.tableLeaf.data = data;
+    for(int i=0; i<20; i++)
+    {
+        btc.key = i * 10;
+        btc.fields.tableLeaf.data_size = i < 2 ? BIG_SIZE : SMALL_SIZE;
+        ck_assert(chidb_Btree_insertCell(btn, i, &btc) == CHIDB_OK);
+    }
+
+    /* In the middle of the tree, the node is split in half, by number of
+     * cells or by size */
+    btc.key = 15;
+    ck_assert_int_eq(chidb_Btree_splitCell(btn, &btc, false, NULL), 9);
+    ck_assert_int_eq(chidb_Btree_splitCell(btn, &btc, true, &by_cells), 9);
+    ck_assert_int_eq(chidb_Btree_splitCell(btn, &btc, false, &by_bytes), 1);
+
+    /* On an append, the left node keeps the fill factor's share */
+    btc.key = 1000;
+    ck_assert_int_eq(chidb_Btree_splitCell(btn, &btc, true, NULL), 18);
+    ck_assert_int_eq(chidb_Btree_splitCell(btn, &btc, true, &by_cells), 11);
+    ck_assert_int_eq(chidb_Btree_splitCell(btn, &btc, false, &by_cells), 9);
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    /* Records of mixed sizes in a tree split by size */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_TABLE_LEAF);
+    rc = chidb_Btree_setSplitPolicy(db->bt, npage, 100, true);
+    ck_assert(rc == CHIDB_OK);
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        put4byte(data, bigfile_ikeys[i]);
+        rc = chidb_Btree_insertInTable(db->bt, npage, bigfile_ikeys[i], data,
+                                       bigfile_ikeys[i] % 7 == 0 ? BIG_SIZE : SMALL_SIZE);
+        ck_assert(rc == CHIDB_OK);
+    }
+    bt_sanity_check(db->bt, npage);
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        uint8_t *found;
+        uint16_t size;
+        ck_assert(chidb_Btree_find(db->bt, npage, bigfile_ikeys[i], &found, &size) == CHIDB_OK);
+        ck_assert_int_eq(get4byte(found), bigfile_ikeys[i]);
+        ck_assert_int_eq(size, bigfile_ikeys[i] % 7 == 0 ? BIG_SIZE : SMALL_SIZE);
+        free(found);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_20_tc(void)
+{
+    TCase *tc = tcase_create ("Step 20: Split policies");
+    tcase_add_test (tc, test_20_1);
+    tcase_add_test (tc, test_20_2);
+    tcase_add_test (tc, test_20_3);
+
+    return tc;
+}
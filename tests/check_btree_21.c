@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/hash.h"
+#include "libchidb/dbm.h"
+
+#define NKEYS (40000)
+
+/* Checks that every entry of bigfile is in the hash index */
+void test_hash_bigfile(Pager *pager, npage_t nroot)
+{
+    chidb_key_t keyPk;
+
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        ck_assert(chidb_Hash_find(pager, nroot, bigfile_ikeys[i], &keyPk) == CHIDB_OK);
+        ck_assert_int_eq(keyPk, bigfile_pkeys[i]);
+    }
+}
+
+/* Looks a key up in a hash index with a DBM program, returning the
+ * primary key, or -1 if the key is not there */
+int32_t dbm_hash_lookup(chidb *db, npage_t nroot, chidb_key_t key)
+{
+    chidb_stmt stmt;
+    chidb_dbm_op_t ops[] = {
+        { Op_Integer,  nroot, 0, 0, NULL },
+        { Op_OpenRead, 0, 0, 0, NULL },
+        { Op_Integer,  key, 1, 0, NULL },
+        { Op_HashSeek, 0, 6, 1, NULL },
+        { Op_HashPKey, 0, 2, 0, NULL },
+        { Op_Halt,     0, 0, 0, NULL },
+        { Op_Integer,  -1, 2, 0, NULL },
+        { Op_Halt,     0, 0, 0, NULL },
+    };
+
+    ck_assert(chidb_stmt_init(&stmt, db) == CHIDB_OK);
+    for(int i=0; i<sizeof(ops) / sizeof(ops[0]); i++)
+        chidb_stmt_set_op(&stmt, &ops[i], i);
+    ck_assert(chidb_stmt_exec(&stmt) == CHIDB_DONE);
+    int32_t keyPk = stmt.reg[2].value.i;
+    chidb_stmt_free(&stmt);
+
+    return keyPk;
+}
+
+
+START_TEST (test_21_1)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_key_t keyPk;
+    HashIndexInfo info;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    rc = chidb_Hash_create(db->bt->pager, &nroot);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Hash_find(db->bt->pager, nroot, 1, &keyPk);
+    ck_assert(rc == CHIDB_ENOTFOUND);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        rc = chidb_Hash_insert(db->bt->pager, nroot, bigfile_ikeys[i], bigfile_pkeys[i]);
+        ck_assert(rc == CHIDB_OK);
+    }
+    test_hash_bigfile(db->bt->pager, nroot);
+
+    /* Every index key can only appear once */
+    rc = chidb_Hash_insert(db->bt->pager, nroot, bigfile_ikeys[0], 0);
+    ck_assert(rc == CHIDB_EDUPLICATE);
+    rc = chidb_Hash_find(db->bt->pager, nroot, 10000, &keyPk);
+    ck_assert(rc == CHIDB_ENOTFOUND);
+
+    rc = chidb_Hash_info(db->bt->pager, nroot, &info);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(info.n_keys, bigfile_nvalues);
+    ck_assert(info.n_buckets > 1);
+    ck_assert(info.n_buckets * info.bucket_capacity >= info.n_keys);
+    ck_assert(info.n_buckets <= (1 << info.global_depth));
+
+    /* The index survives reopening the file */
+    chidb_Btree_close(db->bt);
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    test_hash_bigfile(db->bt->pager, nroot);
+
+    /* A B-Tree is not a hash index */
+    rc = chidb_Hash_find(db->bt->pager, 1, bigfile_ikeys[0], &keyPk);
+    ck_assert(rc == CHIDB_EMISMATCH);
+    rc = chidb_Hash_insert(db->bt->pager, 1, bigfile_ikeys[0], 0);
+    ck_assert(rc == CHIDB_EMISMATCH);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_21_2)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_key_t keyPk;
+    HashIndexInfo info;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Enough keys for the directory to outgrow the directory page */
+    rc = chidb_Hash_create(db->bt->pager, &nroot);
+    ck_assert(rc == CHIDB_OK);
+    for(int i=0; i<NKEYS; i++)
+    {
+        rc = chidb_Hash_insert(db->bt->pager, nroot, i * 7 + 1, i);
+        ck_assert(rc == CHIDB_OK);
+    }
+    rc = chidb_Hash_info(db->bt->pager, nroot, &info);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(info.n_keys, NKEYS);
+    ck_assert(info.n_segments > 0);
+
+    chidb_Btree_close(db->bt);
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    for(int i=0; i<NKEYS; i++)
+    {
+        ck_assert(chidb_Hash_find(db->bt->pager, nroot, i * 7 + 1, &keyPk) == CHIDB_OK);
+        ck_assert_int_eq(keyPk, i);
+        ck_assert(chidb_Hash_find(db->bt->pager, nroot, i * 7 + 2, &keyPk) == CHIDB_ENOTFOUND);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_21_3)
+{
+    chidb *db;
+    npage_t nroot;
+    chidb_stmt stmt;
+    chidb_dbm_op_t ops[] = {
+        { Op_Integer,    0, 0, 0, NULL },
+        { Op_OpenWrite,  0, 0, 0, NULL },
+        { Op_Integer,    42, 1, 0, NULL },
+        { Op_Integer,    4200, 2, 0, NULL },
+        { Op_HashInsert, 0, 1, 2, NULL },
+        { Op_Halt,       0, 0, 0, NULL },
+    };
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+
+    /* The DBM inserts into and probes hash indexes through a cursor */
+    ck_assert(chidb_Hash_create(db->bt->pager, &nroot) == CHIDB_OK);
+    ops[0].p1 = nroot;
+    ck_assert(chidb_stmt_init(&stmt, db) == CHIDB_OK);
+    for(int i=0; i<sizeof(ops) / sizeof(ops[0]); i++)
+        chidb_stmt_set_op(&stmt, &ops[i], i);
+    ck_assert(chidb_stmt_exec(&stmt) == CHIDB_DONE);
+    chidb_stmt_free(&stmt);
+
+    ck_assert_int_eq(dbm_hash_lookup(db, nroot, 42), 4200);
+    ck_assert_int_eq(dbm_hash_lookup(db, nroot, 43), -1);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_21_tc(void)
+{
+    TCase *tc = tcase_create ("Step 21: Hash indexes");
+    tcase_add_test (tc, test_21_1);
+    tcase_add_test (tc, test_21_2);
+    tcase_add_test (tc, test_21_3);
+
+    return tc;
+}
@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define NPINTHREADS (4)
+
+struct pin_worker
+{
+    pthread_t thread;
+    chidb *db;
+    int n;
+    int errors;
+};
+
+void *pin_insert_worker(void *arg)
+{
+    struct pin_worker *w = arg;
+    uint8_t *data;
+    uint16_t size;
+
+    for(int i=w->n; i<bigfile_nvalues; i+=NPINTHREADS)
+    {
+        insert_bigfile(w->db, i);
+        if(chidb_Btree_find(w->db->bt, 1, bigfile_pkeys[i], &data, &size) != CHIDB_OK)
+            w->errors++;
+        else
+            free(data);
+    }
+
+    return NULL;
+}
+
+
+START_TEST (test_22_1)
+{
+    chidb *db;
+    int rc;
+    BTreeStats stats;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Leaves are never pinned */
+    rc = chidb_Btree_pinLevels(db->bt, 1, BTREE_MAX_DEPTH, 0);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(chidb_Btree_pinnedPages(db->bt, 1), 0);
+
+    /* The pinned nodes follow the tree as it grows */
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+    test_bigfile(db);
+    rc = chidb_Btree_analyze(db->bt, 1, &stats);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(stats.depth >= 3);
+    ck_assert_int_eq(chidb_Btree_pinnedPages(db->bt, 1), stats.n_internal);
+    ck_assert(chidb_Pager_isResident(db->bt->pager, 1));
+
+    /* Pinned pages stay in the cache, however small it gets */
+    chidb_Pager_setCacheSize(db->bt->pager, 1);
+    test_bigfile(db);
+    ck_assert(chidb_Pager_isResident(db->bt->pager, 1));
+
+    /* Fewer levels, or a budget, pin fewer nodes */
+    rc = chidb_Btree_pinLevels(db->bt, 1, 1, 0);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(chidb_Btree_pinnedPages(db->bt, 1), 1);
+    rc = chidb_Btree_pinLevels(db->bt, 1, 2, 3);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(chidb_Btree_pinnedPages(db->bt, 1), 3);
+    test_bigfile(db);
+
+    rc = chidb_Btree_pinLevels(db->bt, 1, 0, 0);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(chidb_Btree_pinnedPages(db->bt, 1), 0);
+    ck_assert(!chidb_Pager_isResident(db->bt->pager, 1));
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_22_2)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    BTreeStats stats;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    rc = chidb_Btree_pinLevels(db->bt, npage, 2, 0);
+    ck_assert(rc == CHIDB_OK);
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        rc = chidb_Btree_insertInIndex(db->bt, npage, bigfile_ikeys[i], bigfile_pkeys[i]);
+        ck_assert(rc == CHIDB_OK);
+    }
+    rc = chidb_Btree_analyze(db->bt, npage, &stats);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(stats.depth >= 2 && stats.depth <= 3);
+    ck_assert_int_eq(chidb_Btree_pinnedPages(db->bt, npage), stats.n_internal);
+    test_index_bigfile(db, npage);
+
+    /* Duplicates are caught in pinned internal nodes too */
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        rc = chidb_Btree_insertInIndex(db->bt, npage, bigfile_ikeys[i], 0);
+        ck_assert(rc == CHIDB_EDUPLICATE);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_22_3)
+{
+    chidb *db;
+    int rc;
+    struct pin_worker w[NPINTHREADS];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Splits keep invalidating the pinned nodes while other threads
+     * descend through them */
+    rc = chidb_Btree_pinLevels(db->bt, 1, 2, 0);
+    ck_assert(rc == CHIDB_OK);
+    for(int t=0; t<NPINTHREADS; t++)
+    {
+        w[t] = (struct pin_worker) { .db = db, .n = t, .errors = 0 };
+        pthread_create(&w[t].thread, NULL, pin_insert_worker, &w[t]);
+    }
+    for(int t=0; t<NPINTHREADS; t++)
+    {
+        pthread_join(w[t].thread, NULL);
+        ck_assert_int_eq(w[t].errors, 0);
+    }
+    bt_sanity_check(db->bt, 1);
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_22_tc(void)
+{
+    TCase *tc = tcase_create ("Step 22: Pinned levels");
+    tcase_add_test (tc, test_22_1);
+    tcase_add_test (tc, test_22_2);
+    tcase_add_test (tc, test_22_3);
+
+    return tc;
+}
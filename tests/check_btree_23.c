@@ -0,0 +1,431 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define NROWS (20000)
+#define ROW_SIZE (10)
+#define NDELTHREADS (4)
+
+struct delete_worker
+{
+    pthread_t thread;
+    BTree *bt;
+    npage_t nroot;
+    int n;
+    int errors;
+};
+
+/* Inserts keys from..to, and marks them as present */
+void insert_rows(BTree *bt, npage_t nroot, chidb_key_t from, chidb_key_t to, bool *present)
+{
+    uint8_t data[ROW_SIZE];
+
+    memset(data, 0, sizeof(data));
+    for(chidb_key_t k=from; k<=to; k++)
+    {
+        put4byte(data, k);
+        ck_assert(chidb_Btree_insertInTable(bt, nroot, k, data, ROW_SIZE) == CHIDB_OK);
+        present[k] = true;
+    }
+}
+
+/* Deletes keys lo..hi, and marks them as not present */
+void delete_rows(BTree *bt, npage_t nroot, chidb_key_t lo, chidb_key_t hi, bool *present, chidb_key_t max_key)
+{
+    ck_assert(chidb_Btree_deleteRange(bt, nroot, lo, hi) == CHIDB_OK);
+    for(chidb_key_t k=lo; k<=hi && k<=max_key; k++)
+        present[k] = false;
+}
+
+/* Checks that the keys up to max_key in the tree are exactly those marked
+ * as present, both by looking them up and by walking the leaves */
+void test_rows(BTree *bt, npage_t nroot, bool *present, chidb_key_t max_key)
+{
+    uint8_t *data;
+    uint16_t size;
+    BTreeNode *btn;
+    BTreeCell btc;
+    npage_t prev_leaf = 0;
+    chidb_key_t k = 0;
+
+    for(chidb_key_t i=1; i<=max_key; i++)
+    {
+        if(present[i])
+        {
+            ck_assert(chidb_Btree_find(bt, nroot, i, &data, &size) == CHIDB_OK);
+            ck_assert_int_eq(get4byte(data), i);
+            free(data);
+        }
+        else
+            ck_assert(chidb_Btree_find(bt, nroot, i, &data, &size) == CHIDB_ENOTFOUND);
+    }
+
+    /* The leaves are still linked to each other, in key order */
+    ck_assert(chidb_Btree_findLeaf(bt, nroot, 0, false, &btn, NULL, NULL) == CHIDB_OK);
+    while(1)
+    {
+        npage_t next_leaf = btn->next_leaf;
+        ck_assert_int_eq(btn->prev_leaf, prev_leaf);
+        for(ncell_t i=0; i<btn->n_cells; i++)
+        {
+            for(k++; k<=max_key && !present[k]; k++);
+            chidb_Btree_getCell(btn, i, &btc);
+            ck_assert_int_eq(btc.key, k);
+        }
+        prev_leaf = btn->page->npage;
+        chidb_Btree_releaseNode(bt, btn);
+        if(next_leaf == 0)
+            break;
+        chidb_Pager_latch(bt->pager, next_leaf, false);
+        ck_assert(chidb_Btree_getNodeByPage(bt, next_leaf, &btn) == CHIDB_OK);
+    }
+    for(k++; k<=max_key && !present[k]; k++);
+    ck_assert(k > max_key);
+}
+
+/* Marks the pages of a B-Tree as used, checking that every child pointer
+ * is a page of the file that is not used twice */
+void walk_tree_pages(BTree *bt, npage_t npage, bool *used)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+    npage_t *children;
+    ncell_t n = 0;
+
+    ck_assert(npage >= 1 && npage <= bt->pager->n_pages);
+    ck_assert(!used[npage]);
+    used[npage] = true;
+    chidb_Pager_latch(bt->pager, npage, false);
+    ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+    children = malloc((btn->n_cells + 1) * sizeof(npage_t));
+    if(btn->type == PGTYPE_TABLE_INTERNAL)
+    {
+        for(ncell_t i=0; i<btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &btc);
+            children[n++] = btc.fields.tableInternal.child_page;
+        }
+        children[n++] = btn->right_page;
+    }
+    chidb_Btree_releaseNode(bt, btn);
+    for(ncell_t i=0; i<n; i++)
+        walk_tree_pages(bt, children[i], used);
+    free(children);
+}
+
+/* Marks the pages of the freelist as used, checking that none of them is
+ * used by anything else and that there are as many as the file says */
+void walk_freelist_pages(BTree *bt, bool *used)
+{
+    MemPage *trunk;
+    npage_t npage = bt->free_head, n_free = 0;
+
+    while(npage != 0)
+    {
+        ck_assert(npage <= bt->pager->n_pages && !used[npage]);
+        used[npage] = true;
+        n_free++;
+        ck_assert(chidb_Pager_readPage(bt->pager, npage, &trunk) == CHIDB_OK);
+        uint32_t n = get4byte(&trunk->data[FREELIST_NENTRIES_OFFSET]);
+        for(uint32_t i=0; i<n; i++)
+        {
+            npage_t entry = get4byte(&trunk->data[FREELIST_ENTRIES_OFFSET + i * 4]);
+            ck_assert(entry >= 1 && entry <= bt->pager->n_pages && !used[entry]);
+            used[entry] = true;
+            n_free++;
+        }
+        npage = get4byte(&trunk->data[FREELIST_NEXT_OFFSET]);
+        chidb_Pager_releaseMemPage(bt->pager, trunk);
+    }
+    ck_assert_int_eq(n_free, chidb_Btree_freePages(bt));
+}
+
+/* Checks that every page of the file is either in the B-Tree (or is the
+ * schema table's root) or in the freelist, and only in one of them */
+void check_page_use(BTree *bt, npage_t nroot)
+{
+    bool *used = calloc(bt->pager->n_pages + 1, sizeof(bool));
+
+    used[1] = true;
+    walk_tree_pages(bt, nroot, used);
+    walk_freelist_pages(bt, used);
+    for(npage_t i=1; i<=bt->pager->n_pages; i++)
+        ck_assert(used[i]);
+    free(used);
+}
+
+void *delete_insert_worker(void *arg)
+{
+    struct delete_worker *w = arg;
+    uint8_t data[ROW_SIZE], *found;
+    uint16_t size;
+
+    memset(data, 0, sizeof(data));
+    for(chidb_key_t k=NROWS+1+w->n; k<=2*NROWS; k+=NDELTHREADS)
+    {
+        put4byte(data, k);
+        if(chidb_Btree_insertInTable(w->bt, w->nroot, k, data, ROW_SIZE) != CHIDB_OK)
+            w->errors++;
+        if(chidb_Btree_find(w->bt, w->nroot, k, &found, &size) != CHIDB_OK)
+            w->errors++;
+        else
+            free(found);
+    }
+
+    return NULL;
+}
+
+
+START_TEST (test_23_1)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot, n_pages;
+    BTreeStats before, after;
+    bool *present = calloc(NROWS + 1, sizeof(bool));
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    insert_rows(db->bt, nroot, 1, NROWS, present);
+    rc = chidb_Btree_analyze(db->bt, nroot, &before);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(before.depth >= 3);
+    ck_assert_int_eq(chidb_Btree_freePages(db->bt), 0);
+
+    /* Every page dropped from the tree goes to the freelist */
+    delete_rows(db->bt, nroot, 5000, 15000, present, NROWS);
+    test_rows(db->bt, nroot, present, NROWS);
+    rc = chidb_Btree_analyze(db->bt, nroot, &after);
+    ck_assert(rc == CHIDB_OK);
+    stats_sanity_check(&after);
+    ck_assert_int_eq(after.n_entries, NROWS - 10001);
+    ck_assert(after.depth <= before.depth);
+    ck_assert(chidb_Btree_freePages(db->bt) > 0);
+    ck_assert_int_eq(chidb_Btree_freePages(db->bt), before.n_pages - after.n_pages);
+
+    /* Free pages are used before the file grows */
+    n_pages = db->bt->pager->n_pages;
+    insert_rows(db->bt, nroot, 5000, 5999, present);
+    test_rows(db->bt, nroot, present, NROWS);
+    ck_assert_int_eq(db->bt->pager->n_pages, n_pages);
+    ck_assert(chidb_Btree_freePages(db->bt) < before.n_pages - after.n_pages);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+    free(present);
+}
+END_TEST
+
+
+START_TEST (test_23_2)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot, npage;
+    npage_t n_free;
+    BTreeStats stats;
+    bool *present = calloc(NROWS + 1, sizeof(bool));
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Only table B-Trees */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    rc = chidb_Btree_deleteRange(db->bt, npage, 0, 10);
+    ck_assert(rc == CHIDB_EMISMATCH);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    insert_rows(db->bt, nroot, 1, NROWS, present);
+
+    /* Empty ranges, and ranges within a leaf, free nothing */
+    delete_rows(db->bt, nroot, 200, 100, present, NROWS);
+    delete_rows(db->bt, nroot, NROWS + 1, NROWS + 1000, present, NROWS);
+    delete_rows(db->bt, nroot, 100, 105, present, NROWS);
+    ck_assert_int_eq(chidb_Btree_freePages(db->bt), 0);
+    test_rows(db->bt, nroot, present, NROWS);
+
+    /* Both ends of the tree */
+    delete_rows(db->bt, nroot, 0, 999, present, NROWS);
+    delete_rows(db->bt, nroot, 19001, UINT32_MAX, present, NROWS);
+    test_rows(db->bt, nroot, present, NROWS);
+    n_free = chidb_Btree_freePages(db->bt);
+    ck_assert(n_free > 0);
+
+    /* Appends go to the new rightmost leaf */
+    insert_rows(db->bt, nroot, 19001, 19500, present);
+    test_rows(db->bt, nroot, present, NROWS);
+    ck_assert(chidb_Btree_freePages(db->bt) <= n_free);
+
+    /* Everything: the root is left as an empty leaf */
+    delete_rows(db->bt, nroot, 0, UINT32_MAX, present, NROWS);
+    rc = chidb_Btree_analyze(db->bt, nroot, &stats);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(stats.n_pages, 1);
+    ck_assert_int_eq(stats.n_entries, 0);
+    test_rows(db->bt, nroot, present, NROWS);
+    insert_rows(db->bt, nroot, 1, NROWS, present);
+    test_rows(db->bt, nroot, present, NROWS);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+    free(present);
+}
+END_TEST
+
+
+START_TEST (test_23_3)
+{
+    chidb *db;
+    int rc;
+    npage_t npage, n_free, n_pages;
+    bool *present = calloc(NROWS + 1, sizeof(bool));
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* The root of the schema table shares its page with the file header */
+    insert_rows(db->bt, 1, 1, NROWS, present);
+    delete_rows(db->bt, 1, 1, NROWS - 100, present, NROWS);
+    test_rows(db->bt, 1, present, NROWS);
+    n_free = chidb_Btree_freePages(db->bt);
+    n_pages = db->bt->pager->n_pages;
+    chidb_Btree_close(db->bt);
+
+    /* The freelist is in the file header */
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(chidb_Btree_freePages(db->bt), n_free);
+    test_rows(db->bt, 1, present, NROWS);
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_TABLE_LEAF);
+    ck_assert(npage <= n_pages);
+    ck_assert_int_eq(chidb_Btree_freePages(db->bt), n_free - 1);
+    ck_assert_int_eq(db->bt->pager->n_pages, n_pages);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+    free(present);
+}
+END_TEST
+
+
+START_TEST (test_23_4)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    struct delete_worker w[NDELTHREADS];
+    bool *present = calloc(2 * NROWS + 1, sizeof(bool));
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Ranges are deleted while other threads append to the tree */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    insert_rows(db->bt, nroot, 1, NROWS, present);
+    for(int t=0; t<NDELTHREADS; t++)
+    {
+        w[t] = (struct delete_worker) { .bt = db->bt, .nroot = nroot, .n = t, .errors = 0 };
+        pthread_create(&w[t].thread, NULL, delete_insert_worker, &w[t]);
+    }
+    for(chidb_key_t k=1; k<NROWS; k+=1000)
+        delete_rows(db->bt, nroot, k, k + 499, present, 2 * NROWS);
+    for(int t=0; t<NDELTHREADS; t++)
+    {
+        pthread_join(w[t].thread, NULL);
+        ck_assert_int_eq(w[t].errors, 0);
+    }
+    for(chidb_key_t k=NROWS+1; k<=2*NROWS; k++)
+        present[k] = true;
+    test_rows(db->bt, nroot, present, 2 * NROWS);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+    free(present);
+}
+END_TEST
+
+
+START_TEST (test_23_5)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    uint8_t data[ROW_SIZE];
+    uint32_t seed = 1;
+    chidb_key_t max_key = 4 * NROWS, k, lo;
+    bool *present = calloc(max_key + 1, sizeof(bool));
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Rows inserted in random order after ranges are deleted split nodes
+     * (internal ones too) into pages taken from the freelist, which must
+     * not keep anything from their previous use */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    memset(data, 0, sizeof(data));
+    for(int i=0; i<NROWS; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        k = 1 + (seed >> 8) % max_key;
+        if(present[k])
+            continue;
+        put4byte(data, k);
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, k, data, ROW_SIZE) == CHIDB_OK);
+        present[k] = true;
+    }
+    for(int round=0; round<40; round++)
+    {
+        seed = seed * 1103515245 + 12345;
+        lo = 1 + (seed >> 8) % max_key;
+        delete_rows(db->bt, nroot, lo, lo + max_key / 20, present, max_key);
+        check_page_use(db->bt, nroot);
+        for(int i=0; i<500; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            k = 1 + (seed >> 8) % max_key;
+            if(present[k])
+                continue;
+            put4byte(data, k);
+            ck_assert(chidb_Btree_insertInTable(db->bt, nroot, k, data, ROW_SIZE) == CHIDB_OK);
+            present[k] = true;
+        }
+        check_page_use(db->bt, nroot);
+    }
+    test_rows(db->bt, nroot, present, max_key);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+    free(present);
+}
+END_TEST
+
+
+TCase* make_btree_23_tc(void)
+{
+    TCase *tc = tcase_create ("Step 23: Range deletes");
+    tcase_add_test (tc, test_23_1);
+    tcase_add_test (tc, test_23_2);
+    tcase_add_test (tc, test_23_3);
+    tcase_add_test (tc, test_23_4);
+    tcase_add_test (tc, test_23_5);
+
+    return tc;
+}
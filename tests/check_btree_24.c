@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+
+#define MAX_CURSOR_NODES (CURSOR_MAX_DEPTH + 1)
+
+/* Returns the nodes owned by a cursor (its path and its spare node) */
+uint32_t cursor_nodes(chidb_dbm_cursor_t *cursor, BTreeNode **nodes)
+{
+    uint32_t n = 0;
+    for(uint32_t i=0; i<cursor->n_nodes; i++)
+        nodes[n++] = cursor->path[i].btn;
+    if(cursor->spare != NULL)
+        nodes[n++] = cursor->spare;
+    return n;
+}
+
+/* Checks that a cursor owns exactly the given nodes */
+void check_cursor_nodes(chidb_dbm_cursor_t *cursor, BTreeNode **nodes, uint32_t n)
+{
+    BTreeNode *now[MAX_CURSOR_NODES];
+
+    ck_assert_int_eq(cursor_nodes(cursor, now), n);
+    for(uint32_t i=0; i<n; i++)
+    {
+        bool found = false;
+        for(uint32_t j=0; j<n; j++)
+            found = found || now[i] == nodes[j];
+        ck_assert(found);
+    }
+}
+
+/* Scans a table B-Tree forward and then backward with a cursor, checking
+ * that every one of its n keys is returned in order, and that the cursor
+ * does not load any new node after the first leaf transition */
+void scan_both_ways(BTree *bt, npage_t nroot, uint32_t n)
+{
+    chidb_dbm_cursor_t cursor;
+    BTreeNode *nodes[MAX_CURSOR_NODES];
+    uint32_t n_nodes = 0, count;
+    int32_t key, prev_key;
+
+    chidb_cursor_open(CURSOR_READ, nroot, 0, &cursor);
+    ck_assert(chidb_cursor_rewind(bt, &cursor) == CHIDB_OK);
+    ck_assert(cursor.depth > 0);
+    ck_assert_int_eq(cursor.n_nodes, cursor.depth);
+
+    count = 1;
+    ck_assert(chidb_cursor_fetch_key(bt, &cursor, &prev_key) == CHIDB_OK);
+    while(chidb_cursor_next(bt, &cursor) == CHIDB_OK)
+    {
+        ck_assert(chidb_cursor_fetch_key(bt, &cursor, &key) == CHIDB_OK);
+        ck_assert((uint32_t) key > (uint32_t) prev_key);
+        prev_key = key;
+        count++;
+        if(n_nodes == 0 && CURSOR_LEAF(&cursor)->ncell == 0)
+            n_nodes = cursor_nodes(&cursor, nodes);
+        else if(n_nodes > 0)
+            check_cursor_nodes(&cursor, nodes, n_nodes);
+    }
+    ck_assert_int_eq(count, n);
+
+    /* Back from the last key, with the same nodes */
+    ck_assert(chidb_cursor_seek_le(bt, &cursor, prev_key) == CHIDB_OK);
+    n_nodes = cursor_nodes(&cursor, nodes);
+    count = 1;
+    while(chidb_cursor_prev(bt, &cursor) == CHIDB_OK)
+    {
+        ck_assert(chidb_cursor_fetch_key(bt, &cursor, &key) == CHIDB_OK);
+        ck_assert((uint32_t) key < (uint32_t) prev_key);
+        prev_key = key;
+        count++;
+        check_cursor_nodes(&cursor, nodes, n_nodes);
+    }
+    ck_assert_int_eq(count, n);
+
+    ck_assert(chidb_cursor_close(bt, &cursor) == CHIDB_OK);
+    ck_assert_int_eq(cursor.n_nodes, 0);
+    ck_assert(cursor.spare == NULL);
+}
+
+
+START_TEST (test_24_1)
+{
+    chidb *db;
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Linked leaves: the cursor hops from leaf to leaf */
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+    scan_both_ways(db->bt, 1, bigfile_nvalues);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_24_2)
+{
+    chidb *db;
+    int rc;
+
+    /* Leaves without links: the cursor goes through the parents */
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-24-2.dat");
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    scan_both_ways(db->bt, 1, file1_nvalues);
+
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_24_3)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    BTreeNode *btn, *reloaded, *nodes[MAX_CURSOR_NODES];
+    uint32_t n_nodes;
+    chidb_dbm_cursor_t cursor;
+    int32_t key;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    /* A node reloaded in place is the same as a newly loaded one */
+    ck_assert(chidb_Btree_getNodeByPage(db->bt, 1, &reloaded) == CHIDB_OK);
+    for(npage = 2; npage <= db->bt->pager->n_pages; npage++)
+    {
+        ck_assert(chidb_Btree_getNodeByPage(db->bt, npage, &btn) == CHIDB_OK);
+        ck_assert(chidb_Btree_reloadNode(db->bt, npage, reloaded) == CHIDB_OK);
+        ck_assert_int_eq(reloaded->page->npage, npage);
+        ck_assert_int_eq(reloaded->type, btn->type);
+        ck_assert_int_eq(reloaded->n_cells, btn->n_cells);
+        ck_assert_int_eq(reloaded->right_page, btn->right_page);
+        ck_assert_int_eq(reloaded->next_leaf, btn->next_leaf);
+        ck_assert_int_eq(reloaded->prev_leaf, btn->prev_leaf);
+        ck_assert(memcmp(reloaded->page->data, btn->page->data, db->bt->pager->page_size) == 0);
+        chidb_Btree_freeMemNode(db->bt, btn);
+    }
+    ck_assert(chidb_Btree_reloadNode(db->bt, npage, reloaded) == CHIDB_EPAGENO);
+    chidb_Btree_freeMemNode(db->bt, reloaded);
+
+    /* Seeking again reuses the nodes of the cursor's path */
+    chidb_cursor_open(CURSOR_READ, 1, 0, &cursor);
+    for(rc = chidb_cursor_rewind(db->bt, &cursor); rc == CHIDB_OK; rc = chidb_cursor_next(db->bt, &cursor));
+    ck_assert(rc == CHIDB_EEMPTY);
+    n_nodes = cursor_nodes(&cursor, nodes);
+    for(int i=1; i<100; i++)
+    {
+        ck_assert(chidb_cursor_seek_ge(db->bt, &cursor, bigfile_pkeys[i]) == CHIDB_OK);
+        ck_assert(chidb_cursor_fetch_key(db->bt, &cursor, &key) == CHIDB_OK);
+        ck_assert_int_eq(key, bigfile_pkeys[i]);
+        check_cursor_nodes(&cursor, nodes, n_nodes);
+    }
+    chidb_cursor_close(db->bt, &cursor);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_24_tc(void)
+{
+    TCase *tc = tcase_create ("Step 24: Cursor paths");
+    tcase_add_test (tc, test_24_1);
+    tcase_add_test (tc, test_24_2);
+    tcase_add_test (tc, test_24_3);
+
+    return tc;
+}
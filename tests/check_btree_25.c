@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+#include "libchidb/record.h"
+#include "libchidb/dbm.h"
+
+#define NWIDE (2000)
+#define NWIDE_COLS (8)
+
+static char *wide_names[] = {"a", "bb", "", "dddddddd", "eeeee"};
+
+/* Row i of the wide table: (i, name, NULL, i % 100, i % 1000, name, -i, "x") */
+void insert_wide_row(BTree *bt, npage_t nroot, int i)
+{
+    DBRecord *dbr;
+    uint8_t *data;
+    char *name = wide_names[i % 5];
+
+    chidb_DBRecord_create(&dbr, "|i4|s|0|i1|i2|s|i4|s|", i, name, i % 100, i % 1000, name, -i, "x");
+    chidb_DBRecord_pack(dbr, &data);
+    ck_assert(chidb_Btree_insertInTable(bt, nroot, i, data, dbr->packed_len) == CHIDB_OK);
+    free(data);
+    chidb_DBRecord_destroy(dbr);
+}
+
+/* Checks column n of row i, as returned by the cursor */
+void test_wide_col(BTree *bt, chidb_dbm_cursor_t *cursor, int i, int n)
+{
+    uint8_t type;
+    int32_t num;
+    char *str, *expected;
+    uint32_t len;
+    char *name = wide_names[i % 5];
+
+    ck_assert(chidb_cursor_fetch_col(bt, cursor, n, &type, &num, &str, &len) == CHIDB_OK);
+    switch(n)
+    {
+    case 2:
+        ck_assert_int_eq(type, 1);
+        return;
+    case 1:
+    case 5:
+    case 7:
+        /* Strings are not copied out of the row */
+        expected = n == 7 ? "x" : name;
+        ck_assert_int_eq(type, 3);
+        ck_assert_int_eq(len, strlen(expected));
+        ck_assert(memcmp(str, expected, len) == 0);
+        ck_assert((uint8_t *) str > CURSOR_LEAF(cursor)->btn->page->data);
+        ck_assert((uint8_t *) str < CURSOR_LEAF(cursor)->btn->page->data + bt->pager->page_size);
+        return;
+    }
+    ck_assert_int_eq(type, 2);
+    switch(n)
+    {
+    case 0:
+        ck_assert_int_eq(num, i);
+        break;
+    case 3:
+        ck_assert_int_eq(num, i % 100);
+        break;
+    case 4:
+        ck_assert_int_eq(num, i % 1000);
+        break;
+    case 6:
+        ck_assert_int_eq(num, -i);
+        break;
+    }
+}
+
+
+START_TEST (test_25_1)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_dbm_cursor_t cursor;
+    int i;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(i=1; i<=NWIDE; i++)
+        insert_wide_row(db->bt, nroot, i);
+
+    /* The header is decoded on the first column read after each move, and
+     * columns can then be read in any order */
+    chidb_cursor_open(CURSOR_READ, nroot, NWIDE_COLS, &cursor);
+    i = 1;
+    for(rc = chidb_cursor_rewind(db->bt, &cursor); rc == CHIDB_OK; rc = chidb_cursor_next(db->bt, &cursor))
+    {
+        ck_assert(!cursor.row_valid);
+        for(int n=NWIDE_COLS-1; n>=0; n--)
+            test_wide_col(db->bt, &cursor, i, n);
+        ck_assert(cursor.row_valid);
+        for(int n=0; n<NWIDE_COLS; n++)
+            test_wide_col(db->bt, &cursor, i, n);
+        i++;
+    }
+    ck_assert(rc == CHIDB_EEMPTY);
+    ck_assert_int_eq(i, NWIDE + 1);
+
+    /* Moving back, and seeking, decode the new row too */
+    for(i=NWIDE; i>NWIDE-100; i--)
+    {
+        test_wide_col(db->bt, &cursor, i, 4);
+        test_wide_col(db->bt, &cursor, i, 1);
+        ck_assert(chidb_cursor_prev(db->bt, &cursor) == CHIDB_OK);
+    }
+    for(i=1; i<=NWIDE; i+=37)
+    {
+        ck_assert(chidb_cursor_seek(db->bt, &cursor, i) == CHIDB_OK);
+        test_wide_col(db->bt, &cursor, i, 5);
+        test_wide_col(db->bt, &cursor, i, 6);
+    }
+
+    chidb_cursor_close(db->bt, &cursor);
+    ck_assert(cursor.row_types == NULL && !cursor.row_valid);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_25_2)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_dbm_cursor_t cursor;
+    uint8_t type = 0xff;
+    int32_t num;
+    char *str;
+    uint32_t len;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    insert_wide_row(db->bt, nroot, 7);
+
+    /* Only the cursor's columns are decoded; the rest are not read */
+    chidb_cursor_open(CURSOR_READ, nroot, 3, &cursor);
+    ck_assert(chidb_cursor_rewind(db->bt, &cursor) == CHIDB_OK);
+    test_wide_col(db->bt, &cursor, 7, 2);
+    test_wide_col(db->bt, &cursor, 7, 0);
+    ck_assert(chidb_cursor_fetch_col(db->bt, &cursor, 3, &type, &num, &str, &len) == CHIDB_OK);
+    ck_assert_int_eq(type, 0xff);
+    chidb_cursor_close(db->bt, &cursor);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_25_3)
+{
+    chidb_dbm_register_t r1, r2;
+    char row[] = "abcdefgh";
+
+    /* A borrowed string is copied, and NUL-terminated, only when it must
+     * outlive the row */
+    memset(&r1, 0, sizeof(r1));
+    r1.type = REG_STRING;
+    r1.value.s = row + 2;
+    r1.len = 3;
+    r1.borrowed = true;
+    ck_assert_int_eq(reg_strlen(&r1), 3);
+    ck_assert(chidb_stmt_reg_materialize(&r1) == CHIDB_OK);
+    ck_assert(!r1.borrowed);
+    ck_assert(r1.value.s == r1.owned);
+    ck_assert_str_eq(r1.value.s, "cde");
+    row[2] = 'x';
+    ck_assert_str_eq(r1.value.s, "cde");
+
+    /* The copy is reused by the next one, if it fits */
+    r1.value.s = row;
+    r1.len = 2;
+    r1.borrowed = true;
+    ck_assert(chidb_stmt_reg_materialize(&r1) == CHIDB_OK);
+    ck_assert(r1.value.s == r1.owned);
+    ck_assert_str_eq(r1.value.s, "ab");
+    ck_assert_int_eq(r1.owned_size, 4);
+
+    /* Registers that do not borrow are left alone */
+    memset(&r2, 0, sizeof(r2));
+    r2.type = REG_STRING;
+    r2.value.s = "ab";
+    ck_assert(chidb_stmt_reg_materialize(&r2) == CHIDB_OK);
+    ck_assert(r2.owned == NULL);
+    ck_assert_int_eq(reg_strlen(&r2), 2);
+
+    free(r1.owned);
+}
+END_TEST
+
+
+TCase* make_btree_25_tc(void)
+{
+    TCase *tc = tcase_create ("Step 25: Column access");
+    tcase_add_test (tc, test_25_1);
+    tcase_add_test (tc, test_25_2);
+    tcase_add_test (tc, test_25_3);
+
+    return tc;
+}
@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+
+#define NBATCH_ROWS (3000)
+#define NBATCH_COLS (8)
+
+/* In check_btree_25.c */
+void insert_wide_row(BTree *bt, npage_t nroot, int i);
+
+/* Checks row r of a batch against column col of the row a second cursor
+ * is on, as returned by chidb_cursor_fetch_col */
+void check_batch_row(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_dbm_vector_t *vector, int32_t col, uint32_t r)
+{
+    uint8_t type;
+    int32_t num;
+    char *str;
+    uint32_t len;
+    bool null = vector->nulls[r / 8] & (1 << (r % 8));
+    bool text = vector->texts[r / 8] & (1 << (r % 8));
+
+    ck_assert(chidb_cursor_fetch_col(bt, cursor, col, &type, &num, &str, &len) == CHIDB_OK);
+    ck_assert_int_eq(null, type == 1);
+    ck_assert_int_eq(text, type == 3);
+    if(type == 2)
+        ck_assert_int_eq(vector->ints[r], num);
+    else
+        ck_assert_int_eq(vector->ints[r], 0);
+    if(type == 3)
+    {
+        ck_assert_int_eq(vector->offsets[r + 1] - vector->offsets[r], len);
+        ck_assert(memcmp(vector->arena + vector->offsets[r], str, len) == 0);
+    }
+    else
+        ck_assert_int_eq(vector->offsets[r + 1], vector->offsets[r]);
+}
+
+/* Reads a whole table in batches of batch_size rows, checking each of them
+ * against a cursor that moves one row at a time */
+void scan_in_batches(BTree *bt, npage_t nroot, const int32_t *cols, int ncols, uint32_t batch_size)
+{
+    chidb_dbm_cursor_t cursor, check;
+    chidb_dbm_vector_t vectors[NBATCH_COLS];
+    uint32_t n_fetched, total = 0;
+    int rc;
+
+    memset(vectors, 0, sizeof(vectors));
+    chidb_cursor_open(CURSOR_READ, nroot, NBATCH_COLS, &cursor);
+    chidb_cursor_open(CURSOR_READ, nroot, NBATCH_COLS, &check);
+    ck_assert(chidb_cursor_rewind(bt, &cursor) == CHIDB_OK);
+    ck_assert(chidb_cursor_rewind(bt, &check) == CHIDB_OK);
+
+    while((rc = chidb_cursor_fetch_batch(bt, &cursor, cols, ncols, batch_size, vectors, &n_fetched)) == CHIDB_OK)
+    {
+        for(uint32_t r=0; r<n_fetched; r++)
+        {
+            for(int c=0; c<ncols; c++)
+                check_batch_row(bt, &check, &vectors[c], cols[c], r);
+            chidb_cursor_next(bt, &check);
+        }
+        total += n_fetched;
+        if(n_fetched < batch_size)
+            break;
+    }
+
+    /* Only the last batch is short, and the cursor is then done */
+    ck_assert(rc == CHIDB_OK || (rc == CHIDB_EEMPTY && total % batch_size == 0));
+    ck_assert_int_eq(total, NBATCH_ROWS);
+    ck_assert_int_eq(cursor.depth, 0);
+    ck_assert(chidb_cursor_fetch_batch(bt, &cursor, cols, ncols, batch_size, vectors, &n_fetched) == CHIDB_EEMPTY);
+    ck_assert_int_eq(n_fetched, 0);
+
+    chidb_cursor_batch_free(vectors, ncols);
+    chidb_cursor_close(bt, &cursor);
+    chidb_cursor_close(bt, &check);
+}
+
+
+START_TEST (test_26_1)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    int32_t all[] = {0, 1, 2, 3, 4, 5, 6, 7};
+    int32_t some[] = {7, 2, 0};
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(int i=1; i<=NBATCH_ROWS; i++)
+        insert_wide_row(db->bt, nroot, i);
+
+    /* Batches within a leaf, spanning several leaves, and the whole table */
+    scan_in_batches(db->bt, nroot, all, NBATCH_COLS, 1);
+    scan_in_batches(db->bt, nroot, all, NBATCH_COLS, 7);
+    scan_in_batches(db->bt, nroot, some, 3, 500);
+    scan_in_batches(db->bt, nroot, some, 3, NBATCH_ROWS);
+    scan_in_batches(db->bt, nroot, all, NBATCH_COLS, 2 * NBATCH_ROWS);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_26_2)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot, nindex;
+    chidb_dbm_cursor_t cursor;
+    chidb_dbm_vector_t vectors[2];
+    int32_t cols[] = {0, 3};
+    int32_t bad_cols[] = {0, 3};
+    uint32_t n_fetched;
+    int32_t key;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(int i=1; i<=100; i++)
+        insert_wide_row(db->bt, nroot, i);
+    memset(vectors, 0, sizeof(vectors));
+
+    /* Columns must be among the cursor's */
+    chidb_cursor_open(CURSOR_READ, nroot, 3, &cursor);
+    ck_assert(chidb_cursor_rewind(db->bt, &cursor) == CHIDB_OK);
+    ck_assert(chidb_cursor_fetch_batch(db->bt, &cursor, bad_cols, 2, 10, vectors, &n_fetched) == CHIDB_EMISUSE);
+    bad_cols[1] = -1;
+    ck_assert(chidb_cursor_fetch_batch(db->bt, &cursor, bad_cols, 2, 10, vectors, &n_fetched) == CHIDB_EMISUSE);
+    chidb_cursor_close(db->bt, &cursor);
+
+    /* The cursor continues after the batch, and can be moved in between */
+    chidb_cursor_open(CURSOR_READ, nroot, NBATCH_COLS, &cursor);
+    ck_assert(chidb_cursor_fetch_batch(db->bt, &cursor, cols, 2, 10, vectors, &n_fetched) == CHIDB_EEMPTY);
+    ck_assert(chidb_cursor_seek(db->bt, &cursor, 40) == CHIDB_OK);
+    ck_assert(chidb_cursor_fetch_batch(db->bt, &cursor, cols, 2, 0, vectors, &n_fetched) == CHIDB_OK);
+    ck_assert_int_eq(n_fetched, 0);
+    ck_assert(chidb_cursor_fetch_batch(db->bt, &cursor, cols, 2, 10, vectors, &n_fetched) == CHIDB_OK);
+    ck_assert_int_eq(n_fetched, 10);
+    ck_assert_int_eq(vectors[0].ints[0], 40);
+    ck_assert_int_eq(vectors[1].ints[9], 49 % 100);
+    ck_assert(chidb_cursor_fetch_key(db->bt, &cursor, &key) == CHIDB_OK);
+    ck_assert_int_eq(key, 50);
+    ck_assert(chidb_cursor_prev(db->bt, &cursor) == CHIDB_OK);
+    ck_assert(chidb_cursor_fetch_batch(db->bt, &cursor, cols, 2, 1000, vectors, &n_fetched) == CHIDB_OK);
+    ck_assert_int_eq(n_fetched, 52);
+    ck_assert_int_eq(vectors[0].ints[0], 49);
+    ck_assert_int_eq(vectors[0].ints[51], 100);
+    chidb_cursor_close(db->bt, &cursor);
+
+    /* Only table B-Trees */
+    chidb_Btree_newNode(db->bt, &nindex, PGTYPE_INDEX_LEAF);
+    chidb_Btree_insertInIndex(db->bt, nindex, 1, 1);
+    chidb_cursor_open(CURSOR_READ, nindex, 2, &cursor);
+    ck_assert(chidb_cursor_rewind(db->bt, &cursor) == CHIDB_OK);
+    ck_assert(chidb_cursor_fetch_batch(db->bt, &cursor, cols, 1, 10, vectors, &n_fetched) == CHIDB_EMISMATCH);
+    chidb_cursor_close(db->bt, &cursor);
+
+    chidb_cursor_batch_free(vectors, 2);
+    ck_assert(vectors[0].ints == NULL && vectors[1].arena == NULL);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_26_tc(void)
+{
+    TCase *tc = tcase_create ("Step 26: Batched column fetch");
+    tcase_add_test (tc, test_26_1);
+    tcase_add_test (tc, test_26_2);
+
+    return tc;
+}
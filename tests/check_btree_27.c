@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+
+/* Returns the keys of a B-Tree, in the order a cursor goes through them */
+chidb_key_t *cursor_keys(BTree *bt, npage_t nroot, uint32_t *n)
+{
+    chidb_dbm_cursor_t cursor;
+    chidb_key_t *keys = NULL;
+    int32_t key;
+    int rc;
+
+    *n = 0;
+    chidb_cursor_open(CURSOR_READ, nroot, 0, &cursor);
+    for(rc = chidb_cursor_rewind(bt, &cursor); rc == CHIDB_OK; rc = chidb_cursor_next(bt, &cursor))
+    {
+        keys = realloc(keys, (*n + 1) * sizeof(chidb_key_t));
+        ck_assert(chidb_cursor_fetch_key(bt, &cursor, &key) == CHIDB_OK);
+        keys[(*n)++] = key;
+    }
+    ck_assert(rc == CHIDB_EEMPTY);
+    chidb_cursor_close(bt, &cursor);
+
+    return keys;
+}
+
+/* Checks that a seek ends up on the expected entry (keys[expected], or
+ * none if expected is -1) */
+void check_seek_result(BTree *bt, chidb_dbm_cursor_t *cursor, int rc, chidb_key_t *keys, int32_t expected)
+{
+    int32_t key;
+
+    if(expected < 0)
+    {
+        ck_assert(rc == CHIDB_EEMPTY);
+        return;
+    }
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(chidb_cursor_fetch_key(bt, cursor, &key) == CHIDB_OK);
+    ck_assert_int_eq((chidb_key_t) key, keys[expected]);
+}
+
+/* Seeks a key in every possible way with the same cursor, checking the
+ * results against the sorted keys of the B-Tree */
+void check_seeks(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_key_t *keys, uint32_t n, chidb_key_t key)
+{
+    int32_t ge = n, gt = n;
+    int rc;
+
+    for(int32_t i=n-1; i>=0 && keys[i]>=key; i--)
+        ge = i;
+    gt = (ge < n && keys[ge] == key) ? ge + 1 : ge;
+
+    rc = chidb_cursor_seek(bt, cursor, key);
+    check_seek_result(bt, cursor, rc, keys, (ge < n && keys[ge] == key) ? ge : -1);
+    rc = chidb_cursor_seek_ge(bt, cursor, key);
+    check_seek_result(bt, cursor, rc, keys, ge < n ? ge : -1);
+    rc = chidb_cursor_seek_gt(bt, cursor, key);
+    check_seek_result(bt, cursor, rc, keys, gt < n ? gt : -1);
+    rc = chidb_cursor_seek_le(bt, cursor, key);
+    check_seek_result(bt, cursor, rc, keys, gt - 1);
+    rc = chidb_cursor_seek_lt(bt, cursor, key);
+    check_seek_result(bt, cursor, rc, keys, ge - 1);
+}
+
+/* Seeks every key of a B-Tree, and the keys around them, in increasing,
+ * decreasing and scattered order */
+void check_all_seeks(BTree *bt, npage_t nroot)
+{
+    chidb_dbm_cursor_t cursor;
+    chidb_key_t *keys;
+    uint32_t n;
+
+    keys = cursor_keys(bt, nroot, &n);
+    ck_assert(n > 0);
+    chidb_cursor_open(CURSOR_READ, nroot, 0, &cursor);
+
+    check_seeks(bt, &cursor, keys, n, 0);
+    for(uint32_t i=0; i<n; i++)
+    {
+        check_seeks(bt, &cursor, keys, n, keys[i]);
+        check_seeks(bt, &cursor, keys, n, keys[i] + 1);
+    }
+    check_seeks(bt, &cursor, keys, n, UINT32_MAX);
+    for(int32_t i=n-1; i>=0; i--)
+    {
+        check_seeks(bt, &cursor, keys, n, keys[i] - 1);
+        check_seeks(bt, &cursor, keys, n, keys[i]);
+    }
+    for(uint32_t i=0; i<n; i++)
+        check_seeks(bt, &cursor, keys, n, keys[(i * 7919) % n]);
+
+    /* Moving the cursor in between seeks */
+    for(uint32_t i=0; i+3<n; i+=5)
+    {
+        ck_assert(chidb_cursor_seek(bt, &cursor, keys[i]) == CHIDB_OK);
+        ck_assert(chidb_cursor_next(bt, &cursor) == CHIDB_OK);
+        ck_assert(chidb_cursor_next(bt, &cursor) == CHIDB_OK);
+        check_seeks(bt, &cursor, keys, n, keys[i + 3]);
+    }
+
+    chidb_cursor_close(bt, &cursor);
+    free(keys);
+}
+
+
+START_TEST (test_27_1)
+{
+    chidb *db;
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Linked leaves */
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+    check_all_seeks(db->bt, 1);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_27_2)
+{
+    chidb *db;
+    int rc;
+    chidb_dbm_cursor_t cursor;
+    chidb_key_t *leaf_keys, *root_keys;
+
+    /* Leaves without links */
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-27-2.dat");
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    check_all_seeks(db->bt, 1);
+
+    /* A seek within the current leaf uses the leaf as it is, and one in
+     * another leaf only goes back up as far as it has to */
+    chidb_cursor_open(CURSOR_READ, 1, 0, &cursor);
+    ck_assert(chidb_cursor_seek(db->bt, &cursor, 1) == CHIDB_OK);
+    ck_assert(cursor.depth > 1);
+    leaf_keys = CURSOR_LEAF(&cursor)->btn->keys;
+    root_keys = cursor.path[0].btn->keys;
+    ck_assert(leaf_keys != NULL && root_keys != NULL);
+    ck_assert(chidb_cursor_seek(db->bt, &cursor, 2) == CHIDB_OK);
+    ck_assert(CURSOR_LEAF(&cursor)->btn->keys == leaf_keys);
+    ck_assert(chidb_cursor_seek(db->bt, &cursor, 3000) == CHIDB_OK);
+    ck_assert(cursor.path[0].btn->keys == root_keys);
+    chidb_cursor_close(db->bt, &cursor);
+
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_27_3)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_dbm_cursor_t cursor;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Empty trees */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+    chidb_cursor_open(CURSOR_READ, nroot, 0, &cursor);
+    ck_assert(chidb_cursor_seek_ge(db->bt, &cursor, 10) == CHIDB_EEMPTY);
+    ck_assert(chidb_cursor_seek_le(db->bt, &cursor, 10) == CHIDB_EEMPTY);
+    chidb_cursor_close(db->bt, &cursor);
+
+    /* Index B-Trees */
+    for(int i=0; i<bigfile_nvalues; i++)
+        ck_assert(chidb_Btree_insertInIndex(db->bt, nroot, bigfile_ikeys[i], bigfile_pkeys[i]) == CHIDB_OK);
+    check_all_seeks(db->bt, nroot);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_27_tc(void)
+{
+    TCase *tc = tcase_create ("Step 27: Finger search");
+    tcase_add_test (tc, test_27_1);
+    tcase_add_test (tc, test_27_2);
+    tcase_add_test (tc, test_27_3);
+
+    return tc;
+}
@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm-scan.h"
+
+#define NSCANROWS (20000)
+#define NSCANTHREADS (4)
+
+struct scan_thread
+{
+    pthread_t thread;
+    chidb_dbm_scan_t *scan;
+    uint32_t worker;
+    uint8_t *seen;
+    int errors;
+};
+
+/* Inserts the rows with keys first, first + step, ... up to last */
+void insert_scan_rows(BTree *bt, npage_t nroot, chidb_key_t first, chidb_key_t last, chidb_key_t step)
+{
+    uint8_t data[16];
+
+    memset(data, 0, sizeof(data));
+    for(chidb_key_t k=first; k<=last; k+=step)
+    {
+        put4byte(data, k);
+        ck_assert(chidb_Btree_insertInTable(bt, nroot, k, data, sizeof(data)) == CHIDB_OK);
+    }
+}
+
+/* Goes through the rows of a worker of a parallel scan, counting how many
+ * times each key is seen */
+void *scan_worker(void *arg)
+{
+    struct scan_thread *t = arg;
+    chidb_dbm_cursor_t *cursor = &t->scan->workers[t->worker].cursor;
+    int32_t key;
+    int rc;
+
+    while((rc = chidb_scan_next(t->scan, t->worker)) == CHIDB_OK)
+    {
+        if(chidb_cursor_fetch_key(t->scan->bt, cursor, &key) != CHIDB_OK || key > NSCANROWS)
+            t->errors++;
+        else
+            __atomic_add_fetch(&t->seen[key], 1, __ATOMIC_RELAXED);
+    }
+    if(rc != CHIDB_EEMPTY)
+        t->errors++;
+
+    return NULL;
+}
+
+/* Scans a table with one thread per worker, except that, if late is true,
+ * worker 0 only starts once the others are done. Checks that every key
+ * first, first + step, ... up to last is seen once. */
+void check_parallel_scan(BTree *bt, npage_t nroot, uint32_t n_workers, bool late,
+                         chidb_key_t first, chidb_key_t last, chidb_key_t step, chidb_dbm_scan_t **scan)
+{
+    struct scan_thread t[NSCANTHREADS + 1];
+    uint8_t *seen = calloc(NSCANROWS + 1, 1);
+    uint32_t from = late ? 1 : 0;
+
+    ck_assert(chidb_scan_open(bt, nroot, 0, n_workers, scan) == CHIDB_OK);
+    for(uint32_t i=0; i<n_workers; i++)
+        t[i] = (struct scan_thread) { .scan = *scan, .worker = i, .seen = seen, .errors = 0 };
+    for(uint32_t i=from; i<n_workers; i++)
+        pthread_create(&t[i].thread, NULL, scan_worker, &t[i]);
+    for(uint32_t i=from; i<n_workers; i++)
+        pthread_join(t[i].thread, NULL);
+    if(late)
+        scan_worker(&t[0]);
+    for(uint32_t i=0; i<n_workers; i++)
+        ck_assert_int_eq(t[i].errors, 0);
+
+    for(chidb_key_t k=0; k<=NSCANROWS; k++)
+        ck_assert_int_eq(seen[k], k >= first && k <= last && (k - first) % step == 0 ? 1 : 0);
+    free(seen);
+}
+
+
+START_TEST (test_28_1)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_key_t bounds[64];
+    uint32_t n_bounds;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* A single leaf cannot be split */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    insert_scan_rows(db->bt, nroot, 1, 10, 1);
+    ck_assert(chidb_Btree_partition(db->bt, nroot, 8, bounds, &n_bounds) == CHIDB_OK);
+    ck_assert_int_eq(n_bounds, 0);
+
+    /* The bounds are increasing separator keys, about evenly spread */
+    insert_scan_rows(db->bt, nroot, 11, NSCANROWS, 1);
+    for(uint32_t n=1; n<=64; n*=2)
+    {
+        ck_assert(chidb_Btree_partition(db->bt, nroot, n, bounds, &n_bounds) == CHIDB_OK);
+        ck_assert_int_eq(n_bounds, n - 1);
+        for(uint32_t i=1; i<n_bounds; i++)
+            ck_assert(bounds[i] > bounds[i - 1]);
+        for(uint32_t i=0; i<n_bounds; i++)
+            ck_assert(llabs((int64_t) bounds[i] - (int64_t) (i + 1) * NSCANROWS / n) <= NSCANROWS / 16);
+    }
+
+    /* Only table B-Trees */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+    for(int i=0; i<bigfile_nvalues; i++)
+        chidb_Btree_insertInIndex(db->bt, nroot, bigfile_ikeys[i], bigfile_pkeys[i]);
+    ck_assert(chidb_Btree_partition(db->bt, nroot, 4, bounds, &n_bounds) == CHIDB_EMISMATCH);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_28_2)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_dbm_scan_t *scan;
+    uint32_t total;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    insert_scan_rows(db->bt, nroot, 1, NSCANROWS, 1);
+
+    /* Every worker gets a range */
+    check_parallel_scan(db->bt, nroot, NSCANTHREADS, false, 1, NSCANROWS, 1, &scan);
+    total = 0;
+    for(uint32_t i=0; i<NSCANTHREADS; i++)
+        total += scan->workers[i].n_rows;
+    ck_assert_int_eq(total, NSCANROWS);
+    ck_assert(chidb_scan_close(scan) == CHIDB_OK);
+
+    /* A single worker */
+    check_parallel_scan(db->bt, nroot, 1, false, 1, NSCANROWS, 1, &scan);
+    ck_assert_int_eq(scan->workers[0].n_rows, NSCANROWS);
+    ck_assert(chidb_scan_close(scan) == CHIDB_OK);
+
+    ck_assert(chidb_scan_open(db->bt, nroot, 0, 0, &scan) == CHIDB_EMISUSE);
+
+    /* More workers than ranges: some of them start without one */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    insert_scan_rows(db->bt, nroot, 1, 200, 1);
+    check_parallel_scan(db->bt, nroot, NSCANTHREADS, false, 1, 200, 1, &scan);
+    ck_assert(chidb_scan_close(scan) == CHIDB_OK);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_28_3)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_dbm_scan_t *scan;
+    uint32_t steals = 0;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    insert_scan_rows(db->bt, nroot, 3, NSCANROWS, 7);
+
+    /* The range of a worker that does not start is taken by the others,
+     * which leaves it with almost nothing to do */
+    check_parallel_scan(db->bt, nroot, NSCANTHREADS, true, 3, NSCANROWS, 7, &scan);
+    for(uint32_t i=1; i<NSCANTHREADS; i++)
+        steals += scan->workers[i].n_steals;
+    ck_assert(steals > 0);
+    ck_assert(scan->workers[0].n_rows < 10);
+    ck_assert(chidb_scan_close(scan) == CHIDB_OK);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_28_tc(void)
+{
+    TCase *tc = tcase_create ("Step 28: Parallel scans");
+    tcase_add_test (tc, test_28_1);
+    tcase_add_test (tc, test_28_2);
+    tcase_add_test (tc, test_28_3);
+
+    return tc;
+}
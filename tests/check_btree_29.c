@@ -0,0 +1,232 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+
+#define NSTABLEROWS (3000)
+
+/* In check_btree_25.c */
+void insert_wide_row(BTree *bt, npage_t nroot, int i);
+
+/* In check_btree_27.c */
+chidb_key_t *cursor_keys(BTree *bt, npage_t nroot, uint32_t *n);
+void check_seeks(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_key_t *keys, uint32_t n, chidb_key_t key);
+
+/* Checks that a cursor is on the entry with a given key */
+void check_stable_key(BTree *bt, chidb_dbm_cursor_t *cursor, int rc, chidb_key_t expected)
+{
+    int32_t key;
+
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(chidb_cursor_fetch_key(bt, cursor, &key) == CHIDB_OK);
+    ck_assert_int_eq(key, expected);
+}
+
+
+START_TEST (test_29_1)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot, nother;
+    chidb_dbm_cursor_t cursor;
+    chidb_key_t expected;
+    int32_t key;
+    uint64_t changes;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(chidb_key_t k=2; k<=2 * NSTABLEROWS; k+=2)
+        insert_wide_row(db->bt, nroot, k);
+
+    /* A table that is inserted into while it is scanned: every even row
+     * inserts the odd row after it, splitting the leaves under the cursor,
+     * and the scan goes through the new rows too */
+    chidb_cursor_open(CURSOR_READ, nroot, 0, &cursor);
+    expected = 2;
+    for(rc = chidb_cursor_rewind(db->bt, &cursor); rc == CHIDB_OK; rc = chidb_cursor_next(db->bt, &cursor))
+    {
+        ck_assert(chidb_cursor_fetch_key(db->bt, &cursor, &key) == CHIDB_OK);
+        ck_assert_int_eq(key, expected);
+        if(key % 2 == 0)
+            insert_wide_row(db->bt, nroot, key + 1);
+        expected++;
+    }
+    ck_assert(rc == CHIDB_EEMPTY);
+    ck_assert_int_eq(expected, 2 * NSTABLEROWS + 2);
+
+    /* Rows inserted further on do not upset the cursor either */
+    ck_assert(chidb_cursor_seek(db->bt, &cursor, 1001) == CHIDB_OK);
+    for(chidb_key_t k=1; k<1000; k++)
+    {
+        if(k % 2 == 1)
+            insert_wide_row(db->bt, nroot, 10000 + k);
+        else
+        {
+            rc = chidb_cursor_next(db->bt, &cursor);
+            check_stable_key(db->bt, &cursor, rc, 1001 + k / 2);
+        }
+    }
+    ck_assert(chidb_cursor_prev(db->bt, &cursor) == CHIDB_OK);
+    ck_assert(chidb_cursor_fetch_key(db->bt, &cursor, &key) == CHIDB_OK);
+    ck_assert_int_eq(key, 1001 + 998 / 2 - 1);
+
+    /* Changes to another B-Tree are not changes to this one */
+    changes = chidb_Btree_changes(db->bt, nroot);
+    do
+        chidb_Btree_newNode(db->bt, &nother, PGTYPE_TABLE_LEAF);
+    while(nother % CHANGE_SLOTS == nroot % CHANGE_SLOTS);
+    insert_wide_row(db->bt, nother, 1);
+    ck_assert(chidb_Btree_changes(db->bt, nroot) == changes);
+    ck_assert(chidb_Btree_changes(db->bt, nother) > 0);
+    insert_wide_row(db->bt, nroot, 1);
+    ck_assert(chidb_Btree_changes(db->bt, nroot) > changes);
+    chidb_cursor_close(db->bt, &cursor);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_29_2)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_dbm_cursor_t cursor;
+    int32_t key;
+    int32_t cols[] = {0};
+    chidb_dbm_vector_t vector;
+    uint32_t n_fetched;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(chidb_key_t k=1; k<=NSTABLEROWS; k++)
+        insert_wide_row(db->bt, nroot, k);
+    chidb_cursor_open(CURSOR_READ, nroot, 0, &cursor);
+
+    /* The row the cursor is on is deleted: it cannot be read, and the
+     * cursor goes on from where it was in either direction */
+    ck_assert(chidb_cursor_seek(db->bt, &cursor, 500) == CHIDB_OK);
+    ck_assert(chidb_Btree_deleteRange(db->bt, nroot, 400, 600) == CHIDB_OK);
+    ck_assert(chidb_cursor_fetch_key(db->bt, &cursor, &key) == CHIDB_EEMPTY);
+    check_stable_key(db->bt, &cursor, chidb_cursor_next(db->bt, &cursor), 601);
+    check_stable_key(db->bt, &cursor, chidb_cursor_prev(db->bt, &cursor), 399);
+
+    ck_assert(chidb_cursor_seek(db->bt, &cursor, 1500) == CHIDB_OK);
+    ck_assert(chidb_Btree_deleteRange(db->bt, nroot, 1200, 1700) == CHIDB_OK);
+    check_stable_key(db->bt, &cursor, chidb_cursor_prev(db->bt, &cursor), 1199);
+    check_stable_key(db->bt, &cursor, chidb_cursor_next(db->bt, &cursor), 1701);
+
+    /* Rows around it are deleted, but not the row itself */
+    ck_assert(chidb_Btree_deleteRange(db->bt, nroot, 1702, 1800) == CHIDB_OK);
+    ck_assert(chidb_Btree_deleteRange(db->bt, nroot, 1000, 1100) == CHIDB_OK);
+    check_stable_key(db->bt, &cursor, CHIDB_OK, 1701);
+    check_stable_key(db->bt, &cursor, chidb_cursor_next(db->bt, &cursor), 1801);
+
+    /* A batch starts after the deleted row */
+    memset(&vector, 0, sizeof(vector));
+    chidb_cursor_close(db->bt, &cursor);
+    chidb_cursor_open(CURSOR_READ, nroot, 1, &cursor);
+    ck_assert(chidb_cursor_seek(db->bt, &cursor, 2000) == CHIDB_OK);
+    ck_assert(chidb_Btree_deleteRange(db->bt, nroot, 2000, 2010) == CHIDB_OK);
+    ck_assert(chidb_cursor_fetch_batch(db->bt, &cursor, cols, 1, 5, &vector, &n_fetched) == CHIDB_OK);
+    ck_assert_int_eq(n_fetched, 5);
+    ck_assert_int_eq(vector.ints[0], 2011);
+    check_stable_key(db->bt, &cursor, CHIDB_OK, 2016);
+
+    /* Every row after the cursor is deleted */
+    ck_assert(chidb_Btree_deleteRange(db->bt, nroot, 2016, NSTABLEROWS) == CHIDB_OK);
+    ck_assert(chidb_cursor_fetch_batch(db->bt, &cursor, cols, 1, 5, &vector, &n_fetched) == CHIDB_EEMPTY);
+    ck_assert_int_eq(n_fetched, 0);
+    ck_assert(chidb_cursor_seek(db->bt, &cursor, 2016) == CHIDB_EEMPTY);
+    ck_assert(chidb_cursor_seek(db->bt, &cursor, 1900) == CHIDB_OK);
+    ck_assert(chidb_Btree_deleteRange(db->bt, nroot, 1900, NSTABLEROWS) == CHIDB_OK);
+    ck_assert(chidb_cursor_next(db->bt, &cursor) == CHIDB_EEMPTY);
+    check_stable_key(db->bt, &cursor, chidb_cursor_seek_le(db->bt, &cursor, NSTABLEROWS), 1899);
+
+    /* And then every row */
+    ck_assert(chidb_Btree_deleteRange(db->bt, nroot, 0, NSTABLEROWS) == CHIDB_OK);
+    ck_assert(chidb_cursor_prev(db->bt, &cursor) == CHIDB_EEMPTY);
+    ck_assert_int_eq(cursor.depth, 0);
+
+    chidb_cursor_batch_free(&vector, 1);
+    chidb_cursor_close(db->bt, &cursor);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_29_3)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_dbm_cursor_t cursor;
+    chidb_key_t *keys;
+    uint32_t n;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Seeks start from the cursor's path only while the B-Tree has not
+     * changed, whether it changes through insertions or through merges of
+     * its insert buffer */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+    ck_assert(chidb_Btree_bufferIndex(db->bt, nroot, 64) == CHIDB_OK);
+    chidb_cursor_open(CURSOR_READ, nroot, 0, &cursor);
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        if(i % 2 == 0)
+            ck_assert(chidb_Btree_insertInIndex(db->bt, nroot, bigfile_ikeys[i], bigfile_pkeys[i]) == CHIDB_OK);
+        if(i % 97 == 96)
+        {
+            keys = cursor_keys(db->bt, nroot, &n);
+            for(int j=0; j<=i; j+=7)
+                check_seeks(db->bt, &cursor, keys, n, bigfile_ikeys[j]);
+            free(keys);
+        }
+    }
+    ck_assert(chidb_Btree_flushIndexBuffer(db->bt, nroot) == CHIDB_OK);
+    for(int i=1; i<bigfile_nvalues; i+=2)
+    {
+        ck_assert(chidb_Btree_insertInIndex(db->bt, nroot, bigfile_ikeys[i], bigfile_pkeys[i]) == CHIDB_OK);
+        if(i % 101 == 100)
+        {
+            keys = cursor_keys(db->bt, nroot, &n);
+            for(int j=0; j<bigfile_nvalues; j+=11)
+                check_seeks(db->bt, &cursor, keys, n, bigfile_ikeys[j]);
+            free(keys);
+        }
+    }
+    chidb_cursor_close(db->bt, &cursor);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_29_tc(void)
+{
+    TCase *tc = tcase_create ("Step 29: Cursor stability");
+    tcase_add_test (tc, test_29_1);
+    tcase_add_test (tc, test_29_2);
+    tcase_add_test (tc, test_29_3);
+
+    return tc;
+}
@@ -0,0 +1,276 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm.h"
+#include "libchidb/dbm-cursor.h"
+
+#define NLOOKUPROWS (3000)
+#define LOOKUP_PRIME (3001)
+#define LOOKUP_BATCH (256)
+
+/* In check_btree_25.c */
+void insert_wide_row(BTree *bt, npage_t nroot, int i);
+
+static char *lookup_names[] = {"a", "bb", "", "dddddddd", "eeeee"};
+
+/* Checks some of the columns of row i (as inserted by insert_wide_row),
+ * wherever the cursor reads them from */
+void check_lookup_row(BTree *bt, chidb_dbm_cursor_t *cursor, int i)
+{
+    uint8_t type;
+    int32_t num;
+    char *str;
+    uint32_t len;
+
+    ck_assert(chidb_cursor_fetch_col(bt, cursor, 0, &type, &num, &str, &len) == CHIDB_OK);
+    ck_assert_int_eq(num, i);
+    ck_assert(chidb_cursor_fetch_col(bt, cursor, 1, &type, &num, &str, &len) == CHIDB_OK);
+    ck_assert_int_eq(len, strlen(lookup_names[i % 5]));
+    ck_assert(memcmp(str, lookup_names[i % 5], len) == 0);
+    ck_assert(chidb_cursor_fetch_col(bt, cursor, 6, &type, &num, &str, &len) == CHIDB_OK);
+    ck_assert_int_eq(num, -i);
+}
+
+/* Creates a table with rows 1 to NLOOKUPROWS and an index on it whose keys
+ * are in a scrambled order of the primary keys. Returns the primary keys
+ * in the order an index cursor goes through them. */
+chidb_key_t *create_lookup_tables(BTree *bt, npage_t *ntable, npage_t *nindex, uint32_t *n)
+{
+    chidb_dbm_cursor_t cursor;
+    chidb_key_t pkeys[LOOKUP_PRIME];
+    chidb_key_t *order = malloc(NLOOKUPROWS * sizeof(chidb_key_t));
+    int32_t key;
+    int rc;
+
+    chidb_Btree_newNode(bt, ntable, PGTYPE_TABLE_LEAF);
+    chidb_Btree_newNode(bt, nindex, PGTYPE_INDEX_LEAF);
+    for(chidb_key_t k=1; k<=NLOOKUPROWS; k++)
+    {
+        chidb_key_t ikey = (k * 7919) % LOOKUP_PRIME;
+        insert_wide_row(bt, *ntable, k);
+        ck_assert(chidb_Btree_insertInIndex(bt, *nindex, ikey, k) == CHIDB_OK);
+        pkeys[ikey] = k;
+    }
+
+    *n = 0;
+    chidb_cursor_open(CURSOR_READ, *nindex, 0, &cursor);
+    for(rc = chidb_cursor_rewind(bt, &cursor); rc == CHIDB_OK; rc = chidb_cursor_next(bt, &cursor))
+    {
+        ck_assert(chidb_cursor_fetch_key(bt, &cursor, &key) == CHIDB_OK);
+        order[(*n)++] = pkeys[key];
+    }
+    ck_assert(rc == CHIDB_EEMPTY);
+    chidb_cursor_close(bt, &cursor);
+
+    return order;
+}
+
+/* Looks up every entry of an index in its table, checking that the rows
+ * come out in the order of the index (if ordered is true) or sorted
+ * within each batch, and that rows in deleted are skipped */
+void check_lookups(BTree *bt, npage_t ntable, npage_t nindex, chidb_key_t *order, uint32_t n,
+                   bool ordered, const uint8_t *deleted)
+{
+    chidb_dbm_cursor_t cursor, index;
+    uint8_t seen[NLOOKUPROWS + 1];
+    uint32_t pos = 0, batch_end;
+    int32_t key, last;
+    int rc;
+
+    memset(seen, 0, sizeof(seen));
+    chidb_cursor_open(CURSOR_READ, ntable, 8, &cursor);
+    chidb_cursor_open(CURSOR_READ, nindex, 0, &index);
+    ck_assert(chidb_cursor_rewind(bt, &index) == CHIDB_OK);
+    while((rc = chidb_cursor_lookup_start(bt, &cursor, &index, LOOKUP_BATCH)) == CHIDB_OK)
+    {
+        batch_end = pos + LOOKUP_BATCH < n ? pos + LOOKUP_BATCH : n;
+        last = 0;
+        while((rc = chidb_cursor_lookup_next(bt, &cursor, ordered)) == CHIDB_OK)
+        {
+            ck_assert(chidb_cursor_fetch_key(bt, &cursor, &key) == CHIDB_OK);
+            ck_assert(key > 0 && key <= NLOOKUPROWS && !deleted[key]);
+            if(ordered)
+            {
+                while(deleted[order[pos]])
+                    pos++;
+                ck_assert_int_eq(key, order[pos++]);
+            }
+            else
+                ck_assert(key > last);
+            check_lookup_row(bt, &cursor, key);
+            seen[key]++;
+            last = key;
+        }
+        ck_assert(rc == CHIDB_EEMPTY);
+        pos = batch_end;
+    }
+    ck_assert(rc == CHIDB_EEMPTY);
+    ck_assert_int_eq(pos, n);
+
+    for(uint32_t i=0; i<n; i++)
+        ck_assert_int_eq(seen[order[i]], deleted[order[i]] ? 0 : 1);
+
+    chidb_cursor_close(bt, &cursor);
+    chidb_cursor_close(bt, &index);
+}
+
+/* Reads two columns of the rows of a table through an index with a DBM
+ * program, checking that they come out in the order of the index */
+void check_dbm_lookups(chidb *db, npage_t ntable, npage_t nindex, chidb_key_t *order, uint32_t n)
+{
+    chidb_stmt stmt;
+    chidb_dbm_op_t ops[] = {
+        { Op_Integer,   nindex, 0, 0, NULL },
+        { Op_OpenRead,  0, 0, 0, NULL },
+        { Op_Integer,   ntable, 1, 0, NULL },
+        { Op_OpenRead,  1, 1, 8, NULL },
+        { Op_Rewind,    0, 12, 0, NULL },
+        { Op_IdxBatch,  0, 12, 1, NULL },
+        { Op_BatchNext, 1, 8, 1, NULL },
+        { Op_Halt,      0, 0, 0, NULL },
+        { Op_Column,    1, 0, 2, NULL },
+        { Op_Column,    1, 3, 3, NULL },
+        { Op_ResultRow, 2, 2, 0, NULL },
+        { Op_BatchNext, 1, 8, 1, NULL },
+        { Op_Close,     0, 0, 0, NULL },
+        { Op_Close,     1, 0, 0, NULL },
+        { Op_Halt,      0, 0, 0, NULL },
+    };
+    uint32_t pos = 0;
+    int rc;
+
+    ck_assert(chidb_stmt_init(&stmt, db) == CHIDB_OK);
+    for(int i=0; i<sizeof(ops) / sizeof(ops[0]); i++)
+        chidb_stmt_set_op(&stmt, &ops[i], i);
+    while((rc = chidb_stmt_exec(&stmt)) == CHIDB_ROW)
+    {
+        ck_assert(pos < n);
+        ck_assert_int_eq(stmt.reg[2].value.i, order[pos]);
+        ck_assert_int_eq(stmt.reg[3].value.i, order[pos] % 100);
+        pos++;
+    }
+    ck_assert(rc == CHIDB_DONE);
+    ck_assert_int_eq(pos, n);
+    chidb_stmt_free(&stmt);
+}
+
+
+START_TEST (test_30_1)
+{
+    chidb *db;
+    int rc;
+    npage_t ntable, nindex;
+    chidb_key_t *order;
+    uint32_t n;
+    uint8_t deleted[NLOOKUPROWS + 1];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    order = create_lookup_tables(db->bt, &ntable, &nindex, &n);
+    ck_assert(n > 2 * LOOKUP_BATCH);
+
+    /* Each batch is looked up in key order or, from copies of its rows, in
+     * the order of the index */
+    memset(deleted, 0, sizeof(deleted));
+    check_lookups(db->bt, ntable, nindex, order, n, false, deleted);
+    check_lookups(db->bt, ntable, nindex, order, n, true, deleted);
+    check_dbm_lookups(db, ntable, nindex, order, n);
+
+    /* Rows that are not in the table are skipped, even when a whole batch
+     * is missing */
+    ck_assert(chidb_Btree_deleteRange(db->bt, ntable, 1000, 1500) == CHIDB_OK);
+    for(chidb_key_t k=1000; k<=1500; k++)
+        deleted[k] = 1;
+    for(uint32_t i=0; i<LOOKUP_BATCH; i++)
+    {
+        ck_assert(chidb_Btree_deleteRange(db->bt, ntable, order[i], order[i]) == CHIDB_OK);
+        deleted[order[i]] = 1;
+    }
+    check_lookups(db->bt, ntable, nindex, order, n, false, deleted);
+    check_lookups(db->bt, ntable, nindex, order, n, true, deleted);
+
+    free(order);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_30_2)
+{
+    chidb *db;
+    int rc;
+    npage_t ntable, nindex;
+    chidb_key_t *order;
+    uint32_t n;
+    chidb_dbm_cursor_t cursor, index;
+    int32_t key;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    order = create_lookup_tables(db->bt, &ntable, &nindex, &n);
+    chidb_cursor_open(CURSOR_READ, ntable, 8, &cursor);
+    chidb_cursor_open(CURSOR_READ, nindex, 0, &index);
+
+    /* A batch starts at the index cursor's entry, and moving the table
+     * cursor leaves it */
+    ck_assert(chidb_cursor_lookup_next(db->bt, &cursor, false) == CHIDB_EEMPTY);
+    ck_assert(chidb_cursor_rewind(db->bt, &index) == CHIDB_OK);
+    ck_assert(chidb_cursor_lookup_start(db->bt, &cursor, &index, 0) == CHIDB_EMISUSE);
+    for(uint32_t i=0; i<n-10; i++)
+        ck_assert(chidb_cursor_next(db->bt, &index) == CHIDB_OK);
+    ck_assert(chidb_cursor_lookup_start(db->bt, &cursor, &index, LOOKUP_BATCH) == CHIDB_OK);
+    ck_assert_int_eq(index.depth, 0);
+    ck_assert(chidb_cursor_lookup_next(db->bt, &cursor, true) == CHIDB_OK);
+    ck_assert(chidb_cursor_fetch_key(db->bt, &cursor, &key) == CHIDB_OK);
+    ck_assert_int_eq(key, order[n - 10]);
+    ck_assert(chidb_cursor_seek(db->bt, &cursor, 7) == CHIDB_OK);
+    ck_assert(chidb_cursor_fetch_key(db->bt, &cursor, &key) == CHIDB_OK);
+    ck_assert_int_eq(key, 7);
+    check_lookup_row(db->bt, &cursor, 7);
+    ck_assert(chidb_cursor_lookup_start(db->bt, &cursor, &index, LOOKUP_BATCH) == CHIDB_EEMPTY);
+
+    /* The index cursor goes on from where it was, even if the index changes
+     * in between batches */
+    ck_assert(chidb_cursor_rewind(db->bt, &index) == CHIDB_OK);
+    ck_assert(chidb_cursor_lookup_start(db->bt, &cursor, &index, 10) == CHIDB_OK);
+    ck_assert(chidb_cursor_fetch_key(db->bt, &index, &key) == CHIDB_OK);
+    ck_assert(chidb_Btree_insertInIndex(db->bt, nindex, key + LOOKUP_PRIME, 1) == CHIDB_OK);
+    for(uint32_t i=0; i<10; i++)
+        ck_assert(chidb_cursor_lookup_next(db->bt, &cursor, false) == CHIDB_OK);
+    ck_assert(chidb_cursor_lookup_start(db->bt, &cursor, &index, 10) == CHIDB_OK);
+    ck_assert(chidb_cursor_lookup_next(db->bt, &cursor, true) == CHIDB_OK);
+    ck_assert(chidb_cursor_fetch_key(db->bt, &cursor, &key) == CHIDB_OK);
+    ck_assert_int_eq(key, order[10]);
+    chidb_cursor_close(db->bt, &index);
+
+    /* Only index B-Trees can be looked up */
+    chidb_cursor_open(CURSOR_READ, ntable, 0, &index);
+    ck_assert(chidb_cursor_rewind(db->bt, &index) == CHIDB_OK);
+    ck_assert(chidb_cursor_lookup_start(db->bt, &cursor, &index, LOOKUP_BATCH) == CHIDB_EMISMATCH);
+    chidb_cursor_close(db->bt, &index);
+    chidb_cursor_close(db->bt, &cursor);
+
+    free(order);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_30_tc(void)
+{
+    TCase *tc = tcase_create ("Step 30: Batched index lookups");
+    tcase_add_test (tc, test_30_1);
+    tcase_add_test (tc, test_30_2);
+
+    return tc;
+}
@@ -0,0 +1,211 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm.h"
+#include "libchidb/dbm-cursor.h"
+
+/* In check_btree_27.c */
+chidb_key_t *cursor_keys(BTree *bt, npage_t nroot, uint32_t *n);
+
+/* In check_btree_28.c */
+void insert_scan_rows(BTree *bt, npage_t nroot, chidb_key_t first, chidb_key_t last, chidb_key_t step);
+
+/* Checks that a reverse scan of a B-Tree goes through the same keys as a
+ * forward scan, in the opposite order */
+void check_reverse_scan(BTree *bt, npage_t nroot)
+{
+    chidb_dbm_cursor_t cursor;
+    chidb_key_t *keys;
+    uint32_t n, i;
+    int32_t key;
+    int rc;
+
+    keys = cursor_keys(bt, nroot, &n);
+    ck_assert(n > 0);
+    chidb_cursor_open(CURSOR_READ, nroot, 0, &cursor);
+    i = n;
+    for(rc = chidb_cursor_last(bt, &cursor); rc == CHIDB_OK; rc = chidb_cursor_prev(bt, &cursor))
+    {
+        ck_assert(i > 0);
+        ck_assert(chidb_cursor_fetch_key(bt, &cursor, &key) == CHIDB_OK);
+        ck_assert_int_eq((chidb_key_t) key, keys[--i]);
+    }
+    ck_assert(rc == CHIDB_EEMPTY);
+    ck_assert_int_eq(i, 0);
+
+    /* And turns around at either end */
+    ck_assert(chidb_cursor_last(bt, &cursor) == CHIDB_OK);
+    ck_assert(chidb_cursor_next(bt, &cursor) == CHIDB_EEMPTY);
+    ck_assert(chidb_cursor_last(bt, &cursor) == CHIDB_OK);
+    if(n > 1)
+    {
+        ck_assert(chidb_cursor_prev(bt, &cursor) == CHIDB_OK);
+        ck_assert(chidb_cursor_next(bt, &cursor) == CHIDB_OK);
+        ck_assert(chidb_cursor_fetch_key(bt, &cursor, &key) == CHIDB_OK);
+        ck_assert_int_eq((chidb_key_t) key, keys[n - 1]);
+    }
+    chidb_cursor_close(bt, &cursor);
+    free(keys);
+}
+
+/* Returns the keys of a table in the order a DBM program that goes
+ * through it with Last and Prev returns them */
+chidb_key_t *dbm_reverse_keys(chidb *db, npage_t nroot, uint32_t *n)
+{
+    chidb_stmt stmt;
+    chidb_dbm_op_t ops[] = {
+        { Op_Integer,   nroot, 0, 0, NULL },
+        { Op_OpenRead,  0, 0, 0, NULL },
+        { Op_Last,      0, 7, 0, NULL },
+        { Op_Key,       0, 1, 0, NULL },
+        { Op_ResultRow, 1, 1, 0, NULL },
+        { Op_Prev,      0, 3, 0, NULL },
+        { Op_Halt,      0, 0, 0, NULL },
+        { Op_Integer,   -1, 1, 0, NULL },
+        { Op_Halt,      0, 0, 0, NULL },
+    };
+    chidb_key_t *keys = NULL;
+    int rc;
+
+    *n = 0;
+    ck_assert(chidb_stmt_init(&stmt, db) == CHIDB_OK);
+    for(int i=0; i<sizeof(ops) / sizeof(ops[0]); i++)
+        chidb_stmt_set_op(&stmt, &ops[i], i);
+    while((rc = chidb_stmt_exec(&stmt)) == CHIDB_ROW)
+    {
+        keys = realloc(keys, (*n + 1) * sizeof(chidb_key_t));
+        keys[(*n)++] = stmt.reg[1].value.i;
+    }
+    ck_assert(rc == CHIDB_DONE);
+    if(*n == 0)
+        ck_assert_int_eq(stmt.reg[1].value.i, -1);
+    chidb_cursor_close(db->bt, &stmt.cursors[0]);
+    chidb_stmt_free(&stmt);
+
+    return keys;
+}
+
+
+START_TEST (test_31_1)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_dbm_cursor_t cursor;
+    uint32_t hops = 0;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Empty and single-leaf trees */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    chidb_cursor_open(CURSOR_READ, nroot, 0, &cursor);
+    ck_assert(chidb_cursor_last(db->bt, &cursor) == CHIDB_EEMPTY);
+    insert_scan_rows(db->bt, nroot, 5, 5, 1);
+    check_reverse_scan(db->bt, nroot);
+    insert_scan_rows(db->bt, nroot, 6, 20, 1);
+    check_reverse_scan(db->bt, nroot);
+
+    /* Linked leaves: from the last leaf on, the cursor only follows the
+     * sibling links, as it does forward */
+    insert_scan_rows(db->bt, nroot, 21, 5000, 1);
+    check_reverse_scan(db->bt, nroot);
+    ck_assert(chidb_cursor_last(db->bt, &cursor) == CHIDB_OK);
+    ck_assert(cursor.depth > 1);
+    while((rc = chidb_cursor_prev(db->bt, &cursor)) == CHIDB_OK)
+    {
+        if(CURSOR_LEAF(&cursor)->ncell == CURSOR_LEAF(&cursor)->btn->n_cells - 1)
+        {
+            ck_assert_int_eq(cursor.depth, 1);
+            hops++;
+        }
+    }
+    ck_assert(rc == CHIDB_EEMPTY);
+    ck_assert(hops > 1);
+
+    /* Rows deleted at the end */
+    ck_assert(chidb_Btree_deleteRange(db->bt, nroot, 4000, 5000) == CHIDB_OK);
+    check_reverse_scan(db->bt, nroot);
+    chidb_cursor_close(db->bt, &cursor);
+
+    /* Index B-Trees, through a buffer that has to be merged first */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+    ck_assert(chidb_Btree_bufferIndex(db->bt, nroot, 64) == CHIDB_OK);
+    for(int i=0; i<bigfile_nvalues; i++)
+        ck_assert(chidb_Btree_insertInIndex(db->bt, nroot, bigfile_ikeys[i], bigfile_pkeys[i]) == CHIDB_OK);
+    check_reverse_scan(db->bt, nroot);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_31_2)
+{
+    chidb *db;
+    int rc;
+
+    /* Leaves without links */
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-31-2.dat");
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    check_reverse_scan(db->bt, 1);
+
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_31_3)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_key_t *keys, *reverse;
+    uint32_t n, n_reverse;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* The DBM goes through an empty table without any row */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    reverse = dbm_reverse_keys(db, nroot, &n_reverse);
+    ck_assert_int_eq(n_reverse, 0);
+    free(reverse);
+
+    /* And through a table with many leaves in reverse order */
+    insert_scan_rows(db->bt, nroot, 3, 6000, 3);
+    keys = cursor_keys(db->bt, nroot, &n);
+    reverse = dbm_reverse_keys(db, nroot, &n_reverse);
+    ck_assert_int_eq(n_reverse, n);
+    for(uint32_t i=0; i<n; i++)
+        ck_assert_int_eq(reverse[i], keys[n - 1 - i]);
+    free(keys);
+    free(reverse);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_31_tc(void)
+{
+    TCase *tc = tcase_create ("Step 31: Reverse scans");
+    tcase_add_test (tc, test_31_1);
+    tcase_add_test (tc, test_31_2);
+    tcase_add_test (tc, test_31_3);
+
+    return tc;
+}
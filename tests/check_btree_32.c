@@ -0,0 +1,346 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm.h"
+#include "libchidb/dbm-cursor.h"
+
+/* In check_btree_25.c */
+void insert_wide_row(BTree *bt, npage_t nroot, int i);
+
+/* In check_btree_27.c */
+chidb_key_t *cursor_keys(BTree *bt, npage_t nroot, uint32_t *n);
+
+/* In check_btree_28.c */
+void insert_scan_rows(BTree *bt, npage_t nroot, chidb_key_t first, chidb_key_t last, chidb_key_t step);
+
+/* Returns whether a key is in the range from..to (to being the end of the
+ * range, whichever way it goes) */
+bool in_bounded_range(chidb_key_t key, chidb_key_t from, chidb_key_t to, bool inclusive, bool reverse)
+{
+    if(reverse)
+        return key <= from && (inclusive ? key >= to : key > to);
+    return key >= from && (inclusive ? key <= to : key < to);
+}
+
+/* Scans a B-Tree from a key to the end of a range with a bounded cursor
+ * (forward with seek_ge and next, or backward with seek_le and prev), and
+ * checks the keys against the sorted keys of the B-Tree */
+void check_bounded_scan(BTree *bt, chidb_dbm_cursor_t *cursor, chidb_key_t *keys, uint32_t n,
+                        chidb_key_t from, chidb_key_t to, bool inclusive, bool reverse)
+{
+    int32_t i = reverse ? n - 1 : 0;
+    int32_t step = reverse ? -1 : 1;
+    int32_t key;
+    int rc;
+
+    chidb_cursor_set_end(cursor, to, inclusive, reverse);
+    rc = reverse ? chidb_cursor_seek_le(bt, cursor, from) : chidb_cursor_seek_ge(bt, cursor, from);
+    for(; rc == CHIDB_OK; rc = reverse ? chidb_cursor_prev(bt, cursor) : chidb_cursor_next(bt, cursor))
+    {
+        ck_assert(chidb_cursor_fetch_key(bt, cursor, &key) == CHIDB_OK);
+        while(i >= 0 && i < n && !in_bounded_range(keys[i], from, to, inclusive, reverse))
+            i += step;
+        ck_assert(i >= 0 && i < n);
+        ck_assert_int_eq((chidb_key_t) key, keys[i]);
+        i += step;
+    }
+    ck_assert(rc == CHIDB_EEMPTY);
+    /* Only a cursor stopped by the end of the range (rather than by the end
+     * of the B-Tree) is left unpositioned */
+    if(i >= 0 && i < n)
+        ck_assert_int_eq(cursor->depth, 0);
+    for(; i >= 0 && i < n; i += step)
+        ck_assert(!in_bounded_range(keys[i], from, to, inclusive, reverse));
+}
+
+/* Checks bounded scans over a few ranges of a B-Tree, in both directions */
+void check_bounded_scans(BTree *bt, npage_t nroot)
+{
+    chidb_dbm_cursor_t cursor;
+    chidb_key_t *keys;
+    uint32_t n;
+
+    keys = cursor_keys(bt, nroot, &n);
+    ck_assert(n > 10);
+    chidb_cursor_open(CURSOR_READ, nroot, 0, &cursor);
+    for(uint32_t i=0; i<n; i+=n/7)
+    {
+        for(uint32_t len=0; len<n; len=len*3+1)
+        {
+            chidb_key_t lo = keys[i], hi = i + len < n ? keys[i + len] : keys[n - 1] + 5;
+            check_bounded_scan(bt, &cursor, keys, n, lo, hi, true, false);
+            check_bounded_scan(bt, &cursor, keys, n, lo, hi, false, false);
+            check_bounded_scan(bt, &cursor, keys, n, lo + 1, hi + 1, false, false);
+            check_bounded_scan(bt, &cursor, keys, n, hi, lo, true, true);
+            check_bounded_scan(bt, &cursor, keys, n, hi, lo, false, true);
+            check_bounded_scan(bt, &cursor, keys, n, hi - 1, lo - 1, false, true);
+        }
+    }
+
+    /* Ranges that end before they start */
+    check_bounded_scan(bt, &cursor, keys, n, keys[5], keys[4], true, false);
+    check_bounded_scan(bt, &cursor, keys, n, keys[5], keys[5], false, false);
+    check_bounded_scan(bt, &cursor, keys, n, keys[4], keys[5], true, true);
+    chidb_cursor_close(bt, &cursor);
+    free(keys);
+}
+
+
+START_TEST (test_32_1)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_dbm_cursor_t cursor;
+    chidb_key_t first, last;
+    int32_t key;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Linked leaves */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    insert_scan_rows(db->bt, nroot, 3, 9000, 3);
+    check_bounded_scans(db->bt, nroot);
+
+    /* A range that ends with a leaf does not read the next one (which
+     * would be read into the cursor's spare node) */
+    chidb_cursor_open(CURSOR_READ, nroot, 0, &cursor);
+    ck_assert(chidb_cursor_seek(db->bt, &cursor, 3000) == CHIDB_OK);
+    first = CURSOR_LEAF(&cursor)->btn->keys[0];
+    last = CURSOR_LEAF(&cursor)->btn->keys[CURSOR_LEAF(&cursor)->btn->n_cells - 1];
+    chidb_cursor_close(db->bt, &cursor);
+    chidb_cursor_open(CURSOR_READ, nroot, 0, &cursor);
+    chidb_cursor_set_end(&cursor, last + 1, false, false);
+    ck_assert(chidb_cursor_seek_ge(db->bt, &cursor, first) == CHIDB_OK);
+    while((rc = chidb_cursor_next(db->bt, &cursor)) == CHIDB_OK);
+    ck_assert(rc == CHIDB_EEMPTY);
+    ck_assert(cursor.spare == NULL);
+    chidb_cursor_set_end(&cursor, first, true, true);
+    ck_assert(chidb_cursor_seek_le(db->bt, &cursor, last) == CHIDB_OK);
+    while((rc = chidb_cursor_prev(db->bt, &cursor)) == CHIDB_OK);
+    ck_assert(rc == CHIDB_EEMPTY);
+    ck_assert(cursor.spare == NULL);
+    chidb_cursor_set_end(&cursor, last + 3, true, false);
+    ck_assert(chidb_cursor_seek_ge(db->bt, &cursor, first) == CHIDB_OK);
+    while((rc = chidb_cursor_next(db->bt, &cursor)) == CHIDB_OK);
+    ck_assert(cursor.spare != NULL);
+
+    /* Rewind and last stop at the end too, until it is cleared */
+    chidb_cursor_set_end(&cursor, 2, true, false);
+    ck_assert(chidb_cursor_rewind(db->bt, &cursor) == CHIDB_EEMPTY);
+    chidb_cursor_set_end(&cursor, 9000, false, true);
+    ck_assert(chidb_cursor_last(db->bt, &cursor) == CHIDB_EEMPTY);
+    chidb_cursor_set_end(&cursor, 7, true, false);
+    ck_assert(chidb_cursor_rewind(db->bt, &cursor) == CHIDB_OK);
+    ck_assert(chidb_cursor_next(db->bt, &cursor) == CHIDB_OK);
+    ck_assert(chidb_cursor_next(db->bt, &cursor) == CHIDB_EEMPTY);
+    chidb_cursor_clear_end(&cursor);
+    ck_assert(chidb_cursor_seek_ge(db->bt, &cursor, 8990) == CHIDB_OK);
+    ck_assert(chidb_cursor_next(db->bt, &cursor) == CHIDB_OK);
+    ck_assert(chidb_cursor_fetch_key(db->bt, &cursor, &key) == CHIDB_OK);
+    ck_assert_int_eq(key, 8994);
+
+    /* An upper end does not stop a cursor going backward */
+    chidb_cursor_set_end(&cursor, 100, true, false);
+    ck_assert(chidb_cursor_seek_le(db->bt, &cursor, 3000) == CHIDB_OK);
+    ck_assert(chidb_cursor_prev(db->bt, &cursor) == CHIDB_OK);
+    ck_assert(chidb_cursor_fetch_key(db->bt, &cursor, &key) == CHIDB_OK);
+    ck_assert_int_eq(key, 2997);
+    chidb_cursor_close(db->bt, &cursor);
+
+    /* Index B-Trees, whose leaves are not linked */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+    for(int i=0; i<bigfile_nvalues; i++)
+        ck_assert(chidb_Btree_insertInIndex(db->bt, nroot, bigfile_ikeys[i], bigfile_pkeys[i]) == CHIDB_OK);
+    check_bounded_scans(db->bt, nroot);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_32_2)
+{
+    chidb *db;
+    int rc;
+    npage_t ntable, nindex;
+    chidb_dbm_cursor_t cursor, index;
+    chidb_dbm_vector_t vector;
+    int32_t cols[] = {0};
+    uint32_t n_fetched, total, n, in_range;
+    chidb_key_t *keys;
+    int32_t key;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &ntable, PGTYPE_TABLE_LEAF);
+    chidb_Btree_newNode(db->bt, &nindex, PGTYPE_INDEX_LEAF);
+    for(int i=1; i<=3000; i++)
+    {
+        insert_wide_row(db->bt, ntable, i);
+        ck_assert(chidb_Btree_insertInIndex(db->bt, nindex, 3001 - i, i) == CHIDB_OK);
+    }
+
+    /* Batches stop at the end of the range */
+    memset(&vector, 0, sizeof(vector));
+    chidb_cursor_open(CURSOR_READ, ntable, 8, &cursor);
+    chidb_cursor_set_end(&cursor, 2500, false, false);
+    ck_assert(chidb_cursor_seek_ge(db->bt, &cursor, 100) == CHIDB_OK);
+    total = 0;
+    while((rc = chidb_cursor_fetch_batch(db->bt, &cursor, cols, 1, 300, &vector, &n_fetched)) == CHIDB_OK)
+    {
+        for(uint32_t r=0; r<n_fetched; r++)
+            ck_assert_int_eq(vector.ints[r], 100 + total + r);
+        total += n_fetched;
+        if(n_fetched < 300)
+            break;
+    }
+    ck_assert_int_eq(total, 2400);
+    ck_assert_int_eq(cursor.depth, 0);
+
+    /* Even when the end is set once the cursor is past it */
+    ck_assert(chidb_cursor_seek(db->bt, &cursor, 2000) == CHIDB_OK);
+    chidb_cursor_set_end(&cursor, 1000, true, false);
+    ck_assert(chidb_cursor_fetch_batch(db->bt, &cursor, cols, 1, 300, &vector, &n_fetched) == CHIDB_OK);
+    ck_assert_int_eq(n_fetched, 0);
+    chidb_cursor_batch_free(&vector, 1);
+    chidb_cursor_clear_end(&cursor);
+
+    /* Lookups only collect the entries of the index in its range (whose
+     * primary keys go down as the index keys go up) */
+    keys = cursor_keys(db->bt, nindex, &n);
+    in_range = 0;
+    for(uint32_t i=0; i<n; i++)
+        if(keys[i] >= 1990 && keys[i] <= 2000)
+            in_range++;
+    ck_assert(in_range > 0);
+    chidb_cursor_open(CURSOR_READ, nindex, 0, &index);
+    chidb_cursor_set_end(&index, 2000, true, false);
+    ck_assert(chidb_cursor_seek_ge(db->bt, &index, 1990) == CHIDB_OK);
+    ck_assert(chidb_cursor_lookup_start(db->bt, &cursor, &index, 100) == CHIDB_OK);
+    total = 0;
+    while((rc = chidb_cursor_lookup_next(db->bt, &cursor, false)) == CHIDB_OK)
+    {
+        ck_assert(chidb_cursor_fetch_key(db->bt, &cursor, &key) == CHIDB_OK);
+        ck_assert(key >= 3001 - 2000 && key <= 3001 - 1990);
+        total++;
+    }
+    ck_assert_int_eq(total, in_range);
+    free(keys);
+    ck_assert(chidb_cursor_lookup_start(db->bt, &cursor, &index, 100) == CHIDB_EEMPTY);
+    chidb_cursor_close(db->bt, &index);
+    chidb_cursor_close(db->bt, &cursor);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Returns the keys a DBM range scan returns: from key from to the end of
+ * the range, set with the given op (EndLe, EndLt, EndGe or EndGt), without
+ * any comparison op */
+chidb_key_t *dbm_range_keys(chidb *db, npage_t nroot, int32_t from, int32_t to, int end_op, uint32_t *n)
+{
+    chidb_stmt stmt;
+    bool reverse = end_op == Op_EndGe || end_op == Op_EndGt;
+    chidb_dbm_op_t ops[] = {
+        { Op_Integer,   nroot, 0, 0, NULL },
+        { Op_OpenRead,  0, 0, 0, NULL },
+        { Op_Integer,   from, 1, 0, NULL },
+        { Op_Integer,   to, 2, 0, NULL },
+        { end_op,       0, 0, 2, NULL },
+        { reverse ? Op_SeekLe : Op_SeekGe, 0, 9, 1, NULL },
+        { Op_Key,       0, 3, 0, NULL },
+        { Op_ResultRow, 3, 1, 0, NULL },
+        { reverse ? Op_Prev : Op_Next, 0, 6, 0, NULL },
+        { Op_Close,     0, 0, 0, NULL },
+        { Op_Halt,      0, 0, 0, NULL },
+    };
+    chidb_key_t *keys = NULL;
+    int rc;
+
+    *n = 0;
+    ck_assert(chidb_stmt_init(&stmt, db) == CHIDB_OK);
+    for(int i=0; i<sizeof(ops) / sizeof(ops[0]); i++)
+        chidb_stmt_set_op(&stmt, &ops[i], i);
+    while((rc = chidb_stmt_exec(&stmt)) == CHIDB_ROW)
+    {
+        keys = realloc(keys, (*n + 1) * sizeof(chidb_key_t));
+        keys[(*n)++] = stmt.reg[3].value.i;
+    }
+    ck_assert(rc == CHIDB_DONE);
+    chidb_stmt_free(&stmt);
+
+    return keys;
+}
+
+
+START_TEST (test_32_3)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_key_t *keys;
+    uint32_t n;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    insert_scan_rows(db->bt, nroot, 2, 4000, 2);
+
+    keys = dbm_range_keys(db, nroot, 1000, 2000, Op_EndLe, &n);
+    ck_assert_int_eq(n, 501);
+    for(uint32_t i=0; i<n; i++)
+        ck_assert_int_eq(keys[i], 1000 + 2 * i);
+    free(keys);
+
+    keys = dbm_range_keys(db, nroot, 1000, 2000, Op_EndLt, &n);
+    ck_assert_int_eq(n, 500);
+    ck_assert_int_eq(keys[n - 1], 1998);
+    free(keys);
+
+    keys = dbm_range_keys(db, nroot, 2001, 1000, Op_EndGe, &n);
+    ck_assert_int_eq(n, 501);
+    for(uint32_t i=0; i<n; i++)
+        ck_assert_int_eq(keys[i], 2000 - 2 * i);
+    free(keys);
+
+    keys = dbm_range_keys(db, nroot, 2000, 1000, Op_EndGt, &n);
+    ck_assert_int_eq(n, 500);
+    ck_assert_int_eq(keys[n - 1], 1002);
+    free(keys);
+
+    /* A range with nothing in it jumps straight past the loop */
+    keys = dbm_range_keys(db, nroot, 1001, 1002, Op_EndLt, &n);
+    ck_assert_int_eq(n, 0);
+    free(keys);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_32_tc(void)
+{
+    TCase *tc = tcase_create ("Step 32: Bounded cursors");
+    tcase_add_test (tc, test_32_1);
+    tcase_add_test (tc, test_32_2);
+    tcase_add_test (tc, test_32_3);
+
+    return tc;
+}
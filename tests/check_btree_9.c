@@ -0,0 +1,246 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define APPEND_NKEYS (2000)
+
+void test_append_values(BTree *bt, npage_t nroot, chidb_key_t from, chidb_key_t to)
+{
+    uint16_t size;
+    uint8_t *data;
+    int rc;
+
+    for(chidb_key_t k = from; k < to; k++)
+    {
+        rc = chidb_Btree_find(bt, nroot, k, &data, &size);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(size == 64);
+        ck_assert(get4byte(data) == k);
+        free(data);
+    }
+}
+
+void insert_append_values(BTree *bt, npage_t nroot, chidb_key_t from, chidb_key_t to)
+{
+    uint8_t buf[64];
+    int rc;
+
+    for(chidb_key_t k = from; k < to; k++)
+    {
+        memset(buf, 0, sizeof(buf));
+        put4byte(buf, k);
+        rc = chidb_Btree_insertInTable(bt, nroot, k, buf, sizeof(buf));
+        ck_assert(rc == CHIDB_OK);
+    }
+}
+
+
+START_TEST (test_9_1)
+{
+    chidb *db;
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    insert_append_values(db->bt, 1, 1, APPEND_NKEYS + 1);
+    test_append_values(db->bt, 1, 1, APPEND_NKEYS + 1);
+
+    /* Leaves must be left almost full: with median splits, the same
+     * keys need about twice as many pages. */
+    uint16_t cell_size = TABLELEAFCELL_SIZE_WITHOUTDATA + 64 + 2;
+    npage_t min_leaves = (APPEND_NKEYS * cell_size) / (db->bt->pager->page_size - LEAFPG_CELLSOFFSET_OFFSET) + 1;
+    ck_assert(db->bt->pager->n_pages < min_leaves + min_leaves / 4);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_9_2)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Interleave appends to two trees, and insert keys that are not
+     * appends in between */
+    rc = chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    ck_assert(rc == CHIDB_OK);
+
+    for(chidb_key_t k = 100; k < APPEND_NKEYS; k += 100)
+    {
+        insert_append_values(db->bt, 1, k, k + 100);
+        insert_append_values(db->bt, nroot, k, k + 100);
+    }
+    insert_append_values(db->bt, 1, 1, 100);
+    insert_append_values(db->bt, nroot, 50, 100);
+    insert_append_values(db->bt, 1, APPEND_NKEYS, APPEND_NKEYS + 100);
+
+    test_append_values(db->bt, 1, 1, APPEND_NKEYS + 100);
+    test_append_values(db->bt, nroot, 50, APPEND_NKEYS);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_9_3)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    for(chidb_key_t k = 1; k <= APPEND_NKEYS; k++)
+    {
+        rc = chidb_Btree_insertInIndex(db->bt, npage, k, k + 1);
+        ck_assert(rc == CHIDB_OK);
+    }
+
+    for(chidb_key_t k = 1; k <= APPEND_NKEYS; k++)
+    {
+        chidb_key_t pkey;
+        rc = chidb_Btree_findInIndex(db->bt, npage, k, &pkey);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(pkey == k + 1);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_9_4)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot, nleaf;
+    BTreeNode *btn;
+    BTreeCell btc;
+    chidb_key_t last;
+    ncell_t n_cells;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+    for(chidb_key_t k = 1; k <= 10 * APPEND_NKEYS; k++)
+    {
+        rc = chidb_Btree_insertInIndex(db->bt, nroot, k * 10, k);
+        ck_assert(rc == CHIDB_OK);
+    }
+
+    /* The last leaf of the first subtree of the root is reached through
+     * a right page, but it is not on the right edge of the tree */
+    chidb_Btree_getNodeByPage(db->bt, nroot, &btn);
+    ck_assert(btn->type == PGTYPE_INDEX_INTERNAL);
+    chidb_Btree_getCell(btn, 0, &btc);
+    chidb_Btree_freeMemNode(db->bt, btn);
+    chidb_Btree_getNodeByPage(db->bt, btc.fields.indexInternal.child_page, &btn);
+    ck_assert(btn->type == PGTYPE_INDEX_INTERNAL);
+    nleaf = btn->right_page;
+    chidb_Btree_freeMemNode(db->bt, btn);
+    chidb_Btree_getNodeByPage(db->bt, nleaf, &btn);
+    ck_assert(btn->type == PGTYPE_INDEX_LEAF);
+    n_cells = btn->n_cells;
+    chidb_Btree_getCell(btn, n_cells - 1, &btc);
+    last = btc.key;
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    /* Keys after its last one (which go into it, not into the next
+     * subtree) split it in half, instead of moving all but its last cells
+     * to the new node on its left */
+    for(chidb_key_t k = last + 1; k < last + 10; k++)
+    {
+        rc = chidb_Btree_insertInIndex(db->bt, nroot, k, k);
+        ck_assert(rc == CHIDB_OK);
+    }
+    chidb_Btree_getNodeByPage(db->bt, nleaf, &btn);
+    chidb_Btree_getCell(btn, 0, &btc);
+    ck_assert(btc.key < last);
+    ck_assert(btn->n_cells >= n_cells / 2);
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_9_5)
+{
+    chidb *db;
+    int rc;
+    npage_t roots[2 * APPEND_CACHE_SIZE], nleaf;
+    chidb_key_t max_key;
+    BTreeAppendCache *ac;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* More trees than the append cache has entries: every insertion finds
+     * its tree evicted, and fills the entry in from the leaf it reaches */
+    for(int t=0; t<2 * APPEND_CACHE_SIZE; t++)
+        chidb_Btree_newNode(db->bt, &roots[t], PGTYPE_TABLE_LEAF);
+    for(chidb_key_t k = 1; k <= APPEND_NKEYS; k++)
+        for(int t=0; t<2 * APPEND_CACHE_SIZE; t++)
+        {
+            insert_append_values(db->bt, roots[t], k, k + 1);
+            rc = chidb_Btree_findRightmostLeaf(db->bt, roots[t], &nleaf, &max_key);
+            ck_assert(rc == CHIDB_OK);
+            ac = NULL;
+            for(int i=0; i<APPEND_CACHE_SIZE; i++)
+                if(db->bt->append_cache[i].nroot == roots[t])
+                    ac = &db->bt->append_cache[i];
+            ck_assert(ac != NULL);
+            ck_assert(ac->nleaf == nleaf);
+            ck_assert(ac->max_key == k);
+        }
+    for(int t=0; t<2 * APPEND_CACHE_SIZE; t++)
+        test_append_values(db->bt, roots[t], 1, APPEND_NKEYS + 1);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_9_tc(void)
+{
+    TCase *tc = tcase_create ("Step 9: Appending keys in increasing order");
+    tcase_add_test (tc, test_9_1);
+    tcase_add_test (tc, test_9_2);
+    tcase_add_test (tc, test_9_3);
+    tcase_add_test (tc, test_9_4);
+    tcase_add_test (tc, test_9_5);
+
+    return tc;
+}
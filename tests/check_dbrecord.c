@@ -177,6 +177,112 @@ START_TEST (test_packunpack)
 END_TEST
 
 
+/* Encoded keys sort like the values they encode */
+START_TEST (test_indexkey_order)
+{
+    /* in increasing order */
+    int32_t ints[] = {-2147483647-1, -100000, -1, 0, 1, 100000, 2147483647};
+    char *strs[] = {"", "a", "a b", "aa", "ab", "b", "ba"};
+    uint8_t fields[] = {0, 1};
+    uint8_t key1[64], key2[64];
+    uint16_t size1, size2;
+
+    for(int a=0; a<7*7; a++)
+        for(int b=0; b<7*7; b++)
+        {
+            DBRecord *dbr1, *dbr2;
+            int cmp, expected;
+            chidb_DBRecord_create(&dbr1, "|i4|s|", ints[a / 7], strs[a % 7]);
+            chidb_DBRecord_create(&dbr2, "|i4|s|", ints[b / 7], strs[b % 7]);
+            size1 = size2 = sizeof(key1);
+            ck_assert(chidb_DBRecord_encodeKey(dbr1, fields, 2, NULL, key1, &size1) == CHIDB_OK);
+            ck_assert(chidb_DBRecord_encodeKey(dbr2, fields, 2, NULL, key2, &size2) == CHIDB_OK);
+            cmp = memcmp(key1, key2, size1 < size2 ? size1 : size2);
+            if (cmp == 0)
+                cmp = size1 - size2;
+            expected = a - b;
+            ck_assert((cmp < 0) == (expected < 0));
+            ck_assert((cmp == 0) == (expected == 0));
+            chidb_DBRecord_destroy(dbr1);
+            chidb_DBRecord_destroy(dbr2);
+        }
+
+    /* NULL goes first, and the key of a prefix of the fields is a prefix
+     * of the key */
+    {
+        DBRecord *dbr1, *dbr2;
+        chidb_DBRecord_create(&dbr1, "|0|s|", "zzz");
+        chidb_DBRecord_create(&dbr2, "|i1|s|", -128, "aaa");
+        size1 = size2 = sizeof(key1);
+        chidb_DBRecord_encodeKey(dbr1, fields, 2, NULL, key1, &size1);
+        chidb_DBRecord_encodeKey(dbr2, fields, 2, NULL, key2, &size2);
+        ck_assert(memcmp(key1, key2, 1) < 0);
+        size1 = sizeof(key1);
+        chidb_DBRecord_encodeKey(dbr2, fields, 1, NULL, key1, &size1);
+        ck_assert(size1 < size2);
+        ck_assert(memcmp(key1, key2, size1) == 0);
+
+        size1 = 4;
+        ck_assert(chidb_DBRecord_encodeKey(dbr2, fields, 2, NULL, key1, &size1) == CHIDB_ETOOBIG);
+        chidb_DBRecord_destroy(dbr1);
+        chidb_DBRecord_destroy(dbr2);
+    }
+}
+END_TEST
+
+
+START_TEST (test_indexkey_decode)
+{
+    DBRecord *dbr1, *dbr2, *proj;
+    uint8_t fields[] = {4, 0, 1, 2};
+    uint8_t pfields[] = {3, 0};
+    uint8_t key[128];
+    uint16_t size;
+    chidb_key_t pk = 1234, pk2;
+    char *s;
+    int32_t i32;
+    int16_t i16;
+
+    for(int i=0; i<NVALUES; i++)
+    {
+        chidb_DBRecord_create(&dbr1, "|s|0|i1|i2|i4|", str_values[i], int8_values[i], int16_values[i], int32_values[i]);
+        size = sizeof(key);
+        ck_assert(chidb_DBRecord_encodeKey(dbr1, fields, 4, &pk, key, &size) == CHIDB_OK);
+        ck_assert(chidb_DBRecord_decodeKey(&dbr2, key, size, &pk2) == CHIDB_OK);
+        ck_assert_int_eq(pk2, pk);
+        ck_assert(dbr2->nfields == 4);
+
+        ck_assert_int_eq(chidb_DBRecord_getType(dbr2, 0), SQL_INTEGER_4BYTE);
+        chidb_DBRecord_getInt32(dbr2, 0, &i32);
+        ck_assert_int_eq(int32_values[i], i32);
+        chidb_DBRecord_getString(dbr2, 1, &s);
+        ck_assert_str_eq(str_values[i], s);
+        free(s);
+        ck_assert_int_eq(chidb_DBRecord_getType(dbr2, 2), SQL_NULL);
+        chidb_DBRecord_getInt32(dbr2, 3, &i32);
+        ck_assert_int_eq(int8_values[i], i32);
+
+        /* Projections keep the types of the fields */
+        chidb_DBRecord_project(dbr1, pfields, 2, &proj);
+        ck_assert(proj->nfields == 2);
+        ck_assert_int_eq(chidb_DBRecord_getType(proj, 0), SQL_INTEGER_2BYTE);
+        chidb_DBRecord_getInt16(proj, 0, &i16);
+        ck_assert_int_eq(int16_values[i], i16);
+        chidb_DBRecord_getString(proj, 1, &s);
+        ck_assert_str_eq(str_values[i], s);
+        free(s);
+
+        chidb_DBRecord_destroy(dbr1);
+        chidb_DBRecord_destroy(dbr2);
+        chidb_DBRecord_destroy(proj);
+    }
+
+    key[0] = 0x7f;
+    ck_assert(chidb_DBRecord_decodeKey(&dbr2, key, 1, NULL) == CHIDB_ECORRUPT);
+}
+END_TEST
+
+
 Suite* make_dbrecord_suite (void)
 {
     Suite *s = suite_create ("DB Record");
@@ -197,6 +303,11 @@ Suite* make_dbrecord_suite (void)
     tcase_add_test (tc_packunpack, test_packunpack);
     suite_add_tcase (s, tc_packunpack);
 
+    TCase *tc_indexkey = tcase_create ("Index keys");
+    tcase_add_test (tc_indexkey, test_indexkey_order);
+    tcase_add_test (tc_indexkey, test_indexkey_decode);
+    suite_add_tcase (s, tc_indexkey);
+
     return s;
 }
 
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <pthread.h>
 #include <check.h>
 #include "check_common.h"
 #include "libchidb/pager.h"
@@ -146,6 +147,95 @@ START_TEST (test_readwrite)
 END_TEST
 
 
+/* Pages written by test_concurrent are filled with a single byte, so a
+ * read that overlaps a write shows up as a page with two different bytes */
+#define NWRITES (20000)
+#define NREADERS (3)
+#define BIG_PAGE_SIZE (PAGE_SIZE * 32)
+
+struct pager_thread
+{
+    Pager *pg;
+    int torn;
+    int done;
+};
+
+void *pager_write_pages(void *arg)
+{
+    struct pager_thread *pt = arg;
+    MemPage *page;
+
+    chidb_Pager_readPage(pt->pg, 1, &page);
+    for(int i=0; i<NWRITES; i++)
+    {
+        page->npage = i % MAXPAGES + 1;
+        memset(page->data, i % 255 + 1, BIG_PAGE_SIZE);
+        chidb_Pager_writePage(pt->pg, page);
+    }
+    chidb_Pager_releaseMemPage(pt->pg, page);
+    __atomic_store_n(&pt->done, 1, __ATOMIC_SEQ_CST);
+
+    return NULL;
+}
+
+void *pager_read_pages(void *arg)
+{
+    struct pager_thread *pt = arg;
+    MemPage *page;
+    int torn = 0;
+
+    chidb_Pager_readPage(pt->pg, 1, &page);
+    for(int i=0; !__atomic_load_n(&pt->done, __ATOMIC_SEQ_CST); i++)
+    {
+        chidb_Pager_readPageInto(pt->pg, i % MAXPAGES + 1, page);
+        for(int k=1; k<BIG_PAGE_SIZE; k++)
+            if(page->data[k] != page->data[0])
+            {
+                torn++;
+                break;
+            }
+    }
+    chidb_Pager_releaseMemPage(pt->pg, page);
+    __atomic_add_fetch(&pt->torn, torn, __ATOMIC_SEQ_CST);
+
+    return NULL;
+}
+
+START_TEST (test_concurrent)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    pthread_t writer, readers[NREADERS];
+    struct pager_thread pt;
+
+    char *fname = create_tmp_file();
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, BIG_PAGE_SIZE);
+    /* Fewer cached pages than pages, so that pages are also evicted and
+     * read from the file while they are written */
+    chidb_Pager_setCacheSize(pg, MAXPAGES / 2);
+    for(int j=1; j<=MAXPAGES; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+
+    pt.pg = pg;
+    pt.torn = 0;
+    pt.done = 0;
+    pthread_create(&writer, NULL, pager_write_pages, &pt);
+    for(int i=0; i<NREADERS; i++)
+        pthread_create(&readers[i], NULL, pager_read_pages, &pt);
+    pthread_join(writer, NULL);
+    for(int i=0; i<NREADERS; i++)
+        pthread_join(readers[i], NULL);
+    ck_assert_int_eq(pt.torn, 0);
+
+    chidb_Pager_close(pg);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
 Suite* make_pager_suite (void)
 {
     Suite *s = suite_create ("Pager");
@@ -162,6 +252,10 @@ Suite* make_pager_suite (void)
     tcase_add_test (tc_readwrite, test_readwrite);
     suite_add_tcase (s, tc_readwrite);
 
+    TCase *tc_concurrent = tcase_create ("Reading and writing from several threads");
+    tcase_add_test (tc_concurrent, test_concurrent);
+    suite_add_tcase (s, tc_concurrent);
+
     return s;
 }
 